@@ -99,8 +99,18 @@ typedef struct AppLayerProtoDetectProbingParserPort_ {
 
 typedef struct AppLayerProtoDetectProbingParser_ {
     uint8_t ipproto;
+    /** number of entries in ports */
+    uint16_t ports_cnt;
     AppLayerProtoDetectProbingParserPort *port;
 
+    /** Port lookup index, built from the port list when the state is
+     *  prepared.  port_index[port] is the position + 1 of the port's
+     *  entry in ports, 0 if no parsers are registered for the port. */
+    uint16_t *port_index;
+    AppLayerProtoDetectProbingParserPort **ports;
+    /** port 0 (any port) entry, used for ports not in the index */
+    AppLayerProtoDetectProbingParserPort *any_port;
+
     struct AppLayerProtoDetectProbingParser_ *next;
 } AppLayerProtoDetectProbingParser;
 
@@ -115,6 +125,10 @@ typedef struct AppLayerProtoDetectPMSignature_ {
 typedef struct AppLayerProtoDetectPMCtx_ {
     uint16_t max_len;
     uint16_t min_len;
+    /** number of distinct signature depths */
+    uint16_t depths_cnt;
+    /** distinct signature depths, sorted ascending */
+    uint16_t *depths;
     MpmCtx mpm_ctx;
 
     /** Mapping between pattern id and signature.  As each signature has a
@@ -204,6 +218,39 @@ static AppProto AppLayerProtoDetectPMMatchSignature(const AppLayerProtoDetectPMS
     SCReturnUInt(proto);
 }
 
+/** \internal
+ *  \brief get the number of bytes the mpm needs to scan
+ *
+ *  On tcp we get the stream start again with more data appended until
+ *  detection is done. A signature is only evaluated once the buffer
+ *  covers its depth, and its pattern has to be within that depth, so
+ *  its result doesn't change after that. A call can only find something
+ *  new if the buffer grew past the depth of one or more signatures. We
+ *  then scan from the start up to the largest such depth, so patterns
+ *  overlapping the previously scanned part are found as well.
+ *
+ *  \param scanned bytes scanned by the previous call without a match
+ *  \param searchlen bytes available in this call
+ *
+ *  \retval len bytes to scan, 0 if nothing can match
+ */
+static uint16_t AppLayerProtoDetectPMScanLen(const AppLayerProtoDetectPMCtx *pm_ctx,
+                                             uint32_t scanned, uint16_t searchlen)
+{
+    uint16_t len = 0;
+    uint16_t i;
+
+    /* buffer didn't grow: not the data we scanned before */
+    if (scanned == 0 || scanned >= searchlen)
+        return searchlen;
+
+    for (i = 0; i < pm_ctx->depths_cnt && pm_ctx->depths[i] <= searchlen; i++) {
+        if (pm_ctx->depths[i] > scanned)
+            len = pm_ctx->depths[i];
+    }
+    return len;
+}
+
 /** \internal
  *  \brief Run Pattern Sigs against buffer
  *  \param pm_results[out] AppProto array of size ALPROTO_MAX */
@@ -223,6 +270,8 @@ static AppProto AppLayerProtoDetectPMGetProto(AppLayerProtoDetectThreadCtx *tctx
     uint16_t pm_matches = 0;
     uint8_t cnt;
     uint16_t searchlen;
+    uint16_t scanlen;
+    TcpStream *stream = NULL;
 
     if (f->protomap >= FLOW_PROTO_DEFAULT)
         return ALPROTO_UNKNOWN;
@@ -241,13 +290,27 @@ static AppProto AppLayerProtoDetectPMGetProto(AppLayerProtoDetectThreadCtx *tctx
     if (searchlen > pm_ctx->max_len)
         searchlen = pm_ctx->max_len;
 
+    /* only scan if the buffer grew enough to decide more signatures. Udp
+     * packets are scanned one by one. */
+    scanlen = searchlen;
+    if (ipproto == IPPROTO_TCP && f->protoctx != NULL) {
+        TcpSession *ssn = (TcpSession *)f->protoctx;
+        stream = (direction & STREAM_TOSERVER) ? &ssn->client : &ssn->server;
+        scanlen = AppLayerProtoDetectPMScanLen(pm_ctx,
+                stream->app_proto_pm_scanned, searchlen);
+        SCLogDebug("scanned %u, searchlen %u, scanning %u",
+                stream->app_proto_pm_scanned, searchlen, scanlen);
+        if (scanlen == 0)
+            goto end;
+    }
+
     uint32_t search_cnt = 0;
 
     /* do the mpm search */
     search_cnt = mpm_table[pm_ctx->mpm_ctx.mpm_type].Search(&pm_ctx->mpm_ctx,
                                                             mpm_tctx,
                                                             &tctx->pmq,
-                                                            buf, searchlen);
+                                                            buf, scanlen);
     if (search_cnt == 0)
         goto end;
 
@@ -277,6 +340,10 @@ static AppProto AppLayerProtoDetectPMGetProto(AppLayerProtoDetectThreadCtx *tctx
 
  end:
     PmqReset(&tctx->pmq);
+    /* a match may be discarded by the caller, in which case the next
+     * call has to find it again */
+    if (stream != NULL)
+        stream->app_proto_pm_scanned = pm_matches ? 0 : searchlen;
     if (buflen >= pm_ctx->max_len)
         FLOW_SET_PM_DONE(f, direction);
     SCReturnUInt(pm_matches);
@@ -298,6 +365,12 @@ static AppLayerProtoDetectProbingParserPort *AppLayerProtoDetectGetProbingParser
     if (pp == NULL)
         goto end;
 
+    if (pp->port_index != NULL) {
+        uint16_t idx = pp->port_index[port];
+        pp_port = idx ? pp->ports[idx - 1] : pp->any_port;
+        goto end;
+    }
+
     pp_port = pp->port;
     while (pp_port != NULL) {
         if (pp_port->port == port || pp_port->port == 0) {
@@ -559,10 +632,76 @@ static AppLayerProtoDetectProbingParser *AppLayerProtoDetectProbingParserAlloc(v
     SCReturnPtr(p, "AppLayerProtoDetectProbingParser");
 }
 
+/** \internal
+ *  \brief free the port lookup index, lookups fall back to the list */
+static void AppLayerProtoDetectProbingParserIndexFree(AppLayerProtoDetectProbingParser *p)
+{
+    if (p->port_index != NULL) {
+        SCFree(p->port_index);
+        p->port_index = NULL;
+    }
+    if (p->ports != NULL) {
+        SCFree(p->ports);
+        p->ports = NULL;
+    }
+    p->ports_cnt = 0;
+    p->any_port = NULL;
+}
+
+/** \internal
+ *  \brief build the port lookup index from the port list
+ *
+ *  The list holds at most one entry per port and keeps the port 0 entry
+ *  last, so an index lookup returns the same entry as walking the list.
+ */
+static int AppLayerProtoDetectProbingParserIndexBuild(AppLayerProtoDetectProbingParser *p)
+{
+    SCEnter();
+
+    AppLayerProtoDetectProbingParserPort *pp_port;
+    uint32_t cnt = 0;
+
+    AppLayerProtoDetectProbingParserIndexFree(p);
+
+    for (pp_port = p->port; pp_port != NULL; pp_port = pp_port->next) {
+        if (pp_port->port != 0)
+            cnt++;
+    }
+    /* 65535 ports at most, as port 0 isn't in the index */
+    BUG_ON(cnt > UINT16_MAX);
+
+    p->port_index = SCMalloc((UINT16_MAX + 1) * sizeof(uint16_t));
+    if (p->port_index == NULL)
+        goto error;
+    memset(p->port_index, 0, (UINT16_MAX + 1) * sizeof(uint16_t));
+
+    if (cnt > 0) {
+        p->ports = SCMalloc(cnt * sizeof(AppLayerProtoDetectProbingParserPort *));
+        if (p->ports == NULL)
+            goto error;
+    }
+
+    for (pp_port = p->port; pp_port != NULL; pp_port = pp_port->next) {
+        if (pp_port->port == 0) {
+            p->any_port = pp_port;
+            continue;
+        }
+        p->ports[p->ports_cnt++] = pp_port;
+        p->port_index[pp_port->port] = p->ports_cnt;
+    }
+
+    SCReturnInt(0);
+ error:
+    AppLayerProtoDetectProbingParserIndexFree(p);
+    SCReturnInt(-1);
+}
+
 static void AppLayerProtoDetectProbingParserFree(AppLayerProtoDetectProbingParser *p)
 {
     SCEnter();
 
+    AppLayerProtoDetectProbingParserIndexFree(p);
+
     AppLayerProtoDetectProbingParserPort *pt = p->port;
     while (pt != NULL) {
         AppLayerProtoDetectProbingParserPort *pt_next = pt->next;
@@ -869,6 +1008,8 @@ static void AppLayerProtoDetectInsertNewProbingParser(AppLayerProtoDetectProbing
         AppLayerProtoDetectProbingParserAppend(pp, new_pp);
         curr_pp = new_pp;
     }
+    /* the index is rebuilt when the state is prepared */
+    AppLayerProtoDetectProbingParserIndexFree(curr_pp);
 
     /* get the top level port pp */
     AppLayerProtoDetectProbingParserPort *curr_port = curr_pp->port;
@@ -1129,6 +1270,39 @@ static int AppLayerProtoDetectPMSetContentIDs(AppLayerProtoDetectPMCtx *ctx)
     SCReturnInt(ret);
 }
 
+/** \internal
+ *  \brief collect the distinct depths of the signatures for the
+ *         incremental scans */
+static int AppLayerProtoDetectPMSetupDepths(AppLayerProtoDetectPMCtx *ctx)
+{
+    SigIntId id;
+    uint16_t i;
+
+    if (ctx->max_sig_id == 0)
+        return 0;
+
+    ctx->depths = SCMalloc(ctx->max_sig_id * sizeof(uint16_t));
+    if (ctx->depths == NULL)
+        return -1;
+    ctx->depths_cnt = 0;
+
+    for (id = 0; id < ctx->max_sig_id; id++) {
+        const DetectContentData *cd = ctx->map[id]->cd;
+
+        /* insertion sort, skipping duplicates */
+        for (i = 0; i < ctx->depths_cnt && ctx->depths[i] < cd->depth; i++)
+            ;
+        if (i < ctx->depths_cnt && ctx->depths[i] == cd->depth)
+            continue;
+        memmove(&ctx->depths[i + 1], &ctx->depths[i],
+                (ctx->depths_cnt - i) * sizeof(uint16_t));
+        ctx->depths[i] = cd->depth;
+        ctx->depths_cnt++;
+    }
+
+    return 0;
+}
+
 static int AppLayerProtoDetectPMMapSignatures(AppLayerProtoDetectPMCtx *ctx)
 {
     SCEnter();
@@ -1169,6 +1343,9 @@ static int AppLayerProtoDetectPMMapSignatures(AppLayerProtoDetectPMCtx *ctx)
     }
     ctx->head = NULL;
 
+    if (AppLayerProtoDetectPMSetupDepths(ctx) < 0)
+        goto error;
+
     goto end;
  error:
     ret = -1;
@@ -1359,6 +1536,12 @@ int AppLayerProtoDetectPrepareState(void)
         }
     }
 
+    AppLayerProtoDetectProbingParser *pp;
+    for (pp = alpd_ctx.ctx_pp; pp != NULL; pp = pp->next) {
+        if (AppLayerProtoDetectProbingParserIndexBuild(pp) < 0)
+            goto error;
+    }
+
 #ifdef DEBUG
     if (SCLogDebugEnabled()) {
         AppLayerProtoDetectPrintProbingParsers(alpd_ctx.ctx_pp);
@@ -1563,6 +1746,11 @@ int AppLayerProtoDetectDeSetup(void)
                 sig = pm_ctx->map[id];
                 AppLayerProtoDetectPMFreeSignature(sig);
             }
+            if (pm_ctx->depths != NULL) {
+                SCFree(pm_ctx->depths);
+                pm_ctx->depths = NULL;
+                pm_ctx->depths_cnt = 0;
+            }
         }
     }
 
@@ -3749,6 +3937,165 @@ static int AppLayerProtoDetectTest20(void)
     return result;
 }
 
+/**
+ * \test Incremental detection on a growing tcp stream start, with the
+ *       pattern straddling the previously scanned part.
+ */
+static int AppLayerProtoDetectTest21(void)
+{
+    AppLayerProtoDetectUnittestCtxBackup();
+    AppLayerProtoDetectSetup();
+
+    uint8_t l7data[] = "0123456789abHTTP/1.1 200 OK\r\n";
+    char *buf;
+    int r = 0;
+    Flow f;
+    TcpSession ssn;
+    AppProto pm_results[ALPROTO_MAX];
+    AppLayerProtoDetectThreadCtx *alpd_tctx;
+    uint32_t cnt;
+
+    memset(&f, 0x00, sizeof(f));
+    memset(&ssn, 0x00, sizeof(ssn));
+    f.protomap = FlowGetProtoMapping(IPPROTO_TCP);
+    f.protoctx = &ssn;
+
+    buf = "220 ";
+    AppLayerProtoDetectPMRegisterPatternCS(IPPROTO_TCP, ALPROTO_FTP, buf, 4, 0, STREAM_TOCLIENT);
+    buf = "HTTP/";
+    AppLayerProtoDetectPMRegisterPatternCS(IPPROTO_TCP, ALPROTO_HTTP, buf, 20, 0, STREAM_TOCLIENT);
+
+    AppLayerProtoDetectPrepareState();
+    alpd_tctx = AppLayerProtoDetectGetCtxThread();
+
+    /* depth of the http sig not reached yet */
+    cnt = AppLayerProtoDetectPMGetProto(alpd_tctx, &f, l7data, 14,
+                                        STREAM_TOCLIENT, IPPROTO_TCP, pm_results);
+    if (cnt != 0 || ssn.server.app_proto_pm_scanned != 14) {
+        printf("cnt %u scanned %u, expected 0 and 14: ", cnt,
+               ssn.server.app_proto_pm_scanned);
+        goto end;
+    }
+    /* no new depth covered, nothing to scan */
+    cnt = AppLayerProtoDetectPMGetProto(alpd_tctx, &f, l7data, 16,
+                                        STREAM_TOCLIENT, IPPROTO_TCP, pm_results);
+    if (cnt != 0 || ssn.server.app_proto_pm_scanned != 16) {
+        printf("cnt %u scanned %u, expected 0 and 16: ", cnt,
+               ssn.server.app_proto_pm_scanned);
+        goto end;
+    }
+    /* http depth covered: pattern overlaps both previous calls */
+    cnt = AppLayerProtoDetectPMGetProto(alpd_tctx, &f, l7data, 20,
+                                        STREAM_TOCLIENT, IPPROTO_TCP, pm_results);
+    if (cnt != 1 || pm_results[0] != ALPROTO_HTTP) {
+        printf("cnt %u pm_results[0] %u, expected 1 and ALPROTO_HTTP: ",
+               cnt, pm_results[0]);
+        goto end;
+    }
+    /* the match may be discarded, so the next call has to start over */
+    if (ssn.server.app_proto_pm_scanned != 0) {
+        printf("scanned %u, expected 0: ", ssn.server.app_proto_pm_scanned);
+        goto end;
+    }
+    if (FLOW_IS_PM_DONE(&f, STREAM_TOCLIENT) == 0) {
+        printf("pm not done: ");
+        goto end;
+    }
+
+    r = 1;
+
+ end:
+    if (alpd_tctx != NULL)
+        AppLayerProtoDetectDestroyCtxThread(alpd_tctx);
+    AppLayerProtoDetectDeSetup();
+    AppLayerProtoDetectUnittestCtxRestore();
+    return r;
+}
+
+/**
+ * \test The port index returns the same entries as the port lists.
+ */
+static int AppLayerProtoDetectTest22(void)
+{
+    AppLayerProtoDetectUnittestCtxBackup();
+    AppLayerProtoDetectSetup();
+
+    AppLayerProtoDetectProbingParser *pp;
+    const AppLayerProtoDetectProbingParserPort *pp_port;
+    uint16_t *port_index;
+    uint32_t port;
+    int result = 0;
+
+    AppLayerProtoDetectPPRegister(IPPROTO_TCP, "80,8080", ALPROTO_HTTP,
+                                  5, 8, STREAM_TOSERVER,
+                                  ProbingParserDummyForTesting);
+    AppLayerProtoDetectPPRegister(IPPROTO_TCP, "0", ALPROTO_SMB,
+                                  5, 6, STREAM_TOSERVER,
+                                  ProbingParserDummyForTesting);
+    AppLayerProtoDetectPPRegister(IPPROTO_TCP, "139", ALPROTO_SMB,
+                                  5, 6, STREAM_TOSERVER,
+                                  ProbingParserDummyForTesting);
+    AppLayerProtoDetectPPRegister(IPPROTO_UDP, "53", ALPROTO_DNS,
+                                  12, 0, STREAM_TOSERVER,
+                                  ProbingParserDummyForTesting);
+
+    if (AppLayerProtoDetectPrepareState() < 0)
+        goto end;
+
+    for (pp = alpd_ctx.ctx_pp; pp != NULL; pp = pp->next) {
+        if (pp->port_index == NULL) {
+            printf("no port index for ipproto %u: ", pp->ipproto);
+            goto end;
+        }
+        port_index = pp->port_index;
+        for (port = 0; port <= UINT16_MAX; port++) {
+            pp_port = AppLayerProtoDetectGetProbingParsers(alpd_ctx.ctx_pp,
+                                                           pp->ipproto, port);
+            /* compare to the list walk */
+            pp->port_index = NULL;
+            if (pp_port != AppLayerProtoDetectGetProbingParsers(alpd_ctx.ctx_pp,
+                                                                pp->ipproto, port)) {
+                pp->port_index = port_index;
+                printf("ipproto %u port %u differs: ", pp->ipproto, port);
+                goto end;
+            }
+            pp->port_index = port_index;
+        }
+    }
+
+    pp_port = AppLayerProtoDetectGetProbingParsers(alpd_ctx.ctx_pp, IPPROTO_TCP, 8080);
+    if (pp_port == NULL || pp_port->port != 8080) {
+        printf("no entry for tcp port 8080: ");
+        goto end;
+    }
+    pp_port = AppLayerProtoDetectGetProbingParsers(alpd_ctx.ctx_pp, IPPROTO_TCP, 81);
+    if (pp_port == NULL || pp_port->port != 0) {
+        printf("no any port entry for tcp port 81: ");
+        goto end;
+    }
+    pp_port = AppLayerProtoDetectGetProbingParsers(alpd_ctx.ctx_pp, IPPROTO_UDP, 54);
+    if (pp_port != NULL) {
+        printf("entry for udp port 54: ");
+        goto end;
+    }
+
+    /* registering drops the index until the state is prepared again */
+    AppLayerProtoDetectPPRegister(IPPROTO_UDP, "54", ALPROTO_DNS,
+                                  12, 0, STREAM_TOSERVER,
+                                  ProbingParserDummyForTesting);
+    pp_port = AppLayerProtoDetectGetProbingParsers(alpd_ctx.ctx_pp, IPPROTO_UDP, 54);
+    if (pp_port == NULL || pp_port->port != 54) {
+        printf("no entry for udp port 54: ");
+        goto end;
+    }
+
+    result = 1;
+
+ end:
+    AppLayerProtoDetectDeSetup();
+    AppLayerProtoDetectUnittestCtxRestore();
+    return result;
+}
 
 void AppLayerProtoDetectUnittestsRegister(void)
 {
@@ -3774,6 +4121,8 @@ void AppLayerProtoDetectUnittestsRegister(void)
     UtRegisterTest("AppLayerProtoDetectTest18", AppLayerProtoDetectTest18);
     UtRegisterTest("AppLayerProtoDetectTest19", AppLayerProtoDetectTest19);
     UtRegisterTest("AppLayerProtoDetectTest20", AppLayerProtoDetectTest20);
+    UtRegisterTest("AppLayerProtoDetectTest21", AppLayerProtoDetectTest21);
+    UtRegisterTest("AppLayerProtoDetectTest22", AppLayerProtoDetectTest22);
 
     SCReturn;
 }
@@ -312,6 +312,10 @@ static void HtpTxUserDataFree(HtpState *state, HtpTxUserData *htud)
             HTPFree(htud->request_headers_raw, htud->request_headers_raw_len);
         if (htud->response_headers_raw)
             HTPFree(htud->response_headers_raw, htud->response_headers_raw_len);
+        if (htud->request_headers_buf.buf)
+            HTPFree(htud->request_headers_buf.buf, htud->request_headers_buf.len);
+        if (htud->response_headers_buf.buf)
+            HTPFree(htud->response_headers_buf.buf, htud->response_headers_buf.len);
         AppLayerDecoderEventsFreeEvents(&htud->decoder_events);
         if (htud->boundary)
             HTPFree(htud->boundary, htud->boundary_len);
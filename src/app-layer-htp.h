@@ -204,6 +204,13 @@ typedef struct HtpBody_ {
 
 /** Now the Body Chunks will be stored per transaction, at
   * the tx user data */
+/** buffer built from the tx by the detection engine */
+typedef struct HtpDetectBuffer_ {
+    uint8_t *buf;
+    uint32_t len;
+    int progress;   /**< tx progress the buffer was built at, 0 if not built */
+} HtpDetectBuffer;
+
 typedef struct HtpTxUserData_ {
     /* Body of the request (if any) */
     uint8_t request_body_init;
@@ -222,6 +229,10 @@ typedef struct HtpTxUserData_ {
     uint32_t request_headers_raw_len;
     uint32_t response_headers_raw_len;
 
+    /** normalized headers for http_header, without the cookies */
+    HtpDetectBuffer request_headers_buf;
+    HtpDetectBuffer response_headers_buf;
+
     AppLayerDecoderEvents *decoder_events;          /**< per tx events */
 
     /** Holds the boundary identificator string if any (used on
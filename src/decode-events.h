@@ -251,6 +251,7 @@ enum {
     STREAM_REASSEMBLY_SEQ_GAP,
 
     STREAM_REASSEMBLY_OVERLAP_DIFFERENT_DATA,
+    STREAM_REASSEMBLY_SEGMENT_BEYOND_WINDOW,
 
     /* should always be last! */
     DECODE_EVENT_MAX,
@@ -635,6 +635,13 @@ typedef struct DecodeThreadVars_
      * flow recycle during lookups */
     void *output_flow_thread_data;
 
+    /* thread-local flow hash partition, NULL if the flow hash is shared */
+    struct FlowHashPartition_ *flow_partition;
+
+    /* fragment pool of the thread, created on its first fragment */
+    struct DefragFragPool_ *defrag_pool;
+    uint32_t defrag_ctx_id;     /**< id of the defrag context of the pool */
+
 #ifdef __SC_CUDA_SUPPORT__
     CudaThreadVars cuda_vars;
 #endif
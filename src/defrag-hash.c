@@ -24,12 +24,16 @@
 #include "util-byte.h"
 #include "util-misc.h"
 #include "util-hash-lookup3.h"
+#include "util-hugepage.h"
 
 static DefragTracker *DefragTrackerGetUsedDefragTracker(void);
 
 /** queue with spare tracker */
 static DefragTrackerQueue defragtracker_spare_q;
 
+/** huge page arena the trackers are allocated from, NULL if not in use */
+static HugepageArena *defragtracker_arena = NULL;
+
 uint32_t DefragTrackerSpareQueueGetSize(void)
 {
     return DefragTrackerQueueLen(&defragtracker_spare_q);
@@ -49,7 +53,11 @@ DefragTracker *DefragTrackerAlloc(void)
 
     (void) SC_ATOMIC_ADD(defrag_memuse, sizeof(DefragTracker));
 
-    DefragTracker *dt = SCMalloc(sizeof(DefragTracker));
+    DefragTracker *dt;
+    if (defragtracker_arena != NULL)
+        dt = HugepageArenaAlloc(defragtracker_arena);
+    else
+        dt = SCMalloc(sizeof(DefragTracker));
     if (unlikely(dt == NULL))
         goto error;
 
@@ -69,7 +77,10 @@ void DefragTrackerFree(DefragTracker *dt)
         DefragTrackerClearMemory(dt);
 
         SCMutexDestroy(&dt->lock);
-        SCFree(dt);
+        if (defragtracker_arena != NULL)
+            HugepageArenaFree(defragtracker_arena, dt);
+        else
+            SCFree(dt);
         (void) SC_ATOMIC_SUB(defrag_memuse, sizeof(DefragTracker));
     }
 }
@@ -190,7 +201,7 @@ void DefragInitConfig(char quiet)
                 (uintmax_t)sizeof(DefragTrackerHashRow));
         exit(EXIT_FAILURE);
     }
-    defragtracker_hash = SCCalloc(defrag_config.hash_size, sizeof(DefragTrackerHashRow));
+    defragtracker_hash = HugepageAlloc(defrag_config.hash_size * sizeof(DefragTrackerHashRow));
     if (unlikely(defragtracker_hash == NULL)) {
         SCLogError(SC_ERR_FATAL, "Fatal error encountered in DefragTrackerInitConfig. Exiting...");
         exit(EXIT_FAILURE);
@@ -203,6 +214,8 @@ void DefragInitConfig(char quiet)
     }
     (void) SC_ATOMIC_ADD(defrag_memuse, (defrag_config.hash_size * sizeof(DefragTrackerHashRow)));
 
+    defragtracker_arena = HugepageArenaCreate("defrag", sizeof(DefragTracker));
+
     if (quiet == FALSE) {
         SCLogInfo("allocated %llu bytes of memory for the defrag hash... "
                   "%" PRIu32 " buckets of size %" PRIuMAX "",
@@ -279,9 +292,12 @@ void DefragHashShutdown(void)
 
             DRLOCK_DESTROY(&defragtracker_hash[u]);
         }
-        SCFree(defragtracker_hash);
+        HugepageFree(defragtracker_hash);
         defragtracker_hash = NULL;
     }
+    /* all trackers are freed now */
+    HugepageArenaDestroy(defragtracker_arena);
+    defragtracker_arena = NULL;
     (void) SC_ATOMIC_SUB(defrag_memuse, defrag_config.hash_size * sizeof(DefragTrackerHashRow));
     DefragTrackerQueueDestroy(&defragtracker_spare_q);
 
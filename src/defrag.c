@@ -120,27 +120,239 @@ DumpFrags(DefragTracker *tracker)
 #endif /* UNITTESTS */
 #endif
 
+/** frags a pool reserves from the context's max-frags at once */
+#define DEFRAG_FRAG_QUOTA_CHUNK 64
+
+/** frags a thread pool preallocates */
+#define DEFRAG_FRAG_POOL_PREALLOC 256
+
+/** id of the last context created, see DefragThreadFragPool() */
+static uint32_t defrag_context_id = 0;
+
 /**
  * \brief Reset a frag for reuse in a pool.
  */
 static void
 DefragFragReset(Frag *frag)
 {
+    DefragFragPool *pool = frag->pool;
+
     if (frag->pkt != NULL)
         SCFree(frag->pkt);
     memset(frag, 0, sizeof(*frag));
+    frag->pool = pool;
 }
 
 /**
- * \brief Allocate a new frag for use in a pool.
+ * \brief Reserve up to 'want' frags from the max-frags of the context.
+ *
+ * \retval cnt number of frags reserved, 0 if the memcap is reached
  */
-static int
-DefragFragInit(void *data, void *initdata)
+static uint32_t
+DefragFragQuotaReserve(DefragContext *dc, uint32_t want)
 {
-    Frag *frag = data;
+    uint32_t avail, cnt;
 
-    memset(frag, 0, sizeof(*frag));
-    return 1;
+    do {
+        avail = SC_ATOMIC_GET(dc->frag_quota);
+        if (avail == 0)
+            return 0;
+        cnt = MIN(avail, want);
+    } while (SC_ATOMIC_CAS(&dc->frag_quota, avail, avail - cnt) == 0);
+
+    return cnt;
+}
+
+/**
+ * \brief Create a frag pool and add it to the context.
+ *
+ * \param shared pool is used by multiple threads, with its lock held
+ */
+static DefragFragPool *
+DefragFragPoolNew(DefragContext *dc, int shared)
+{
+    DefragFragPool *pool = SCCalloc(1, sizeof(*pool));
+    if (unlikely(pool == NULL))
+        return NULL;
+
+    pool->owner = pthread_self();
+    pool->shared = shared;
+    SCMutexInit(&pool->lock, NULL);
+    SC_ATOMIC_INIT(pool->return_stack);
+
+    uint32_t u;
+    for (u = 0; u < DEFRAG_FRAG_POOL_PREALLOC && u < dc->frag_pool_keep; u++) {
+        Frag *frag = SCCalloc(1, sizeof(*frag));
+        if (unlikely(frag == NULL))
+            break;
+        frag->pool = pool;
+        frag->pool_next = pool->head;
+        pool->head = frag;
+        pool->len++;
+    }
+
+    SCMutexLock(&dc->frag_pools_lock);
+    pool->next = dc->frag_pools;
+    dc->frag_pools = pool;
+    SCMutexUnlock(&dc->frag_pools_lock);
+
+    return pool;
+}
+
+/**
+ * \brief Put a list of frags on the free list of the pool.
+ *
+ * Frags beyond what the pool holds on to are freed.
+ */
+static void
+DefragFragPoolPutFree(DefragContext *dc, DefragFragPool *pool, Frag *frag)
+{
+    while (frag != NULL) {
+        Frag *next = frag->pool_next;
+        if (pool->len < dc->frag_pool_keep) {
+            frag->pool_next = pool->head;
+            pool->head = frag;
+            pool->len++;
+        } else {
+            SCFree(frag);
+        }
+        frag = next;
+    }
+}
+
+/**
+ * \brief Take the frags other threads returned to the pool.
+ *
+ * Only called by the owner of the pool, or with the lock of the
+ * shared pool held.
+ */
+static void
+DefragFragPoolTakeReturned(DefragContext *dc, DefragFragPool *pool)
+{
+    Frag *head;
+
+    do {
+        head = SC_ATOMIC_GET(pool->return_stack);
+        if (head == NULL)
+            return;
+    } while (SC_ATOMIC_CAS(&pool->return_stack, head, NULL) == 0);
+
+    DefragFragPoolPutFree(dc, pool, head);
+}
+
+/**
+ * \brief Get a frag from the pool of the calling thread.
+ *
+ * \retval frag the frag or NULL if the memcap is reached or the
+ *     allocation failed
+ */
+static Frag *
+DefragFragPoolGet(DefragContext *dc, DefragFragPool *pool)
+{
+    Frag *frag = NULL;
+
+    if (pool->shared)
+        SCMutexLock(&pool->lock);
+
+    if (SC_ATOMIC_GET(pool->return_stack) != NULL)
+        DefragFragPoolTakeReturned(dc, pool);
+
+    if (pool->quota == 0) {
+        pool->quota = DefragFragQuotaReserve(dc, DEFRAG_FRAG_QUOTA_CHUNK);
+        if (pool->quota == 0)
+            goto end;
+    }
+
+    frag = pool->head;
+    if (frag != NULL) {
+        pool->head = frag->pool_next;
+        pool->len--;
+    } else {
+        frag = SCCalloc(1, sizeof(*frag));
+        if (unlikely(frag == NULL))
+            goto end;
+        frag->pool = pool;
+    }
+    frag->pool_next = NULL;
+    pool->quota--;
+
+end:
+    if (pool->shared)
+        SCMutexUnlock(&pool->lock);
+    return frag;
+}
+
+/**
+ * \brief Return a list of reset frags of the same pool.
+ *
+ * The owner of the pool puts them on its free list and keeps the quota
+ * for its next frags. Other threads push them onto the return stack of
+ * the pool in one go and release the quota to the context right away.
+ */
+static void
+DefragFragPoolReturn(DefragContext *dc, Frag *head, Frag *tail, uint32_t cnt)
+{
+    DefragFragPool *pool = head->pool;
+
+    if (!pool->shared && pthread_equal(pool->owner, pthread_self())) {
+        DefragFragPoolPutFree(dc, pool, head);
+
+        pool->quota += cnt;
+        if (pool->quota > 2 * DEFRAG_FRAG_QUOTA_CHUNK) {
+            (void)SC_ATOMIC_ADD(dc->frag_quota,
+                    pool->quota - DEFRAG_FRAG_QUOTA_CHUNK);
+            pool->quota = DEFRAG_FRAG_QUOTA_CHUNK;
+        }
+        return;
+    }
+
+    Frag *old;
+    do {
+        old = SC_ATOMIC_GET(pool->return_stack);
+        tail->pool_next = old;
+    } while (SC_ATOMIC_CAS(&pool->return_stack, old, head) == 0);
+
+    (void)SC_ATOMIC_ADD(dc->frag_quota, cnt);
+}
+
+/**
+ * \brief Free all frags of a pool and the pool itself.
+ */
+static void
+DefragFragPoolFree(DefragContext *dc, DefragFragPool *pool)
+{
+    Frag *frag, *next;
+
+    DefragFragPoolTakeReturned(dc, pool);
+    for (frag = pool->head; frag != NULL; frag = next) {
+        next = frag->pool_next;
+        SCFree(frag);
+    }
+
+    SC_ATOMIC_DESTROY(pool->return_stack);
+    SCMutexDestroy(&pool->lock);
+    SCFree(pool);
+}
+
+/**
+ * \brief Get the frag pool of the calling decoder thread.
+ *
+ * The pool is created on the first fragment of the thread, so that it's
+ * owned by that thread. Callers without a thread get the shared pool.
+ */
+static DefragFragPool *
+DefragThreadFragPool(DefragContext *dc, DecodeThreadVars *dtv)
+{
+    if (dtv == NULL)
+        return dc->frag_pool;
+
+    if (dtv->defrag_pool == NULL || dtv->defrag_ctx_id != dc->id) {
+        dtv->defrag_pool = DefragFragPoolNew(dc, 0);
+        if (dtv->defrag_pool == NULL)
+            return dc->frag_pool;
+        dtv->defrag_ctx_id = dc->id;
+    }
+    return dtv->defrag_pool;
 }
 
 /**
@@ -150,19 +362,31 @@ void
 DefragTrackerFreeFrags(DefragTracker *tracker)
 {
     Frag *frag;
+    Frag *head = NULL, *tail = NULL;
+    uint32_t cnt = 0;
 
-    /* Lock the frag pool as we'll be return items to it. */
-    SCMutexLock(&defrag_context->frag_pool_lock);
-
+    /* Return the frags in runs of the same pool, which is usually all
+     * of them. */
     while ((frag = TAILQ_FIRST(&tracker->frags)) != NULL) {
         TAILQ_REMOVE(&tracker->frags, frag, next);
 
+        if (head != NULL && frag->pool != head->pool) {
+            DefragFragPoolReturn(defrag_context, head, tail, cnt);
+            head = NULL;
+            cnt = 0;
+        }
+
         /* Don't SCFree the frag, just give it back to its pool. */
         DefragFragReset(frag);
-        PoolReturn(defrag_context->frag_pool, frag);
+        frag->pool_next = head;
+        if (head == NULL)
+            tail = frag;
+        head = frag;
+        cnt++;
     }
 
-    SCMutexUnlock(&defrag_context->frag_pool_lock);
+    if (head != NULL)
+        DefragFragPoolReturn(defrag_context, head, tail, cnt);
 }
 
 /**
@@ -186,25 +410,29 @@ DefragContextNew(void)
         tracker_pool_size = DEFAULT_DEFRAG_HASH_SIZE;
     }
 
-    /* Initialize the pool of frags. */
+    /* Initialize the pools of frags. */
     intmax_t frag_pool_size;
     if (!ConfGetInt("defrag.max-frags", &frag_pool_size) || frag_pool_size == 0) {
         frag_pool_size = DEFAULT_DEFRAG_POOL_SIZE;
     }
     intmax_t frag_pool_prealloc = frag_pool_size / 2;
-    dc->frag_pool = PoolInit(frag_pool_size, frag_pool_prealloc,
-        sizeof(Frag),
-        NULL, DefragFragInit, dc, NULL, NULL);
+    dc->max_frags = (uint32_t)frag_pool_size;
+    dc->frag_pool_keep = (uint32_t)frag_pool_prealloc;
+    SC_ATOMIC_INIT(dc->frag_quota);
+    SC_ATOMIC_SET(dc->frag_quota, dc->max_frags);
+    dc->id = ++defrag_context_id;
+
+    if (SCMutexInit(&dc->frag_pools_lock, NULL) != 0) {
+        SCLogError(SC_ERR_MUTEX,
+            "Defrag: Failed to initialize frag pool mutex.");
+        exit(EXIT_FAILURE);
+    }
+    dc->frag_pool = DefragFragPoolNew(dc, 1);
     if (dc->frag_pool == NULL) {
         SCLogError(SC_ERR_MEM_ALLOC,
             "Defrag: Failed to initialize fragment pool.");
         exit(EXIT_FAILURE);
     }
-    if (SCMutexInit(&dc->frag_pool_lock, NULL) != 0) {
-        SCLogError(SC_ERR_MUTEX,
-            "Defrag: Failed to initialize frag pool mutex.");
-        exit(EXIT_FAILURE);
-    }
 
     /* Set the default timeout. */
     intmax_t timeout;
@@ -230,7 +458,7 @@ DefragContextNew(void)
     SCLogDebug("\tMaximum defrag trackers: %"PRIuMAX, tracker_pool_size);
     SCLogDebug("\tPreallocated defrag trackers: %"PRIuMAX, tracker_pool_size);
     SCLogDebug("\tMaximum fragments: %"PRIuMAX, (uintmax_t)frag_pool_size);
-    SCLogDebug("\tPreallocated fragments: %"PRIuMAX, (uintmax_t)frag_pool_prealloc);
+    SCLogDebug("\tFree fragments kept per thread: %"PRIuMAX, (uintmax_t)frag_pool_prealloc);
 
     return dc;
 }
@@ -241,7 +469,14 @@ DefragContextDestroy(DefragContext *dc)
     if (dc == NULL)
         return;
 
-    PoolFree(dc->frag_pool);
+    DefragFragPool *pool = dc->frag_pools;
+    while (pool != NULL) {
+        DefragFragPool *next = pool->next;
+        DefragFragPoolFree(dc, pool);
+        pool = next;
+    }
+    SCMutexDestroy(&dc->frag_pools_lock);
+    SC_ATOMIC_DESTROY(dc->frag_quota);
     SCFree(dc);
 }
 
@@ -714,10 +949,12 @@ insert:
     }
 
     /* Allocate fragment and insert. */
-    SCMutexLock(&defrag_context->frag_pool_lock);
-    Frag *new = PoolGet(defrag_context->frag_pool);
-    SCMutexUnlock(&defrag_context->frag_pool_lock);
+    Frag *new = DefragFragPoolGet(defrag_context,
+            DefragThreadFragPool(defrag_context, dtv));
     if (new == NULL) {
+        if (tv != NULL && dtv != NULL) {
+            StatsIncr(tv, dtv->counter_defrag_max_hit);
+        }
         if (af == AF_INET) {
             ENGINE_SET_EVENT(p, IPV4_FRAG_IGNORED);
         } else {
@@ -727,9 +964,7 @@ insert:
     }
     new->pkt = SCMalloc(GET_PKT_LEN(p));
     if (new->pkt == NULL) {
-        SCMutexLock(&defrag_context->frag_pool_lock);
-        PoolReturn(defrag_context->frag_pool, new);
-        SCMutexUnlock(&defrag_context->frag_pool_lock);
+        DefragFragPoolReturn(defrag_context, new, new, 1);
         if (af == AF_INET) {
             ENGINE_SET_EVENT(p, IPV4_FRAG_IGNORED);
         } else {
@@ -993,6 +1228,21 @@ void DefragDestroy(void)
 #ifdef UNITTESTS
 #define IP_MF 0x2000
 
+/**
+ * Number of frags taken from the pools of a context and not returned.
+ */
+static uint32_t
+DefragFragsInUse(DefragContext *dc)
+{
+    uint32_t unused = SC_ATOMIC_GET(dc->frag_quota);
+    DefragFragPool *pool;
+
+    for (pool = dc->frag_pools; pool != NULL; pool = pool->next) {
+        unused += pool->quota;
+    }
+    return dc->max_frags - unused;
+}
+
 /**
  * Allocate a test packet.  Nothing to fancy, just a simple IP packet
  * with some payload of no particular protocol.
@@ -1555,7 +1805,7 @@ DefragDoSturgesNovakTest(int policy, u_char *expected, size_t expected_len)
     SCFree(reassembled);
 
     /* Make sure all frags were returned back to the pool. */
-    if (defrag_context->frag_pool->outstanding != 0) {
+    if (DefragFragsInUse(defrag_context) != 0) {
         goto end;
     }
 
@@ -1683,8 +1933,8 @@ IPV6DefragDoSturgesNovakTest(int policy, u_char *expected, size_t expected_len)
     SCFree(reassembled);
 
     /* Make sure all frags were returned to the pool. */
-    if (defrag_context->frag_pool->outstanding != 0) {
-        printf("defrag_context->frag_pool->outstanding %u: ", defrag_context->frag_pool->outstanding);
+    if (DefragFragsInUse(defrag_context) != 0) {
+        printf("frags in use %u: ", DefragFragsInUse(defrag_context));
         goto end;
     }
 
@@ -2201,7 +2451,7 @@ DefragIPv4NoDataTest(void)
 
     /* The fragment should have been ignored so no fragments should
      * have been allocated from the pool. */
-    if (dc->frag_pool->outstanding != 0)
+    if (DefragFragsInUse(dc) != 0)
         return 0;
 
     ret = 1;
@@ -2242,7 +2492,7 @@ DefragIPv4TooLargeTest(void)
 
     /* The fragment should have been ignored so no fragments should have
      * been allocated from the pool. */
-    if (dc->frag_pool->outstanding != 0)
+    if (DefragFragsInUse(dc) != 0)
         return 0;
 
     ret = 1;
@@ -2544,6 +2794,123 @@ end:
     return retval;
 }
 
+typedef struct DefragPoolTestThread_ {
+    Packet *p;                  /**< last fragment to insert */
+    Packet *reassembled;
+    DefragFragPool *pool;       /**< pool of the thread */
+} DefragPoolTestThread;
+
+static void *
+DefragPoolTestThreadFunc(void *data)
+{
+    DefragPoolTestThread *t = (DefragPoolTestThread *)data;
+    DecodeThreadVars dtv;
+
+    memset(&dtv, 0, sizeof(dtv));
+    t->reassembled = Defrag(NULL, &dtv, t->p, NULL);
+    t->pool = dtv.defrag_pool;
+    return NULL;
+}
+
+/**
+ * Frags of a thread's pool that are freed by another thread, as when the
+ * last fragment is handled by a different decoder, go back to the owner
+ * through its return stack, and no quota is lost or created.
+ */
+static int
+DefragPoolCrossThreadTest(void)
+{
+    DecodeThreadVars dtv;
+    DefragPoolTestThread t;
+    Packet *p1 = NULL, *p2 = NULL, *p3 = NULL, *p4 = NULL;
+    DefragFragPool *pool, *p;
+    pthread_t thread;
+    int id = 12;
+    int ret = 0;
+
+    DefragInit();
+    memset(&dtv, 0, sizeof(dtv));
+    memset(&t, 0, sizeof(t));
+
+    p1 = BuildTestPacket(id, 0, 1, 'A', 8);
+    p2 = BuildTestPacket(id, 1, 1, 'B', 8);
+    p3 = BuildTestPacket(id, 2, 0, 'C', 3);
+    p4 = BuildTestPacket(id + 1, 0, 1, 'D', 8);
+    if (p1 == NULL || p2 == NULL || p3 == NULL || p4 == NULL)
+        goto end;
+
+    if (Defrag(NULL, &dtv, p1, NULL) != NULL)
+        goto end;
+    if (Defrag(NULL, &dtv, p2, NULL) != NULL)
+        goto end;
+    pool = dtv.defrag_pool;
+    if (pool == NULL || pool->shared)
+        goto end;
+    if (DefragFragsInUse(defrag_context) != 2)
+        goto end;
+    uint32_t pool_len = pool->len;
+
+    /* the last fragment completes the packet in another thread, which
+     * frees all frags */
+    t.p = p3;
+    if (pthread_create(&thread, NULL, DefragPoolTestThreadFunc, &t) != 0)
+        goto end;
+    pthread_join(thread, NULL);
+
+    if (t.reassembled == NULL)
+        goto end;
+    SCFree(t.reassembled);
+    if (t.pool == NULL || t.pool == pool)
+        goto end;
+
+    /* our frags wait on the return stack, their quota is back in the
+     * context */
+    if (SC_ATOMIC_GET(pool->return_stack) == NULL || pool->len != pool_len)
+        goto end;
+    if (DefragFragsInUse(defrag_context) != 0)
+        goto end;
+
+    /* the owner takes them back with its next frag */
+    if (Defrag(NULL, &dtv, p4, NULL) != NULL)
+        goto end;
+    if (SC_ATOMIC_GET(pool->return_stack) != NULL || pool->len != pool_len + 1)
+        goto end;
+    if (DefragFragsInUse(defrag_context) != 1)
+        goto end;
+
+    DefragTracker *tracker = DefragLookupTrackerFromHash(p4);
+    if (tracker == NULL)
+        goto end;
+    DefragTrackerFreeFrags(tracker);
+    DefragTrackerRelease(tracker);
+    if (DefragFragsInUse(defrag_context) != 0)
+        goto end;
+
+    /* all of max-frags can still be reserved: the quota in the context
+     * plus what the pools hold adds up */
+    uint32_t quota = 0;
+    for (p = defrag_context->frag_pools; p != NULL; p = p->next) {
+        quota += p->quota;
+    }
+    uint32_t reserved = DefragFragQuotaReserve(defrag_context, UINT32_MAX);
+    (void)SC_ATOMIC_ADD(defrag_context->frag_quota, reserved);
+    if (reserved + quota != defrag_context->max_frags)
+        goto end;
+
+    ret = 1;
+end:
+    if (p1 != NULL)
+        SCFree(p1);
+    if (p2 != NULL)
+        SCFree(p2);
+    if (p3 != NULL)
+        SCFree(p3);
+    if (p4 != NULL)
+        SCFree(p4);
+    DefragDestroy();
+    return ret;
+}
+
 #endif /* UNITTESTS */
 
 void
@@ -2585,6 +2952,7 @@ DefragRegisterTests(void)
     UtRegisterTest("DefragTimeoutTest", DefragTimeoutTest);
     UtRegisterTest("DefragMfIpv4Test", DefragMfIpv4Test);
     UtRegisterTest("DefragMfIpv6Test", DefragMfIpv6Test);
+    UtRegisterTest("DefragPoolCrossThreadTest", DefragPoolCrossThreadTest);
 #endif /* UNITTESTS */
 }
 
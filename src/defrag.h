@@ -24,15 +24,52 @@
 #ifndef __DEFRAG_H__
 #define __DEFRAG_H__
 
-#include "util-pool.h"
+#include "util-atomic.h"
+
+/**
+ * A per thread pool of fragments.
+ *
+ * Only the thread owning the pool takes fragments from it, so that needs
+ * no locking. Fragments freed by other threads are pushed onto a lock-free
+ * return stack, which the owner takes over as a whole.
+ */
+typedef struct DefragFragPool_ {
+    struct Frag_ *head;         /**< free fragments, owner only */
+    uint32_t len;               /**< length of the free list */
+
+    /** fragments the owner may still take from the pool. Reserved from
+     *  the context's max-frags in chunks, so that the memcap is only
+     *  checked globally once per chunk. */
+    uint32_t quota;
+
+    pthread_t owner;            /**< thread taking frags from the pool */
+    int shared;                 /**< pool without an owner, used locked */
+    SCMutex lock;               /**< only used for the shared pool */
+
+    /** fragments returned by other threads. They push with a CAS, the
+     *  owner takes the whole stack at once, so there is no ABA problem. */
+    SC_ATOMIC_DECLARE(struct Frag_ *, return_stack);
+
+    struct DefragFragPool_ *next; /**< list of the context's pools */
+} DefragFragPool;
 
 /**
  * A context for an instance of a fragmentation re-assembler, in case
  * we ever need more than one.
  */
 typedef struct DefragContext_ {
-    Pool *frag_pool; /**< Pool of fragments. */
-    SCMutex frag_pool_lock;
+    uint32_t id;                /**< unique id, to detect a stale thread pool */
+
+    DefragFragPool *frag_pools; /**< per thread pools */
+    SCMutex frag_pools_lock;    /**< protects adding to frag_pools */
+
+    /** pool for callers without a thread, such as the unittests */
+    DefragFragPool *frag_pool;
+
+    uint32_t max_frags;         /**< the defrag.max-frags memcap */
+    /** fragments not reserved by any pool */
+    SC_ATOMIC_DECLARE(uint32_t, frag_quota);
+    uint32_t frag_pool_keep;    /**< max free frags a pool holds on to */
 
     time_t timeout; /**< Default timeout. */
 } DefragContext;
@@ -64,6 +101,10 @@ typedef struct Frag_ {
 
     uint8_t *pkt;               /**< The actual packet. */
 
+    DefragFragPool *pool;       /**< pool the fragment belongs to */
+    struct Frag_ *pool_next;    /**< next in the pool's free list or
+                                 *   return stack */
+
 #ifdef DEBUG
     uint64_t pcap_cnt;          /**< pcap_cnt of original packet */
 #endif
@@ -33,6 +33,8 @@
 #include "detect-engine-mpm.h"
 
 #include "detect-ack.h"
+#include "detect-engine-prefilter.h"
+#include "detect-engine-prefilter-common.h"
 
 #include "util-byte.h"
 #include "util-unittest.h"
@@ -45,6 +47,7 @@ static int DetectAckMatch(ThreadVars *, DetectEngineThreadCtx *,
                           Packet *, Signature *, const SigMatchCtx *);
 static void DetectAckRegisterTests(void);
 static void DetectAckFree(void *);
+static int PrefilterSetupAck(SigGroupHead *sgh);
 
 void DetectAckRegister(void)
 {
@@ -55,6 +58,7 @@ void DetectAckRegister(void)
     sigmatch_table[DETECT_ACK].Setup = DetectAckSetup;
     sigmatch_table[DETECT_ACK].Free = DetectAckFree;
     sigmatch_table[DETECT_ACK].RegisterTests = DetectAckRegisterTests;
+    sigmatch_table[DETECT_ACK].SetupPrefilter = PrefilterSetupAck;
 }
 
 /**
@@ -82,6 +86,34 @@ static int DetectAckMatch(ThreadVars *t, DetectEngineThreadCtx *det_ctx,
     return (data->ack == TCP_GET_ACK(p)) ? 1 : 0;
 }
 
+/* prefilter: v1.u32[0] ack, groups are sorted so we can bsearch */
+
+static void PrefilterPacketAckMatch(DetectEngineThreadCtx *det_ctx,
+        Packet *p, const void *pectx)
+{
+    const PrefilterPacketHeaderCtx *ctx = pectx;
+
+    if (!(PKT_IS_TCP(p)) || PKT_IS_PSEUDOPKT(p))
+        return;
+
+    const PrefilterPacketHeaderGroup *g =
+        PrefilterPacketHeaderLookupU32(ctx, TCP_GET_ACK(p));
+    if (g != NULL)
+        PrefilterPacketHeaderAddGroup(det_ctx, g);
+}
+
+static void PrefilterPacketAckSet(PrefilterPacketHeaderValue *v, const void *smctx)
+{
+    const DetectAckData *data = smctx;
+    v->u32[0] = data->ack;
+}
+
+static int PrefilterSetupAck(SigGroupHead *sgh)
+{
+    return PrefilterSetupPacketHeader(sgh, DETECT_ACK,
+            PrefilterPacketAckSet, PrefilterPacketAckMatch);
+}
+
 /**
  * \internal
  * \brief this function is used to add the ack option into the signature
@@ -29,5 +29,7 @@
 void DetectDnsQueryRegister (void);
 uint32_t DetectDnsQueryInspectMpm(DetectEngineThreadCtx *det_ctx, Flow *f,
                                   DNSState *dns_state, uint8_t flags, void *txv, uint64_t tx_id);
+void PrefilterTxDnsQuery(DetectEngineThreadCtx *det_ctx, Flow *f, void *alstate,
+        void *tx, const uint64_t idx, const uint8_t flags);
 
 #endif /* __DETECT_DNS_QUERY_H__ */
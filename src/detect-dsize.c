@@ -32,6 +32,8 @@
 #include "flow-var.h"
 
 #include "detect-dsize.h"
+#include "detect-engine-prefilter.h"
+#include "detect-engine-prefilter-common.h"
 
 #include "util-unittest.h"
 #include "util-debug.h"
@@ -52,6 +54,7 @@ int DetectDsizeMatch (ThreadVars *, DetectEngineThreadCtx *, Packet *, Signature
 static int DetectDsizeSetup (DetectEngineCtx *, Signature *s, char *str);
 void DsizeRegisterTests(void);
 static void DetectDsizeFree(void *);
+static int PrefilterSetupDsize(SigGroupHead *sgh);
 
 /**
  * \brief Registration function for dsize: keyword
@@ -65,10 +68,26 @@ void DetectDsizeRegister (void)
     sigmatch_table[DETECT_DSIZE].Setup = DetectDsizeSetup;
     sigmatch_table[DETECT_DSIZE].Free  = DetectDsizeFree;
     sigmatch_table[DETECT_DSIZE].RegisterTests = DsizeRegisterTests;
+    sigmatch_table[DETECT_DSIZE].SetupPrefilter = PrefilterSetupDsize;
 
     DetectSetupParseRegexes(PARSE_REGEX, &parse_regex, &parse_regex_study);
 }
 
+static inline int DsizeMatch(const uint16_t psize, const uint8_t mode,
+        const uint16_t dsize, const uint16_t dsize2)
+{
+    if (mode == DETECTDSIZE_EQ && dsize == psize)
+        return 1;
+    else if (mode == DETECTDSIZE_LT && psize < dsize)
+        return 1;
+    else if (mode == DETECTDSIZE_GT && psize > dsize)
+        return 1;
+    else if (mode == DETECTDSIZE_RA && psize > dsize && psize < dsize2)
+        return 1;
+
+    return 0;
+}
+
 /**
  * \internal
  * \brief This function is used to match flags on a packet with those passed via dsize:
@@ -95,18 +114,44 @@ int DetectDsizeMatch (ThreadVars *t, DetectEngineThreadCtx *det_ctx, Packet *p,
 
     SCLogDebug("p->payload_len %"PRIu16"", p->payload_len);
 
-    if (dd->mode == DETECTDSIZE_EQ && dd->dsize == p->payload_len)
-        ret = 1;
-    else if (dd->mode == DETECTDSIZE_LT && p->payload_len < dd->dsize)
-        ret = 1;
-    else if (dd->mode == DETECTDSIZE_GT && p->payload_len > dd->dsize)
-        ret = 1;
-    else if (dd->mode == DETECTDSIZE_RA && p->payload_len > dd->dsize && p->payload_len < dd->dsize2)
-        ret = 1;
+    ret = DsizeMatch(p->payload_len, dd->mode, dd->dsize, dd->dsize2);
 
     SCReturnInt(ret);
 }
 
+/* prefilter: v1.u16[0] dsize, v1.u16[1] dsize2, v1.u8[4] mode */
+
+static void PrefilterPacketDsizeMatch(DetectEngineThreadCtx *det_ctx,
+        Packet *p, const void *pectx)
+{
+    const PrefilterPacketHeaderCtx *ctx = pectx;
+    uint32_t i;
+
+    if (PKT_IS_PSEUDOPKT(p))
+        return;
+
+    const uint16_t psize = p->payload_len;
+    for (i = 0; i < ctx->groups_cnt; i++) {
+        const PrefilterPacketHeaderGroup *g = &ctx->groups[i];
+        if (DsizeMatch(psize, g->v1.u8[4], g->v1.u16[0], g->v1.u16[1]))
+            PrefilterPacketHeaderAddGroup(det_ctx, g);
+    }
+}
+
+static void PrefilterPacketDsizeSet(PrefilterPacketHeaderValue *v, const void *smctx)
+{
+    const DetectDsizeData *dd = smctx;
+    v->u16[0] = dd->dsize;
+    v->u16[1] = dd->dsize2;
+    v->u8[4] = dd->mode;
+}
+
+static int PrefilterSetupDsize(SigGroupHead *sgh)
+{
+    return PrefilterSetupPacketHeader(sgh, DETECT_DSIZE,
+            PrefilterPacketDsizeSet, PrefilterPacketDsizeMatch);
+}
+
 /**
  * \internal
  * \brief This function is used to parse dsize options passed via dsize: keyword
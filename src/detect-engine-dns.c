@@ -41,6 +41,7 @@
 #include "app-layer-parser.h"
 #include "app-layer-protos.h"
 #include "app-layer-dns-common.h"
+#include "detect-dns-query.h"
 
 #include "util-unittest.h"
 #include "util-unittest-helper.h"
@@ -159,6 +160,13 @@ uint32_t DetectDnsQueryInspectMpm(DetectEngineThreadCtx *det_ctx, Flow *f,
     SCReturnUInt(cnt);
 }
 
+/** \brief tx prefilter callback running the dns_query mpm */
+void PrefilterTxDnsQuery(DetectEngineThreadCtx *det_ctx, Flow *f, void *alstate,
+        void *tx, const uint64_t idx, const uint8_t flags)
+{
+    DetectDnsQueryInspectMpm(det_ctx, f, (DNSState *)alstate, flags, tx, idx);
+}
+
 /** \brief Do the content inspection & validation for a signature
  *
  *  \param de_ctx Detection engine context
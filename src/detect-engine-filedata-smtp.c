@@ -293,6 +293,14 @@ end:
     return cnt;
 }
 
+/** \brief tx prefilter callback running the smtp file_data mpm */
+void PrefilterTxSmtpFiledata(DetectEngineThreadCtx *det_ctx, Flow *f, void *alstate,
+        void *tx, const uint64_t idx, const uint8_t flags)
+{
+    DetectEngineRunSMTPMpm(det_ctx->de_ctx, det_ctx, f,
+            (SMTPState *)alstate, flags, tx, idx);
+}
+
 #ifdef UNITTESTS
 
 static int DetectEngineSMTPFiledataTest01(void)
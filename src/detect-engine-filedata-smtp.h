@@ -37,6 +37,8 @@ int DetectEngineRunSMTPMpm(DetectEngineCtx *de_ctx,
                            DetectEngineThreadCtx *det_ctx, Flow *f,
                            SMTPState *smtp_state, uint8_t flags,
                            void *tx, uint64_t idx);
+void PrefilterTxSmtpFiledata(DetectEngineThreadCtx *det_ctx, Flow *f, void *alstate,
+        void *tx, const uint64_t idx, const uint8_t flags);
 
 void DetectEngineSMTPFiledataRegisterTests(void);
 
@@ -264,6 +264,14 @@ int DetectEngineRunHttpClientBodyMpm(DetectEngineCtx *de_ctx,
     return cnt;
 }
 
+/** \brief tx prefilter callback running the http_client_body mpm */
+void PrefilterTxHttpClientBody(DetectEngineThreadCtx *det_ctx, Flow *f, void *alstate,
+        void *tx, const uint64_t idx, const uint8_t flags)
+{
+    DetectEngineRunHttpClientBodyMpm(det_ctx->de_ctx, det_ctx, f,
+            (HtpState *)alstate, flags, tx, idx);
+}
+
 int DetectEngineInspectHttpClientBody(ThreadVars *tv,
                                       DetectEngineCtx *de_ctx,
                                       DetectEngineThreadCtx *det_ctx,
@@ -129,6 +129,13 @@ int DetectEngineRunHttpCookieMpm(DetectEngineThreadCtx *det_ctx, Flow *f,
     return cnt;
 }
 
+/** \brief tx prefilter callback running the http_cookie mpm */
+void PrefilterTxHttpCookie(DetectEngineThreadCtx *det_ctx, Flow *f, void *alstate,
+        void *tx, const uint64_t idx, const uint8_t flags)
+{
+    DetectEngineRunHttpCookieMpm(det_ctx, f, (HtpState *)alstate, flags, tx, idx);
+}
+
 /**
  * \brief Do the http_cookie content inspection for a signature.
  *
@@ -56,142 +56,59 @@
 #include "util-unittest-helper.h"
 #include "app-layer.h"
 #include "app-layer-htp.h"
+#include "app-layer-htp-mem.h"
 #include "app-layer-protos.h"
 
 #include "util-validate.h"
 
-#define BUFFER_STEP 50
-
-static inline int HHDCreateSpace(DetectEngineThreadCtx *det_ctx, uint64_t size)
+/** \brief the cookies have their own buffer, http_cookie */
+static inline int HHDSkipHeader(const htp_header_t *h, const uint8_t flags)
 {
-    if (size >= (USHRT_MAX - BUFFER_STEP))
-        return -1;
-
-    void *ptmp;
-    if (size > det_ctx->hhd_buffers_size) {
-        ptmp = SCRealloc(det_ctx->hhd_buffers,
-                         (det_ctx->hhd_buffers_size + BUFFER_STEP) * sizeof(uint8_t *));
-        if (ptmp == NULL) {
-            SCFree(det_ctx->hhd_buffers);
-            det_ctx->hhd_buffers = NULL;
-            det_ctx->hhd_buffers_size = 0;
-            det_ctx->hhd_buffers_list_len = 0;
-            return -1;
-        }
-        det_ctx->hhd_buffers = ptmp;
-
-        memset(det_ctx->hhd_buffers + det_ctx->hhd_buffers_size, 0, BUFFER_STEP * sizeof(uint8_t *));
-        ptmp = SCRealloc(det_ctx->hhd_buffers_len,
-                         (det_ctx->hhd_buffers_size + BUFFER_STEP) * sizeof(uint32_t));
-        if (ptmp == NULL) {
-            SCFree(det_ctx->hhd_buffers_len);
-            det_ctx->hhd_buffers_len = NULL;
-            det_ctx->hhd_buffers_size = 0;
-            det_ctx->hhd_buffers_list_len = 0;
-            return -1;
-        }
-        det_ctx->hhd_buffers_len = ptmp;
+    size_t size = bstr_size(h->name);
 
-        memset(det_ctx->hhd_buffers_len + det_ctx->hhd_buffers_size, 0, BUFFER_STEP * sizeof(uint32_t));
-        det_ctx->hhd_buffers_size += BUFFER_STEP;
+    if (flags & STREAM_TOSERVER) {
+        return (size == 6 &&
+                SCMemcmpLowercase("cookie", bstr_ptr(h->name), 6) == 0);
+    } else {
+        return (size == 10 &&
+                SCMemcmpLowercase("set-cookie", bstr_ptr(h->name), 10) == 0);
     }
-    memset(det_ctx->hhd_buffers_len + det_ctx->hhd_buffers_list_len, 0, (size - det_ctx->hhd_buffers_list_len) * sizeof(uint32_t));
-
-    return 0;
 }
 
-static uint8_t *DetectEngineHHDGetBufferForTX(htp_tx_t *tx, uint64_t tx_id,
-                                              DetectEngineCtx *de_ctx,
-                                              DetectEngineThreadCtx *det_ctx,
-                                              Flow *f, HtpState *htp_state,
-                                              uint8_t flags,
-                                              uint32_t *buffer_len)
+/** \brief size of the normalized header buffer */
+static size_t HHDBufferSize(htp_table_t *headers, const uint8_t flags)
 {
-    uint8_t *headers_buffer = NULL;
-    int index = 0;
-    *buffer_len = 0;
-
-    if (det_ctx->hhd_buffers_list_len == 0) {
-        /* get the inspect id to use as a 'base id' */
-        uint64_t base_inspect_id = AppLayerParserGetTransactionInspectId(f->alparser, flags);
-        BUG_ON(base_inspect_id > tx_id);
-        /* see how many space we need for the current tx_id */
-        uint64_t txs = (tx_id - base_inspect_id) + 1;
-        if (HHDCreateSpace(det_ctx, txs) < 0)
-            goto end;
-
-        index = (tx_id - base_inspect_id);
-        det_ctx->hhd_start_tx_id = base_inspect_id;
-        det_ctx->hhd_buffers_list_len = txs;
-    } else {
-        /* tx fits in our current buffers */
-        if ((tx_id - det_ctx->hhd_start_tx_id) < det_ctx->hhd_buffers_list_len) {
-            /* if we previously reassembled, return that buffer */
-            if (det_ctx->hhd_buffers_len[(tx_id - det_ctx->hhd_start_tx_id)] != 0) {
-                *buffer_len = det_ctx->hhd_buffers_len[(tx_id - det_ctx->hhd_start_tx_id)];
-                return det_ctx->hhd_buffers[(tx_id - det_ctx->hhd_start_tx_id)];
-            }
-            /* otherwise fall through */
-        } else {
-            /* not enough space, lets expand */
-            uint64_t txs = (tx_id - det_ctx->hhd_start_tx_id) + 1;
-            if (HHDCreateSpace(det_ctx, txs) < 0)
-                goto end;
-
-            det_ctx->hhd_buffers_list_len = txs;
-        }
-        index = (tx_id - det_ctx->hhd_start_tx_id);
-    }
+    size_t no_of_headers = htp_table_size(headers);
+    size_t size = 0;
+    size_t i;
 
-    htp_table_t *headers;
-    if (flags & STREAM_TOSERVER) {
-        if (AppLayerParserGetStateProgress(IPPROTO_TCP, ALPROTO_HTTP, tx, flags) <= HTP_REQUEST_HEADERS)
-            goto end;
-        headers = tx->request_headers;
-    } else {
-        if (AppLayerParserGetStateProgress(IPPROTO_TCP, ALPROTO_HTTP, tx, flags) <= HTP_RESPONSE_HEADERS)
-            goto end;
-        headers = tx->response_headers;
+    for (i = 0; i < no_of_headers; i++) {
+        htp_header_t *h = htp_table_get_index(headers, i, NULL);
+        if (HHDSkipHeader(h, flags))
+            continue;
+        /* the extra 4 bytes if for ": " and "\r\n" */
+        size += bstr_size(h->name) + bstr_size(h->value) + 4;
     }
-    if (headers == NULL)
-        goto end;
+    return size;
+}
 
-    htp_header_t *h = NULL;
-    headers_buffer = det_ctx->hhd_buffers[index];
+/** \brief write the normalized headers to a buffer of HHDBufferSize()
+ *  \retval len bytes written */
+static uint32_t HHDBufferFill(htp_table_t *headers, const uint8_t flags,
+                              uint8_t *headers_buffer)
+{
+    size_t no_of_headers = htp_table_size(headers);
     size_t headers_buffer_len = 0;
-    size_t i = 0;
+    size_t i;
+
+    for (i = 0; i < no_of_headers; i++) {
+        htp_header_t *h = htp_table_get_index(headers, i, NULL);
+        if (HHDSkipHeader(h, flags))
+            continue;
 
-    size_t no_of_headers = htp_table_size(headers);
-    for (; i < no_of_headers; i++) {
-        h = htp_table_get_index(headers, i, NULL);
         size_t size1 = bstr_size(h->name);
         size_t size2 = bstr_size(h->value);
 
-        if (flags & STREAM_TOSERVER) {
-            if (size1 == 6 &&
-                SCMemcmpLowercase("cookie", bstr_ptr(h->name), 6) == 0) {
-                continue;
-            }
-        } else {
-            if (size1 == 10 &&
-                SCMemcmpLowercase("set-cookie", bstr_ptr(h->name), 10) == 0) {
-                continue;
-            }
-        }
-
-        /* the extra 4 bytes if for ": " and "\r\n" */
-        uint8_t *new_headers_buffer = SCRealloc(headers_buffer, headers_buffer_len + size1 + size2 + 4);
-        if (unlikely(new_headers_buffer == NULL)) {
-            if (headers_buffer != NULL) {
-                SCFree(headers_buffer);
-                headers_buffer = NULL;
-            }
-            det_ctx->hhd_buffers[index] = NULL;
-            det_ctx->hhd_buffers_len[index] = 0;
-            goto end;
-        }
-        headers_buffer = new_headers_buffer;
-
         memcpy(headers_buffer + headers_buffer_len, bstr_ptr(h->name), size1);
         headers_buffer_len += size1;
         headers_buffer[headers_buffer_len] = ':';
@@ -204,14 +121,97 @@ static uint8_t *DetectEngineHHDGetBufferForTX(htp_tx_t *tx, uint64_t tx_id,
         /* \n */
         headers_buffer[headers_buffer_len - 1] = '\n';
     }
+    return (uint32_t)headers_buffer_len;
+}
 
-    /* store the buffers.  We will need it for further inspection */
-    det_ctx->hhd_buffers[index] = headers_buffer;
-    det_ctx->hhd_buffers_len[index] = headers_buffer_len;
+/**
+ *  \brief get the normalized header buffer of a tx
+ *
+ *  The buffer is built once per tx and direction and kept in the tx user
+ *  data, so that it's shared by the mpm and the inspection on all later
+ *  packets. It's only rebuilt if the tx progress changed, as libhtp can
+ *  still add headers (trailers) after the header stage.
+ *
+ *  The cached buffer counts against the http memcap. If it can't be
+ *  allocated the buffer is built in the thread's hhd_buffer instead, for
+ *  this call only.
+ */
+static uint8_t *DetectEngineHHDGetBufferForTX(DetectEngineThreadCtx *det_ctx,
+                                              htp_tx_t *tx, uint8_t flags,
+                                              uint32_t *buffer_len)
+{
+    *buffer_len = 0;
 
-    *buffer_len = (uint32_t)headers_buffer_len;
- end:
-    return headers_buffer;
+    htp_table_t *headers;
+    int progress = AppLayerParserGetStateProgress(IPPROTO_TCP, ALPROTO_HTTP, tx, flags);
+    if (flags & STREAM_TOSERVER) {
+        if (progress <= HTP_REQUEST_HEADERS)
+            return NULL;
+        headers = tx->request_headers;
+    } else {
+        if (progress <= HTP_RESPONSE_HEADERS)
+            return NULL;
+        headers = tx->response_headers;
+    }
+    if (headers == NULL)
+        return NULL;
+
+    HtpDetectBuffer *hb = NULL;
+    HtpTxUserData *tx_ud = htp_tx_get_user_data(tx);
+    if (tx_ud == NULL) {
+        tx_ud = HTPMalloc(sizeof(*tx_ud));
+        if (likely(tx_ud != NULL)) {
+            memset(tx_ud, 0, sizeof(*tx_ud));
+            htp_tx_set_user_data(tx, tx_ud);
+        }
+    }
+    if (tx_ud != NULL) {
+        hb = (flags & STREAM_TOSERVER) ?
+            &tx_ud->request_headers_buf : &tx_ud->response_headers_buf;
+        if (hb->progress == progress) {
+            *buffer_len = hb->len;
+            return hb->buf;
+        }
+        if (hb->buf != NULL) {
+            HTPFree(hb->buf, hb->len);
+            hb->buf = NULL;
+            hb->len = 0;
+        }
+        hb->progress = 0;
+    }
+
+    /* size the buffer first, so that it's allocated only once */
+    size_t size = HHDBufferSize(headers, flags);
+    if (size == 0 || size > UINT32_MAX) {
+        if (hb != NULL)
+            hb->progress = progress;
+        return NULL;
+    }
+
+    if (hb != NULL) {
+        uint8_t *headers_buffer = HTPMalloc(size);
+        if (likely(headers_buffer != NULL)) {
+            /* store the buffer, it's used for all further inspection
+             * of the tx */
+            hb->buf = headers_buffer;
+            hb->len = HHDBufferFill(headers, flags, headers_buffer);
+            hb->progress = progress;
+
+            *buffer_len = hb->len;
+            return headers_buffer;
+        }
+    }
+
+    /* no room in the http memcap, don't go blind on the headers */
+    if (det_ctx->hhd_buffer_size < size) {
+        void *ptmp = SCRealloc(det_ctx->hhd_buffer, size);
+        if (unlikely(ptmp == NULL))
+            return NULL;
+        det_ctx->hhd_buffer = ptmp;
+        det_ctx->hhd_buffer_size = (uint32_t)size;
+    }
+    *buffer_len = HHDBufferFill(headers, flags, det_ctx->hhd_buffer);
+    return det_ctx->hhd_buffer;
 }
 
 /**
@@ -258,11 +258,7 @@ int DetectEngineRunHttpHeaderMpm(DetectEngineThreadCtx *det_ctx, Flow *f,
 {
     uint32_t cnt = 0;
     uint32_t buffer_len = 0;
-    uint8_t *buffer = DetectEngineHHDGetBufferForTX(tx, idx,
-                                                    NULL, det_ctx,
-                                                    f, htp_state,
-                                                    flags,
-                                                    &buffer_len);
+    uint8_t *buffer = DetectEngineHHDGetBufferForTX(det_ctx, tx, flags, &buffer_len);
     if (buffer_len == 0)
         goto end;
 
@@ -272,6 +268,13 @@ int DetectEngineRunHttpHeaderMpm(DetectEngineThreadCtx *det_ctx, Flow *f,
     return cnt;
 }
 
+/** \brief tx prefilter callback running the http_header mpm */
+void PrefilterTxHttpHeader(DetectEngineThreadCtx *det_ctx, Flow *f, void *alstate,
+        void *tx, const uint64_t idx, const uint8_t flags)
+{
+    DetectEngineRunHttpHeaderMpm(det_ctx, f, (HtpState *)alstate, flags, tx, idx);
+}
+
 int DetectEngineInspectHttpHeader(ThreadVars *tv,
                                   DetectEngineCtx *de_ctx,
                                   DetectEngineThreadCtx *det_ctx,
@@ -279,13 +282,8 @@ int DetectEngineInspectHttpHeader(ThreadVars *tv,
                                   void *alstate,
                                   void *tx, uint64_t tx_id)
 {
-    HtpState *htp_state = (HtpState *)alstate;
     uint32_t buffer_len = 0;
-    uint8_t *buffer = DetectEngineHHDGetBufferForTX(tx, tx_id,
-                                                    de_ctx, det_ctx,
-                                                    f, htp_state,
-                                                    flags,
-                                                    &buffer_len);
+    uint8_t *buffer = DetectEngineHHDGetBufferForTX(det_ctx, tx, flags, &buffer_len);
     if (buffer_len == 0)
         goto end;
 
@@ -312,20 +310,6 @@ int DetectEngineInspectHttpHeader(ThreadVars *tv,
     return DETECT_ENGINE_INSPECT_SIG_NO_MATCH;
 }
 
-void DetectEngineCleanHHDBuffers(DetectEngineThreadCtx *det_ctx)
-{
-    if (det_ctx->hhd_buffers_list_len != 0) {
-        int i;
-        for (i = 0; i < det_ctx->hhd_buffers_list_len; i++) {
-            det_ctx->hhd_buffers_len[i] = 0;
-        }
-        det_ctx->hhd_buffers_list_len = 0;
-    }
-    det_ctx->hhd_start_tx_id = 0;
-
-    return;
-}
-
 /***********************************Unittests**********************************/
 
 #ifdef UNITTESTS
@@ -3859,6 +3843,131 @@ end:
     return result;
 }
 
+/** http memcap, set low to make the tx buffer allocation fail */
+extern uint64_t htp_config_memcap;
+
+/**
+ *\test Test that the header buffer is cached in the tx, rebuilt when the
+ *      tx progress changes and built in the thread's buffer if the http
+ *      memcap doesn't leave room to cache it.
+ */
+static int DetectEngineHttpHeaderTest34(void)
+{
+    TcpSession ssn;
+    DetectEngineThreadCtx det_ctx;
+    HtpState *http_state = NULL;
+    Flow f;
+    uint8_t http1_buf[] =
+        "GET /index.html HTTP/1.0\r\n"
+        "host: boom\r\n"
+        "Transfer-Encoding: chunked\r\n"
+        "\r\n"
+        "13\r\n"
+        "This is dummy body1\r\n"
+        "0\r\n";
+    uint8_t http2_buf[] =
+        "Dummy-Header: kaboom\r\n"
+        "\r\n";
+    uint32_t http1_len = sizeof(http1_buf) - 1;
+    uint32_t http2_len = sizeof(http2_buf) - 1;
+    const char trailer[] = "Dummy-Header: kaboom\r\n";
+    uint32_t trailer_len = sizeof(trailer) - 1;
+    uint64_t memcap = htp_config_memcap;
+    int result = 0;
+    AppLayerParserThreadCtx *alp_tctx = AppLayerParserThreadCtxAlloc();
+
+    memset(&det_ctx, 0, sizeof(det_ctx));
+    memset(&f, 0, sizeof(f));
+    memset(&ssn, 0, sizeof(ssn));
+
+    FLOW_INITIALIZE(&f);
+    f.protoctx = (void *)&ssn;
+    f.proto = IPPROTO_TCP;
+    f.flags |= FLOW_IPV4;
+    f.alproto = ALPROTO_HTTP;
+
+    StreamTcpInitConfig(TRUE);
+
+    SCMutexLock(&f.m);
+    int r = AppLayerParserParse(alp_tctx, &f, ALPROTO_HTTP, STREAM_TOSERVER, http1_buf, http1_len);
+    SCMutexUnlock(&f.m);
+    if (r != 0) {
+        printf("toserver chunk 1 returned %" PRId32 ", expected 0: ", r);
+        goto end;
+    }
+
+    http_state = f.alstate;
+    if (http_state == NULL) {
+        printf("no http state: ");
+        goto end;
+    }
+    htp_tx_t *tx = AppLayerParserGetTx(IPPROTO_TCP, ALPROTO_HTTP, http_state, 0);
+    if (tx == NULL) {
+        printf("no tx: ");
+        goto end;
+    }
+
+    uint32_t len1 = 0;
+    uint8_t *buf1 = DetectEngineHHDGetBufferForTX(&det_ctx, tx, STREAM_TOSERVER, &len1);
+    HtpTxUserData *tx_ud = htp_tx_get_user_data(tx);
+    if (buf1 == NULL || len1 == 0 || tx_ud == NULL ||
+            tx_ud->request_headers_buf.buf != buf1) {
+        printf("buffer not cached in the tx: ");
+        goto end;
+    }
+
+    /* same progress: the cached buffer is returned as is */
+    buf1[0] = 'X';
+    uint32_t len2 = 0;
+    uint8_t *buf2 = DetectEngineHHDGetBufferForTX(&det_ctx, tx, STREAM_TOSERVER, &len2);
+    if (buf2 != buf1 || len2 != len1 || buf2[0] != 'X') {
+        printf("buffer rebuilt without a progress change: ");
+        goto end;
+    }
+
+    /* the trailer moves the tx on, the buffer is rebuilt with it */
+    SCMutexLock(&f.m);
+    r = AppLayerParserParse(alp_tctx, &f, ALPROTO_HTTP, STREAM_TOSERVER, http2_buf, http2_len);
+    SCMutexUnlock(&f.m);
+    if (r != 0) {
+        printf("toserver chunk 2 returned %" PRId32 ", expected 0: ", r);
+        goto end;
+    }
+
+    buf2 = DetectEngineHHDGetBufferForTX(&det_ctx, tx, STREAM_TOSERVER, &len2);
+    if (buf2 == NULL || buf2 != tx_ud->request_headers_buf.buf ||
+            buf2[0] == 'X' || len2 != len1 + trailer_len ||
+            memcmp(buf2 + len1, trailer, trailer_len) != 0) {
+        printf("buffer not rebuilt after the progress change: ");
+        goto end;
+    }
+
+    /* no room in the memcap: the buffer is built, but not cached */
+    tx_ud->request_headers_buf.progress = 0;
+    htp_config_memcap = 1;
+    uint32_t len3 = 0;
+    uint8_t *buf3 = DetectEngineHHDGetBufferForTX(&det_ctx, tx, STREAM_TOSERVER, &len3);
+    htp_config_memcap = memcap;
+    if (buf3 == NULL || buf3 != det_ctx.hhd_buffer ||
+            tx_ud->request_headers_buf.buf != NULL || len3 != len2 ||
+            memcmp(buf3 + len1, trailer, trailer_len) != 0) {
+        printf("no uncached buffer when out of memcap: ");
+        goto end;
+    }
+
+    result = 1;
+end:
+    htp_config_memcap = memcap;
+    if (det_ctx.hhd_buffer != NULL)
+        SCFree(det_ctx.hhd_buffer);
+    if (alp_tctx != NULL)
+        AppLayerParserThreadCtxFree(alp_tctx);
+
+    StreamTcpFreeConfig(TRUE);
+    FLOW_DESTROY(&f);
+    return result;
+}
+
 #endif /* UNITTESTS */
 
 void DetectEngineHttpHeaderRegisterTests(void)
@@ -3935,6 +4044,8 @@ void DetectEngineHttpHeaderRegisterTests(void)
                    DetectEngineHttpHeaderTest32);
     UtRegisterTest("DetectEngineHttpHeaderTest33",
                    DetectEngineHttpHeaderTest33);
+    UtRegisterTest("DetectEngineHttpHeaderTest34",
+                   DetectEngineHttpHeaderTest34);
 
 #endif /* UNITTESTS */
 
@@ -34,8 +34,8 @@ int DetectEngineInspectHttpHeader(ThreadVars *tv,
 int DetectEngineRunHttpHeaderMpm(DetectEngineThreadCtx *det_ctx, Flow *f,
                                  HtpState *htp_state, uint8_t flags,
                                  void *tx, uint64_t idx);
-void DetectEngineCleanHHDBuffers(DetectEngineThreadCtx *det_ctx);
-
+void PrefilterTxHttpHeader(DetectEngineThreadCtx *det_ctx, Flow *f, void *alstate,
+        void *tx, const uint64_t idx, const uint8_t flags);
 void DetectEngineHttpHeaderRegisterTests(void);
 
 #endif /* __DETECT_ENGINE_HHD_H__ */
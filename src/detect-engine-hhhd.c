@@ -109,6 +109,13 @@ int DetectEngineRunHttpHHMpm(DetectEngineThreadCtx *det_ctx, Flow *f,
     return cnt;
 }
 
+/** \brief tx prefilter callback running the http_host mpm */
+void PrefilterTxHttpHost(DetectEngineThreadCtx *det_ctx, Flow *f, void *alstate,
+        void *tx, const uint64_t idx, const uint8_t flags)
+{
+    DetectEngineRunHttpHHMpm(det_ctx, f, (HtpState *)alstate, flags, tx, idx);
+}
+
 /**
  * \brief Do the http_header content inspection for a signature.
  *
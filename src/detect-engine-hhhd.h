@@ -34,6 +34,8 @@ int DetectEngineInspectHttpHH(ThreadVars *tv,
 int DetectEngineRunHttpHHMpm(DetectEngineThreadCtx *det_ctx, Flow *f,
                              HtpState *htp_state, uint8_t flags,
                              void *tx, uint64_t idx);
+void PrefilterTxHttpHost(DetectEngineThreadCtx *det_ctx, Flow *f, void *alstate,
+        void *tx, const uint64_t idx, const uint8_t flags);
 void DetectEngineHttpHHRegisterTests(void);
 
 #endif /* __DETECT_ENGINE_HHHD_H__ */
@@ -104,6 +104,13 @@ int DetectEngineRunHttpMethodMpm(DetectEngineThreadCtx *det_ctx, Flow *f,
     return cnt;
 }
 
+/** \brief tx prefilter callback running the http_method mpm */
+void PrefilterTxHttpMethod(DetectEngineThreadCtx *det_ctx, Flow *f, void *alstate,
+        void *tx, const uint64_t idx, const uint8_t flags)
+{
+    DetectEngineRunHttpMethodMpm(det_ctx, f, (HtpState *)alstate, flags, tx, idx);
+}
+
 /**
  * \brief Do the http_method content inspection for a signature.
  *
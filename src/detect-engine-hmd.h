@@ -34,6 +34,8 @@ int DetectEngineInspectHttpMethod(ThreadVars *tv,
 int DetectEngineRunHttpMethodMpm(DetectEngineThreadCtx *det_ctx, Flow *f,
                                  HtpState *htp_state, uint8_t flags,
                                  void *tx, uint64_t idx);
+void PrefilterTxHttpMethod(DetectEngineThreadCtx *det_ctx, Flow *f, void *alstate,
+        void *tx, const uint64_t idx, const uint8_t flags);
 void DetectEngineHttpMethodRegisterTests(void);
 
 #endif /* __DETECT_ENGINE_HMD_H__ */
@@ -130,6 +130,13 @@ int DetectEngineRunHttpRawHeaderMpm(DetectEngineThreadCtx *det_ctx, Flow *f,
     SCReturnInt(cnt);
 }
 
+/** \brief tx prefilter callback running the http_raw_header mpm */
+void PrefilterTxHttpRawHeader(DetectEngineThreadCtx *det_ctx, Flow *f, void *alstate,
+        void *tx, const uint64_t idx, const uint8_t flags)
+{
+    DetectEngineRunHttpRawHeaderMpm(det_ctx, f, (HtpState *)alstate, flags, tx, idx);
+}
+
 /**
  * \brief Do the http_raw_header content inspection for a signature.
  *
@@ -126,6 +126,13 @@ int DetectEngineRunHttpHRHMpm(DetectEngineThreadCtx *det_ctx, Flow *f,
     return cnt;
 }
 
+/** \brief tx prefilter callback running the http_raw_host mpm */
+void PrefilterTxHttpRawHost(DetectEngineThreadCtx *det_ctx, Flow *f, void *alstate,
+        void *tx, const uint64_t idx, const uint8_t flags)
+{
+    DetectEngineRunHttpHRHMpm(det_ctx, f, (HtpState *)alstate, flags, tx, idx);
+}
+
 /**
  * \brief Do the http_header content inspection for a signature.
  *
@@ -34,6 +34,8 @@ int DetectEngineInspectHttpHRH(ThreadVars *tv,
 int DetectEngineRunHttpHRHMpm(DetectEngineThreadCtx *det_ctx, Flow *f,
                               HtpState *htp_state, uint8_t flags,
                               void *tx, uint64_t idx);
+void PrefilterTxHttpRawHost(DetectEngineThreadCtx *det_ctx, Flow *f, void *alstate,
+        void *tx, const uint64_t idx, const uint8_t flags);
 void DetectEngineHttpHRHRegisterTests(void);
 
 #endif /* __DETECT_ENGINE_HRHHD_H__ */
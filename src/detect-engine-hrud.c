@@ -110,6 +110,13 @@ end:
     SCReturnInt(cnt);
 }
 
+/** \brief tx prefilter callback running the http_raw_uri mpm */
+void PrefilterTxHttpRawUri(DetectEngineThreadCtx *det_ctx, Flow *f, void *alstate,
+        void *tx, const uint64_t idx, const uint8_t flags)
+{
+    DetectEngineRunHttpRawUriMpm(det_ctx, f, (HtpState *)alstate, flags, tx, idx);
+}
+
 /**
  * \brief Do the http_raw_uri content inspection for a signature.
  *
@@ -269,6 +269,14 @@ int DetectEngineRunHttpServerBodyMpm(DetectEngineCtx *de_ctx,
     return cnt;
 }
 
+/** \brief tx prefilter callback running the http server body file_data mpm */
+void PrefilterTxHttpServerBody(DetectEngineThreadCtx *det_ctx, Flow *f, void *alstate,
+        void *tx, const uint64_t idx, const uint8_t flags)
+{
+    DetectEngineRunHttpServerBodyMpm(det_ctx->de_ctx, det_ctx, f,
+            (HtpState *)alstate, flags, tx, idx);
+}
+
 int DetectEngineInspectHttpServerBody(ThreadVars *tv,
                                       DetectEngineCtx *de_ctx,
                                       DetectEngineThreadCtx *det_ctx,
@@ -107,6 +107,13 @@ end:
     SCReturnInt(cnt);
 }
 
+/** \brief tx prefilter callback running the http_stat_msg mpm */
+void PrefilterTxHttpStatMsg(DetectEngineThreadCtx *det_ctx, Flow *f, void *alstate,
+        void *tx, const uint64_t idx, const uint8_t flags)
+{
+    DetectEngineRunHttpStatMsgMpm(det_ctx, f, (HtpState *)alstate, flags, tx, idx);
+}
+
 /**
  * \brief Do the http_stat_msg content inspection for a signature.
  *
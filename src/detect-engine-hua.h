@@ -34,6 +34,8 @@ int DetectEngineInspectHttpUA(ThreadVars *tv,
 int DetectEngineRunHttpUAMpm(DetectEngineThreadCtx *det_ctx, Flow *f,
                              HtpState *htp_state, uint8_t flags,
                              void *tx, uint64_t idx);
+void PrefilterTxHttpUA(DetectEngineThreadCtx *det_ctx, Flow *f, void *alstate,
+        void *tx, const uint64_t idx, const uint8_t flags);
 void DetectEngineHttpUARegisterTests(void);
 
 #endif /* __DETECT_ENGINE_HUA_H__ */
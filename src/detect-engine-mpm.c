@@ -48,6 +48,22 @@
 
 #include "detect-content.h"
 #include "detect-uricontent.h"
+#include "detect-engine-prefilter.h"
+#include "detect-engine-hrud.h"
+#include "detect-engine-hhd.h"
+#include "detect-engine-hrhd.h"
+#include "detect-engine-hmd.h"
+#include "detect-engine-hcd.h"
+#include "detect-engine-hua.h"
+#include "detect-engine-hhhd.h"
+#include "detect-engine-hrhhd.h"
+#include "detect-engine-hcbd.h"
+#include "detect-engine-hsbd.h"
+#include "detect-engine-hsmd.h"
+#include "detect-engine-hscd.h"
+#include "detect-engine-filedata-smtp.h"
+#include "detect-dns-query.h"
+#include "detect-tls-sni.h"
 
 #include "stream.h"
 
@@ -55,6 +71,8 @@
 #include "util-debug.h"
 #include "util-print.h"
 #include "util-validate.h"
+#include "util-atomic.h"
+#include "util-cpu.h"
 
 const char *builtin_mpms[] = {
     "toserver TCP packet",
@@ -74,41 +92,66 @@ typedef struct AppLayerMpms_ {
     int sm_list;
     uint32_t flags;             /**< flags set to SGH when this mpm is present */
     int id;                     /**< index into this array and result arrays */
+
+    /* tx prefilter engine registered to SGH when this mpm is present */
+    AppProto alproto;
+    int tx_min_progress;        /**< tx progress for the buffer to be available */
+    int profile_id;             /**< PROF_DETECT_MPM_* */
+    PrefilterTxFunc PrefilterTx;
 } AppLayerMpms;
 
 AppLayerMpms app_mpms[] = {
-    { "http_uri", 0, SIG_FLAG_TOSERVER, DETECT_SM_LIST_UMATCH, SIG_GROUP_HEAD_MPM_URI, 0 },
-    { "http_raw_uri", 0, SIG_FLAG_TOSERVER, DETECT_SM_LIST_HRUDMATCH, SIG_GROUP_HEAD_MPM_HRUD, 1 },
+    { "http_uri", 0, SIG_FLAG_TOSERVER, DETECT_SM_LIST_UMATCH, SIG_GROUP_HEAD_MPM_URI, 0,
+        ALPROTO_HTTP, HTP_REQUEST_LINE + 1, PROF_DETECT_MPM_URI, PrefilterTxUri },
+    { "http_raw_uri", 0, SIG_FLAG_TOSERVER, DETECT_SM_LIST_HRUDMATCH, SIG_GROUP_HEAD_MPM_HRUD, 1,
+        ALPROTO_HTTP, HTP_REQUEST_LINE + 1, PROF_DETECT_MPM_HRUD, PrefilterTxHttpRawUri },
 
-    { "http_header", 0, SIG_FLAG_TOSERVER, DETECT_SM_LIST_HHDMATCH, SIG_GROUP_HEAD_MPM_HHD, 2},
-    { "http_header", 0, SIG_FLAG_TOCLIENT, DETECT_SM_LIST_HHDMATCH, SIG_GROUP_HEAD_MPM_HHD, 3},
+    { "http_header", 0, SIG_FLAG_TOSERVER, DETECT_SM_LIST_HHDMATCH, SIG_GROUP_HEAD_MPM_HHD, 2,
+        ALPROTO_HTTP, HTP_REQUEST_HEADERS, PROF_DETECT_MPM_HHD, PrefilterTxHttpHeader },
+    { "http_header", 0, SIG_FLAG_TOCLIENT, DETECT_SM_LIST_HHDMATCH, SIG_GROUP_HEAD_MPM_HHD, 3,
+        ALPROTO_HTTP, HTP_RESPONSE_HEADERS, PROF_DETECT_MPM_HHD, PrefilterTxHttpHeader },
 
-    { "http_user_agent", 0, SIG_FLAG_TOSERVER, DETECT_SM_LIST_HUADMATCH, SIG_GROUP_HEAD_MPM_HUAD, 4},
+    { "http_user_agent", 0, SIG_FLAG_TOSERVER, DETECT_SM_LIST_HUADMATCH, SIG_GROUP_HEAD_MPM_HUAD, 4,
+        ALPROTO_HTTP, HTP_REQUEST_HEADERS, PROF_DETECT_MPM_HUAD, PrefilterTxHttpUA },
 
-    { "http_raw_header", 0, SIG_FLAG_TOSERVER, DETECT_SM_LIST_HRHDMATCH, SIG_GROUP_HEAD_MPM_HRHD, 5},
-    { "http_raw_header", 0, SIG_FLAG_TOCLIENT, DETECT_SM_LIST_HRHDMATCH, SIG_GROUP_HEAD_MPM_HRHD, 6},
+    { "http_raw_header", 0, SIG_FLAG_TOSERVER, DETECT_SM_LIST_HRHDMATCH, SIG_GROUP_HEAD_MPM_HRHD, 5,
+        ALPROTO_HTTP, HTP_REQUEST_HEADERS + 1, PROF_DETECT_MPM_HRHD, PrefilterTxHttpRawHeader },
+    { "http_raw_header", 0, SIG_FLAG_TOCLIENT, DETECT_SM_LIST_HRHDMATCH, SIG_GROUP_HEAD_MPM_HRHD, 6,
+        ALPROTO_HTTP, HTP_RESPONSE_HEADERS + 1, PROF_DETECT_MPM_HRHD, PrefilterTxHttpRawHeader },
 
-    { "http_method", 0, SIG_FLAG_TOSERVER, DETECT_SM_LIST_HMDMATCH, SIG_GROUP_HEAD_MPM_HMD, 7},
+    { "http_method", 0, SIG_FLAG_TOSERVER, DETECT_SM_LIST_HMDMATCH, SIG_GROUP_HEAD_MPM_HMD, 7,
+        ALPROTO_HTTP, HTP_REQUEST_LINE + 1, PROF_DETECT_MPM_HMD, PrefilterTxHttpMethod },
 
-    { "file_data", 0, SIG_FLAG_TOSERVER, DETECT_SM_LIST_FILEDATA, SIG_GROUP_HEAD_MPM_FD_SMTP, 8}, /* smtp */
-    { "file_data", 0, SIG_FLAG_TOCLIENT, DETECT_SM_LIST_FILEDATA, SIG_GROUP_HEAD_MPM_HSBD, 9}, /* http server body */
+    { "file_data", 0, SIG_FLAG_TOSERVER, DETECT_SM_LIST_FILEDATA, SIG_GROUP_HEAD_MPM_FD_SMTP, 8, /* smtp */
+        ALPROTO_SMTP, 0, PROF_DETECT_MPM_FD_SMTP, PrefilterTxSmtpFiledata },
+    { "file_data", 0, SIG_FLAG_TOCLIENT, DETECT_SM_LIST_FILEDATA, SIG_GROUP_HEAD_MPM_HSBD, 9, /* http server body */
+        ALPROTO_HTTP, HTP_RESPONSE_BODY, PROF_DETECT_MPM_HSBD, PrefilterTxHttpServerBody },
 
-    { "http_stat_msg", 0, SIG_FLAG_TOCLIENT, DETECT_SM_LIST_HSMDMATCH, SIG_GROUP_HEAD_MPM_HSMD, 10},
-    { "http_stat_code", 0, SIG_FLAG_TOCLIENT, DETECT_SM_LIST_HSCDMATCH, SIG_GROUP_HEAD_MPM_HSCD, 11},
+    { "http_stat_msg", 0, SIG_FLAG_TOCLIENT, DETECT_SM_LIST_HSMDMATCH, SIG_GROUP_HEAD_MPM_HSMD, 10,
+        ALPROTO_HTTP, HTP_RESPONSE_LINE + 1, PROF_DETECT_MPM_HSMD, PrefilterTxHttpStatMsg },
+    { "http_stat_code", 0, SIG_FLAG_TOCLIENT, DETECT_SM_LIST_HSCDMATCH, SIG_GROUP_HEAD_MPM_HSCD, 11,
+        ALPROTO_HTTP, HTP_RESPONSE_LINE + 1, PROF_DETECT_MPM_HSCD, PrefilterTxHttpStatCode },
 
-    { "http_client_body", 0, SIG_FLAG_TOSERVER, DETECT_SM_LIST_HCBDMATCH, SIG_GROUP_HEAD_MPM_HCBD, 12},
+    { "http_client_body", 0, SIG_FLAG_TOSERVER, DETECT_SM_LIST_HCBDMATCH, SIG_GROUP_HEAD_MPM_HCBD, 12,
+        ALPROTO_HTTP, HTP_REQUEST_BODY, PROF_DETECT_MPM_HCBD, PrefilterTxHttpClientBody },
 
-    { "http_host", 0, SIG_FLAG_TOSERVER, DETECT_SM_LIST_HHHDMATCH, SIG_GROUP_HEAD_MPM_HHHD, 13},
-    { "http_raw_host", 0, SIG_FLAG_TOSERVER, DETECT_SM_LIST_HRHHDMATCH, SIG_GROUP_HEAD_MPM_HRHHD, 14},
+    { "http_host", 0, SIG_FLAG_TOSERVER, DETECT_SM_LIST_HHHDMATCH, SIG_GROUP_HEAD_MPM_HHHD, 13,
+        ALPROTO_HTTP, HTP_REQUEST_HEADERS, PROF_DETECT_MPM_HHHD, PrefilterTxHttpHost },
+    { "http_raw_host", 0, SIG_FLAG_TOSERVER, DETECT_SM_LIST_HRHHDMATCH, SIG_GROUP_HEAD_MPM_HRHHD, 14,
+        ALPROTO_HTTP, HTP_REQUEST_HEADERS, PROF_DETECT_MPM_HRHHD, PrefilterTxHttpRawHost },
 
-    { "http_cookie", 0, SIG_FLAG_TOSERVER, DETECT_SM_LIST_HCDMATCH, SIG_GROUP_HEAD_MPM_HCD, 15},
-    { "http_cookie", 0, SIG_FLAG_TOCLIENT, DETECT_SM_LIST_HCDMATCH, SIG_GROUP_HEAD_MPM_HCD, 16},
+    { "http_cookie", 0, SIG_FLAG_TOSERVER, DETECT_SM_LIST_HCDMATCH, SIG_GROUP_HEAD_MPM_HCD, 15,
+        ALPROTO_HTTP, HTP_REQUEST_HEADERS, PROF_DETECT_MPM_HCD, PrefilterTxHttpCookie },
+    { "http_cookie", 0, SIG_FLAG_TOCLIENT, DETECT_SM_LIST_HCDMATCH, SIG_GROUP_HEAD_MPM_HCD, 16,
+        ALPROTO_HTTP, HTP_RESPONSE_HEADERS, PROF_DETECT_MPM_HCD, PrefilterTxHttpCookie },
 
-    { "dns_query", 0, SIG_FLAG_TOSERVER, DETECT_SM_LIST_DNSQUERYNAME_MATCH, SIG_GROUP_HEAD_MPM_DNSQUERY, 17},
+    { "dns_query", 0, SIG_FLAG_TOSERVER, DETECT_SM_LIST_DNSQUERYNAME_MATCH, SIG_GROUP_HEAD_MPM_DNSQUERY, 17,
+        ALPROTO_DNS, 0, PROF_DETECT_MPM_DNSQUERY, PrefilterTxDnsQuery },
 
-    { "tls_sni", 0, SIG_FLAG_TOSERVER, DETECT_SM_LIST_TLSSNI_MATCH, SIG_GROUP_HEAD_MPM_TLSSNI, 18},
+    { "tls_sni", 0, SIG_FLAG_TOSERVER, DETECT_SM_LIST_TLSSNI_MATCH, SIG_GROUP_HEAD_MPM_TLSSNI, 18,
+        ALPROTO_TLS, 0, PROF_DETECT_MPM_TLSSNI, PrefilterTxTlsSni },
 
-    { NULL, 0, 0, 0, 0, 0, }
+    { NULL, 0, 0, 0, 0, 0, 0, 0, 0, NULL, }
 };
 
 void DetectMpmInitializeAppMpms(DetectEngineCtx *de_ctx)
@@ -941,16 +984,132 @@ void MpmStoreSetup(const DetectEngineCtx *de_ctx, MpmStore *ms)
         }
     }
 
+    /* unique contexts are prepared later by MpmStorePrepareAll */
     if (ms->mpm_ctx->pattern_cnt == 0) {
         MpmFactoryReClaimMpmCtx(de_ctx, ms->mpm_ctx);
         ms->mpm_ctx = NULL;
-    } else {
-        if (ms->sgh_mpm_context == MPM_CTX_FACTORY_UNIQUE_CONTEXT) {
-            if (mpm_table[ms->mpm_ctx->mpm_type].Prepare != NULL) {
-                mpm_table[ms->mpm_ctx->mpm_type].Prepare(ms->mpm_ctx);
+    }
+}
+
+typedef struct MpmStorePrepareQueue_ {
+    MpmCtx **ctxs;
+    uint32_t cnt;
+    SC_ATOMIC_DECLARE(uint32_t, next);
+} MpmStorePrepareQueue;
+
+static void MpmStorePrepareWork(MpmStorePrepareQueue *q)
+{
+    while (1) {
+        uint32_t idx = SC_ATOMIC_ADD(q->next, 1) - 1;
+        if (idx >= q->cnt)
+            break;
+
+        MpmCtx *mpm_ctx = q->ctxs[idx];
+        mpm_table[mpm_ctx->mpm_type].Prepare(mpm_ctx);
+    }
+}
+
+static void *MpmStorePrepareThread(void *arg)
+{
+    MpmStorePrepareWork((MpmStorePrepareQueue *)arg);
+    return NULL;
+}
+
+static int MpmStorePrepareCompare(const void *a, const void *b)
+{
+    const MpmCtx *ma = *(const MpmCtx **)a;
+    const MpmCtx *mb = *(const MpmCtx **)b;
+
+    /* largest first, so that the threads finish at about the same time */
+    if (ma->pattern_cnt > mb->pattern_cnt)
+        return -1;
+    if (ma->pattern_cnt < mb->pattern_cnt)
+        return 1;
+    return 0;
+}
+
+/**
+ *  \brief Prepare the mpm ctx of all unique MpmStores.
+ *
+ *  This is where most of the build time goes, so the work is spread over
+ *  de_ctx->prepare_threads threads, the calling thread included. The mpm
+ *  ctxs are independent; shared state in the matchers (e.g. the Hyperscan
+ *  database cache) is protected by their own locks.
+ */
+void MpmStorePrepareAll(DetectEngineCtx *de_ctx)
+{
+    MpmStorePrepareQueue q;
+    HashListTableBucket *htb;
+    uint32_t cnt = 0;
+
+    memset(&q, 0, sizeof(q));
+    SC_ATOMIC_INIT(q.next);
+
+    for (htb = HashListTableGetListHead(de_ctx->mpm_hash_table);
+            htb != NULL; htb = HashListTableGetListNext(htb))
+    {
+        const MpmStore *ms = (MpmStore *)HashListTableGetListData(htb);
+        if (ms->mpm_ctx != NULL &&
+            ms->sgh_mpm_context == MPM_CTX_FACTORY_UNIQUE_CONTEXT &&
+            mpm_table[ms->mpm_ctx->mpm_type].Prepare != NULL)
+            cnt++;
+    }
+    if (cnt == 0)
+        goto end;
+
+    q.ctxs = SCMalloc(cnt * sizeof(MpmCtx *));
+    if (q.ctxs == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "failed to alloc mpm prepare queue");
+        exit(EXIT_FAILURE);
+    }
+    for (htb = HashListTableGetListHead(de_ctx->mpm_hash_table);
+            htb != NULL; htb = HashListTableGetListNext(htb))
+    {
+        const MpmStore *ms = (MpmStore *)HashListTableGetListData(htb);
+        if (ms->mpm_ctx != NULL &&
+            ms->sgh_mpm_context == MPM_CTX_FACTORY_UNIQUE_CONTEXT &&
+            mpm_table[ms->mpm_ctx->mpm_type].Prepare != NULL)
+            q.ctxs[q.cnt++] = ms->mpm_ctx;
+    }
+    qsort(q.ctxs, q.cnt, sizeof(MpmCtx *), MpmStorePrepareCompare);
+
+    uint32_t nthreads = de_ctx->prepare_threads;
+#ifdef __SC_CUDA_SUPPORT__
+    /* the cuda contexts are bound to the calling thread */
+    if (de_ctx->mpm_matcher == MPM_AC_CUDA)
+        nthreads = 1;
+#endif
+    if (nthreads > q.cnt)
+        nthreads = q.cnt;
+
+    pthread_t *threads = NULL;
+    uint32_t started = 0;
+    if (nthreads > 1) {
+        threads = SCMalloc((nthreads - 1) * sizeof(pthread_t));
+        if (threads != NULL) {
+            for ( ; started < nthreads - 1; started++) {
+                if (pthread_create(&threads[started], NULL,
+                            MpmStorePrepareThread, &q) != 0) {
+                    SCLogWarning(SC_ERR_THREAD_CREATE, "failed to create mpm "
+                            "prepare thread: %s", strerror(errno));
+                    break;
+                }
             }
         }
     }
+    SCLogInfo("preparing %u mpm contexts using %u threads", q.cnt,
+            started + 1);
+
+    MpmStorePrepareWork(&q);
+
+    uint32_t t;
+    for (t = 0; t < started; t++)
+        pthread_join(threads[t], NULL);
+    if (threads != NULL)
+        SCFree(threads);
+    SCFree(q.ctxs);
+end:
+    SC_ATOMIC_DESTROY(q.next);
 }
 
 
@@ -1297,8 +1456,18 @@ int PatternMatchPrepareGroup(DetectEngineCtx *de_ctx, SigGroupHead *sh)
         mpm_store = MpmStorePrepareBuffer2(de_ctx, sh, a);
         if (mpm_store != NULL) {
             sh->init->app_mpms[a->id] = mpm_store->mpm_ctx;
-            if (sh->init->app_mpms[a->id] != NULL)
+            if (sh->init->app_mpms[a->id] != NULL) {
                 sh->flags |= a->flags;
+
+                uint8_t dir = (a->direction == SIG_FLAG_TOSERVER) ?
+                    STREAM_TOSERVER : STREAM_TOCLIENT;
+                if (PrefilterAppendTxEngine(sh, a->PrefilterTx, a->alproto,
+                            dir, a->tx_min_progress, a->profile_id) != 0) {
+                    SCLogError(SC_ERR_MEM_ALLOC, "failed to register %s "
+                            "prefilter engine", a->name);
+                    return -1;
+                }
+            }
         }
         a++;
     }
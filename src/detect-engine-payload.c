@@ -84,10 +84,14 @@ uint32_t StreamPatternSearch(DetectEngineThreadCtx *det_ctx, const Packet *p,
 
     uint32_t r;
     for ( ; smsg != NULL; smsg = smsg->next) {
-        if (smsg->data_len >= det_ctx->sgh->mpm_stream_ctx->minlen) {
+        const uint8_t *data = NULL;
+        uint32_t data_len = 0;
+        StreamMsgGetData(smsg, &data, &data_len);
+
+        if (data_len >= det_ctx->sgh->mpm_stream_ctx->minlen) {
             r = mpm_table[det_ctx->sgh->mpm_stream_ctx->mpm_type].
                 Search(det_ctx->sgh->mpm_stream_ctx, &det_ctx->mtcs,
-                        &det_ctx->pmq, smsg->data, smsg->data_len);
+                        &det_ctx->pmq, data, data_len);
             if (r > 0) {
                 ret += r;
             }
@@ -818,6 +818,87 @@ DetectPortLookupGroup(DetectPort *dp, uint16_t port)
     return NULL;
 }
 
+/**
+ * \brief Compile a grouped port list into a port -> sgh table, so that
+ *        the per packet lookup is a fixed number of indexed loads
+ *        instead of a walk over the list.
+ *
+ * \param t table to fill, must be empty
+ * \param list grouped port list, ports not covered by it map to NULL
+ *
+ * \retval 0 on success
+ * \retval -1 on error
+ */
+int DetectPortSghTableBuild(DetectPortSghTable *t, const DetectPort *list)
+{
+    const uint32_t nblocks = 65536 / PORT_SGH_BLOCK_SIZE;
+    const size_t block_size = PORT_SGH_BLOCK_SIZE * sizeof(SigGroupHead *);
+    uint32_t ids[65536 / PORT_SGH_BLOCK_SIZE];
+    uint32_t b, u;
+
+    memset(t, 0, sizeof(*t));
+
+    SigGroupHead **flat = SCCalloc(65536, sizeof(SigGroupHead *));
+    if (unlikely(flat == NULL))
+        return -1;
+
+    const DetectPort *dp;
+    for (dp = list; dp != NULL; dp = dp->next) {
+        uint32_t port;
+        for (port = dp->port; port <= dp->port2; port++)
+            flat[port] = dp->sh;
+    }
+
+    /* find the unique blocks: ids[b] is the first block with the
+     * same content as block b */
+    for (b = 0; b < nblocks; b++) {
+        ids[b] = b;
+        for (u = 0; u < b; u++) {
+            if (ids[u] == u && memcmp(flat + u * PORT_SGH_BLOCK_SIZE,
+                        flat + b * PORT_SGH_BLOCK_SIZE, block_size) == 0) {
+                ids[b] = u;
+                break;
+            }
+        }
+        if (ids[b] == b)
+            t->store_cnt++;
+    }
+
+    t->store = SCMalloc(t->store_cnt * block_size);
+    if (unlikely(t->store == NULL)) {
+        SCFree(flat);
+        t->store_cnt = 0;
+        return -1;
+    }
+
+    uint32_t next = 0;
+    for (b = 0; b < nblocks; b++) {
+        if (ids[b] == b) {
+            t->block[b] = t->store + next * PORT_SGH_BLOCK_SIZE;
+            memcpy(t->block[b], flat + b * PORT_SGH_BLOCK_SIZE, block_size);
+            next++;
+        } else {
+            t->block[b] = t->block[ids[b]];
+        }
+    }
+    SCFree(flat);
+
+    SCLogDebug("port table: %u unique blocks of %u ports",
+            t->store_cnt, PORT_SGH_BLOCK_SIZE);
+    return 0;
+}
+
+/**
+ * \brief Free the memory of a port -> sgh table. The sgh's themselves
+ *        are not owned by the table.
+ */
+void DetectPortSghTableFree(DetectPortSghTable *t)
+{
+    if (t->store != NULL)
+        SCFree(t->store);
+    memset(t, 0, sizeof(*t));
+}
+
 /**
  * \brief Function to join the source group to the target and its members
  *
@@ -2686,6 +2767,67 @@ static int PortTestMatchDoubleNegation(void)
     return result;
 }
 
+/**
+ * \test Check that the compiled port table gives the same sgh as the
+ *       list lookup for every port.
+ */
+static int PortTestSghTable01(void)
+{
+    /* sorted, non overlapping groups with a gap in 2048-39999 */
+    const uint16_t ranges[][2] = { { 1, 79 }, { 80, 80 }, { 81, 1023 },
+        { 1024, 2047 }, { 40000, 65535 } };
+    SigGroupHead sgh[3];
+    DetectPort *list = NULL, *last = NULL, *dp;
+    DetectPortSghTable t;
+    int result = 0;
+    uint32_t i;
+
+    memset(&sgh, 0, sizeof(sgh));
+
+    for (i = 0; i < sizeof(ranges) / sizeof(ranges[0]); i++) {
+        dp = DetectPortInit();
+        if (dp == NULL)
+            goto end;
+        dp->port = ranges[i][0];
+        dp->port2 = ranges[i][1];
+        dp->sh = &sgh[i % 3];
+        dp->flags |= PORT_SIGGROUPHEAD_COPY;
+        if (last == NULL) {
+            list = dp;
+        } else {
+            last->next = dp;
+            dp->prev = last;
+        }
+        last = dp;
+    }
+
+    if (DetectPortSghTableBuild(&t, list) != 0)
+        goto end;
+
+    uint32_t port;
+    for (port = 0; port <= 65535; port++) {
+        dp = DetectPortLookupGroup(list, (uint16_t)port);
+        SigGroupHead *expect = dp ? dp->sh : NULL;
+        if (DetectPortSghTableLookup(&t, (uint16_t)port) != expect) {
+            printf("port %u: table and list disagree: ", port);
+            goto cleanup;
+        }
+    }
+
+    /* the unused blocks in the gap share one copy */
+    if (t.store_cnt > 10) {
+        printf("expected shared blocks, got %u: ", t.store_cnt);
+        goto cleanup;
+    }
+
+    result = 1;
+cleanup:
+    DetectPortSghTableFree(&t);
+end:
+    DetectPortCleanupList(list);
+    return result;
+}
+
 #endif /* UNITTESTS */
 
 void DetectPortTests(void)
@@ -2733,6 +2875,7 @@ void DetectPortTests(void)
     UtRegisterTest("PortTestMatchReal18", PortTestMatchReal18);
     UtRegisterTest("PortTestMatchReal19", PortTestMatchReal19);
     UtRegisterTest("PortTestMatchDoubleNegation", PortTestMatchDoubleNegation);
+    UtRegisterTest("PortTestSghTable01", PortTestSghTable01);
 
 
 #endif /* UNITTESTS */
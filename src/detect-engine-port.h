@@ -35,6 +35,23 @@ void DetectPortCleanupList (DetectPort *head);
 
 DetectPort *DetectPortLookupGroup(DetectPort *dp, uint16_t port);
 
+int DetectPortSghTableBuild(DetectPortSghTable *t, const DetectPort *list);
+void DetectPortSghTableFree(DetectPortSghTable *t);
+
+/**
+ * \brief Get the sgh for a port from a compiled port table
+ *
+ * \param t table built by DetectPortSghTableBuild
+ * \param port port to look up
+ *
+ * \retval sgh of the port group the port is in, NULL if none
+ */
+static inline struct SigGroupHead_ *
+DetectPortSghTableLookup(const DetectPortSghTable *t, uint16_t port)
+{
+    return t->block[port / PORT_SGH_BLOCK_SIZE][port % PORT_SGH_BLOCK_SIZE];
+}
+
 int DetectPortJoin(DetectEngineCtx *,DetectPort *target, DetectPort *source);
 
 void DetectPortPrint(DetectPort *);
@@ -0,0 +1,240 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/** \file
+ *
+ * Helpers for keywords that prefilter on a packet header field.
+ *
+ * Two lookup types are provided:
+ * - U8Hash: a bucket per possible value of a 8 bit field (ttl, icmp
+ *   type, etc), each holding the sigs that can match that value. The
+ *   packet's value is used to directly index the buckets.
+ * - Header: the sigs are grouped on their (unique) keyword settings, so
+ *   that each setting is compared only once per packet. Keywords doing
+ *   an exact match can lookup the packet's value with a binary search.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+
+#include "detect.h"
+#include "detect-engine-prefilter.h"
+#include "detect-engine-prefilter-common.h"
+
+static inline int PrefilterSigMatchesType(const Signature *s, const int sm_type)
+{
+    return (s != NULL && s->prefilter_sm != NULL &&
+            s->prefilter_sm->type == sm_type);
+}
+
+static void PrefilterPacketU8HashFree(void *ptr)
+{
+    PrefilterPacketU8HashCtx *ctx = (PrefilterPacketU8HashCtx *)ptr;
+    int i;
+    for (i = 0; i < 256; i++) {
+        if (ctx->sigs_array[i] != NULL)
+            SCFree(ctx->sigs_array[i]);
+    }
+    SCFree(ctx);
+}
+
+/**
+ *  \brief setup a U8Hash engine for the sigs using keyword 'sm_type'
+ *         as prefilter
+ *
+ *  \param ValueMatch returns 1 if the keyword ctx matches the value
+ *  \param Prefilter engine callback getting the packet's value and
+ *                   calling PrefilterPacketU8HashRun()
+ *
+ *  \retval 0 ok
+ *  \retval -1 error
+ */
+int PrefilterSetupPacketHeaderU8Hash(SigGroupHead *sgh, int sm_type,
+        int (*ValueMatch)(const void *smctx, const uint8_t value),
+        PrefilterPktFunc Prefilter)
+{
+    PrefilterPacketU8HashCtx *ctx = SCCalloc(1, sizeof(*ctx));
+    if (ctx == NULL)
+        return -1;
+
+    uint32_t sig;
+    int v;
+    for (sig = 0; sig < sgh->sig_cnt; sig++) {
+        const Signature *s = sgh->match_array[sig];
+        if (!PrefilterSigMatchesType(s, sm_type))
+            continue;
+
+        for (v = 0; v < 256; v++) {
+            if (ValueMatch(s->prefilter_sm->ctx, (uint8_t)v))
+                ctx->sigs_cnt[v]++;
+        }
+    }
+
+    for (v = 0; v < 256; v++) {
+        if (ctx->sigs_cnt[v] == 0)
+            continue;
+        ctx->sigs_array[v] = SCMalloc(ctx->sigs_cnt[v] * sizeof(SigIntId));
+        if (ctx->sigs_array[v] == NULL)
+            goto error;
+        ctx->sigs_cnt[v] = 0;
+    }
+
+    for (sig = 0; sig < sgh->sig_cnt; sig++) {
+        const Signature *s = sgh->match_array[sig];
+        if (!PrefilterSigMatchesType(s, sm_type))
+            continue;
+
+        for (v = 0; v < 256; v++) {
+            if (ValueMatch(s->prefilter_sm->ctx, (uint8_t)v))
+                ctx->sigs_array[v][ctx->sigs_cnt[v]++] = s->num;
+        }
+    }
+
+    if (PrefilterAppendPktEngine(sgh, Prefilter, ctx,
+                PrefilterPacketU8HashFree) != 0)
+        goto error;
+    return 0;
+
+error:
+    PrefilterPacketU8HashFree(ctx);
+    return -1;
+}
+
+static void PrefilterPacketHeaderFree(void *ptr)
+{
+    PrefilterPacketHeaderCtx *ctx = (PrefilterPacketHeaderCtx *)ptr;
+    uint32_t i;
+    for (i = 0; i < ctx->groups_cnt; i++) {
+        if (ctx->groups[i].sigs_array != NULL)
+            SCFree(ctx->groups[i].sigs_array);
+    }
+    if (ctx->groups != NULL)
+        SCFree(ctx->groups);
+    SCFree(ctx);
+}
+
+static PrefilterPacketHeaderGroup *PrefilterPacketHeaderGetGroup(
+        PrefilterPacketHeaderCtx *ctx, const PrefilterPacketHeaderValue *v)
+{
+    uint32_t i;
+    for (i = 0; i < ctx->groups_cnt; i++) {
+        if (memcmp(&ctx->groups[i].v1, v, sizeof(*v)) == 0)
+            return &ctx->groups[i];
+    }
+    return NULL;
+}
+
+static int PrefilterPacketHeaderGroupCompare(const void *a, const void *b)
+{
+    const PrefilterPacketHeaderGroup *ga = a;
+    const PrefilterPacketHeaderGroup *gb = b;
+
+    if (ga->v1.u32[0] < gb->v1.u32[0])
+        return -1;
+    if (ga->v1.u32[0] > gb->v1.u32[0])
+        return 1;
+    return memcmp(&ga->v1, &gb->v1, sizeof(ga->v1));
+}
+
+/**
+ *  \brief setup a Header engine for the sigs using keyword 'sm_type'
+ *         as prefilter
+ *
+ *  \param Set store the keyword settings that matter for the match
+ *             in the value. Sigs with the same value share a group.
+ *  \param Prefilter engine callback comparing the packet against the
+ *                   groups
+ *
+ *  \retval 0 ok
+ *  \retval -1 error
+ */
+int PrefilterSetupPacketHeader(SigGroupHead *sgh, int sm_type,
+        void (*Set)(PrefilterPacketHeaderValue *v, const void *smctx),
+        PrefilterPktFunc Prefilter)
+{
+    PrefilterPacketHeaderValue v;
+    uint32_t sig;
+    uint32_t cnt = 0;
+
+    for (sig = 0; sig < sgh->sig_cnt; sig++) {
+        if (PrefilterSigMatchesType(sgh->match_array[sig], sm_type))
+            cnt++;
+    }
+    if (cnt == 0)
+        return 0;
+
+    PrefilterPacketHeaderCtx *ctx = SCCalloc(1, sizeof(*ctx));
+    if (ctx == NULL)
+        return -1;
+    /* worst case each sig has its own group */
+    ctx->groups = SCCalloc(cnt, sizeof(PrefilterPacketHeaderGroup));
+    if (ctx->groups == NULL)
+        goto error;
+
+    for (sig = 0; sig < sgh->sig_cnt; sig++) {
+        const Signature *s = sgh->match_array[sig];
+        if (!PrefilterSigMatchesType(s, sm_type))
+            continue;
+
+        memset(&v, 0x00, sizeof(v));
+        Set(&v, s->prefilter_sm->ctx);
+
+        PrefilterPacketHeaderGroup *g = PrefilterPacketHeaderGetGroup(ctx, &v);
+        if (g == NULL) {
+            g = &ctx->groups[ctx->groups_cnt++];
+            g->v1 = v;
+        }
+        g->sigs_cnt++;
+    }
+
+    uint32_t i;
+    for (i = 0; i < ctx->groups_cnt; i++) {
+        PrefilterPacketHeaderGroup *g = &ctx->groups[i];
+        g->sigs_array = SCMalloc(g->sigs_cnt * sizeof(SigIntId));
+        if (g->sigs_array == NULL)
+            goto error;
+        g->sigs_cnt = 0;
+    }
+
+    for (sig = 0; sig < sgh->sig_cnt; sig++) {
+        const Signature *s = sgh->match_array[sig];
+        if (!PrefilterSigMatchesType(s, sm_type))
+            continue;
+
+        memset(&v, 0x00, sizeof(v));
+        Set(&v, s->prefilter_sm->ctx);
+
+        PrefilterPacketHeaderGroup *g = PrefilterPacketHeaderGetGroup(ctx, &v);
+        BUG_ON(g == NULL);
+        g->sigs_array[g->sigs_cnt++] = s->num;
+    }
+
+    qsort(ctx->groups, ctx->groups_cnt, sizeof(PrefilterPacketHeaderGroup),
+            PrefilterPacketHeaderGroupCompare);
+
+    SCLogDebug("%s: %u sigs in %u groups", sigmatch_table[sm_type].name,
+            cnt, ctx->groups_cnt);
+
+    if (PrefilterAppendPktEngine(sgh, Prefilter, ctx,
+                PrefilterPacketHeaderFree) != 0)
+        goto error;
+    return 0;
+
+error:
+    PrefilterPacketHeaderFree(ctx);
+    return -1;
+}
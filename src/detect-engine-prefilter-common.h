@@ -0,0 +1,102 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/** \file
+ */
+
+#ifndef __DETECT_ENGINE_PREFILTER_COMMON_H__
+#define __DETECT_ENGINE_PREFILTER_COMMON_H__
+
+/** bucket per possible value of a 8 bit packet header field, holding
+ *  the sigs that can match that value */
+typedef struct PrefilterPacketU8HashCtx_ {
+    SigIntId *sigs_array[256];
+    uint32_t sigs_cnt[256];
+} PrefilterPacketU8HashCtx;
+
+/** keyword settings to compare a packet header field against */
+typedef union PrefilterPacketHeaderValue_ {
+    uint8_t u8[16];
+    uint16_t u16[8];
+    uint32_t u32[4];
+} PrefilterPacketHeaderValue;
+
+/** sigs sharing the exact same keyword settings */
+typedef struct PrefilterPacketHeaderGroup_ {
+    PrefilterPacketHeaderValue v1;
+    SigIntId *sigs_array;
+    uint32_t sigs_cnt;
+} PrefilterPacketHeaderGroup;
+
+/** unique keyword settings in a sgh, sorted by v1.u32[0] */
+typedef struct PrefilterPacketHeaderCtx_ {
+    PrefilterPacketHeaderGroup *groups;
+    uint32_t groups_cnt;
+} PrefilterPacketHeaderCtx;
+
+int PrefilterSetupPacketHeaderU8Hash(SigGroupHead *sgh, int sm_type,
+        int (*ValueMatch)(const void *smctx, const uint8_t value),
+        PrefilterPktFunc Prefilter);
+
+int PrefilterSetupPacketHeader(SigGroupHead *sgh, int sm_type,
+        void (*Set)(PrefilterPacketHeaderValue *v, const void *smctx),
+        PrefilterPktFunc Prefilter);
+
+/** \brief add the sigs that can match 'value' to the mpm queue */
+static inline void PrefilterPacketU8HashRun(DetectEngineThreadCtx *det_ctx,
+        const PrefilterPacketU8HashCtx *ctx, const uint8_t value)
+{
+    if (ctx->sigs_cnt[value] > 0) {
+        MpmAddSids(&det_ctx->pmq, ctx->sigs_array[value],
+                ctx->sigs_cnt[value]);
+    }
+}
+
+/** \brief add the sigs of a group to the mpm queue */
+static inline void PrefilterPacketHeaderAddGroup(DetectEngineThreadCtx *det_ctx,
+        const PrefilterPacketHeaderGroup *g)
+{
+    MpmAddSids(&det_ctx->pmq, g->sigs_array, g->sigs_cnt);
+}
+
+/**
+ *  \brief lookup the group for a value
+ *
+ *  Only for keywords doing an exact match on the value they store in
+ *  v1.u32[0]: the groups are sorted on that.
+ *
+ *  \retval g group or NULL if no sig is interested in this value
+ */
+static inline const PrefilterPacketHeaderGroup *
+PrefilterPacketHeaderLookupU32(const PrefilterPacketHeaderCtx *ctx,
+        const uint32_t value)
+{
+    uint32_t lo = 0, hi = ctx->groups_cnt;
+    while (lo < hi) {
+        const uint32_t mid = lo + (hi - lo) / 2;
+        const uint32_t v = ctx->groups[mid].v1.u32[0];
+        if (v == value)
+            return &ctx->groups[mid];
+        else if (v < value)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return NULL;
+}
+
+#endif /* __DETECT_ENGINE_PREFILTER_COMMON_H__ */
@@ -0,0 +1,397 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/** \file
+ *
+ * Prefilter engines
+ *
+ * Each app layer buffer that has a mpm in a rule group (sgh) gets a
+ * 'tx engine' in that sgh. The engine knows the alproto and direction
+ * of the buffer, the tx progress needed before the buffer is available
+ * and the callback that runs the buffer's mpm for a tx.
+ *
+ * At runtime DetectRunPrefilterTx() loops over the unfinished txs of
+ * the flow and runs each engine of the sgh that applies. This replaces
+ * a hardcoded list of per buffer mpm calls in the detection engine:
+ * a new buffer only needs to be added to the app_mpms table in
+ * detect-engine-mpm.c.
+ *
+ * Signatures without a mpm can be prefiltered by a cheap packet keyword
+ * like 'flags' or 'ttl' instead. Keywords that support this register a
+ * SetupPrefilter callback in the sigmatch_table. Per sgh the callback
+ * builds a 'packet engine' that looks up the candidate sigs for the
+ * packet's value and adds them to the same queue the mpm uses. These
+ * sigs then no longer need to be on the non-mpm list that is walked for
+ * each packet.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+
+#include "detect.h"
+#include "detect-engine-prefilter.h"
+
+#include "stream.h"
+#include "app-layer-parser.h"
+#include "util-profiling.h"
+#include "util-unittest.h"
+#include "detect-parse.h"
+#include "detect-engine.h"
+
+/**
+ *  \brief Add a tx prefilter engine to a sgh
+ *
+ *  \param sgh rule group the engine is for
+ *  \param PrefilterTx callback to run the buffer's mpm
+ *  \param alproto app layer protocol the buffer belongs to
+ *  \param direction STREAM_TOSERVER or STREAM_TOCLIENT
+ *  \param tx_min_progress tx progress needed for the buffer to be
+ *                         available
+ *  \param profile_id PROF_DETECT_MPM_* id for the packet profiling
+ *
+ *  \retval 0 ok
+ *  \retval -1 error
+ */
+int PrefilterAppendTxEngine(SigGroupHead *sgh, PrefilterTxFunc PrefilterTx,
+        AppProto alproto, uint8_t direction, int tx_min_progress,
+        int profile_id)
+{
+    if (sgh == NULL || PrefilterTx == NULL)
+        return -1;
+
+    PrefilterTxEngine *engines = SCRealloc(sgh->tx_engines,
+            (sgh->tx_engines_cnt + 1) * sizeof(PrefilterTxEngine));
+    if (engines == NULL)
+        return -1;
+    sgh->tx_engines = engines;
+
+    PrefilterTxEngine *e = &sgh->tx_engines[sgh->tx_engines_cnt];
+    memset(e, 0x00, sizeof(*e));
+    e->alproto = alproto;
+    e->direction = direction;
+    e->tx_min_progress = tx_min_progress;
+    e->profile_id = profile_id;
+    e->PrefilterTx = PrefilterTx;
+    sgh->tx_engines_cnt++;
+    return 0;
+}
+
+/**
+ *  \brief Add a packet prefilter engine to a sgh
+ *
+ *  \param sgh rule group the engine is for
+ *  \param Prefilter callback adding the candidate sigs for a packet
+ *  \param pectx engine ctx, owned by the engine after this call
+ *  \param FreeFunc function to free pectx
+ *
+ *  \retval 0 ok
+ *  \retval -1 error
+ */
+int PrefilterAppendPktEngine(SigGroupHead *sgh, PrefilterPktFunc Prefilter,
+        void *pectx, void (*FreeFunc)(void *pectx))
+{
+    if (sgh == NULL || Prefilter == NULL || pectx == NULL)
+        return -1;
+
+    PrefilterPktEngine *engines = SCRealloc(sgh->pkt_engines,
+            (sgh->pkt_engines_cnt + 1) * sizeof(PrefilterPktEngine));
+    if (engines == NULL)
+        return -1;
+    sgh->pkt_engines = engines;
+
+    PrefilterPktEngine *e = &sgh->pkt_engines[sgh->pkt_engines_cnt];
+    memset(e, 0x00, sizeof(*e));
+    e->pectx = pectx;
+    e->Prefilter = Prefilter;
+    e->Free = FreeFunc;
+    sgh->pkt_engines_cnt++;
+    return 0;
+}
+
+void PrefilterCleanupRuleGroup(SigGroupHead *sgh)
+{
+    if (sgh->tx_engines != NULL) {
+        SCFree(sgh->tx_engines);
+        sgh->tx_engines = NULL;
+    }
+    sgh->tx_engines_cnt = 0;
+
+    if (sgh->pkt_engines != NULL) {
+        uint32_t i;
+        for (i = 0; i < sgh->pkt_engines_cnt; i++) {
+            PrefilterPktEngine *e = &sgh->pkt_engines[i];
+            if (e->Free != NULL && e->pectx != NULL)
+                e->Free(e->pectx);
+        }
+        SCFree(sgh->pkt_engines);
+        sgh->pkt_engines = NULL;
+    }
+    sgh->pkt_engines_cnt = 0;
+}
+
+/**
+ *  \brief pick the keyword to prefilter a signature with
+ *
+ *  Only for signatures that have no mpm: those would otherwise be
+ *  inspected for each packet. The first keyword in the packet match
+ *  list that supports prefiltering is used.
+ */
+void PrefilterSetupSignature(Signature *s)
+{
+    s->prefilter_sm = NULL;
+
+    if (s->mpm_sm != NULL || (s->flags & SIG_FLAG_MPM_NEG))
+        return;
+    if ((s->flags & SIG_FLAG_IPONLY) || (s->init_flags & SIG_FLAG_INIT_DEONLY))
+        return;
+
+    SigMatch *sm = s->sm_lists[DETECT_SM_LIST_MATCH];
+    for ( ; sm != NULL; sm = sm->next) {
+        if (sigmatch_table[sm->type].SetupPrefilter != NULL) {
+            s->prefilter_sm = sm;
+            SCLogDebug("sig %u prefiltered by %s", s->id,
+                    sigmatch_table[sm->type].name);
+            break;
+        }
+    }
+}
+
+/**
+ *  \brief setup the packet prefilter engines for a sgh
+ *
+ *  Each keyword that is the prefilter_sm of at least one of the sgh's
+ *  signatures gets to setup its engine.
+ */
+int PrefilterSetupRuleGroup(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
+{
+    uint8_t types[DETECT_TBLSIZE];
+    memset(types, 0x00, sizeof(types));
+
+    uint32_t sig;
+    for (sig = 0; sig < sgh->sig_cnt; sig++) {
+        const Signature *s = sgh->match_array[sig];
+        if (s == NULL || s->prefilter_sm == NULL)
+            continue;
+        types[s->prefilter_sm->type] = 1;
+    }
+
+    int i;
+    for (i = 0; i < DETECT_TBLSIZE; i++) {
+        if (types[i] == 0)
+            continue;
+        BUG_ON(sigmatch_table[i].SetupPrefilter == NULL);
+        if (sigmatch_table[i].SetupPrefilter(sgh) != 0) {
+            SCLogError(SC_ERR_MEM_ALLOC, "failed to setup %s prefilter",
+                    sigmatch_table[i].name);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ *  \brief run the tx prefilter engines of a sgh
+ *
+ *  For each tx that is not fully inspected yet, run all engines that
+ *  match the flow's alproto and the packet direction and for which the
+ *  tx has progressed far enough.
+ *
+ *  \param flags STREAM_* flags, used for direction
+ *
+ *  \warning flow should be locked
+ */
+void DetectRunPrefilterTx(DetectEngineThreadCtx *det_ctx,
+        const SigGroupHead *sgh, Packet *p, const uint8_t ipproto,
+        const uint8_t flags, const AppProto alproto, void *alstate)
+{
+    const PrefilterTxEngine *engines = sgh->tx_engines;
+    const uint32_t engines_cnt = sgh->tx_engines_cnt;
+    const uint8_t direction = flags & (STREAM_TOSERVER|STREAM_TOCLIENT);
+    uint32_t e;
+
+    /* see if we have any work to do before we walk the txs */
+    for (e = 0; e < engines_cnt; e++) {
+        if (engines[e].alproto == alproto && (engines[e].direction & direction))
+            break;
+    }
+    if (e == engines_cnt)
+        return;
+
+    uint64_t idx = AppLayerParserGetTransactionInspectId(p->flow->alparser, flags);
+    const uint64_t total_txs = AppLayerParserGetTxCnt(ipproto, alproto, alstate);
+    for ( ; idx < total_txs; idx++) {
+        void *tx = AppLayerParserGetTx(ipproto, alproto, alstate, idx);
+        if (tx == NULL)
+            continue;
+
+        const int tx_progress = AppLayerParserGetStateProgress(ipproto,
+                alproto, tx, flags);
+
+        for (e = 0; e < engines_cnt; e++) {
+            const PrefilterTxEngine *engine = &engines[e];
+            if (engine->alproto != alproto)
+                continue;
+            if (!(engine->direction & direction))
+                continue;
+            if (tx_progress < engine->tx_min_progress) {
+                SCLogDebug("tx %"PRIu64" progress %d < %d", idx,
+                        tx_progress, engine->tx_min_progress);
+                continue;
+            }
+
+            PACKET_PROFILING_DETECT_START(p, engine->profile_id);
+            engine->PrefilterTx(det_ctx, p->flow, alstate, tx, idx, flags);
+            PACKET_PROFILING_DETECT_END(p, engine->profile_id);
+        }
+    }
+}
+
+/**
+ *  \brief run the packet prefilter engines of a sgh
+ *
+ *  Candidate sigs are added to the det_ctx::pmq.
+ */
+void DetectRunPrefilterPkt(DetectEngineThreadCtx *det_ctx,
+        const SigGroupHead *sgh, Packet *p)
+{
+    uint32_t e;
+    for (e = 0; e < sgh->pkt_engines_cnt; e++) {
+        const PrefilterPktEngine *engine = &sgh->pkt_engines[e];
+        engine->Prefilter(det_ctx, p, engine->pectx);
+    }
+}
+
+#ifdef UNITTESTS
+
+static void PrefilterTestDummy(DetectEngineThreadCtx *det_ctx, Flow *f,
+        void *alstate, void *tx, const uint64_t idx, const uint8_t flags)
+{
+}
+
+/** \test append and cleanup of tx engines */
+static int PrefilterTest01(void)
+{
+    SigGroupHead sgh;
+    memset(&sgh, 0x00, sizeof(sgh));
+
+    if (PrefilterAppendTxEngine(&sgh, NULL, ALPROTO_HTTP,
+                STREAM_TOSERVER, 0, PROF_DETECT_MPM_URI) != -1)
+        return 0;
+    if (PrefilterAppendTxEngine(&sgh, PrefilterTestDummy, ALPROTO_HTTP,
+                STREAM_TOSERVER, 2, PROF_DETECT_MPM_URI) != 0)
+        return 0;
+    if (PrefilterAppendTxEngine(&sgh, PrefilterTestDummy, ALPROTO_DNS,
+                STREAM_TOSERVER, 0, PROF_DETECT_MPM_DNSQUERY) != 0)
+        return 0;
+
+    int result = 0;
+    if (sgh.tx_engines_cnt != 2)
+        goto end;
+    if (sgh.tx_engines[0].alproto != ALPROTO_HTTP ||
+        sgh.tx_engines[0].tx_min_progress != 2 ||
+        sgh.tx_engines[0].PrefilterTx != PrefilterTestDummy)
+        goto end;
+    if (sgh.tx_engines[1].alproto != ALPROTO_DNS ||
+        sgh.tx_engines[1].profile_id != PROF_DETECT_MPM_DNSQUERY)
+        goto end;
+
+    result = 1;
+end:
+    PrefilterCleanupRuleGroup(&sgh);
+    if (sgh.tx_engines != NULL || sgh.tx_engines_cnt != 0)
+        result = 0;
+    return result;
+}
+
+/** \test ttl sigs without mpm are prefiltered through a pkt engine */
+static int PrefilterTest02(void)
+{
+    ThreadVars th_v;
+    DetectEngineThreadCtx *det_ctx = NULL;
+    IPV4Hdr ip4h;
+    int result = 0;
+
+    memset(&th_v, 0, sizeof(th_v));
+    memset(&ip4h, 0, sizeof(ip4h));
+
+    Packet *p = PacketGetFromAlloc();
+    if (unlikely(p == NULL))
+        return 0;
+    p->src.family = AF_INET;
+    p->dst.family = AF_INET;
+    p->proto = IPPROTO_TCP;
+    ip4h.ip_ttl = 15;
+    p->ip4h = &ip4h;
+
+    DetectEngineCtx *de_ctx = DetectEngineCtxInit();
+    if (de_ctx == NULL)
+        goto end;
+    de_ctx->flags |= DE_QUIET;
+
+    Signature *s = de_ctx->sig_list = SigInit(de_ctx,
+            "alert ip any any -> any any (ttl:15; sid:1;)");
+    if (s == NULL)
+        goto cleanup;
+    s = s->next = SigInit(de_ctx,
+            "alert ip any any -> any any (ttl:20; sid:2;)");
+    if (s == NULL)
+        goto cleanup;
+    s = s->next = SigInit(de_ctx,
+            "alert ip any any -> any any (ttl:<16; sid:3;)");
+    if (s == NULL)
+        goto cleanup;
+
+    SigGroupBuild(de_ctx);
+    DetectEngineThreadCtxInit(&th_v, (void *)de_ctx, (void *)&det_ctx);
+
+    if (de_ctx->sig_list->prefilter_sm == NULL) {
+        printf("sid 1 has no prefilter_sm: ");
+        goto cleanup;
+    }
+
+    SigMatchSignatures(&th_v, de_ctx, det_ctx, p);
+    if (det_ctx->sgh == NULL || det_ctx->sgh->pkt_engines_cnt != 1) {
+        printf("expected a single pkt engine: ");
+        goto cleanup;
+    }
+    if (!PacketAlertCheck(p, 1) || PacketAlertCheck(p, 2) ||
+        !PacketAlertCheck(p, 3)) {
+        printf("wrong alerts: ");
+        goto cleanup;
+    }
+
+    result = 1;
+cleanup:
+    SigGroupCleanup(de_ctx);
+    SigCleanSignatures(de_ctx);
+    if (det_ctx != NULL)
+        DetectEngineThreadCtxDeinit(&th_v, (void *)det_ctx);
+    DetectEngineCtxFree(de_ctx);
+end:
+    SCFree(p);
+    return result;
+}
+
+#endif /* UNITTESTS */
+
+void PrefilterRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("PrefilterTest01", PrefilterTest01);
+    UtRegisterTest("PrefilterTest02", PrefilterTest02);
+#endif /* UNITTESTS */
+}
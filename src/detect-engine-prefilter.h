@@ -0,0 +1,43 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/** \file
+ */
+
+#ifndef __DETECT_ENGINE_PREFILTER_H__
+#define __DETECT_ENGINE_PREFILTER_H__
+
+int PrefilterAppendTxEngine(SigGroupHead *sgh, PrefilterTxFunc PrefilterTx,
+        AppProto alproto, uint8_t direction, int tx_min_progress,
+        int profile_id);
+int PrefilterAppendPktEngine(SigGroupHead *sgh, PrefilterPktFunc Prefilter,
+        void *pectx, void (*FreeFunc)(void *pectx));
+void PrefilterCleanupRuleGroup(SigGroupHead *sgh);
+
+void PrefilterSetupSignature(Signature *s);
+int PrefilterSetupRuleGroup(DetectEngineCtx *de_ctx, SigGroupHead *sgh);
+
+void DetectRunPrefilterTx(DetectEngineThreadCtx *det_ctx,
+        const SigGroupHead *sgh, Packet *p, const uint8_t ipproto,
+        const uint8_t flags, const AppProto alproto, void *alstate);
+
+void DetectRunPrefilterPkt(DetectEngineThreadCtx *det_ctx,
+        const SigGroupHead *sgh, Packet *p);
+
+void PrefilterRegisterTests(void);
+
+#endif /* __DETECT_ENGINE_PREFILTER_H__ */
@@ -36,6 +36,7 @@
 #include "detect-engine-address.h"
 #include "detect-engine-mpm.h"
 #include "detect-engine-siggroup.h"
+#include "detect-engine-prefilter.h"
 
 #include "detect-content.h"
 #include "detect-uricontent.h"
@@ -163,6 +164,8 @@ void SigGroupHeadFree(SigGroupHead *sgh)
         sgh->non_mpm_syn_store_cnt = 0;
     }
 
+    PrefilterCleanupRuleGroup(sgh);
+
     sgh->sig_cnt = 0;
 
     if (sgh->init != NULL) {
@@ -683,6 +686,10 @@ int SigGroupHeadBuildNonMpmArray(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
         if (s == NULL)
             continue;
 
+        /* sigs with a keyword prefilter are added by its engine */
+        if (s->prefilter_sm != NULL)
+            continue;
+
         if (s->mpm_sm == NULL || (s->flags & SIG_FLAG_MPM_NEG)) {
             if (!(DetectFlagsSignatureNeedsSynPackets(s))) {
                 non_mpm++;
@@ -691,6 +698,9 @@ int SigGroupHeadBuildNonMpmArray(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
         }
     }
 
+    if (PrefilterSetupRuleGroup(de_ctx, sgh) != 0)
+        return -1;
+
     if (non_mpm == 0 && non_mpm_syn == 0) {
         sgh->non_mpm_other_store_array = NULL;
         sgh->non_mpm_syn_store_array = NULL;
@@ -714,6 +724,9 @@ int SigGroupHeadBuildNonMpmArray(DetectEngineCtx *de_ctx, SigGroupHead *sgh)
         if (s == NULL)
             continue;
 
+        if (s->prefilter_sm != NULL)
+            continue;
+
         if (s->mpm_sm == NULL || (s->flags & SIG_FLAG_MPM_NEG)) {
             if (!(DetectFlagsSignatureNeedsSynPackets(s))) {
                 BUG_ON(sgh->non_mpm_other_store_cnt >= non_mpm);
@@ -40,6 +40,7 @@
 #include "app-layer-parser.h"
 #include "app-layer-protos.h"
 #include "app-layer-ssl.h"
+#include "detect-tls-sni.h"
 
 #include "util-unittest.h"
 #include "util-unittest-helper.h"
@@ -106,6 +107,14 @@ uint32_t DetectTlsSniInspectMpm(DetectEngineThreadCtx *det_ctx, Flow *f,
     SCReturnUInt(cnt);
 }
 
+/** \brief tx prefilter callback running the tls_sni mpm */
+void PrefilterTxTlsSni(DetectEngineThreadCtx *det_ctx, Flow *f, void *alstate,
+        void *tx, const uint64_t idx, const uint8_t flags)
+{
+    /* the tls state is its own (single) tx */
+    DetectTlsSniInspectMpm(det_ctx, f, (SSLState *)alstate, flags);
+}
+
 /** \brief Do the content inspection and validation for a signature
  *
  *  \param de_ctx   Detection engine context
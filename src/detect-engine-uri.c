@@ -112,6 +112,13 @@ end:
     SCReturnUInt(cnt);
 }
 
+/** \brief tx prefilter callback running the http_uri mpm */
+void PrefilterTxUri(DetectEngineThreadCtx *det_ctx, Flow *f, void *alstate,
+        void *tx, const uint64_t idx, const uint8_t flags)
+{
+    DetectUricontentInspectMpm(det_ctx, f, (HtpState *)alstate, flags, tx, idx);
+}
+
 /**
  * \brief Do the content inspection & validation for a signature
  *
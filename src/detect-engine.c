@@ -89,6 +89,7 @@
 #include "util-spm.h"
 
 #include "util-var-name.h"
+#include "util-cpu.h"
 
 #include "tm-threads.h"
 #include "runmodes.h"
@@ -1203,6 +1204,18 @@ static int DetectEngineCtxLoadConf(DetectEngineCtx *de_ctx)
     SCLogDebug("de_ctx->inspection_recursion_limit: %d",
                de_ctx->inspection_recursion_limit);
 
+    /* threads to prepare the mpm contexts with, 0 or unset is one per cpu */
+    value = 0;
+    (void)ConfGetInt("detect.prepare-threads", &value);
+    if (value > 0 && value <= UINT16_MAX) {
+        de_ctx->prepare_threads = (uint16_t)value;
+    } else {
+        de_ctx->prepare_threads = UtilCpuGetNumProcessorsOnline();
+    }
+    if (de_ctx->prepare_threads == 0)
+        de_ctx->prepare_threads = 1;
+    SCLogDebug("de_ctx->prepare_threads: %u", de_ctx->prepare_threads);
+
     /* parse port grouping whitelisting settings */
 
     char *ports = NULL;
@@ -1633,8 +1646,6 @@ static DetectEngineThreadCtx *DetectEngineThreadCtxInitForReload(
 
 void DetectEngineThreadCtxFree(DetectEngineThreadCtx *det_ctx)
 {
-    int i;
-
     if (det_ctx->tenant_array != NULL) {
         SCFree(det_ctx->tenant_array);
         det_ctx->tenant_array = NULL;
@@ -1673,16 +1684,8 @@ void DetectEngineThreadCtxFree(DetectEngineThreadCtx *det_ctx)
         SCFree(det_ctx->bj_values);
 
     /* HHD temp storage */
-    for (i = 0; i < det_ctx->hhd_buffers_size; i++) {
-        if (det_ctx->hhd_buffers[i] != NULL)
-            SCFree(det_ctx->hhd_buffers[i]);
-    }
-    if (det_ctx->hhd_buffers)
-        SCFree(det_ctx->hhd_buffers);
-    det_ctx->hhd_buffers = NULL;
-    if (det_ctx->hhd_buffers_len)
-        SCFree(det_ctx->hhd_buffers_len);
-    det_ctx->hhd_buffers_len = NULL;
+    if (det_ctx->hhd_buffer != NULL)
+        SCFree(det_ctx->hhd_buffer);
 
     /* HSBD */
     if (det_ctx->hsbd != NULL) {
@@ -31,6 +31,8 @@
 #include "detect-parse.h"
 
 #include "detect-itype.h"
+#include "detect-engine-prefilter.h"
+#include "detect-engine-prefilter-common.h"
 
 #include "util-byte.h"
 #include "util-unittest.h"
@@ -49,6 +51,7 @@ int DetectITypeMatch(ThreadVars *, DetectEngineThreadCtx *, Packet *, Signature
 static int DetectITypeSetup(DetectEngineCtx *, Signature *, char *);
 void DetectITypeRegisterTests(void);
 void DetectITypeFree(void *);
+static int PrefilterSetupIType(SigGroupHead *sgh);
 
 
 /**
@@ -63,10 +66,27 @@ void DetectITypeRegister (void)
     sigmatch_table[DETECT_ITYPE].Setup = DetectITypeSetup;
     sigmatch_table[DETECT_ITYPE].Free = DetectITypeFree;
     sigmatch_table[DETECT_ITYPE].RegisterTests = DetectITypeRegisterTests;
+    sigmatch_table[DETECT_ITYPE].SetupPrefilter = PrefilterSetupIType;
 
     DetectSetupParseRegexes(PARSE_REGEX, &parse_regex, &parse_regex_study);
 }
 
+static inline int ITypeMatch(const uint8_t pitype, const DetectITypeData *itd)
+{
+    switch(itd->mode) {
+        case DETECT_ITYPE_EQ:
+            return (pitype == itd->type1) ? 1 : 0;
+        case DETECT_ITYPE_LT:
+            return (pitype < itd->type1) ? 1 : 0;
+        case DETECT_ITYPE_GT:
+            return (pitype > itd->type1) ? 1 : 0;
+        case DETECT_ITYPE_RN:
+            return (pitype > itd->type1 && pitype < itd->type2) ? 1 : 0;
+    }
+
+    return 0;
+}
+
 /**
  * \brief This function is used to match itype rule option set on a packet with those passed via itype:
  *
@@ -96,22 +116,37 @@ int DetectITypeMatch (ThreadVars *t, DetectEngineThreadCtx *det_ctx, Packet *p,
         return ret;
     }
 
-    switch(itd->mode) {
-        case DETECT_ITYPE_EQ:
-            ret = (pitype == itd->type1) ? 1 : 0;
-            break;
-        case DETECT_ITYPE_LT:
-            ret = (pitype < itd->type1) ? 1 : 0;
-            break;
-        case DETECT_ITYPE_GT:
-            ret = (pitype > itd->type1) ? 1 : 0;
-            break;
-        case DETECT_ITYPE_RN:
-            ret = (pitype > itd->type1 && pitype < itd->type2) ? 1 : 0;
-            break;
+    return ITypeMatch(pitype, itd);
+}
+
+static void PrefilterPacketITypeMatch(DetectEngineThreadCtx *det_ctx,
+        Packet *p, const void *pectx)
+{
+    uint8_t pitype;
+
+    if (PKT_IS_PSEUDOPKT(p))
+        return;
+
+    if (PKT_IS_ICMPV4(p)) {
+        pitype = ICMPV4_GET_TYPE(p);
+    } else if (PKT_IS_ICMPV6(p)) {
+        pitype = ICMPV6_GET_TYPE(p);
+    } else {
+        return;
     }
 
-    return ret;
+    PrefilterPacketU8HashRun(det_ctx, pectx, pitype);
+}
+
+static int PrefilterITypeValueMatch(const void *smctx, const uint8_t value)
+{
+    return ITypeMatch(value, (const DetectITypeData *)smctx);
+}
+
+static int PrefilterSetupIType(SigGroupHead *sgh)
+{
+    return PrefilterSetupPacketHeaderU8Hash(sgh, DETECT_ITYPE,
+            PrefilterITypeValueMatch, PrefilterPacketITypeMatch);
 }
 
 /**
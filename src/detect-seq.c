@@ -33,6 +33,8 @@
 #include "detect-engine-mpm.h"
 
 #include "detect-seq.h"
+#include "detect-engine-prefilter.h"
+#include "detect-engine-prefilter-common.h"
 
 #include "util-byte.h"
 #include "util-unittest.h"
@@ -44,6 +46,7 @@ static int DetectSeqMatch(ThreadVars *, DetectEngineThreadCtx *,
                           Packet *, Signature *, const SigMatchCtx *);
 static void DetectSeqRegisterTests(void);
 static void DetectSeqFree(void *);
+static int PrefilterSetupSeq(SigGroupHead *sgh);
 
 
 void DetectSeqRegister(void)
@@ -55,6 +58,7 @@ void DetectSeqRegister(void)
     sigmatch_table[DETECT_SEQ].Setup = DetectSeqSetup;
     sigmatch_table[DETECT_SEQ].Free = DetectSeqFree;
     sigmatch_table[DETECT_SEQ].RegisterTests = DetectSeqRegisterTests;
+    sigmatch_table[DETECT_SEQ].SetupPrefilter = PrefilterSetupSeq;
 }
 
 /**
@@ -82,6 +86,34 @@ static int DetectSeqMatch(ThreadVars *t, DetectEngineThreadCtx *det_ctx,
     return (data->seq == TCP_GET_SEQ(p)) ? 1 : 0;
 }
 
+/* prefilter: v1.u32[0] seq, groups are sorted so we can bsearch */
+
+static void PrefilterPacketSeqMatch(DetectEngineThreadCtx *det_ctx,
+        Packet *p, const void *pectx)
+{
+    const PrefilterPacketHeaderCtx *ctx = pectx;
+
+    if (!(PKT_IS_TCP(p)) || PKT_IS_PSEUDOPKT(p))
+        return;
+
+    const PrefilterPacketHeaderGroup *g =
+        PrefilterPacketHeaderLookupU32(ctx, TCP_GET_SEQ(p));
+    if (g != NULL)
+        PrefilterPacketHeaderAddGroup(det_ctx, g);
+}
+
+static void PrefilterPacketSeqSet(PrefilterPacketHeaderValue *v, const void *smctx)
+{
+    const DetectSeqData *data = smctx;
+    v->u32[0] = data->seq;
+}
+
+static int PrefilterSetupSeq(SigGroupHead *sgh)
+{
+    return PrefilterSetupPacketHeader(sgh, DETECT_SEQ,
+            PrefilterPacketSeqSet, PrefilterPacketSeqMatch);
+}
+
 /**
  * \internal
  * \brief this function is used to add the seq option into the signature
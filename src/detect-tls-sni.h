@@ -29,5 +29,7 @@
 void DetectTlsSniRegister(void);
 uint32_t DetectTlsSniInspectMpm(DetectEngineThreadCtx *det_ctx, Flow *f,
                                 SSLState *ssl_state, uint8_t flags);
+void PrefilterTxTlsSni(DetectEngineThreadCtx *det_ctx, Flow *f, void *alstate,
+        void *tx, const uint64_t idx, const uint8_t flags);
 
 #endif /* __DETECT_TLS_SNI_H__ */
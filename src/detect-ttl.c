@@ -31,6 +31,8 @@
 #include "detect-parse.h"
 
 #include "detect-ttl.h"
+#include "detect-engine-prefilter.h"
+#include "detect-engine-prefilter-common.h"
 #include "util-debug.h"
 
 /**
@@ -46,6 +48,7 @@ int DetectTtlMatch (ThreadVars *, DetectEngineThreadCtx *, Packet *, Signature *
 static int DetectTtlSetup (DetectEngineCtx *, Signature *, char *);
 void DetectTtlFree (void *);
 void DetectTtlRegisterTests (void);
+static int PrefilterSetupTtl(SigGroupHead *sgh);
 
 /**
  * \brief Registration function for ttl: keyword
@@ -60,11 +63,26 @@ void DetectTtlRegister(void)
     sigmatch_table[DETECT_TTL].Setup = DetectTtlSetup;
     sigmatch_table[DETECT_TTL].Free = DetectTtlFree;
     sigmatch_table[DETECT_TTL].RegisterTests = DetectTtlRegisterTests;
+    sigmatch_table[DETECT_TTL].SetupPrefilter = PrefilterSetupTtl;
 
     DetectSetupParseRegexes(PARSE_REGEX, &parse_regex, &parse_regex_study);
     return;
 }
 
+static inline int TtlMatch(const uint8_t pttl, const DetectTtlData *ttld)
+{
+    if (ttld->mode == DETECT_TTL_EQ && pttl == ttld->ttl1)
+        return 1;
+    else if (ttld->mode == DETECT_TTL_LT && pttl < ttld->ttl1)
+        return 1;
+    else if (ttld->mode == DETECT_TTL_GT && pttl > ttld->ttl1)
+        return 1;
+    else if (ttld->mode == DETECT_TTL_RA && (pttl > ttld->ttl1 && pttl < ttld->ttl2))
+        return 1;
+
+    return 0;
+}
+
 /**
  * \brief This function is used to match TTL rule option on a packet with those passed via ttl:
  *
@@ -95,16 +113,37 @@ int DetectTtlMatch (ThreadVars *t, DetectEngineThreadCtx *det_ctx, Packet *p, Si
         return ret;
     }
 
-    if (ttld->mode == DETECT_TTL_EQ && pttl == ttld->ttl1)
-        ret = 1;
-    else if (ttld->mode == DETECT_TTL_LT && pttl < ttld->ttl1)
-        ret = 1;
-    else if (ttld->mode == DETECT_TTL_GT && pttl > ttld->ttl1)
-        ret = 1;
-    else if (ttld->mode == DETECT_TTL_RA && (pttl > ttld->ttl1 && pttl < ttld->ttl2))
-        ret = 1;
+    return TtlMatch(pttl, ttld);
+}
+
+static void PrefilterPacketTtlMatch(DetectEngineThreadCtx *det_ctx,
+        Packet *p, const void *pectx)
+{
+    uint8_t pttl;
+
+    if (PKT_IS_PSEUDOPKT(p))
+        return;
+
+    if (PKT_IS_IPV4(p)) {
+        pttl = IPV4_GET_IPTTL(p);
+    } else if (PKT_IS_IPV6(p)) {
+        pttl = IPV6_GET_HLIM(p);
+    } else {
+        return;
+    }
+
+    PrefilterPacketU8HashRun(det_ctx, pectx, pttl);
+}
 
-    return ret;
+static int PrefilterTtlValueMatch(const void *smctx, const uint8_t value)
+{
+    return TtlMatch(value, (const DetectTtlData *)smctx);
+}
+
+static int PrefilterSetupTtl(SigGroupHead *sgh)
+{
+    return PrefilterSetupPacketHeaderU8Hash(sgh, DETECT_TTL,
+            PrefilterTtlValueMatch, PrefilterPacketTtlMatch);
 }
 
 /**
@@ -37,5 +37,7 @@ void DetectUricontentPrint(DetectContentData *);
 uint32_t DetectUricontentInspectMpm(DetectEngineThreadCtx *det_ctx, Flow *f,
                                     HtpState *htp_state, uint8_t flags,
                                     void *tx, uint64_t idx);
+void PrefilterTxUri(DetectEngineThreadCtx *det_ctx, Flow *f, void *alstate,
+        void *tx, const uint64_t idx, const uint8_t flags);
 
 #endif /* __DETECT_URICONTENT_H__ */
@@ -31,6 +31,8 @@
 #include "detect-parse.h"
 
 #include "detect-window.h"
+#include "detect-engine-prefilter.h"
+#include "detect-engine-prefilter-common.h"
 #include "flow.h"
 #include "flow-var.h"
 
@@ -51,6 +53,7 @@ int DetectWindowMatch(ThreadVars *, DetectEngineThreadCtx *, Packet *, Signature
 int DetectWindowSetup(DetectEngineCtx *, Signature *, char *);
 void DetectWindowRegisterTests(void);
 void DetectWindowFree(void *);
+static int PrefilterSetupWindow(SigGroupHead *sgh);
 
 /**
  * \brief Registration function for window: keyword
@@ -64,6 +67,7 @@ void DetectWindowRegister (void)
     sigmatch_table[DETECT_WINDOW].Setup = DetectWindowSetup;
     sigmatch_table[DETECT_WINDOW].Free  = DetectWindowFree;
     sigmatch_table[DETECT_WINDOW].RegisterTests = DetectWindowRegisterTests;
+    sigmatch_table[DETECT_WINDOW].SetupPrefilter = PrefilterSetupWindow;
 
     DetectSetupParseRegexes(PARSE_REGEX, &parse_regex, &parse_regex_study);
 }
@@ -94,6 +98,38 @@ int DetectWindowMatch(ThreadVars *t, DetectEngineThreadCtx *det_ctx, Packet *p,
     return 0;
 }
 
+/* prefilter: v1.u32[0] size, v1.u8[4] negated */
+
+static void PrefilterPacketWindowMatch(DetectEngineThreadCtx *det_ctx,
+        Packet *p, const void *pectx)
+{
+    const PrefilterPacketHeaderCtx *ctx = pectx;
+    uint32_t i;
+
+    if (!(PKT_IS_TCP(p)) || PKT_IS_PSEUDOPKT(p))
+        return;
+
+    const uint32_t window = TCP_GET_WINDOW(p);
+    for (i = 0; i < ctx->groups_cnt; i++) {
+        const PrefilterPacketHeaderGroup *g = &ctx->groups[i];
+        if ((g->v1.u32[0] == window) != (g->v1.u8[4] != 0))
+            PrefilterPacketHeaderAddGroup(det_ctx, g);
+    }
+}
+
+static void PrefilterPacketWindowSet(PrefilterPacketHeaderValue *v, const void *smctx)
+{
+    const DetectWindowData *wd = smctx;
+    v->u32[0] = wd->size;
+    v->u8[4] = wd->negated;
+}
+
+static int PrefilterSetupWindow(SigGroupHead *sgh)
+{
+    return PrefilterSetupPacketHeader(sgh, DETECT_WINDOW,
+            PrefilterPacketWindowSet, PrefilterPacketWindowMatch);
+}
+
 /**
  * \brief This function is used to parse window options passed via window: keyword
  *
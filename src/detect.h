@@ -431,6 +431,8 @@ typedef struct Signature_ {
     SigMatch *dsize_sm;
     /* the fast pattern added from this signature */
     SigMatch *mpm_sm;
+    /* non-mpm sigs: keyword used to prefilter this signature */
+    SigMatch *prefilter_sm;
 
     /* SigMatch list used for adding content and friends. E.g. file_data; */
     int list;
@@ -504,9 +506,25 @@ typedef struct DetectEngineIPOnlyCtx_ {
     uint32_t *match_array;
 } DetectEngineIPOnlyCtx;
 
+/** number of ports covered by a DetectPortSghTable block */
+#define PORT_SGH_BLOCK_SIZE 256
+
+/** port -> sgh lookup table compiled from a grouped port list. The
+ *  65536 ports are split in blocks of PORT_SGH_BLOCK_SIZE; blocks with
+ *  the same content share their storage. */
+typedef struct DetectPortSghTable_ {
+    struct SigGroupHead_ **block[65536 / PORT_SGH_BLOCK_SIZE];
+    /* unique blocks, PORT_SGH_BLOCK_SIZE entries each */
+    struct SigGroupHead_ **store;
+    uint32_t store_cnt;
+} DetectPortSghTable;
+
 typedef struct DetectEngineLookupFlow_ {
     DetectPort *tcp;
     DetectPort *udp;
+    /* tables compiled from the tcp and udp lists above */
+    DetectPortSghTable tcp_sgh;
+    DetectPortSghTable udp_sgh;
     struct SigGroupHead_ *sgh[256];
 } DetectEngineLookupFlow;
 
@@ -611,6 +629,9 @@ typedef struct DetectEngineCtx_ {
     /* maximum recursion depth for content inspection */
     int inspection_recursion_limit;
 
+    /* number of threads used to prepare the mpm contexts */
+    uint16_t prepare_threads;
+
     /* conf parameter that limits the length of the http request body inspected */
     int hcbd_buffer_limit;
     /* conf parameter that limits the length of the http response body inspected */
@@ -765,11 +786,9 @@ typedef struct DetectEngineThreadCtx_ {
     uint16_t hcbd_buffers_size;
     uint16_t hcbd_buffers_list_len;
 
-    uint8_t **hhd_buffers;
-    uint32_t *hhd_buffers_len;
-    uint16_t hhd_buffers_size;
-    uint16_t hhd_buffers_list_len;
-    uint64_t hhd_start_tx_id;
+    /** http_header buffer for a tx that can't cache its own */
+    uint8_t *hhd_buffer;
+    uint32_t hhd_buffer_size;
 
     FiledataReassembledBody *smtp;
     uint64_t smtp_start_tx_id;
@@ -898,6 +917,10 @@ typedef struct SigTableElmt_ {
     void (*Free)(void *);
     void (*RegisterTests)(void);
 
+    /** setup the prefilter engine for the sigs in the sgh that use this
+     *  keyword as their prefilter_sm */
+    int (*SetupPrefilter)(struct SigGroupHead_ *sgh);
+
     uint8_t flags;
     char *name;     /**< keyword name alias */
     char *alias;    /**< name alias */
@@ -976,6 +999,40 @@ typedef struct SigGroupHeadInitData_ {
     struct DetectPort_ *port;
 } SigGroupHeadInitData;
 
+/** callback running a buffer's prefilter (mpm) for a single tx */
+typedef void (*PrefilterTxFunc)(DetectEngineThreadCtx *det_ctx, Flow *f,
+        void *alstate, void *tx, const uint64_t idx, const uint8_t flags);
+
+/** \brief tx prefilter engine: runs the mpm of a single app layer
+ *         buffer against each tx that progressed far enough to have
+ *         that buffer available. */
+typedef struct PrefilterTxEngine_ {
+    AppProto alproto;
+    /** STREAM_TOSERVER or STREAM_TOCLIENT */
+    uint8_t direction;
+    /** tx progress required in 'direction' before we run */
+    int tx_min_progress;
+    /** PROF_DETECT_MPM_* id for packet profiling */
+    int profile_id;
+
+    PrefilterTxFunc PrefilterTx;
+} PrefilterTxEngine;
+
+/** callback running a keyword prefilter against a packet */
+typedef void (*PrefilterPktFunc)(DetectEngineThreadCtx *det_ctx,
+        Packet *p, const void *pectx);
+
+/** \brief packet prefilter engine: adds the candidate sigs of a non-mpm
+ *         keyword (flags, ttl, dsize, etc) based on the packet's value
+ *         for that keyword. */
+typedef struct PrefilterPktEngine_ {
+    /** keyword specific lookup context */
+    void *pectx;
+
+    PrefilterPktFunc Prefilter;
+    void (*Free)(void *pectx);
+} PrefilterPktEngine;
+
 /** \brief Container for matching data for a signature group */
 typedef struct SigGroupHead_ {
     uint32_t flags;
@@ -1025,6 +1082,16 @@ typedef struct SigGroupHead_ {
         };
     };
 
+    /** tx prefilter engines for the app layer buffers that have an
+     *  mpm in this sgh. Size is tx_engines_cnt. */
+    PrefilterTxEngine *tx_engines;
+    uint32_t tx_engines_cnt;
+
+    /** packet prefilter engines for the non-mpm keywords of this sgh.
+     *  Size is pkt_engines_cnt. */
+    PrefilterPktEngine *pkt_engines;
+    uint32_t pkt_engines_cnt;
+
     /** Array with sig ptrs... size is sig_cnt * sizeof(Signature *) */
     Signature **match_array;
 
@@ -26,6 +26,7 @@
 
 #include "suricata-common.h"
 #include "threads.h"
+#include "suricata.h"
 
 #include "decode.h"
 #include "detect-engine-state.h"
@@ -36,10 +37,13 @@
 #include "flow-private.h"
 #include "flow-manager.h"
 #include "flow-storage.h"
+#include "flow-wheel.h"
 #include "app-layer-parser.h"
+#include "runmodes.h"
 
 #include "util-time.h"
 #include "util-debug.h"
+#include "util-validate.h"
 
 #include "util-hash-lookup3.h"
 
@@ -339,6 +343,22 @@ static inline int FlowCreateCheck(const Packet *p)
     return 1;
 }
 
+/**
+ *  \brief Get a spare flow from the queue of another NUMA node
+ */
+static Flow *FlowDequeueRemoteSpare(const uint32_t node)
+{
+    const uint32_t cnt = NumaNodeCount();
+    uint32_t n;
+
+    for (n = 1; n < cnt; n++) {
+        Flow *f = FlowDequeue(FlowSpareQueue((node + n) % cnt));
+        if (f != NULL)
+            return f;
+    }
+    return NULL;
+}
+
 /**
  *  \brief Get a new flow
  *
@@ -358,8 +378,13 @@ static Flow *FlowGetNew(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p)
         return NULL;
     }
 
-    /* get a flow from the spare queue */
-    f = FlowDequeue(&flow_spare_q);
+    /* get a flow from the spare queue of our node */
+    const uint32_t node = NumaThreadNode();
+    f = FlowDequeue(FlowSpareQueue(node));
+    if (f == NULL && !(FLOW_CHECK_MEMCAP(sizeof(Flow) + FlowStorageSize()))) {
+        /* no memory left for a node local flow, use a remote spare */
+        f = FlowDequeueRemoteSpare(node);
+    }
     if (f == NULL) {
         /* If we reached the max memcap, we get a used flow */
         if (!(FLOW_CHECK_MEMCAP(sizeof(Flow) + FlowStorageSize()))) {
@@ -441,39 +466,30 @@ static Flow *TcpReuseReplace(ThreadVars *tv, DecodeThreadVars *dtv,
     return f;
 }
 
-/** \brief Get Flow for packet
- *
- * Hash retrieval function for flows. Looks up the hash bucket containing the
- * flow pointer. Then compares the packet with the found flow to see if it is
- * the flow we need. If it isn't, walk the list until the right flow is found.
- *
- * If the flow is not found or the bucket was emtpy, a new flow is taken from
- * the queue. FlowDequeue() will alloc new flows as long as we stay within our
- * memcap limit.
+/** \internal
+ *  \brief Get Flow for packet from a hash bucket
  *
- * The p->flow pointer is updated to point to the flow.
+ *  Compares the packet with the flows in the bucket to see if one of them
+ *  is the flow we need. If the flow is not found or the bucket was emtpy,
+ *  a new flow is taken from the queue. FlowDequeue() will alloc new flows
+ *  as long as we stay within our memcap limit.
  *
- *  \param tv thread vars
- *  \param dtv decode thread vars (for flow log api thread data)
+ *  \note the bucket must be locked by the caller, or be part of the
+ *        calling thread's flow hash partition.
  *
  *  \retval f *LOCKED* flow or NULL
  */
-Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p, Flow **dest)
+static inline Flow *FlowGetFlowFromBucket(ThreadVars *tv, DecodeThreadVars *dtv,
+        const Packet *p, Flow **dest, FlowBucket *fb, const uint32_t hash)
 {
     Flow *f = NULL;
 
-    /* get our hash bucket and lock it */
-    const uint32_t hash = p->flow_hash;
-    FlowBucket *fb = &flow_hash[hash % flow_config.hash_size];
-    FBLOCK_LOCK(fb);
-
     SCLogDebug("fb %p fb->head %p", fb, fb->head);
 
     /* see if the bucket already has a flow */
     if (fb->head == NULL) {
         f = FlowGetNew(tv, dtv, p);
         if (f == NULL) {
-            FBLOCK_UNLOCK(fb);
             return NULL;
         }
 
@@ -490,7 +506,6 @@ Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p
         COPY_TIMESTAMP(&p->ts,&f->lastts);
         FlowReference(dest, f);
 
-        FBLOCK_UNLOCK(fb);
         return f;
     }
 
@@ -508,7 +523,6 @@ Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p
             if (f == NULL) {
                 f = pf->hnext = FlowGetNew(tv, dtv, p);
                 if (f == NULL) {
-                    FBLOCK_UNLOCK(fb);
                     return NULL;
                 }
                 fb->tail = f;
@@ -526,7 +540,6 @@ Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p
                 COPY_TIMESTAMP(&p->ts,&f->lastts);
                 FlowReference(dest, f);
 
-                FBLOCK_UNLOCK(fb);
                 return f;
             }
 
@@ -553,7 +566,6 @@ Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p
                 if (unlikely(TcpSessionPacketSsnReuse(p, f, f->protoctx) == 1)) {
                     f = TcpReuseReplace(tv, dtv, fb, f, hash, p);
                     if (f == NULL) {
-                        FBLOCK_UNLOCK(fb);
                         return NULL;
                     }
                 }
@@ -562,7 +574,6 @@ Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p
                 COPY_TIMESTAMP(&p->ts,&f->lastts);
                 FlowReference(dest, f);
 
-                FBLOCK_UNLOCK(fb);
                 return f;
             }
         }
@@ -573,7 +584,6 @@ Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p
     if (unlikely(TcpSessionPacketSsnReuse(p, f, f->protoctx) == 1)) {
         f = TcpReuseReplace(tv, dtv, fb, f, hash, p);
         if (f == NULL) {
-            FBLOCK_UNLOCK(fb);
             return NULL;
         }
     }
@@ -582,7 +592,100 @@ Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p
     COPY_TIMESTAMP(&p->ts,&f->lastts);
     FlowReference(dest, f);
 
-    FBLOCK_UNLOCK(fb);
+    return f;
+}
+
+/** \brief Prefetch the flow hash buckets and flows for a batch of packets
+ *
+ *  First phase of a batched flow lookup: the packets' flow hashes are
+ *  computed by the decoder, so here we issue prefetches for the buckets
+ *  the packets will be looked up in, and then for the first flow in each
+ *  of those buckets. The second phase is the regular lookup through
+ *  FlowGetFlowFromHash() for each packet of the batch, which then
+ *  doesn't stall on a cache miss for every packet.
+ *
+ *  The bucket heads are read without taking the bucket locks. They are
+ *  only used as prefetch hints, and a prefetch of a stale pointer is
+ *  harmless.
+ *
+ *  \param dtv decode thread vars of the thread doing the lookups
+ *  \param packets batch of decoded packets
+ *  \param cnt number of packets in the batch
+ */
+void FlowHashPrefetch(const DecodeThreadVars *dtv, Packet **packets, uint32_t cnt)
+{
+    if (cnt == 0)
+        return;
+
+    const FlowHashPartition *part = dtv ? dtv->flow_partition : NULL;
+    const FlowBucket *fbs[cnt];
+    uint32_t i, n = 0;
+
+    /* buckets: all misses of the batch are in flight at the same time */
+    for (i = 0; i < cnt; i++) {
+        const Packet *p = packets[i];
+        if (!(p->flags & PKT_WANTS_FLOW))
+            continue;
+
+        const FlowBucket *fb;
+        if (part != NULL)
+            fb = &flow_hash[part->min + (p->flow_hash % (part->max - part->min))];
+        else
+            fb = &flow_hash[p->flow_hash % flow_config.hash_size];
+        __builtin_prefetch(fb, 1 /* write */, 3);
+        fbs[n++] = fb;
+    }
+
+    /* flows: by now the first buckets have arrived */
+    for (i = 0; i < n; i++) {
+        const Flow *f = fbs[i]->head;
+        if (f != NULL)
+            __builtin_prefetch(f, 1 /* write */, 3);
+    }
+}
+
+/** \brief Get Flow for packet
+ *
+ * Hash retrieval function for flows. Looks up the hash bucket containing the
+ * flow pointer. Then compares the packet with the found flow to see if it is
+ * the flow we need. If it isn't, walk the list until the right flow is found.
+ *
+ * If the flow is not found or the bucket was emtpy, a new flow is taken from
+ * the queue. FlowDequeue() will alloc new flows as long as we stay within our
+ * memcap limit.
+ *
+ * If the thread owns a flow hash partition, the bucket is picked from the
+ * partition and no bucket lock is taken.
+ *
+ * The p->flow pointer is updated to point to the flow.
+ *
+ *  \param tv thread vars
+ *  \param dtv decode thread vars (for flow log api thread data)
+ *
+ *  \retval f *LOCKED* flow or NULL
+ */
+Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p, Flow **dest)
+{
+    Flow *f = NULL;
+    const uint32_t hash = p->flow_hash;
+    FlowHashPartition *part = dtv ? dtv->flow_partition : NULL;
+
+    if (part != NULL) {
+        /* our own hash rows, claimed by FlowWorker, no locking needed */
+        BUG_ON(SC_ATOMIC_GET(part->claim) != FLOW_PARTITION_OWNER);
+        FlowBucket *fb = &flow_hash[part->min + (hash % (part->max - part->min))];
+        f = FlowGetFlowFromBucket(tv, dtv, p, dest, fb, hash);
+    } else {
+        /* get our hash bucket and lock it */
+        FlowBucket *fb = &flow_hash[hash % flow_config.hash_size];
+        FBLOCK_LOCK(fb);
+        f = FlowGetFlowFromBucket(tv, dtv, p, dest, fb, hash);
+        /* make sure the flow manager checks the row in time */
+        if (f != NULL)
+            FlowWheelFlowUpdate(f);
+        FBLOCK_UNLOCK(fb);
+    }
+
     return f;
 }
 
@@ -603,33 +706,48 @@ Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *p
  */
 static Flow *FlowGetUsedFlow(ThreadVars *tv, DecodeThreadVars *dtv)
 {
-    uint32_t idx = SC_ATOMIC_GET(flow_prune_idx) % flow_config.hash_size;
-    uint32_t cnt = flow_config.hash_size;
+    FlowHashPartition *part = dtv ? dtv->flow_partition : NULL;
+    uint32_t min = 0;
+    uint32_t size = flow_config.hash_size;
+    uint32_t idx;
+
+    if (part != NULL) {
+        min = part->min;
+        size = part->max - part->min;
+        idx = part->prune_idx % size;
+    } else {
+        idx = SC_ATOMIC_GET(flow_prune_idx) % size;
+    }
+    uint32_t cnt = size;
 
     while (cnt--) {
-        if (++idx >= flow_config.hash_size)
+        if (++idx >= size)
             idx = 0;
 
-        FlowBucket *fb = &flow_hash[idx];
+        FlowBucket *fb = &flow_hash[min + idx];
 
-        if (FBLOCK_TRYLOCK(fb) != 0)
+        /* rows in our own partition are not locked */
+        if (part == NULL && FBLOCK_TRYLOCK(fb) != 0)
             continue;
 
         Flow *f = fb->tail;
         if (f == NULL) {
-            FBLOCK_UNLOCK(fb);
+            if (part == NULL)
+                FBLOCK_UNLOCK(fb);
             continue;
         }
 
         if (FLOWLOCK_TRYWRLOCK(f) != 0) {
-            FBLOCK_UNLOCK(fb);
+            if (part == NULL)
+                FBLOCK_UNLOCK(fb);
             continue;
         }
 
         /** never prune a flow that is used by a packet or stream msg
          *  we are currently processing in one of the threads */
         if (SC_ATOMIC_GET(f->use_cnt) > 0) {
-            FBLOCK_UNLOCK(fb);
+            if (part == NULL)
+                FBLOCK_UNLOCK(fb);
             FLOWLOCK_UNLOCK(f);
             continue;
         }
@@ -647,7 +765,8 @@ static Flow *FlowGetUsedFlow(ThreadVars *tv, DecodeThreadVars *dtv)
         f->hnext = NULL;
         f->hprev = NULL;
         f->fb = NULL;
-        FBLOCK_UNLOCK(fb);
+        if (part == NULL)
+            FBLOCK_UNLOCK(fb);
 
         int state = SC_ATOMIC_GET(f->flow_state);
         if (state == FLOW_STATE_NEW)
@@ -670,9 +789,145 @@ static Flow *FlowGetUsedFlow(ThreadVars *tv, DecodeThreadVars *dtv)
 
         FLOWLOCK_UNLOCK(f);
 
-        (void) SC_ATOMIC_ADD(flow_prune_idx, (flow_config.hash_size - cnt));
+        if (part != NULL)
+            part->prune_idx += (size - cnt);
+        else
+            (void) SC_ATOMIC_ADD(flow_prune_idx, (size - cnt));
         return f;
     }
 
     return NULL;
 }
+
+/** flow hash partitions, one per flow worker in thread-local mode */
+static FlowHashPartition **flow_hash_partitions = NULL;
+static uint32_t flow_hash_partitions_cnt = 0;
+static SCMutex flow_hash_partitions_lock = SCMUTEX_INITIALIZER;
+
+/**
+ *  \brief Register a flow hash partition for the calling flow worker
+ *
+ *  Only used if "flow.thread-local-table" is enabled and the runmode
+ *  guarantees that all packets of a flow are handled by the same thread,
+ *  which is the case for the 'workers' and 'single' runmodes.
+ *
+ *  The hash rows are assigned in FlowHashPartitionsSetup() once all
+ *  threads have registered.
+ *
+ *  \retval part partition or NULL if the flow hash is shared
+ */
+FlowHashPartition *FlowHashPartitionRegister(void)
+{
+    if (flow_config.thread_local == 0)
+        return NULL;
+
+    const char *active = RunmodeGetActive();
+    if (RunmodeGetCurrent() == RUNMODE_UNIX_SOCKET || active == NULL ||
+        (strcasecmp(active, "workers") != 0 && strcasecmp(active, "single") != 0))
+    {
+        SCLogWarning(SC_ERR_INVALID_ARGUMENTS, "flow.thread-local-table is "
+                "only supported in the 'workers' and 'single' runmodes, "
+                "using the shared flow hash");
+        flow_config.thread_local = 0;
+        return NULL;
+    }
+
+    FlowHashPartition *part = SCMallocAligned(sizeof(*part), CLS);
+    if (unlikely(part == NULL))
+        return NULL;
+    memset(part, 0, sizeof(*part));
+    SC_ATOMIC_INIT(part->claim);
+    SC_ATOMIC_INIT(part->timeout_gen);
+    SC_ATOMIC_INIT(part->last_seen);
+    SC_ATOMIC_INIT(part->cnt_new);
+    SC_ATOMIC_INIT(part->cnt_est);
+    SC_ATOMIC_INIT(part->cnt_clo);
+    SC_ATOMIC_INIT(part->cnt_tcp_reuse);
+
+    SCMutexLock(&flow_hash_partitions_lock);
+    FlowHashPartition **ptrs = SCRealloc(flow_hash_partitions,
+            (flow_hash_partitions_cnt + 1) * sizeof(FlowHashPartition *));
+    if (unlikely(ptrs == NULL)) {
+        SCMutexUnlock(&flow_hash_partitions_lock);
+        SCFreeAligned(part);
+        return NULL;
+    }
+    flow_hash_partitions = ptrs;
+    flow_hash_partitions[flow_hash_partitions_cnt++] = part;
+    SCMutexUnlock(&flow_hash_partitions_lock);
+
+    return part;
+}
+
+/**
+ *  \brief Divide the flow hash rows over the registered partitions
+ *
+ *  Called after all packet threads are initialized, but before they
+ *  start processing packets.
+ */
+void FlowHashPartitionsSetup(void)
+{
+    SCMutexLock(&flow_hash_partitions_lock);
+    if (flow_hash_partitions_cnt == 0) {
+        SCMutexUnlock(&flow_hash_partitions_lock);
+        return;
+    }
+
+    if (flow_config.hash_size < flow_hash_partitions_cnt) {
+        SCLogError(SC_ERR_INVALID_ARGUMENTS, "flow.hash-size %"PRIu32" is "
+                "smaller than the number of flow hash partitions %"PRIu32,
+                flow_config.hash_size, flow_hash_partitions_cnt);
+        exit(EXIT_FAILURE);
+    }
+
+    uint32_t range = flow_config.hash_size / flow_hash_partitions_cnt;
+    uint32_t u;
+    for (u = 0; u < flow_hash_partitions_cnt; u++) {
+        FlowHashPartition *part = flow_hash_partitions[u];
+        part->min = range * u;
+        if (u == flow_hash_partitions_cnt - 1)
+            part->max = flow_config.hash_size;
+        else
+            part->max = range * (u + 1);
+        /* no timeout pass in progress */
+        part->timeout_idx = part->max;
+        SCLogDebug("partition %u hash range %u %u", u, part->min, part->max);
+    }
+    SCLogInfo("using %"PRIu32" thread-local flow hash partitions of "
+            "%"PRIu32" rows", flow_hash_partitions_cnt, range);
+    SCMutexUnlock(&flow_hash_partitions_lock);
+}
+
+void FlowHashPartitionsFree(void)
+{
+    uint32_t u;
+
+    SCMutexLock(&flow_hash_partitions_lock);
+    for (u = 0; u < flow_hash_partitions_cnt; u++) {
+        FlowHashPartition *part = flow_hash_partitions[u];
+        SC_ATOMIC_DESTROY(part->claim);
+        SC_ATOMIC_DESTROY(part->timeout_gen);
+        SC_ATOMIC_DESTROY(part->cnt_new);
+        SC_ATOMIC_DESTROY(part->cnt_est);
+        SC_ATOMIC_DESTROY(part->cnt_clo);
+        SC_ATOMIC_DESTROY(part->cnt_tcp_reuse);
+        SCFreeAligned(part);
+    }
+    if (flow_hash_partitions != NULL)
+        SCFree(flow_hash_partitions);
+    flow_hash_partitions = NULL;
+    flow_hash_partitions_cnt = 0;
+    SCMutexUnlock(&flow_hash_partitions_lock);
+}
+
+uint32_t FlowHashPartitionCount(void)
+{
+    return flow_hash_partitions_cnt;
+}
+
+FlowHashPartition *FlowHashPartitionGet(uint32_t idx)
+{
+    if (idx >= flow_hash_partitions_cnt)
+        return NULL;
+    return flow_hash_partitions[idx];
+}
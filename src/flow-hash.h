@@ -41,6 +41,10 @@
 typedef struct FlowBucket_ {
     Flow *head;
     Flow *tail;
+    /** second the row is due to be checked for timeouts by the flow
+     *  manager, 0 if not scheduled. Only updated with atomic CAS,
+     *  see flow-wheel.c */
+    uint32_t next_ts;
 #ifdef FBLOCK_MUTEX
     SCMutex m;
 #elif defined FBLOCK_SPIN
@@ -66,11 +70,121 @@ typedef struct FlowBucket_ {
     #error Enable FBLOCK_SPIN or FBLOCK_MUTEX
 #endif
 
+/** states of FlowHashPartition::claim */
+#define FLOW_PARTITION_FREE     0
+#define FLOW_PARTITION_OWNER    1   /**< owner is using the rows */
+#define FLOW_PARTITION_MANAGER  2   /**< manager times out the rows */
+
+/** max hash rows checked per claim in a timeout pass, by the owner per
+ *  packet or by the flow manager between releasing the claim */
+#define FLOW_PARTITION_TIMEOUT_SLICE    256
+
+/** seconds without packets after which the owner is considered idle and
+ *  the flow manager runs its timeout passes */
+#define FLOW_PARTITION_IDLE_TIME        2
+
+/** spins on a claimed partition before yielding the cpu */
+#define FLOW_PARTITION_SPINS            1000
+
+#if defined(__i386__) || defined(__x86_64__)
+#define FLOW_PARTITION_CPU_RELAX() __builtin_ia32_pause()
+#else
+#define FLOW_PARTITION_CPU_RELAX() hw_barrier()
+#endif
+
+/** \brief thread-local partition of the flow hash
+ *
+ *  In thread-local mode ("flow.thread-local-table") each flow worker owns
+ *  the hash rows [min, max). The bucket locks are not used, instead the
+ *  rows may only be accessed by the thread holding the claim. The owner
+ *  claims the partition while handling a packet, which is uncontended
+ *  unless it's idle. The flow manager doesn't walk the rows, instead it
+ *  bumps timeout_gen to ask the owner to run a timeout pass. If the owner
+ *  saw no packets for FLOW_PARTITION_IDLE_TIME seconds, it's idle and the
+ *  manager claims the partition to run the pass itself, a slice at a time
+ *  so that an owner getting packets again waits for one slice at most. */
+typedef struct FlowHashPartition_ {
+    uint32_t min;               /**< first hash row of the partition */
+    uint32_t max;               /**< last hash row + 1 */
+    uint32_t prune_idx;         /**< emergency pruning position (claim holder only) */
+    uint32_t timeout_gen_seen;  /**< last timeout request handled (claim holder only) */
+    uint32_t timeout_idx;       /**< next row of the timeout pass in progress,
+                                     max if none (claim holder only) */
+
+    /** FLOW_PARTITION_FREE, _OWNER or _MANAGER */
+    SC_ATOMIC_DECLARE(int, claim);
+
+    /** timeout request generation, bumped by the flow manager */
+    SC_ATOMIC_DECLARE(uint32_t, timeout_gen);
+
+    /** time in seconds of the last packet the owner handled */
+    SC_ATOMIC_DECLARE(uint32_t, last_seen);
+
+    /** timed out flow counters, collected by the flow manager */
+    SC_ATOMIC_DECLARE(uint32_t, cnt_new);
+    SC_ATOMIC_DECLARE(uint32_t, cnt_est);
+    SC_ATOMIC_DECLARE(uint32_t, cnt_clo);
+    SC_ATOMIC_DECLARE(uint32_t, cnt_tcp_reuse);
+} __attribute__((aligned(CLS))) FlowHashPartition;
+
+/** \brief claim the partition for the owner thread
+ *
+ *  Only waits if the flow manager is running a timeout pass for the
+ *  partition because the owner was idle. */
+static inline void FlowHashPartitionEnter(FlowHashPartition *part)
+{
+    uint32_t spins = 0;
+
+    while (SC_ATOMIC_CAS(&part->claim, FLOW_PARTITION_FREE,
+                FLOW_PARTITION_OWNER) == 0)
+    {
+        if (++spins < FLOW_PARTITION_SPINS) {
+            FLOW_PARTITION_CPU_RELAX();
+        } else {
+            spins = 0;
+            sched_yield();
+        }
+    }
+}
+
+/** \brief record the time of a packet handled by the owner, so that the
+ *         flow manager knows it's not idle */
+static inline void FlowHashPartitionSetLastSeen(FlowHashPartition *part,
+        uint32_t sec)
+{
+    /* don't dirty the cache line for every packet */
+    if (SC_ATOMIC_GET(part->last_seen) != sec)
+        SC_ATOMIC_SET(part->last_seen, sec);
+}
+
+static inline void FlowHashPartitionLeave(FlowHashPartition *part)
+{
+    int r = SC_ATOMIC_CAS(&part->claim, FLOW_PARTITION_OWNER,
+            FLOW_PARTITION_FREE);
+    BUG_ON(r == 0);
+}
+
+/** \brief check if a timeout pass was requested or is in progress
+ *
+ *  \note caller must hold the claim */
+static inline int FlowHashPartitionTimeoutPending(FlowHashPartition *part)
+{
+    return (part->timeout_idx < part->max ||
+            SC_ATOMIC_GET(part->timeout_gen) != part->timeout_gen_seen);
+}
+
 /* prototypes */
 
 Flow *FlowGetFlowFromHash(ThreadVars *tv, DecodeThreadVars *dtv, const Packet *, Flow **);
+void FlowHashPrefetch(const DecodeThreadVars *dtv, Packet **packets, uint32_t cnt);
 
 void FlowDisableTcpReuseHandling(void);
 
+FlowHashPartition *FlowHashPartitionRegister(void);
+void FlowHashPartitionsSetup(void);
+void FlowHashPartitionsFree(void);
+uint32_t FlowHashPartitionCount(void);
+FlowHashPartition *FlowHashPartitionGet(uint32_t);
+
 #endif /* __FLOW_HASH_H__ */
 
@@ -41,6 +41,7 @@
 #include "flow-private.h"
 #include "flow-timeout.h"
 #include "flow-manager.h"
+#include "flow-wheel.h"
 
 #include "stream-tcp-private.h"
 #include "stream-tcp-reassemble.h"
@@ -238,7 +239,7 @@ static int FlowManagerFlowTimeout(const Flow *f, int state, struct timeval *ts,
  *  \retval 0 not timed out just yet
  *  \retval 1 fully timed out, lets kill it
  */
-static int FlowManagerFlowTimedOut(Flow *f, struct timeval *ts)
+static int FlowManagerFlowTimedOut(Flow *f, struct timeval *ts, int owner)
 {
     /** never prune a flow that is used by a packet or stream msg
      *  we are currently processing in one of the threads */
@@ -249,7 +250,10 @@ static int FlowManagerFlowTimedOut(Flow *f, struct timeval *ts)
     int server = 0, client = 0;
     if (!(f->flags & FLOW_TIMEOUT_REASSEMBLY_DONE) &&
             FlowForceReassemblyNeedReassembly(f, &server, &client) == 1) {
-        FlowForceReassemblyForFlow(f, server, client);
+        if (owner)
+            FlowForceReassemblyForFlowNoWait(f, server, client);
+        else
+            FlowForceReassemblyForFlow(f, server, client);
         return 0;
     }
 #ifdef DEBUG
@@ -269,13 +273,18 @@ static int FlowManagerFlowTimedOut(Flow *f, struct timeval *ts)
  *  \param ts timestamp
  *  \param emergency bool indicating emergency mode
  *  \param counters ptr to FlowTimeoutCounters structure
+ *  \param owner bool indicating we're the packet thread owning the row
+ *  \param next_ts if not NULL, set to the second the first of the flows
+ *                 left in the row times out, 0 if the row is empty
  *
  *  \retval cnt timed out flows
  */
 static uint32_t FlowManagerHashRowTimeout(Flow *f, struct timeval *ts,
-        int emergency, FlowTimeoutCounters *counters)
+        int emergency, FlowTimeoutCounters *counters, int owner,
+        uint32_t *next_ts)
 {
     uint32_t cnt = 0;
+    uint32_t next = 0;
 
     do {
         /* check flow timeout based on lastts and state. Both can be
@@ -287,13 +296,20 @@ static uint32_t FlowManagerHashRowTimeout(Flow *f, struct timeval *ts,
 
         /* timeout logic goes here */
         if (FlowManagerFlowTimeout(f, state, ts, emergency) == 0) {
+            uint32_t flow_next = (uint32_t)f->lastts.tv_sec +
+                FlowGetFlowTimeout(f, state, emergency) + 1;
+            if (next == 0 || flow_next < next)
+                next = flow_next;
+
             f = f->hprev;
             continue;
         }
 
         /* before grabbing the flow lock, make sure we have at least
-         * 3 packets in the pool */
-        PacketPoolWaitForN(3);
+         * 3 packets in the pool. The owner thread can't wait on its
+         * own pool, its pseudo packets are alloc'd if the pool is empty. */
+        if (!owner)
+            PacketPoolWaitForN(3);
 
         FLOWLOCK_WRLOCK(f);
 
@@ -301,7 +317,7 @@ static uint32_t FlowManagerHashRowTimeout(Flow *f, struct timeval *ts,
 
         /* check if the flow is fully timed out and
          * ready to be discarded. */
-        if (FlowManagerFlowTimedOut(f, ts) == 1) {
+        if (FlowManagerFlowTimedOut(f, ts, owner) == 1) {
             /* remove from the hash */
             if (f->hprev != NULL)
                 f->hprev->hnext = f->hnext;
@@ -354,14 +370,43 @@ static uint32_t FlowManagerHashRowTimeout(Flow *f, struct timeval *ts,
             }
         } else {
             FLOWLOCK_UNLOCK(f);
+
+            /* timed out, but still in use: try again next second */
+            if (next == 0 || (uint32_t)ts->tv_sec + 1 < next)
+                next = (uint32_t)ts->tv_sec + 1;
         }
 
         f = next_flow;
     } while (f != NULL);
 
+    if (next_ts != NULL)
+        *next_ts = next;
     return cnt;
 }
 
+typedef struct FlowManagerThreadData_ {
+    uint32_t instance;
+    uint32_t min;
+    uint32_t max;
+
+    /** the hash rows were all walked once, so the timer wheel is
+     *  complete and can be used from now on */
+    int wheel_ready;
+    /** all rows were checked against the emergency timeouts */
+    int wheel_emerg;
+    /** rows due according to the timer wheel */
+    uint32_t *rows;
+    uint32_t rows_size;
+
+    uint16_t flow_mgr_cnt_clo;
+    uint16_t flow_mgr_cnt_new;
+    uint16_t flow_mgr_cnt_est;
+    uint16_t flow_mgr_spare;
+    uint16_t flow_emerg_mode_enter;
+    uint16_t flow_emerg_mode_over;
+    uint16_t flow_tcp_reuse;
+} FlowManagerThreadData;
+
 /**
  *  \brief time out flows from the hash
  *
@@ -387,12 +432,18 @@ static uint32_t FlowTimeoutHash(struct timeval *ts, uint32_t try_cnt,
     for (idx = hash_min; idx < hash_max; idx++) {
         FlowBucket *fb = &flow_hash[idx];
 
+        /* the row is checked now, so its timer wheel entry is dropped.
+         * This also recovers rows the wheel lost track of. */
+        FlowWheelRowReset(idx);
+
         /* before grabbing the row lock, make sure we have at least
          * 9 packets in the pool */
         PacketPoolWaitForN(9);
 
-        if (FBLOCK_TRYLOCK(fb) != 0)
+        if (FBLOCK_TRYLOCK(fb) != 0) {
+            FlowWheelRescheduleRow(idx, (uint32_t)ts->tv_sec + 1);
             continue;
+        }
 
         /* flow hash bucket is now locked */
 
@@ -400,7 +451,13 @@ static uint32_t FlowTimeoutHash(struct timeval *ts, uint32_t try_cnt,
             goto next;
 
         /* we have a flow, or more than one */
-        cnt += FlowManagerHashRowTimeout(fb->tail, ts, emergency, counters);
+        uint32_t next_ts = 0;
+        cnt += FlowManagerHashRowTimeout(fb->tail, ts, emergency, counters, 0,
+                &next_ts);
+
+        /* fill the timer wheel */
+        if (next_ts != 0)
+            FlowWheelRescheduleRow(idx, next_ts);
 
 next:
         FBLOCK_UNLOCK(fb);
@@ -412,6 +469,213 @@ next:
     return cnt;
 }
 
+/**
+ *  \brief time out flows in the hash rows that are due according to the
+ *         timer wheel
+ *
+ *  \param ftd flow manager thread data
+ *  \param ts timestamp
+ *  \param emergency bool indicating emergency mode
+ *  \param all bool to check all scheduled rows, not just the due ones
+ *  \param counters ptr to FlowTimeoutCounters structure
+ *
+ *  \retval cnt number of timed out flow
+ */
+static uint32_t FlowTimeoutWheel(FlowManagerThreadData *ftd, struct timeval *ts,
+        int emergency, int all, FlowTimeoutCounters *counters)
+{
+    uint32_t cnt = 0;
+    uint32_t u;
+    uint32_t rows;
+
+    if (all) {
+        rows = FlowWheelExpireAll(ftd->instance - 1, &ftd->rows, &ftd->rows_size);
+    } else {
+        rows = FlowWheelExpire(ftd->instance - 1, (uint32_t)ts->tv_sec,
+                &ftd->rows, &ftd->rows_size);
+    }
+
+    for (u = 0; u < rows; u++) {
+        uint32_t idx = ftd->rows[u];
+        FlowBucket *fb = &flow_hash[idx];
+
+        /* before grabbing the row lock, make sure we have at least
+         * 9 packets in the pool */
+        PacketPoolWaitForN(9);
+
+        if (FBLOCK_TRYLOCK(fb) != 0) {
+            FlowWheelRescheduleRow(idx, (uint32_t)ts->tv_sec + 1);
+            continue;
+        }
+
+        uint32_t next_ts = 0;
+        if (fb->tail != NULL) {
+            cnt += FlowManagerHashRowTimeout(fb->tail, ts, emergency, counters,
+                    0, &next_ts);
+        }
+        FBLOCK_UNLOCK(fb);
+
+        if (next_ts != 0)
+            FlowWheelRescheduleRow(idx, next_ts);
+    }
+
+    return cnt;
+}
+
+/**
+ *  \internal
+ *  \brief run (part of) a timeout pass over a thread-local partition
+ *
+ *  A pass is started for a new timeout request. The rows are only
+ *  accessed by the holder of the partition's claim, so no row locks are
+ *  needed. Flow timeout pseudo packets are injected into the owner's own
+ *  stream queue.
+ *
+ *  \param part partition, claimed by the caller
+ *  \param max_rows max rows to check, 0 to finish the pass
+ *  \param owner bool indicating we're the packet thread owning the rows
+ *  \param counters ptr to FlowTimeoutCounters structure
+ */
+static void FlowTimeoutPartitionRows(FlowHashPartition *part, uint32_t max_rows,
+        int owner, FlowTimeoutCounters *counters)
+{
+    struct timeval ts;
+    int emergency = 0;
+
+    /* start a new pass if we're done with the last one */
+    if (part->timeout_idx >= part->max) {
+        uint32_t gen = SC_ATOMIC_GET(part->timeout_gen);
+        if (gen == part->timeout_gen_seen)
+            return;
+        part->timeout_gen_seen = gen;
+        part->timeout_idx = part->min;
+    }
+
+    if (SC_ATOMIC_GET(flow_flags) & FLOW_EMERGENCY)
+        emergency = 1;
+
+    memset(&ts, 0, sizeof(ts));
+    TimeGet(&ts);
+
+    uint32_t end = part->max;
+    if (max_rows != 0 && part->max - part->timeout_idx > max_rows)
+        end = part->timeout_idx + max_rows;
+
+    for ( ; part->timeout_idx < end; part->timeout_idx++) {
+        FlowBucket *fb = &flow_hash[part->timeout_idx];
+        if (fb->tail == NULL)
+            continue;
+
+        (void)FlowManagerHashRowTimeout(fb->tail, &ts, emergency, counters,
+                owner, NULL);
+    }
+}
+
+/**
+ *  \brief time out flows in a thread-local flow hash partition
+ *
+ *  Called by the flow worker owning the partition, with the partition
+ *  claimed, while a timeout pass is pending. The pass is spread over
+ *  packets, FLOW_PARTITION_TIMEOUT_SLICE rows at a time, to bound the
+ *  time it takes on the packet path.
+ *
+ *  \param part the calling thread's partition
+ */
+void FlowTimeoutPartition(FlowHashPartition *part)
+{
+    FlowTimeoutCounters counters = { 0, 0, 0, 0, };
+
+    FlowTimeoutPartitionRows(part, FLOW_PARTITION_TIMEOUT_SLICE, 1, &counters);
+
+    if (counters.new)
+        (void)SC_ATOMIC_ADD(part->cnt_new, counters.new);
+    if (counters.est)
+        (void)SC_ATOMIC_ADD(part->cnt_est, counters.est);
+    if (counters.clo)
+        (void)SC_ATOMIC_ADD(part->cnt_clo, counters.clo);
+    if (counters.tcp_reuse)
+        (void)SC_ATOMIC_ADD(part->cnt_tcp_reuse, counters.tcp_reuse);
+}
+
+/**
+ *  \internal
+ *  \brief ask the owner of a thread-local flow hash partition to time
+ *         out its flows
+ *
+ *  The counters of the previous timeout passes are collected. If the
+ *  owner saw no packets for FLOW_PARTITION_IDLE_TIME seconds it's idle,
+ *  so we run its pending pass ourselves. Otherwise the flows of a quiet
+ *  thread would never time out. The pass is done in slices, releasing the
+ *  claim in between, and left to the owner as soon as it gets packets
+ *  again.
+ *
+ *  \param part partition
+ *  \param ts current time
+ *  \param counters ptr to FlowTimeoutCounters structure
+ */
+static void FlowTimeoutPartitionRequest(FlowHashPartition *part,
+        struct timeval *ts, FlowTimeoutCounters *counters)
+{
+    uint32_t v;
+
+    v = SC_ATOMIC_GET(part->cnt_new);
+    (void)SC_ATOMIC_SUB(part->cnt_new, v);
+    counters->new += v;
+    v = SC_ATOMIC_GET(part->cnt_est);
+    (void)SC_ATOMIC_SUB(part->cnt_est, v);
+    counters->est += v;
+    v = SC_ATOMIC_GET(part->cnt_clo);
+    (void)SC_ATOMIC_SUB(part->cnt_clo, v);
+    counters->clo += v;
+    v = SC_ATOMIC_GET(part->cnt_tcp_reuse);
+    (void)SC_ATOMIC_SUB(part->cnt_tcp_reuse, v);
+    counters->tcp_reuse += v;
+
+    while ((uint32_t)ts->tv_sec - SC_ATOMIC_GET(part->last_seen) >=
+            FLOW_PARTITION_IDLE_TIME)
+    {
+        /* a busy owner holds the claim */
+        if (SC_ATOMIC_CAS(&part->claim, FLOW_PARTITION_FREE,
+                    FLOW_PARTITION_MANAGER) == 0)
+            break;
+
+        int pending = FlowHashPartitionTimeoutPending(part);
+        if (pending) {
+            SCLogDebug("partition %u-%u: owner idle, timing out its flows",
+                    part->min, part->max);
+            FlowTimeoutPartitionRows(part, FLOW_PARTITION_TIMEOUT_SLICE, 0,
+                    counters);
+        }
+        (void)SC_ATOMIC_CAS(&part->claim, FLOW_PARTITION_MANAGER,
+                FLOW_PARTITION_FREE);
+
+        if (!pending)
+            break;
+    }
+
+    (void)SC_ATOMIC_ADD(part->timeout_gen, 1);
+}
+
+/**
+ *  \brief ask the owners of the thread-local flow hash partitions to
+ *         time out their flows
+ *
+ *  Each manager instance handles its share of the partitions.
+ *
+ *  \param instance flow manager instance (starts at 1)
+ *  \param counters ptr to FlowTimeoutCounters structure
+ */
+static void FlowTimeoutPartitionsRequest(uint32_t instance,
+        struct timeval *ts, FlowTimeoutCounters *counters)
+{
+    uint32_t cnt = FlowHashPartitionCount();
+    uint32_t u;
+
+    for (u = instance - 1; u < cnt; u += flowmgr_number) {
+        FlowTimeoutPartitionRequest(FlowHashPartitionGet(u), ts, counters);
+    }
+}
+
 /**
  *  \internal
  *
@@ -495,20 +759,6 @@ static uint32_t FlowCleanupHash(void){
 
 extern int g_detect_disabled;
 
-typedef struct FlowManagerThreadData_ {
-    uint32_t instance;
-    uint32_t min;
-    uint32_t max;
-
-    uint16_t flow_mgr_cnt_clo;
-    uint16_t flow_mgr_cnt_new;
-    uint16_t flow_mgr_cnt_est;
-    uint16_t flow_mgr_spare;
-    uint16_t flow_emerg_mode_enter;
-    uint16_t flow_emerg_mode_over;
-    uint16_t flow_tcp_reuse;
-} FlowManagerThreadData;
-
 static TmEcode FlowManagerThreadInit(ThreadVars *t, void *initdata, void **data)
 {
     FlowManagerThreadData *ftd = SCCalloc(1, sizeof(FlowManagerThreadData));
@@ -551,7 +801,11 @@ static TmEcode FlowManagerThreadInit(ThreadVars *t, void *initdata, void **data)
 
 static TmEcode FlowManagerThreadDeinit(ThreadVars *t, void *data)
 {
+    FlowManagerThreadData *ftd = data;
+
     PacketPoolDestroy();
+    if (ftd->rows != NULL)
+        SCFree(ftd->rows);
     SCFree(data);
     return TM_ECODE_OK;
 }
@@ -615,7 +869,27 @@ static TmEcode FlowManager(ThreadVars *th_v, void *thread_data)
 
         /* try to time out flows */
         FlowTimeoutCounters counters = { 0, 0, 0, 0, };
-        FlowTimeoutHash(&ts, 0 /* check all */, ftd->min, ftd->max, &counters);
+        if (flow_config.thread_local && FlowHashPartitionCount() > 0) {
+            /* the flow workers time out their own partitions */
+            FlowTimeoutPartitionsRequest(ftd->instance, &ts, &counters);
+        } else if (ftd->wheel_ready && !FlowWheelOverflowed(ftd->instance - 1)) {
+            /* only check the rows with flows that are due. When entering
+             * emergency mode the rows are still scheduled for the normal
+             * timeouts, so all rows with flows are checked once. They are
+             * then rescheduled for the emergency timeouts. */
+            int all = (emerg == TRUE && ftd->wheel_emerg == 0);
+            FlowTimeoutWheel(ftd, &ts, emerg == TRUE, all, &counters);
+            ftd->wheel_emerg = (emerg == TRUE);
+        } else {
+            /* walk all rows: the first time to fill the timer wheel with
+             * the flows from before it was set up, and when the wheel
+             * lost track of rows it couldn't schedule */
+            FlowTimeoutHash(&ts, 0 /* check all */, ftd->min, ftd->max, &counters);
+            if (FlowWheelsEnabled()) {
+                ftd->wheel_ready = 1;
+                ftd->wheel_emerg = (emerg == TRUE);
+            }
+        }
 
 
         if (ftd->instance == 1) {
@@ -636,10 +910,7 @@ static TmEcode FlowManager(ThreadVars *th_v, void *thread_data)
         StatsAddUI64(th_v, ftd->flow_mgr_cnt_est, (uint64_t)counters.est);
         StatsAddUI64(th_v, ftd->flow_tcp_reuse, (uint64_t)counters.tcp_reuse);
 
-        uint32_t len = 0;
-        FQLOCK_LOCK(&flow_spare_q);
-        len = flow_spare_q.len;
-        FQLOCK_UNLOCK(&flow_spare_q);
+        uint32_t len = FlowSpareQueueLen();
         StatsSetUI64(th_v, ftd->flow_mgr_spare, (uint64_t)len);
 
         /* Don't fear, FlowManagerThread is here...
@@ -704,6 +975,10 @@ static uint64_t FlowGetMemuse(void)
 /** \brief spawn the flow manager thread */
 void FlowManagerThreadSpawn()
 {
+    /* all packet threads are initialized at this point, so the
+     * thread-local flow hash partitions can be set up */
+    FlowHashPartitionsSetup();
+
 #ifdef AFLFUZZ_DISABLE_MGTTHREADS
     return;
 #endif
@@ -718,6 +993,15 @@ void FlowManagerThreadSpawn()
     flowmgr_number = (uint32_t)setting;
 
     SCLogInfo("using %u flow manager threads", flowmgr_number);
+
+    /* with thread-local partitions the workers time out their own flows */
+    if (flow_config.timer_wheel &&
+            !(flow_config.thread_local && FlowHashPartitionCount() > 0)) {
+        if (FlowWheelsSetup(flowmgr_number) != 0) {
+            SCLogWarning(SC_ERR_MEM_ALLOC, "flow timer wheel setup failed, "
+                    "flow managers will walk the whole flow hash");
+        }
+    }
     SCCtrlCondInit(&flow_manager_ctrl_cond, NULL);
     SCCtrlMutexInit(&flow_manager_ctrl_mutex, NULL);
 
@@ -1049,7 +1333,7 @@ static int FlowMgrTest01 (void)
     f.proto = IPPROTO_TCP;
 
     int state = SC_ATOMIC_GET(f.flow_state);
-    if (FlowManagerFlowTimeout(&f, state, &ts, 0) != 1 && FlowManagerFlowTimedOut(&f, &ts) != 1) {
+    if (FlowManagerFlowTimeout(&f, state, &ts, 0) != 1 && FlowManagerFlowTimedOut(&f, &ts, 0) != 1) {
         FBLOCK_DESTROY(&fb);
         FLOW_DESTROY(&f);
         FlowQueueDestroy(&flow_spare_q);
@@ -1108,7 +1392,7 @@ static int FlowMgrTest02 (void)
     f.proto = IPPROTO_TCP;
 
     int state = SC_ATOMIC_GET(f.flow_state);
-    if (FlowManagerFlowTimeout(&f, state, &ts, 0) != 1 && FlowManagerFlowTimedOut(&f, &ts) != 1) {
+    if (FlowManagerFlowTimeout(&f, state, &ts, 0) != 1 && FlowManagerFlowTimedOut(&f, &ts, 0) != 1) {
         FBLOCK_DESTROY(&fb);
         FLOW_DESTROY(&f);
         FlowQueueDestroy(&flow_spare_q);
@@ -1155,7 +1439,7 @@ static int FlowMgrTest03 (void)
     f.flags |= FLOW_EMERGENCY;
 
     int state = SC_ATOMIC_GET(f.flow_state);
-    if (FlowManagerFlowTimeout(&f, state, &ts, 0) != 1 && FlowManagerFlowTimedOut(&f, &ts) != 1) {
+    if (FlowManagerFlowTimeout(&f, state, &ts, 0) != 1 && FlowManagerFlowTimedOut(&f, &ts, 0) != 1) {
         FBLOCK_DESTROY(&fb);
         FLOW_DESTROY(&f);
         FlowQueueDestroy(&flow_spare_q);
@@ -1215,7 +1499,7 @@ static int FlowMgrTest04 (void)
     f.flags |= FLOW_EMERGENCY;
 
     int state = SC_ATOMIC_GET(f.flow_state);
-    if (FlowManagerFlowTimeout(&f, state, &ts, 0) != 1 && FlowManagerFlowTimedOut(&f, &ts) != 1) {
+    if (FlowManagerFlowTimeout(&f, state, &ts, 0) != 1 && FlowManagerFlowTimedOut(&f, &ts, 0) != 1) {
         FBLOCK_DESTROY(&fb);
         FLOW_DESTROY(&f);
         FlowQueueDestroy(&flow_spare_q);
@@ -1278,6 +1562,123 @@ static int FlowMgrTest05 (void)
     FlowShutdown();
     return result;
 }
+
+static void FlowMgrTestPartitionInit(FlowHashPartition *part)
+{
+    memset(part, 0, sizeof(*part));
+    SC_ATOMIC_INIT(part->claim);
+    SC_ATOMIC_INIT(part->timeout_gen);
+    SC_ATOMIC_INIT(part->last_seen);
+    SC_ATOMIC_INIT(part->cnt_new);
+    SC_ATOMIC_INIT(part->cnt_est);
+    SC_ATOMIC_INIT(part->cnt_clo);
+    SC_ATOMIC_INIT(part->cnt_tcp_reuse);
+    part->min = 0;
+    part->max = flow_config.hash_size;
+    part->timeout_idx = part->max;
+}
+
+/**
+ *  \test Test the thread-local partition timeout pass, requested through
+ *        the partition's timeout generation and spread over calls.
+ *
+ *  \retval On success it returns 1 and on failure 0.
+ */
+static int FlowMgrTest06 (void)
+{
+    int result = 0;
+    FlowHashPartition part;
+    uint32_t calls = 0;
+
+    FlowInitConfig(FLOW_QUIET);
+    FlowMgrTestPartitionInit(&part);
+
+    UTHBuildPacketOfFlows(0, 10, 0);
+
+    if (FlowHashPartitionTimeoutPending(&part))
+        goto end;
+
+    /* request a timeout pass like the flow manager would */
+    (void)SC_ATOMIC_ADD(part.timeout_gen, 1);
+    if (!(FlowHashPartitionTimeoutPending(&part)))
+        goto end;
+
+    /* should time out normal */
+    TimeSetIncrementTime(2000);
+    while (FlowHashPartitionTimeoutPending(&part)) {
+        FlowTimeoutPartition(&part);
+        calls++;
+    }
+    /* no more than a slice of rows per call */
+    if (calls < flow_config.hash_size / FLOW_PARTITION_TIMEOUT_SLICE)
+        goto end;
+
+    if (flow_recycle_q.len == 0)
+        goto end;
+    if (SC_ATOMIC_GET(part.cnt_new) + SC_ATOMIC_GET(part.cnt_est) +
+        SC_ATOMIC_GET(part.cnt_clo) != flow_recycle_q.len)
+        goto end;
+
+    result = 1;
+end:
+    FlowShutdown();
+    return result;
+}
+
+/**
+ *  \test Test that the flow manager times out the flows of a partition
+ *        whose owner is idle, but not of one whose owner is busy or
+ *        recently saw packets.
+ *
+ *  \retval On success it returns 1 and on failure 0.
+ */
+static int FlowMgrTest07 (void)
+{
+    int result = 0;
+    FlowHashPartition part;
+    FlowTimeoutCounters counters = { 0, 0, 0, 0, };
+    struct timeval ts;
+
+    FlowInitConfig(FLOW_QUIET);
+    FlowMgrTestPartitionInit(&part);
+
+    UTHBuildPacketOfFlows(0, 10, 0);
+    TimeSetIncrementTime(2000);
+    memset(&ts, 0, sizeof(ts));
+    TimeGet(&ts);
+
+    /* owner got a packet just now: it runs the pass itself */
+    SC_ATOMIC_SET(part.last_seen, (uint32_t)ts.tv_sec);
+    FlowTimeoutPartitionRequest(&part, &ts, &counters);
+    FlowTimeoutPartitionRequest(&part, &ts, &counters);
+    if (flow_recycle_q.len != 0)
+        goto end;
+
+    /* owner idle, but holding the claim: manager leaves the rows alone */
+    SC_ATOMIC_SET(part.last_seen,
+            (uint32_t)ts.tv_sec - FLOW_PARTITION_IDLE_TIME);
+    FlowHashPartitionEnter(&part);
+    FlowTimeoutPartitionRequest(&part, &ts, &counters);
+    FlowHashPartitionLeave(&part);
+    if (flow_recycle_q.len != 0)
+        goto end;
+
+    /* owner idle: the manager runs the pending pass, slice by slice */
+    FlowTimeoutPartitionRequest(&part, &ts, &counters);
+    if (flow_recycle_q.len == 0)
+        goto end;
+    if (counters.new + counters.est + counters.clo != flow_recycle_q.len)
+        goto end;
+    if (part.timeout_idx < part.max)
+        goto end;
+    if (SC_ATOMIC_GET(part.claim) != FLOW_PARTITION_FREE)
+        goto end;
+
+    result = 1;
+end:
+    FlowShutdown();
+    return result;
+}
 #endif /* UNITTESTS */
 
 /**
@@ -1296,5 +1697,9 @@ void FlowMgrRegisterTests (void)
                    FlowMgrTest04);
     UtRegisterTest("FlowMgrTest05 -- Test flow Allocations when it reach memcap",
                    FlowMgrTest05);
+    UtRegisterTest("FlowMgrTest06 -- Time out flows in a thread-local hash partition",
+                   FlowMgrTest06);
+    UtRegisterTest("FlowMgrTest07 -- Time out flows of an idle partition owner",
+                   FlowMgrTest07);
 #endif /* UNITTESTS */
 }
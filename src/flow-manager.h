@@ -33,6 +33,9 @@ void FlowManagerThreadSpawn(void);
 void FlowDisableFlowManagerThread(void);
 void FlowMgrRegisterTests (void);
 
+struct FlowHashPartition_;
+void FlowTimeoutPartition(struct FlowHashPartition_ *);
+
 /** flow recycler scheduling condition */
 SCCtrlCondT flow_recycler_ctrl_cond;
 SCCtrlMutex flow_recycler_ctrl_mutex;
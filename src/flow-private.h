@@ -28,6 +28,8 @@
 #include "flow-queue.h"
 
 #include "util-atomic.h"
+#include "util-numa.h"
+#include "util-hugepage.h"
 
 /* global flow flags */
 
@@ -77,6 +79,8 @@ FlowProto flow_proto[FLOW_PROTO_MAX];
 
 /** spare/unused/prealloced flows live here */
 FlowQueue flow_spare_q;
+/** spare flows of the other NUMA nodes, node 0 uses flow_spare_q */
+FlowQueue flow_spare_node_q[NUMA_MAX_NODES];
 
 /** queue to pass flows to cleanup/log thread(s) */
 FlowQueue flow_recycle_q;
@@ -84,8 +88,19 @@ FlowQueue flow_recycle_q;
 FlowBucket *flow_hash;
 FlowConfig flow_config;
 
+/** huge page arena the flows are allocated from, NULL if not in use */
+HugepageArena *flow_arena;
+
 /** flow memuse counter (atomic), for enforcing memcap limit */
 SC_ATOMIC_DECLARE(long long unsigned int, flow_memuse);
 
+/** \brief get the spare queue holding the flows allocated on a node */
+static inline FlowQueue *FlowSpareQueue(uint32_t node)
+{
+    if (node == 0 || node >= NUMA_MAX_NODES)
+        return &flow_spare_q;
+    return &flow_spare_node_q[node];
+}
+
 #endif /* __FLOW_PRIVATE_H__ */
 
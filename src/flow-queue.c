@@ -135,6 +135,23 @@ Flow *FlowDequeue (FlowQueue *q)
     return f;
 }
 
+/**
+ *  \brief Get the number of spare flows, over all nodes
+ */
+uint32_t FlowSpareQueueLen(void)
+{
+    uint32_t len = 0;
+    uint32_t n;
+
+    for (n = 0; n < NumaNodeCount(); n++) {
+        FlowQueue *q = FlowSpareQueue(n);
+        FQLOCK_LOCK(q);
+        len += q->len;
+        FQLOCK_UNLOCK(q);
+    }
+    return len;
+}
+
 /**
  *  \brief Transfer a flow from a queue to the spare queue
  *
@@ -145,24 +162,25 @@ Flow *FlowDequeue (FlowQueue *q)
  */
 void FlowMoveToSpare(Flow *f)
 {
-    /* now put it in spare */
-    FQLOCK_LOCK(&flow_spare_q);
+    /* now put it in the spare queue of the node the flow lives on */
+    FlowQueue *q = FlowSpareQueue(f->numa_node);
+    FQLOCK_LOCK(q);
 
     /* add to new queue (append) */
-    f->lprev = flow_spare_q.bot;
+    f->lprev = q->bot;
     if (f->lprev != NULL)
         f->lprev->lnext = f;
     f->lnext = NULL;
-    flow_spare_q.bot = f;
-    if (flow_spare_q.top == NULL)
-        flow_spare_q.top = f;
+    q->bot = f;
+    if (q->top == NULL)
+        q->top = f;
 
-    flow_spare_q.len++;
+    q->len++;
 #ifdef DBG_PERF
-    if (flow_spare_q.len > flow_spare_q.dbg_maxlen)
-        flow_spare_q.dbg_maxlen = flow_spare_q.len;
+    if (q->len > q->dbg_maxlen)
+        q->dbg_maxlen = q->len;
 #endif /* DBG_PERF */
 
-    FQLOCK_UNLOCK(&flow_spare_q);
+    FQLOCK_UNLOCK(q);
 }
 
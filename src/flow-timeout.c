@@ -258,13 +258,27 @@ static inline Packet *FlowForceReassemblyPseudoPacketSetup(Packet *p,
     return p;
 }
 
+/**
+ * \param nowait don't wait for the packet pool, alloc a packet if it's
+ *               empty. Used by the thread owning the pool, as only it
+ *               can return packets to it.
+ */
 static inline Packet *FlowForceReassemblyPseudoPacketGet(int direction,
                                                          Flow *f,
                                                          TcpSession *ssn,
-                                                         int dummy)
+                                                         int dummy,
+                                                         int nowait)
 {
-    PacketPoolWait();
-    Packet *p = PacketPoolGetPacket();
+    Packet *p;
+
+    if (nowait) {
+        p = PacketPoolGetPacket();
+        if (p == NULL)
+            p = PacketGetFromAlloc();
+    } else {
+        PacketPoolWait();
+        p = PacketPoolGetPacket();
+    }
     if (p == NULL) {
         return NULL;
     }
@@ -352,10 +366,12 @@ int FlowForceReassemblyNeedReassembly(Flow *f, int *server, int *client)
  * \param f Pointer to the flow.
  * \param server action required for server: 1 or 2
  * \param client action required for client: 1 or 2
+ * \param nowait don't wait for packets in the calling thread's pool
  *
  * \retval 0 This flow doesn't need any reassembly processing; 1 otherwise.
  */
-int FlowForceReassemblyForFlow(Flow *f, int server, int client)
+static int FlowForceReassemblyForFlowDo(Flow *f, int server, int client,
+                                        int nowait)
 {
     Packet *p1 = NULL, *p2 = NULL, *p3 = NULL;
     TcpSession *ssn;
@@ -381,14 +397,14 @@ int FlowForceReassemblyForFlow(Flow *f, int server, int client)
 
     /* insert a pseudo packet in the toserver direction */
     if (client == STREAM_HAS_UNPROCESSED_SEGMENTS_NEED_REASSEMBLY) {
-        p1 = FlowForceReassemblyPseudoPacketGet(1, f, ssn, 0);
+        p1 = FlowForceReassemblyPseudoPacketGet(1, f, ssn, 0, nowait);
         if (p1 == NULL) {
             goto done;
         }
         PKT_SET_SRC(p1, PKT_SRC_FFR);
 
         if (server == STREAM_HAS_UNPROCESSED_SEGMENTS_NEED_REASSEMBLY) {
-            p2 = FlowForceReassemblyPseudoPacketGet(0, f, ssn, 0);
+            p2 = FlowForceReassemblyPseudoPacketGet(0, f, ssn, 0, nowait);
             if (p2 == NULL) {
                 FlowDeReference(&p1->flow);
                 TmqhOutputPacketpool(NULL, p1);
@@ -396,7 +412,7 @@ int FlowForceReassemblyForFlow(Flow *f, int server, int client)
             }
             PKT_SET_SRC(p2, PKT_SRC_FFR);
 
-            p3 = FlowForceReassemblyPseudoPacketGet(1, f, ssn, 1);
+            p3 = FlowForceReassemblyPseudoPacketGet(1, f, ssn, 1, nowait);
             if (p3 == NULL) {
                 FlowDeReference(&p1->flow);
                 TmqhOutputPacketpool(NULL, p1);
@@ -406,7 +422,7 @@ int FlowForceReassemblyForFlow(Flow *f, int server, int client)
             }
             PKT_SET_SRC(p3, PKT_SRC_FFR);
         } else {
-            p2 = FlowForceReassemblyPseudoPacketGet(0, f, ssn, 1);
+            p2 = FlowForceReassemblyPseudoPacketGet(0, f, ssn, 1, nowait);
             if (p2 == NULL) {
                 FlowDeReference(&p1->flow);
                 TmqhOutputPacketpool(NULL, p1);
@@ -417,13 +433,13 @@ int FlowForceReassemblyForFlow(Flow *f, int server, int client)
 
     } else if (client == STREAM_HAS_UNPROCESSED_SEGMENTS_NEED_ONLY_DETECTION) {
         if (server == STREAM_HAS_UNPROCESSED_SEGMENTS_NEED_REASSEMBLY) {
-            p1 = FlowForceReassemblyPseudoPacketGet(0, f, ssn, 0);
+            p1 = FlowForceReassemblyPseudoPacketGet(0, f, ssn, 0, nowait);
             if (p1 == NULL) {
                 goto done;
             }
             PKT_SET_SRC(p1, PKT_SRC_FFR);
 
-            p2 = FlowForceReassemblyPseudoPacketGet(1, f, ssn, 1);
+            p2 = FlowForceReassemblyPseudoPacketGet(1, f, ssn, 1, nowait);
             if (p2 == NULL) {
                 FlowDeReference(&p1->flow);
                 TmqhOutputPacketpool(NULL, p1);
@@ -431,14 +447,14 @@ int FlowForceReassemblyForFlow(Flow *f, int server, int client)
             }
             PKT_SET_SRC(p2, PKT_SRC_FFR);
         } else {
-            p1 = FlowForceReassemblyPseudoPacketGet(0, f, ssn, 1);
+            p1 = FlowForceReassemblyPseudoPacketGet(0, f, ssn, 1, nowait);
             if (p1 == NULL) {
                 goto done;
             }
             PKT_SET_SRC(p1, PKT_SRC_FFR);
 
             if (server == STREAM_HAS_UNPROCESSED_SEGMENTS_NEED_ONLY_DETECTION) {
-                p2 = FlowForceReassemblyPseudoPacketGet(1, f, ssn, 1);
+                p2 = FlowForceReassemblyPseudoPacketGet(1, f, ssn, 1, nowait);
                 if (p2 == NULL) {
                     FlowDeReference(&p1->flow);
                     TmqhOutputPacketpool(NULL, p1);
@@ -450,13 +466,13 @@ int FlowForceReassemblyForFlow(Flow *f, int server, int client)
 
     } else {
         if (server == STREAM_HAS_UNPROCESSED_SEGMENTS_NEED_REASSEMBLY) {
-            p1 = FlowForceReassemblyPseudoPacketGet(0, f, ssn, 0);
+            p1 = FlowForceReassemblyPseudoPacketGet(0, f, ssn, 0, nowait);
             if (p1 == NULL) {
                 goto done;
             }
             PKT_SET_SRC(p1, PKT_SRC_FFR);
 
-            p2 = FlowForceReassemblyPseudoPacketGet(1, f, ssn, 1);
+            p2 = FlowForceReassemblyPseudoPacketGet(1, f, ssn, 1, nowait);
             if (p2 == NULL) {
                 FlowDeReference(&p1->flow);
                 TmqhOutputPacketpool(NULL, p1);
@@ -464,7 +480,7 @@ int FlowForceReassemblyForFlow(Flow *f, int server, int client)
             }
             PKT_SET_SRC(p2, PKT_SRC_FFR);
         } else if (server == STREAM_HAS_UNPROCESSED_SEGMENTS_NEED_ONLY_DETECTION) {
-            p1 = FlowForceReassemblyPseudoPacketGet(1, f, ssn, 1);
+            p1 = FlowForceReassemblyPseudoPacketGet(1, f, ssn, 1, nowait);
             if (p1 == NULL) {
                 goto done;
             }
@@ -498,6 +514,23 @@ done:
     return 1;
 }
 
+int FlowForceReassemblyForFlow(Flow *f, int server, int client)
+{
+    return FlowForceReassemblyForFlowDo(f, server, client, 0);
+}
+
+/**
+ * \brief Forces reassembly for flow if it needs it, without waiting for
+ *        the packet pool
+ *
+ *        For packet threads that time out their own flows: waiting on
+ *        their own pool would never end if it's empty.
+ */
+int FlowForceReassemblyForFlowNoWait(Flow *f, int server, int client)
+{
+    return FlowForceReassemblyForFlowDo(f, server, client, 1);
+}
+
 /**
  * \internal
  * \brief Forces reassembly for flows that need it.
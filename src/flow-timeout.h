@@ -25,6 +25,7 @@
 #define __FLOW_TIMEOUT_H__
 
 int FlowForceReassemblyForFlow(Flow *f, int server, int client);
+int FlowForceReassemblyForFlowNoWait(Flow *f, int server, int client);
 int FlowForceReassemblyNeedReassembly(Flow *f, int *server, int *client);
 void FlowForceReassembly(void);
 void FlowForceReassemblySetup(int detect_disabled);
@@ -57,7 +57,10 @@ Flow *FlowAlloc(void)
 
     (void) SC_ATOMIC_ADD(flow_memuse, size);
 
-    f = SCMalloc(size);
+    if (flow_arena != NULL)
+        f = HugepageArenaAlloc(flow_arena);
+    else
+        f = SCMalloc(size);
     if (unlikely(f == NULL)) {
         (void)SC_ATOMIC_SUB(flow_memuse, size);
         return NULL;
@@ -65,6 +68,8 @@ Flow *FlowAlloc(void)
     memset(f, 0, size);
 
     FLOW_INITIALIZE(f);
+    f->numa_node = (uint8_t)NumaThreadNode();
+    NumaMemuseAdd(f->numa_node, size);
     return f;
 }
 
@@ -76,11 +81,17 @@ Flow *FlowAlloc(void)
  */
 void FlowFree(Flow *f)
 {
+    uint32_t node = f->numa_node;
+
     FLOW_DESTROY(f);
-    SCFree(f);
+    if (flow_arena != NULL)
+        HugepageArenaFree(flow_arena, f);
+    else
+        SCFree(f);
 
     size_t size = sizeof(Flow) + FlowStorageSize();
     (void) SC_ATOMIC_SUB(flow_memuse, size);
+    NumaMemuseSub(node, size);
 }
 
 /**
@@ -0,0 +1,758 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Timer wheel of the flow hash rows that are due for a timeout check.
+ *
+ * Instead of walking the whole flow hash each run, the flow manager only
+ * checks the rows that have a flow that may have timed out. Each row keeps
+ * the second it is due in FlowBucket::next_ts, and an entry for that second
+ * is added to a two level timer wheel: one second slots for the next 256
+ * seconds, then 256 second slots that are moved to the first level when
+ * they come up.
+ *
+ * The wheel is lazy: a flow that sees packets doesn't move in the wheel.
+ * When its row comes up the flow manager checks the row and schedules it
+ * again for the earliest timeout of the flows left in it. Only when a flow
+ * would time out earlier than its row is due, e.g. a new flow or a flow
+ * that moved to the closed state, the row is moved up.
+ *
+ * An entry is only valid if the row's next_ts still matches it. Entries
+ * made stale by moving a row up are dropped when their slot comes up.
+ *
+ * The wheel slots are only touched by the flow manager owning the wheel,
+ * so no lock is needed. The packet threads move a row up by lowering
+ * next_ts with a CAS and pushing the row on a bounded lock-free queue,
+ * that the flow manager moves to the wheel on its next run. If the queue
+ * is full, or the wheel can't grow a slot, the row is lost to the wheel:
+ * the wheel is then flagged and the flow manager walks its whole part of
+ * the hash once, which resets and reschedules every row.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+#include "decode.h"
+#include "threads.h"
+
+#include "flow.h"
+#include "flow-hash.h"
+#include "flow-private.h"
+#include "flow-wheel.h"
+
+#include "util-unittest.h"
+#include "util-debug.h"
+
+SC_ATOMIC_EXTERN(unsigned int, flow_flags);
+
+static FlowWheel *flow_wheels = NULL;
+static uint32_t flow_wheels_cnt = 0;
+/** hash rows per wheel, the last one also gets the remainder */
+static uint32_t flow_wheels_range = 0;
+
+/** queue size bounds, in entries */
+#define FLOW_WHEEL_QUEUE_MIN    1024
+#define FLOW_WHEEL_QUEUE_MAX    (1 << 20)
+
+/**
+ * \brief set up a timer wheel per flow manager
+ *
+ * Wheel n covers the hash rows of flow manager instance n + 1.
+ *
+ * \param cnt number of flow managers
+ *
+ * \retval 0 ok
+ * \retval -1 error
+ */
+int FlowWheelsSetup(uint32_t cnt)
+{
+    uint32_t u, q;
+
+    FlowWheelsFree();
+
+    if (cnt == 0)
+        return -1;
+
+    flow_wheels_range = flow_config.hash_size / cnt;
+    if (flow_wheels_range == 0)
+        flow_wheels_range = 1;
+
+    /* room to move every row of the wheel up once between two runs */
+    uint32_t queue_size = FLOW_WHEEL_QUEUE_MIN;
+    while (queue_size < flow_wheels_range && queue_size < FLOW_WHEEL_QUEUE_MAX)
+        queue_size <<= 1;
+
+    flow_wheels = SCCalloc(cnt, sizeof(FlowWheel));
+    if (flow_wheels == NULL) {
+        SCLogError(SC_ERR_MEM_ALLOC, "failed to alloc flow timer wheels");
+        return -1;
+    }
+    flow_wheels_cnt = cnt;
+
+    for (u = 0; u < cnt; u++) {
+        FlowWheel *w = &flow_wheels[u];
+        SC_ATOMIC_INIT(w->queue_tail);
+        SC_ATOMIC_INIT(w->overflow);
+
+        w->queue = SCMalloc(queue_size * sizeof(FlowWheelQueueEntry));
+        if (w->queue == NULL) {
+            SCLogError(SC_ERR_MEM_ALLOC, "failed to alloc flow timer wheel queue");
+            FlowWheelsFree();
+            return -1;
+        }
+        for (q = 0; q < queue_size; q++) {
+            w->queue[q].seq = q;
+        }
+        w->queue_mask = queue_size - 1;
+    }
+    return 0;
+}
+
+void FlowWheelsFree(void)
+{
+    uint32_t u, s;
+
+    if (flow_wheels == NULL)
+        return;
+
+    for (u = 0; u < flow_wheels_cnt; u++) {
+        FlowWheel *w = &flow_wheels[u];
+        for (s = 0; s < FLOW_WHEEL_L0_SLOTS; s++) {
+            if (w->l0[s].entries != NULL)
+                SCFree(w->l0[s].entries);
+        }
+        for (s = 0; s < FLOW_WHEEL_L1_SLOTS; s++) {
+            if (w->l1[s].entries != NULL)
+                SCFree(w->l1[s].entries);
+        }
+        if (w->queue != NULL)
+            SCFree(w->queue);
+        SC_ATOMIC_DESTROY(w->queue_tail);
+        SC_ATOMIC_DESTROY(w->overflow);
+    }
+    SCFree(flow_wheels);
+    flow_wheels = NULL;
+    flow_wheels_cnt = 0;
+    flow_wheels_range = 0;
+}
+
+int FlowWheelsEnabled(void)
+{
+    return (flow_wheels != NULL);
+}
+
+static inline FlowWheel *FlowWheelForRow(uint32_t row)
+{
+    uint32_t idx = row / flow_wheels_range;
+    if (idx >= flow_wheels_cnt)
+        idx = flow_wheels_cnt - 1;
+    return &flow_wheels[idx];
+}
+
+/** \internal
+ *  \brief flag the wheel: a row got lost, so all its rows need a check */
+static inline void FlowWheelSetOverflow(FlowWheel *w, uint32_t row)
+{
+    SCLogDebug("failed to schedule row %u", row);
+    (void)SC_ATOMIC_CAS(&w->overflow, 0, 1);
+}
+
+/** \internal
+ *  \brief lower the row's next_ts to 'ts'
+ *
+ *  \retval 1 next_ts set to 'ts', the row needs an entry for it
+ *  \retval 0 row is already due at or before 'ts'
+ */
+static inline int FlowWheelRowMoveUp(FlowBucket *fb, uint32_t ts)
+{
+    uint32_t cur;
+
+    do {
+        cur = fb->next_ts;
+        if (cur != 0 && cur <= ts)
+            return 0;
+    } while (SCAtomicCompareAndSwap(&fb->next_ts, cur, ts) == 0);
+    return 1;
+}
+
+static int FlowWheelSlotAdd(FlowWheelSlot *slot, uint32_t row, uint32_t ts)
+{
+    if (slot->cnt == slot->size) {
+        uint32_t size = slot->size ? slot->size * 2 : 16;
+        FlowWheelEntry *ptr = SCRealloc(slot->entries, size * sizeof(FlowWheelEntry));
+        if (ptr == NULL)
+            return -1;
+        slot->entries = ptr;
+        slot->size = size;
+    }
+    slot->entries[slot->cnt].row = row;
+    slot->entries[slot->cnt].ts = ts;
+    slot->cnt++;
+    return 0;
+}
+
+/** \internal
+ *  \brief add an entry to the wheel, flow manager only
+ *
+ *  Entries for a second that already passed go in the slot that is up
+ *  next. Entries too far out go in the last slot, and are put back in
+ *  when that comes up. Until the wheel is started by the first expire
+ *  run, all entries go in the first slot and are all due on that run.
+ *  If the slot can't grow, the wheel is flagged for a hash walk.
+ */
+static void FlowWheelInsert(FlowWheel *w, uint32_t row, uint32_t ts)
+{
+    FlowWheelSlot *slot;
+
+    if (w->now == 0) {
+        slot = &w->l0[0];
+    } else {
+        uint32_t slot_ts = ts > w->now ? ts : w->now;
+        uint32_t delta = slot_ts - w->now;
+
+        if (delta < FLOW_WHEEL_L0_SLOTS) {
+            slot = &w->l0[slot_ts % FLOW_WHEEL_L0_SLOTS];
+        } else {
+            if (delta >= FLOW_WHEEL_L0_SLOTS * FLOW_WHEEL_L1_SLOTS)
+                slot_ts = w->now + (FLOW_WHEEL_L0_SLOTS * (FLOW_WHEEL_L1_SLOTS - 1));
+            slot = &w->l1[(slot_ts / FLOW_WHEEL_L0_SLOTS) % FLOW_WHEEL_L1_SLOTS];
+        }
+    }
+
+    if (FlowWheelSlotAdd(slot, row, ts) != 0)
+        FlowWheelSetOverflow(w, row);
+}
+
+/** \internal
+ *  \brief push a row on the wheel's queue, multiple producers
+ *
+ *  Bounded queue where each entry carries the position it can be
+ *  written at, so producers only need to CAS the tail.
+ *
+ *  \retval 0 ok
+ *  \retval -1 queue full
+ */
+static int FlowWheelQueuePush(FlowWheel *w, uint32_t row, uint32_t ts)
+{
+    uint32_t pos = SC_ATOMIC_GET(w->queue_tail);
+
+    while (1) {
+        FlowWheelQueueEntry *e = &w->queue[pos & w->queue_mask];
+        int32_t diff = (int32_t)(e->seq - pos);
+        if (diff == 0) {
+            if (SC_ATOMIC_CAS(&w->queue_tail, pos, pos + 1) == 1) {
+                e->row = row;
+                e->ts = ts;
+                /* publish the entry */
+                hw_barrier();
+                e->seq = pos + 1;
+                return 0;
+            }
+        } else if (diff < 0) {
+            return -1;
+        }
+        pos = SC_ATOMIC_GET(w->queue_tail);
+    }
+}
+
+/** \internal
+ *  \brief move the rows queued by other threads to the wheel, flow
+ *         manager only. Stops at an entry that is still being written. */
+static void FlowWheelQueueDrain(FlowWheel *w)
+{
+    while (1) {
+        FlowWheelQueueEntry *e = &w->queue[w->queue_head & w->queue_mask];
+        if (e->seq != w->queue_head + 1)
+            break;
+        hw_barrier();
+
+        uint32_t row = e->row;
+        uint32_t ts = e->ts;
+        hw_barrier();
+        e->seq = w->queue_head + w->queue_mask + 1;
+        w->queue_head++;
+
+        /* moved up again, or checked in the mean time */
+        if (flow_hash[row].next_ts != ts)
+            continue;
+        FlowWheelInsert(w, row, ts);
+    }
+}
+
+/**
+ * \brief schedule a timeout check of a hash row, from any thread
+ *
+ * Nothing is done if the row is already due earlier. Doesn't lock: the
+ * row is queued for the flow manager owning it.
+ *
+ * \param row flow hash row
+ * \param ts second the row is due
+ */
+void FlowWheelScheduleRow(uint32_t row, uint32_t ts)
+{
+    if (flow_wheels == NULL)
+        return;
+
+    if (ts == 0)
+        ts = 1;
+
+    if (FlowWheelRowMoveUp(&flow_hash[row], ts) == 0)
+        return;
+
+    FlowWheel *w = FlowWheelForRow(row);
+    if (FlowWheelQueuePush(w, row, ts) != 0)
+        FlowWheelSetOverflow(w, row);
+}
+
+/**
+ * \brief schedule a timeout check of a hash row, by the flow manager
+ *        owning the row's wheel
+ *
+ * \param row flow hash row
+ * \param ts second the row is due
+ */
+void FlowWheelRescheduleRow(uint32_t row, uint32_t ts)
+{
+    if (flow_wheels == NULL)
+        return;
+
+    if (ts == 0)
+        ts = 1;
+
+    if (FlowWheelRowMoveUp(&flow_hash[row], ts) == 0)
+        return;
+
+    FlowWheelInsert(FlowWheelForRow(row), row, ts);
+}
+
+/**
+ * \brief mark a row as not scheduled, before checking it outside of the
+ *        wheel. Its entries become stale. Flow manager only.
+ *
+ * \param row flow hash row
+ */
+void FlowWheelRowReset(uint32_t row)
+{
+    if (flow_wheels == NULL)
+        return;
+
+    FlowBucket *fb = &flow_hash[row];
+    uint32_t cur;
+    do {
+        cur = fb->next_ts;
+    } while (SCAtomicCompareAndSwap(&fb->next_ts, cur, 0) == 0);
+}
+
+/**
+ * \brief check and clear the wheel's overflow flag
+ *
+ * \param wheel wheel index, the flow manager instance - 1
+ *
+ * \retval 1 rows were lost: the flow manager needs to walk its part of
+ *           the hash, resetting the rows with FlowWheelRowReset()
+ * \retval 0 the wheel is complete
+ */
+int FlowWheelOverflowed(uint32_t wheel)
+{
+    if (flow_wheels == NULL || wheel >= flow_wheels_cnt)
+        return 0;
+
+    return (SC_ATOMIC_CAS(&flow_wheels[wheel].overflow, 1, 0) == 1);
+}
+
+/**
+ * \brief make sure the row of a flow is due no later than the flow's timeout
+ *
+ * Called for every packet and on flow state changes, with the flow locked.
+ * Only queues the row if it needs to be moved up. In emergency mode the
+ * emergency timeouts are used.
+ *
+ * \param f flow
+ */
+void FlowWheelFlowUpdate(const Flow *f)
+{
+    if (flow_wheels == NULL || f->fb == NULL)
+        return;
+
+    int emergency = ((SC_ATOMIC_GET(flow_flags) & FLOW_EMERGENCY) != 0);
+    uint32_t timeout;
+    switch (SC_ATOMIC_GET(f->flow_state)) {
+        default:
+        case FLOW_STATE_NEW:
+            timeout = emergency ? flow_proto[f->protomap].emerg_new_timeout :
+                flow_proto[f->protomap].new_timeout;
+            break;
+        case FLOW_STATE_ESTABLISHED:
+            timeout = emergency ? flow_proto[f->protomap].emerg_est_timeout :
+                flow_proto[f->protomap].est_timeout;
+            break;
+        case FLOW_STATE_CLOSED:
+            timeout = emergency ? flow_proto[f->protomap].emerg_closed_timeout :
+                flow_proto[f->protomap].closed_timeout;
+            break;
+    }
+    /* timed out once the timeout has fully passed */
+    uint32_t ts = (uint32_t)f->lastts.tv_sec + timeout + 1;
+
+    /* unlocked read: if we race with the flow manager checking the row,
+     * it will reschedule it after the check */
+    uint32_t next_ts = f->fb->next_ts;
+    if (next_ts != 0 && next_ts <= ts)
+        return;
+
+    FlowWheelScheduleRow((uint32_t)(f->fb - flow_hash), ts);
+}
+
+/** \internal
+ *  \brief move the valid entries of a slot to 'rows', flow manager only.
+ *         The rows are marked as not scheduled. */
+static int FlowWheelSlotTake(FlowWheelSlot *slot, uint32_t **rows,
+        uint32_t *rows_size, uint32_t *cnt)
+{
+    uint32_t u;
+
+    for (u = 0; u < slot->cnt; u++) {
+        FlowWheelEntry *e = &slot->entries[u];
+        FlowBucket *fb = &flow_hash[e->row];
+        if (fb->next_ts != e->ts)
+            continue;
+
+        if (*cnt == *rows_size) {
+            uint32_t size = *rows_size ? *rows_size * 2 : 256;
+            uint32_t *ptr = SCRealloc(*rows, size * sizeof(uint32_t));
+            if (ptr == NULL) {
+                /* leave the rest of the slot for the next run */
+                memmove(slot->entries, e, (slot->cnt - u) * sizeof(FlowWheelEntry));
+                slot->cnt -= u;
+                return -1;
+            }
+            *rows = ptr;
+            *rows_size = size;
+        }
+
+        /* a packet thread may move the row up at the same time */
+        if (SCAtomicCompareAndSwap(&fb->next_ts, e->ts, 0) == 0)
+            continue;
+        (*rows)[(*cnt)++] = e->row;
+    }
+    slot->cnt = 0;
+    return 0;
+}
+
+/** \internal
+ *  \brief put the entries of a second level slot back in the wheel, flow
+ *         manager only */
+static void FlowWheelCascade(FlowWheel *w, FlowWheelSlot *slot)
+{
+    uint32_t u, cnt = slot->cnt;
+
+    /* the slot itself may get entries back, so work on a copy */
+    FlowWheelEntry *entries = slot->entries;
+    slot->entries = NULL;
+    slot->cnt = 0;
+    slot->size = 0;
+
+    for (u = 0; u < cnt; u++) {
+        FlowWheelEntry *e = &entries[u];
+        if (flow_hash[e->row].next_ts != e->ts)
+            continue;
+        FlowWheelInsert(w, e->row, e->ts);
+    }
+    SCFree(entries);
+}
+
+/** \internal
+ *  \brief take the valid entries of all slots, flow manager only */
+static int FlowWheelTakeAll(FlowWheel *w, uint32_t **rows,
+        uint32_t *rows_size, uint32_t *cnt)
+{
+    uint32_t s;
+
+    for (s = 0; s < FLOW_WHEEL_L0_SLOTS; s++) {
+        if (FlowWheelSlotTake(&w->l0[s], rows, rows_size, cnt) != 0)
+            return -1;
+    }
+    for (s = 0; s < FLOW_WHEEL_L1_SLOTS; s++) {
+        if (FlowWheelSlotTake(&w->l1[s], rows, rows_size, cnt) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+/**
+ * \brief get the rows that are due for a timeout check
+ *
+ * The returned rows are no longer scheduled: after checking a row the
+ * caller reschedules it with FlowWheelRescheduleRow() if flows are left
+ * in it.
+ *
+ * \param wheel wheel index, the flow manager instance - 1
+ * \param ts current time in seconds
+ * \param rows array to store the rows in, realloc'd as needed
+ * \param rows_size size of the rows array
+ *
+ * \retval cnt number of rows in 'rows'
+ */
+uint32_t FlowWheelExpire(uint32_t wheel, uint32_t ts,
+        uint32_t **rows, uint32_t *rows_size)
+{
+    uint32_t cnt = 0;
+
+    if (flow_wheels == NULL || wheel >= flow_wheels_cnt)
+        return 0;
+
+    FlowWheel *w = &flow_wheels[wheel];
+    FlowWheelQueueDrain(w);
+
+    if (w->now == 0 || ts - w->now >= FLOW_WHEEL_L0_SLOTS * FLOW_WHEEL_L1_SLOTS) {
+        if (w->now != 0 && ts < w->now)
+            return 0;
+
+        /* time jumped past the whole wheel: everything is due */
+        if (FlowWheelTakeAll(w, rows, rows_size, &cnt) == 0)
+            w->now = ts + 1;
+        return cnt;
+    }
+
+    while (w->now <= ts) {
+        if ((w->now % FLOW_WHEEL_L0_SLOTS) == 0) {
+            FlowWheelCascade(w, &w->l1[(w->now / FLOW_WHEEL_L0_SLOTS) % FLOW_WHEEL_L1_SLOTS]);
+        }
+        if (FlowWheelSlotTake(&w->l0[w->now % FLOW_WHEEL_L0_SLOTS],
+                    rows, rows_size, &cnt) != 0)
+            break;
+        w->now++;
+    }
+    return cnt;
+}
+
+/**
+ * \brief get all scheduled rows, whenever they are due
+ *
+ * Used when entering emergency mode: the rows were scheduled for the
+ * normal timeouts, so they all need a check against the emergency
+ * timeouts. The wheel's time doesn't move.
+ *
+ * \param wheel wheel index, the flow manager instance - 1
+ * \param rows array to store the rows in, realloc'd as needed
+ * \param rows_size size of the rows array
+ *
+ * \retval cnt number of rows in 'rows'
+ */
+uint32_t FlowWheelExpireAll(uint32_t wheel, uint32_t **rows,
+        uint32_t *rows_size)
+{
+    uint32_t cnt = 0;
+
+    if (flow_wheels == NULL || wheel >= flow_wheels_cnt)
+        return 0;
+
+    FlowWheel *w = &flow_wheels[wheel];
+    FlowWheelQueueDrain(w);
+    (void)FlowWheelTakeAll(w, rows, rows_size, &cnt);
+    return cnt;
+}
+
+#ifdef UNITTESTS
+
+/** \internal
+ *  \brief check that expiring the wheel up to 'ts' returns just 'row' */
+static int FlowWheelTestExpect(uint32_t ts, uint32_t row, uint32_t **rows,
+        uint32_t *rows_size)
+{
+    uint32_t cnt = FlowWheelExpire(0, ts, rows, rows_size);
+    if (row == 0)
+        return (cnt == 0);
+    if (cnt != 1 || (*rows)[0] != row) {
+        printf("ts %u: expected row %u, got %u rows (%u): ", ts, row, cnt,
+                cnt ? (*rows)[0] : 0);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * \test rows come up at their second, stale entries are dropped and the
+ *       second level is cascaded.
+ */
+static int FlowWheelTest01(void)
+{
+    uint32_t *rows = NULL;
+    uint32_t rows_size = 0;
+    int result = 0;
+
+    FlowInitConfig(FLOW_QUIET);
+    if (FlowWheelsSetup(1) != 0)
+        goto end;
+
+    /* start the wheel */
+    if (!FlowWheelTestExpect(900, 0, &rows, &rows_size))
+        goto end;
+
+    FlowWheelScheduleRow(1, 1000);
+    FlowWheelScheduleRow(2, 1100);
+    FlowWheelScheduleRow(3, 1300);      /* second level */
+    FlowWheelScheduleRow(4, 1000 + 50000); /* beyond the wheel */
+    FlowWheelScheduleRow(1, 1050);      /* due earlier already: no-op */
+    if (flow_hash[1].next_ts != 1000)
+        goto end;
+
+    if (!FlowWheelTestExpect(999, 0, &rows, &rows_size))
+        goto end;
+    if (!FlowWheelTestExpect(1000, 1, &rows, &rows_size))
+        goto end;
+    if (flow_hash[1].next_ts != 0)
+        goto end;
+
+    /* move row 2 up: only the new entry counts */
+    FlowWheelScheduleRow(2, 1050);
+    if (!FlowWheelTestExpect(1050, 2, &rows, &rows_size))
+        goto end;
+    if (!FlowWheelTestExpect(1100, 0, &rows, &rows_size))
+        goto end;
+
+    if (!FlowWheelTestExpect(1299, 0, &rows, &rows_size))
+        goto end;
+    if (!FlowWheelTestExpect(1300, 3, &rows, &rows_size))
+        goto end;
+
+    /* jump past the end of the wheel */
+    if (!FlowWheelTestExpect(1000 + 50000, 4, &rows, &rows_size))
+        goto end;
+    if (!FlowWheelTestExpect(1000 + 60000, 0, &rows, &rows_size))
+        goto end;
+
+    result = 1;
+end:
+    if (rows != NULL)
+        SCFree(rows);
+    FlowShutdown();
+    return result;
+}
+
+/**
+ * \test a row that doesn't fit in the queue flags the wheel, and is
+ *       scheduled again after a reset as the flow manager's walk does.
+ */
+static int FlowWheelTest02(void)
+{
+    uint32_t *rows = NULL;
+    uint32_t rows_size = 0;
+    uint32_t u;
+    int result = 0;
+
+    FlowInitConfig(FLOW_QUIET);
+    if (FlowWheelsSetup(1) != 0)
+        goto end;
+    if (!FlowWheelTestExpect(900, 0, &rows, &rows_size))
+        goto end;
+
+    /* fill the queue by moving row 1 up over and over */
+    for (u = 0; u <= flow_wheels[0].queue_mask; u++) {
+        FlowWheelScheduleRow(1, 100000 - u);
+    }
+    if (FlowWheelOverflowed(0))
+        goto end;
+
+    /* row 2 doesn't fit anymore: it is lost to the wheel */
+    FlowWheelScheduleRow(2, 1000);
+    if (flow_hash[2].next_ts != 1000)
+        goto end;
+    if (FlowWheelOverflowed(0) != 1)
+        goto end;
+    /* flag is cleared by the check */
+    if (FlowWheelOverflowed(0))
+        goto end;
+
+    /* the queued entries for row 1 are all stale but the last */
+    if (!FlowWheelTestExpect(1000, 0, &rows, &rows_size))
+        goto end;
+
+    /* the walk: reset and reschedule the row */
+    FlowWheelRowReset(2);
+    FlowWheelRescheduleRow(2, 1001);
+    if (!FlowWheelTestExpect(1001, 2, &rows, &rows_size))
+        goto end;
+
+    /* the queue works again */
+    FlowWheelScheduleRow(3, 1002);
+    if (!FlowWheelTestExpect(1002, 3, &rows, &rows_size))
+        goto end;
+    if (FlowWheelOverflowed(0))
+        goto end;
+
+    result = 1;
+end:
+    if (rows != NULL)
+        SCFree(rows);
+    FlowShutdown();
+    return result;
+}
+
+/**
+ * \test taking all rows for emergency mode doesn't move the wheel's time.
+ */
+static int FlowWheelTest03(void)
+{
+    uint32_t *rows = NULL;
+    uint32_t rows_size = 0;
+    int result = 0;
+
+    FlowInitConfig(FLOW_QUIET);
+    if (FlowWheelsSetup(1) != 0)
+        goto end;
+    if (!FlowWheelTestExpect(900, 0, &rows, &rows_size))
+        goto end;
+
+    FlowWheelScheduleRow(1, 1000);
+    FlowWheelRescheduleRow(2, 1000 + 3600);
+    if (FlowWheelExpireAll(0, &rows, &rows_size) != 2)
+        goto end;
+    if (flow_hash[1].next_ts != 0 || flow_hash[2].next_ts != 0)
+        goto end;
+
+    /* rescheduled for the emergency timeouts */
+    FlowWheelRescheduleRow(1, 910);
+    FlowWheelRescheduleRow(2, 920);
+    if (!FlowWheelTestExpect(909, 0, &rows, &rows_size))
+        goto end;
+    if (!FlowWheelTestExpect(910, 1, &rows, &rows_size))
+        goto end;
+    if (!FlowWheelTestExpect(920, 2, &rows, &rows_size))
+        goto end;
+    if (!FlowWheelTestExpect(1000 + 3600, 0, &rows, &rows_size))
+        goto end;
+
+    result = 1;
+end:
+    if (rows != NULL)
+        SCFree(rows);
+    FlowShutdown();
+    return result;
+}
+
+#endif /* UNITTESTS */
+
+void FlowWheelRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("FlowWheelTest01", FlowWheelTest01);
+    UtRegisterTest("FlowWheelTest02", FlowWheelTest02);
+    UtRegisterTest("FlowWheelTest03", FlowWheelTest03);
+#endif /* UNITTESTS */
+}
@@ -0,0 +1,90 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Timer wheel of the flow hash rows that are due for a timeout check.
+ */
+
+#ifndef __FLOW_WHEEL_H__
+#define __FLOW_WHEEL_H__
+
+/** one second slots */
+#define FLOW_WHEEL_L0_SLOTS     256
+/** FLOW_WHEEL_L0_SLOTS second slots, for ~4.5 hours in total */
+#define FLOW_WHEEL_L1_SLOTS     64
+
+typedef struct FlowWheelEntry_ {
+    uint32_t row;   /**< flow hash row */
+    uint32_t ts;    /**< the row's next_ts when scheduled */
+} FlowWheelEntry;
+
+typedef struct FlowWheelSlot_ {
+    FlowWheelEntry *entries;
+    uint32_t cnt;
+    uint32_t size;
+} FlowWheelSlot;
+
+/** rows scheduled by the packet threads, waiting for the flow manager */
+typedef struct FlowWheelQueueEntry_ {
+    /** position the entry can be pushed at, + 1 once it is filled in */
+    uint32_t seq;
+    uint32_t row;
+    uint32_t ts;
+} FlowWheelQueueEntry;
+
+/** \brief timer wheel for the rows handled by one flow manager
+ *
+ *  The slots are only accessed by the flow manager owning the wheel. Other
+ *  threads schedule rows through the lock-free queue. */
+typedef struct FlowWheel_ {
+    /** next second to expire, 0 if the wheel is not started yet */
+    uint32_t now;
+    FlowWheelSlot l0[FLOW_WHEEL_L0_SLOTS];
+    FlowWheelSlot l1[FLOW_WHEEL_L1_SLOTS];
+
+    FlowWheelQueueEntry *queue;
+    uint32_t queue_mask;
+    /** next entry to take, only used by the flow manager */
+    uint32_t queue_head;
+    /** next entry to push */
+    SC_ATOMIC_DECLARE(uint32_t, queue_tail);
+    /** set if a row could not be scheduled: the flow manager then walks
+     *  its part of the hash */
+    SC_ATOMIC_DECLARE(int, overflow);
+} FlowWheel;
+
+int FlowWheelsSetup(uint32_t cnt);
+void FlowWheelsFree(void);
+int FlowWheelsEnabled(void);
+
+void FlowWheelScheduleRow(uint32_t row, uint32_t ts);
+void FlowWheelFlowUpdate(const Flow *f);
+
+/* flow manager only, for the rows of its own wheel */
+void FlowWheelRescheduleRow(uint32_t row, uint32_t ts);
+void FlowWheelRowReset(uint32_t row);
+int FlowWheelOverflowed(uint32_t wheel);
+uint32_t FlowWheelExpire(uint32_t wheel, uint32_t ts,
+        uint32_t **rows, uint32_t *rows_size);
+uint32_t FlowWheelExpireAll(uint32_t wheel, uint32_t **rows,
+        uint32_t *rows_size);
+
+void FlowWheelRegisterTests(void);
+
+#endif /* __FLOW_WHEEL_H__ */
@@ -45,6 +45,9 @@
 #include "app-layer.h"
 #include "detect-engine.h"
 
+#include "flow-hash.h"
+#include "flow-manager.h"
+
 #include "util-validate.h"
 
 typedef DetectEngineThreadCtx *DetectEngineThreadCtxPtr;
@@ -94,6 +97,9 @@ static TmEcode FlowWorkerThreadInit(ThreadVars *tv, void *initdata, void **data)
         return TM_ECODE_FAILED;
     }
 
+    /* get our private part of the flow hash, if enabled */
+    fw->dtv->flow_partition = FlowHashPartitionRegister();
+
     /* setup TCP */
     BUG_ON(StreamTcpThreadInit(tv, NULL, &fw->stream_thread_ptr) != TM_ECODE_OK);
 
@@ -149,12 +155,25 @@ TmEcode FlowWorker(ThreadVars *tv, Packet *p, void *data, PacketQueue *preq, Pac
 {
     FlowWorkerThreadData *fw = data;
     void *detect_thread = SC_ATOMIC_GET(fw->detect_thread);
+    FlowHashPartition *part = fw->dtv->flow_partition;
 
     SCLogDebug("packet %"PRIu64, p->pcap_cnt);
 
+    /* claim our own part of the flow hash while we use it */
+    if (part != NULL)
+        FlowHashPartitionEnter(part);
+
     /* update time */
-    if (!(PKT_IS_PSEUDOPKT(p)))
+    if (!(PKT_IS_PSEUDOPKT(p))) {
         TimeSetByThread(tv->id, &p->ts);
+        if (part != NULL)
+            FlowHashPartitionSetLastSeen(part, (uint32_t)p->ts.tv_sec);
+
+        /* time out flows in our own part of the flow hash if the
+         * flow manager asked us to, a slice of it per packet */
+        if (part != NULL && FlowHashPartitionTimeoutPending(part))
+            FlowTimeoutPartition(part);
+    }
 
     /* handle Flow */
     if (p->flags & PKT_WANTS_FLOW) {
@@ -171,6 +190,11 @@ TmEcode FlowWorker(ThreadVars *tv, Packet *p, void *data, PacketQueue *preq, Pac
         FLOWLOCK_WRLOCK(p->flow);
     }
 
+    /* the packet holds a reference to its flow, so it can't be removed
+     * from the hash after this */
+    if (part != NULL)
+        FlowHashPartitionLeave(part);
+
     SCLogDebug("packet %"PRIu64" has flow? %s", p->pcap_cnt, p->flow ? "yes" : "no");
 
     /* handle TCP and app layer */
@@ -220,6 +244,18 @@ TmEcode FlowWorker(ThreadVars *tv, Packet *p, void *data, PacketQueue *preq, Pac
     return TM_ECODE_OK;
 }
 
+/** \brief prepare a batch of packets for FlowWorker()
+ *
+ *  Prefetch the flow hash buckets and flows of the whole batch, so the
+ *  flow lookups of the batch overlap their cache misses.
+ */
+static void FlowWorkerBatchPrepare(ThreadVars *tv, Packet **packets, uint32_t cnt, void *data)
+{
+    FlowWorkerThreadData *fw = data;
+
+    FlowHashPrefetch(fw->dtv, packets, cnt);
+}
+
 void FlowWorkerReplaceDetectCtx(void *flow_worker, void *detect_ctx)
 {
     FlowWorkerThreadData *fw = flow_worker;
@@ -239,6 +275,7 @@ void TmModuleFlowWorkerRegister (void)
     tmm_modules[TMM_FLOWWORKER].name = "FlowWorker";
     tmm_modules[TMM_FLOWWORKER].ThreadInit = FlowWorkerThreadInit;
     tmm_modules[TMM_FLOWWORKER].Func = FlowWorker;
+    tmm_modules[TMM_FLOWWORKER].FuncBatchPrepare = FlowWorkerBatchPrepare;
     tmm_modules[TMM_FLOWWORKER].ThreadDeinit = FlowWorkerThreadDeinit;
     tmm_modules[TMM_FLOWWORKER].cap_flags = 0;
     tmm_modules[TMM_FLOWWORKER].flags = TM_FLAG_STREAM_TM|TM_FLAG_DETECT_TM;
@@ -43,6 +43,7 @@
 #include "flow-timeout.h"
 #include "flow-manager.h"
 #include "flow-storage.h"
+#include "flow-wheel.h"
 
 #include "stream-tcp-private.h"
 #include "stream-tcp-reassemble.h"
@@ -102,10 +103,38 @@ void FlowCleanupAppLayer(Flow *f)
     return;
 }
 
+/** \brief number of spare flows to keep for a NUMA node */
+static uint32_t FlowSparePrealloc(uint32_t node)
+{
+    return NumaNodeShare(node, flow_config.prealloc);
+}
+
+typedef struct FlowSpareFill_ {
+    FlowQueue *q;
+    uint32_t cnt;   /**< flows to add to q */
+    uint32_t done;  /**< flows added */
+} FlowSpareFill;
+
+/** \brief alloc flows into a spare queue, runs on the queue's node so
+ *         the flows are allocated from its local memory */
+static void FlowSpareFillQueue(void *data)
+{
+    FlowSpareFill *fill = (FlowSpareFill *)data;
+
+    for (fill->done = 0; fill->done < fill->cnt; fill->done++) {
+        Flow *f = FlowAlloc();
+        if (f == NULL)
+            return;
+
+        FlowEnqueue(fill->q, f);
+    }
+}
+
 /** \brief Make sure we have enough spare flows. 
  *
  *  Enforce the prealloc parameter, so keep at least prealloc flows in the
- *  spare queue and free flows going over the limit.
+ *  spare queue and free flows going over the limit. The prealloc is spread
+ *  over the spare queues of the NUMA nodes.
  *
  *  \retval 1 if the queue was properly updated (or if it already was in good shape)
  *  \retval 0 otherwise.
@@ -113,34 +142,35 @@ void FlowCleanupAppLayer(Flow *f)
 int FlowUpdateSpareFlows(void)
 {
     SCEnter();
-    uint32_t toalloc = 0, tofree = 0, len;
+    uint32_t toalloc = 0, tofree = 0, len, node;
 
-    FQLOCK_LOCK(&flow_spare_q);
-    len = flow_spare_q.len;
-    FQLOCK_UNLOCK(&flow_spare_q);
+    for (node = 0; node < NumaNodeCount(); node++) {
+        FlowQueue *q = FlowSpareQueue(node);
+        uint32_t prealloc = FlowSparePrealloc(node);
 
-    if (len < flow_config.prealloc) {
-        toalloc = flow_config.prealloc - len;
+        FQLOCK_LOCK(q);
+        len = q->len;
+        FQLOCK_UNLOCK(q);
 
-        uint32_t i;
-        for (i = 0; i < toalloc; i++) {
-            Flow *f = FlowAlloc();
-            if (f == NULL)
-                return 0;
+        if (len < prealloc) {
+            toalloc = prealloc - len;
 
-            FlowEnqueue(&flow_spare_q,f);
-        }
-    } else if (len > flow_config.prealloc) {
-        tofree = len - flow_config.prealloc;
+            FlowSpareFill fill = { q, toalloc, 0 };
+            NumaRunOnNode(node, FlowSpareFillQueue, &fill);
+            if (fill.done < fill.cnt)
+                return 0;
+        } else if (len > prealloc) {
+            tofree = len - prealloc;
 
-        uint32_t i;
-        for (i = 0; i < tofree; i++) {
-            /* FlowDequeue locks the queue */
-            Flow *f = FlowDequeue(&flow_spare_q);
-            if (f == NULL)
-                return 1;
+            uint32_t i;
+            for (i = 0; i < tofree; i++) {
+                /* FlowDequeue locks the queue */
+                Flow *f = FlowDequeue(q);
+                if (f == NULL)
+                    break;
 
-            FlowFree(f);
+                FlowFree(f);
+            }
         }
     }
 
@@ -252,8 +282,10 @@ void FlowHandlePacketUpdate(Flow *f, Packet *p)
         SCLogDebug("pkt %p FLOW_PKT_ESTABLISHED", p);
         p->flowflags |= FLOW_PKT_ESTABLISHED;
 
-        if (f->proto != IPPROTO_TCP) {
+        if (f->proto != IPPROTO_TCP &&
+                SC_ATOMIC_GET(f->flow_state) != FLOW_STATE_ESTABLISHED) {
             SC_ATOMIC_SET(f->flow_state, FLOW_STATE_ESTABLISHED);
+            FlowWheelFlowUpdate(f);
         }
     }
 
@@ -301,6 +333,10 @@ void FlowInitConfig(char quiet)
     SC_ATOMIC_INIT(flow_memuse);
     SC_ATOMIC_INIT(flow_prune_idx);
     FlowQueueInit(&flow_spare_q);
+    int n;
+    for (n = 1; n < NUMA_MAX_NODES; n++) {
+        FlowQueueInit(&flow_spare_node_q[n]);
+    }
     FlowQueueInit(&flow_recycle_q);
 
 #ifndef AFLFUZZ_NO_RANDOM
@@ -355,6 +391,13 @@ void FlowInitConfig(char quiet)
             flow_config.prealloc = configval;
         }
     }
+    int thread_local = 0;
+    if (ConfGetBool("flow.thread-local-table", &thread_local) == 1) {
+        flow_config.thread_local = thread_local;
+    }
+    int timer_wheel = 1;
+    (void)ConfGetBool("flow.timer-wheel", &timer_wheel);
+    flow_config.timer_wheel = timer_wheel;
     SCLogDebug("Flow config from suricata.yaml: memcap: %"PRIu64", hash-size: "
                "%"PRIu32", prealloc: %"PRIu32, flow_config.memcap,
                flow_config.hash_size, flow_config.prealloc);
@@ -370,7 +413,7 @@ void FlowInitConfig(char quiet)
                 (uintmax_t)sizeof(FlowBucket));
         exit(EXIT_FAILURE);
     }
-    flow_hash = SCMallocAligned(flow_config.hash_size * sizeof(FlowBucket), CLS);
+    flow_hash = HugepageAlloc(flow_config.hash_size * sizeof(FlowBucket));
     if (unlikely(flow_hash == NULL)) {
         SCLogError(SC_ERR_FATAL, "Fatal error encountered in FlowInitConfig. Exiting...");
         exit(EXIT_FAILURE);
@@ -390,28 +433,29 @@ void FlowInitConfig(char quiet)
                   (uintmax_t)sizeof(FlowBucket));
     }
 
-    /* pre allocate flows */
-    for (i = 0; i < flow_config.prealloc; i++) {
+    flow_arena = HugepageArenaCreate("flow", sizeof(Flow) + FlowStorageSize());
+
+    /* pre allocate flows, spread over the NUMA nodes */
+    for (i = 0; i < NumaNodeCount(); i++) {
+        FlowSpareFill fill = { FlowSpareQueue(i), FlowSparePrealloc(i), 0 };
+        NumaRunOnNode(i, FlowSpareFillQueue, &fill);
+        if (fill.done == fill.cnt)
+            continue;
+
         if (!(FLOW_CHECK_MEMCAP(sizeof(Flow) + FlowStorageSize()))) {
             SCLogError(SC_ERR_FLOW_INIT, "preallocating flows failed: "
                     "max flow memcap reached. Memcap %"PRIu64", "
                     "Memuse %"PRIu64".", flow_config.memcap,
                     ((uint64_t)SC_ATOMIC_GET(flow_memuse) + (uint64_t)sizeof(Flow)));
-            exit(EXIT_FAILURE);
-        }
-
-        Flow *f = FlowAlloc();
-        if (f == NULL) {
+        } else {
             SCLogError(SC_ERR_FLOW_INIT, "preallocating flow failed: %s", strerror(errno));
-            exit(EXIT_FAILURE);
         }
-
-        FlowEnqueue(&flow_spare_q,f);
+        exit(EXIT_FAILURE);
     }
 
     if (quiet == FALSE) {
         SCLogInfo("preallocated %" PRIu32 " flows of size %" PRIuMAX "",
-                flow_spare_q.len, (uintmax_t)(sizeof(Flow) + + FlowStorageSize()));
+                FlowSpareQueueLen(), (uintmax_t)(sizeof(Flow) + + FlowStorageSize()));
         SCLogInfo("flow memory usage: %llu bytes, maximum: %"PRIu64,
                 SC_ATOMIC_GET(flow_memuse), flow_config.memcap);
     }
@@ -441,6 +485,11 @@ void FlowShutdown(void)
     while((f = FlowDequeue(&flow_spare_q))) {
         FlowFree(f);
     }
+    for (u = 1; u < NUMA_MAX_NODES; u++) {
+        while((f = FlowDequeue(&flow_spare_node_q[u]))) {
+            FlowFree(f);
+        }
+    }
     while((f = FlowDequeue(&flow_recycle_q))) {
         FlowFree(f);
     }
@@ -463,11 +512,19 @@ void FlowShutdown(void)
 
             FBLOCK_DESTROY(&flow_hash[u]);
         }
-        SCFreeAligned(flow_hash);
+        HugepageFree(flow_hash);
         flow_hash = NULL;
     }
+    FlowHashPartitionsFree();
+    FlowWheelsFree();
+    /* all flows are freed now */
+    HugepageArenaDestroy(flow_arena);
+    flow_arena = NULL;
     (void) SC_ATOMIC_SUB(flow_memuse, flow_config.hash_size * sizeof(FlowBucket));
     FlowQueueDestroy(&flow_spare_q);
+    for (u = 1; u < NUMA_MAX_NODES; u++) {
+        FlowQueueDestroy(&flow_spare_node_q[u]);
+    }
     FlowQueueDestroy(&flow_recycle_q);
 
     SC_ATOMIC_DESTROY(flow_prune_idx);
@@ -1090,6 +1147,7 @@ void FlowRegisterTests (void)
                    FlowTest09);
 
     FlowMgrRegisterTests();
+    FlowWheelRegisterTests();
     RegisterFlowStorageTests();
 #endif /* UNITTESTS */
 }
@@ -238,6 +238,11 @@ typedef struct FlowCnf_
     uint32_t emerg_timeout_est;
     uint32_t emergency_recovery;
 
+    /** give each flow worker a private part of the flow hash */
+    int thread_local;
+    /** let the flow managers only check the rows that are due */
+    int timer_wheel;
+
 } FlowConfig;
 
 /* Hash key for the flow hash */
@@ -313,6 +318,8 @@ typedef struct Flow_
     uint8_t proto;
     uint8_t recursion_level;
     uint16_t vlan_id[2];
+    /** NUMA node the flow was allocated on */
+    uint8_t numa_node;
 
     /** flow hash - the flow hash before hash table size mod. */
     uint32_t flow_hash;
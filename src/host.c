@@ -42,6 +42,7 @@
 #include "detect-engine-threshold.h"
 
 #include "util-hash-lookup3.h"
+#include "util-hugepage.h"
 
 static Host *HostGetUsedHost(void);
 
@@ -52,6 +53,9 @@ static HostQueue host_spare_q;
  *  the storage APIs additions. */
 static uint16_t g_host_size = sizeof(Host);
 
+/** huge page arena the hosts are allocated from, NULL if not in use */
+static HugepageArena *host_arena = NULL;
+
 uint32_t HostSpareQueueGetSize(void)
 {
     return HostQueueLen(&host_spare_q);
@@ -70,7 +74,11 @@ Host *HostAlloc(void)
     }
     (void) SC_ATOMIC_ADD(host_memuse, g_host_size);
 
-    Host *h = SCMalloc(g_host_size);
+    Host *h;
+    if (host_arena != NULL)
+        h = HugepageArenaAlloc(host_arena);
+    else
+        h = SCMalloc(g_host_size);
     if (unlikely(h == NULL))
         goto error;
 
@@ -91,7 +99,10 @@ void HostFree(Host *h)
 
         SC_ATOMIC_DESTROY(h->use_cnt);
         SCMutexDestroy(&h->m);
-        SCFree(h);
+        if (host_arena != NULL)
+            HugepageArenaFree(host_arena, h);
+        else
+            SCFree(h);
         (void) SC_ATOMIC_SUB(host_memuse, g_host_size);
     }
 }
@@ -196,7 +207,7 @@ void HostInitConfig(char quiet)
                 (uintmax_t)sizeof(HostHashRow));
         exit(EXIT_FAILURE);
     }
-    host_hash = SCMallocAligned(host_config.hash_size * sizeof(HostHashRow), CLS);
+    host_hash = HugepageAlloc(host_config.hash_size * sizeof(HostHashRow));
     if (unlikely(host_hash == NULL)) {
         SCLogError(SC_ERR_FATAL, "Fatal error encountered in HostInitConfig. Exiting...");
         exit(EXIT_FAILURE);
@@ -216,6 +227,8 @@ void HostInitConfig(char quiet)
                   (uintmax_t)sizeof(HostHashRow));
     }
 
+    host_arena = HugepageArenaCreate("host", g_host_size);
+
     /* pre allocate hosts */
     for (i = 0; i < host_config.prealloc; i++) {
         if (!(HOST_CHECK_MEMCAP(g_host_size))) {
@@ -284,9 +297,12 @@ void HostShutdown(void)
 
             HRLOCK_DESTROY(&host_hash[u]);
         }
-        SCFreeAligned(host_hash);
+        HugepageFree(host_hash);
         host_hash = NULL;
     }
+    /* all hosts are freed now */
+    HugepageArenaDestroy(host_arena);
+    host_arena = NULL;
     (void) SC_ATOMIC_SUB(host_memuse, host_config.hash_size * sizeof(HostHashRow));
     HostQueueDestroy(&host_spare_q);
 
@@ -41,6 +41,7 @@
 #include "detect-engine-threshold.h"
 
 #include "util-hash-lookup3.h"
+#include "util-hugepage.h"
 
 static IPPair *IPPairGetUsedIPPair(void);
 
@@ -51,6 +52,9 @@ static IPPairQueue ippair_spare_q;
  *  the storage APIs additions. */
 static uint16_t g_ippair_size = sizeof(IPPair);
 
+/** huge page arena the ippairs are allocated from, NULL if not in use */
+static HugepageArena *ippair_arena = NULL;
+
 uint32_t IPPairSpareQueueGetSize(void)
 {
     return IPPairQueueLen(&ippair_spare_q);
@@ -70,7 +74,11 @@ IPPair *IPPairAlloc(void)
 
     (void) SC_ATOMIC_ADD(ippair_memuse, g_ippair_size);
 
-    IPPair *h = SCMalloc(g_ippair_size);
+    IPPair *h;
+    if (ippair_arena != NULL)
+        h = HugepageArenaAlloc(ippair_arena);
+    else
+        h = SCMalloc(g_ippair_size);
     if (unlikely(h == NULL))
         goto error;
 
@@ -91,7 +99,10 @@ void IPPairFree(IPPair *h)
 
         SC_ATOMIC_DESTROY(h->use_cnt);
         SCMutexDestroy(&h->m);
-        SCFree(h);
+        if (ippair_arena != NULL)
+            HugepageArenaFree(ippair_arena, h);
+        else
+            SCFree(h);
         (void) SC_ATOMIC_SUB(ippair_memuse, g_ippair_size);
     }
 }
@@ -192,7 +203,7 @@ void IPPairInitConfig(char quiet)
                 (uintmax_t)sizeof(IPPairHashRow));
         exit(EXIT_FAILURE);
     }
-    ippair_hash = SCMallocAligned(ippair_config.hash_size * sizeof(IPPairHashRow), CLS);
+    ippair_hash = HugepageAlloc(ippair_config.hash_size * sizeof(IPPairHashRow));
     if (unlikely(ippair_hash == NULL)) {
         SCLogError(SC_ERR_FATAL, "Fatal error encountered in IPPairInitConfig. Exiting...");
         exit(EXIT_FAILURE);
@@ -212,6 +223,8 @@ void IPPairInitConfig(char quiet)
                   (uintmax_t)sizeof(IPPairHashRow));
     }
 
+    ippair_arena = HugepageArenaCreate("ippair", g_ippair_size);
+
     /* pre allocate ippairs */
     for (i = 0; i < ippair_config.prealloc; i++) {
         if (!(IPPAIR_CHECK_MEMCAP(g_ippair_size))) {
@@ -280,9 +293,12 @@ void IPPairShutdown(void)
 
             HRLOCK_DESTROY(&ippair_hash[u]);
         }
-        SCFreeAligned(ippair_hash);
+        HugepageFree(ippair_hash);
         ippair_hash = NULL;
     }
+    /* all ippairs are freed now */
+    HugepageArenaDestroy(ippair_arena);
+    ippair_arena = NULL;
     (void) SC_ATOMIC_SUB(ippair_memuse, ippair_config.hash_size * sizeof(IPPairHashRow));
     IPPairQueueDestroy(&ippair_spare_q);
 
@@ -148,6 +148,8 @@ static OutputCtx *LogDropLogInitCtx(ConfNode *conf)
         SCLogDebug("LogDropLogInitCtx: Could not create new LogFileCtx");
         return NULL;
     }
+    /* drop log lines are written to fp directly */
+    logfile_ctx->flags |= LOGFILE_WRITES_FP;
 
     if (SCConfLogOpenGeneric(conf, logfile_ctx, DEFAULT_LOG_FILENAME, 1) < 0) {
         LogFileFreeCtx(logfile_ctx);
@@ -403,6 +403,8 @@ static OutputCtx *LogFileLogInitCtx(ConfNode *conf)
         SCLogDebug("Could not create new LogFileCtx");
         return NULL;
     }
+    /* file log records are written to fp directly */
+    logfile_ctx->flags |= LOGFILE_WRITES_FP;
 
     if (SCConfLogOpenGeneric(conf, logfile_ctx, DEFAULT_LOG_FILENAME, 1) < 0) {
         LogFileFreeCtx(logfile_ctx);
@@ -505,10 +505,8 @@ static TmEcode LogHttpLogIPWrapper(ThreadVars *tv, void *data, const Packet *p,
 
     aft->uri_cnt ++;
 
-    SCMutexLock(&hlog->file_ctx->fp_mutex);
-    hlog->file_ctx->Write((const char *)MEMBUFFER_BUFFER(aft->buffer),
-        MEMBUFFER_OFFSET(aft->buffer), hlog->file_ctx);
-    SCMutexUnlock(&hlog->file_ctx->fp_mutex);
+    LogFileWriteRecord(hlog->file_ctx, (const char *)MEMBUFFER_BUFFER(aft->buffer),
+            MEMBUFFER_OFFSET(aft->buffer));
 
 end:
     SCReturnInt(0);
@@ -304,10 +304,8 @@ static int LogTlsLogger(ThreadVars *tv, void *thread_data, const Packet *p,
 
     aft->tls_cnt++;
 
-    SCMutexLock(&hlog->file_ctx->fp_mutex);
-    hlog->file_ctx->Write((const char *)MEMBUFFER_BUFFER(aft->buffer),
-        MEMBUFFER_OFFSET(aft->buffer), hlog->file_ctx);
-    SCMutexUnlock(&hlog->file_ctx->fp_mutex);
+    LogFileWriteRecord(hlog->file_ctx, (const char *)MEMBUFFER_BUFFER(aft->buffer),
+            MEMBUFFER_OFFSET(aft->buffer));
 
     return 0;
 }
@@ -105,24 +105,22 @@ static int AlertJsonDumpStreamSegmentCallback(const Packet *p, void *data, uint8
     return 1;
 }
 
-static void AlertJsonTls(const Flow *f, json_t *js)
+static void AlertJsonTls(const Flow *f, JsonWriter *jw)
 {
     SSLState *ssl_state = (SSLState *)FlowGetAppState(f);
     if (ssl_state) {
-        json_t *tjs = json_object();
-        if (unlikely(tjs == NULL))
-            return;
+        JsonWriterOpenObject(jw, "tls");
 
-        JsonTlsLogJSONBasic(tjs, ssl_state);
-        JsonTlsLogJSONExtended(tjs, ssl_state);
+        JsonTlsLogJSONBasic(jw, ssl_state);
+        JsonTlsLogJSONExtended(jw, ssl_state);
 
-        json_object_set_new(js, "tls", tjs);
+        JsonWriterCloseObject(jw);
     }
 
     return;
 }
 
-static void AlertJsonSsh(const Flow *f, json_t *js)
+static void AlertJsonSsh(const Flow *f, JsonWriter *jw)
 {
     SshState *ssh_state = (SshState *)FlowGetAppState(f);
     if (ssh_state) {
@@ -132,20 +130,26 @@ static void AlertJsonSsh(const Flow *f, json_t *js)
 
         JsonSshLogJSON(tjs, ssh_state);
 
-        json_object_set_new(js, "ssh", tjs);
+        JsonWriterJson(jw, "ssh", tjs);
+        json_decref(tjs);
     }
 
     return;
 }
 
-void AlertJsonHeader(const Packet *p, const PacketAlert *pa, json_t *js)
+static const char *AlertJsonAction(const PacketAlert *pa)
 {
-    char *action = "allowed";
     if (pa->action & (ACTION_REJECT|ACTION_REJECT_DST|ACTION_REJECT_BOTH)) {
-        action = "blocked";
+        return "blocked";
     } else if ((pa->action & ACTION_DROP) && EngineModeIsIPS()) {
-        action = "blocked";
+        return "blocked";
     }
+    return "allowed";
+}
+
+void AlertJsonHeader(const Packet *p, const PacketAlert *pa, json_t *js)
+{
+    const char *action = AlertJsonAction(pa);
 
     /* Add tx_id to root element for correlation with other events. */
     json_object_del(js, "tx_id");
@@ -175,92 +179,122 @@ void AlertJsonHeader(const Packet *p, const PacketAlert *pa, json_t *js)
     json_object_set_new(js, "alert", ajs);
 }
 
+/** \brief JsonWriter version of AlertJsonHeader */
+static void AlertJsonWriterHeader(JsonWriter *jw, const Packet *p, const PacketAlert *pa)
+{
+    /* Add tx_id to root element for correlation with other events. */
+    if (pa->flags & PACKET_ALERT_FLAG_TX)
+        JsonWriterUint(jw, "tx_id", pa->tx_id);
+
+    JsonWriterOpenObject(jw, "alert");
+    JsonWriterString(jw, "action", AlertJsonAction(pa));
+    JsonWriterUint(jw, "gid", pa->s->gid);
+    JsonWriterUint(jw, "signature_id", pa->s->id);
+    JsonWriterUint(jw, "rev", pa->s->rev);
+    JsonWriterString(jw, "signature", (pa->s->msg) ? pa->s->msg : "");
+    JsonWriterString(jw, "category",
+            (pa->s->class_msg) ? pa->s->class_msg : "");
+    JsonWriterInt(jw, "severity", pa->s->prio);
+
+    if (p->tenant_id > 0)
+        JsonWriterUint(jw, "tenant_id", p->tenant_id);
+
+    JsonWriterCloseObject(jw);
+}
+
+/** \brief add the app layer metadata of the alert's flow */
+static void AlertJsonAppLayer(JsonWriter *jw, const AlertJsonOutputCtx *json_output_ctx,
+        const Packet *p, const PacketAlert *pa)
+{
+    json_t *hjs;
+
+    FLOWLOCK_RDLOCK(p->flow);
+    uint16_t proto = FlowGetAppProtocol(p->flow);
+
+    /* http alert */
+    if ((json_output_ctx->flags & LOG_JSON_HTTP) && proto == ALPROTO_HTTP)
+        JsonHttpWriteMetadata(jw, "http", p->flow, pa->tx_id);
+
+    /* tls alert */
+    if ((json_output_ctx->flags & LOG_JSON_TLS) && proto == ALPROTO_TLS)
+        AlertJsonTls(p->flow, jw);
+
+    /* ssh alert */
+    if ((json_output_ctx->flags & LOG_JSON_SSH) && proto == ALPROTO_SSH)
+        AlertJsonSsh(p->flow, jw);
+
+    /* smtp alert */
+    if ((json_output_ctx->flags & LOG_JSON_SMTP) && proto == ALPROTO_SMTP) {
+        hjs = JsonSMTPAddMetadata(p->flow, pa->tx_id);
+        if (hjs) {
+            JsonWriterJson(jw, "smtp", hjs);
+            json_decref(hjs);
+        }
+
+        hjs = JsonEmailAddMetadata(p->flow, pa->tx_id);
+        if (hjs) {
+            JsonWriterJson(jw, "email", hjs);
+            json_decref(hjs);
+        }
+    }
+
+    FLOWLOCK_UNLOCK(p->flow);
+}
+
 static int AlertJson(ThreadVars *tv, JsonAlertLogThread *aft, const Packet *p)
 {
     MemBuffer *payload = aft->payload_buffer;
     AlertJsonOutputCtx *json_output_ctx = aft->json_output_ctx;
-    json_t *hjs = NULL;
+    JsonWriter jw;
 
     int i;
 
     if (p->alerts.cnt == 0)
         return TM_ECODE_OK;
 
-    json_t *js = CreateJSONHeader((Packet *)p, 0, "alert");
-    if (unlikely(js == NULL))
-        return TM_ECODE_OK;
-
     for (i = 0; i < p->alerts.cnt; i++) {
         const PacketAlert *pa = &p->alerts.alerts[i];
         if (unlikely(pa->s == NULL)) {
             continue;
         }
 
-        MemBufferReset(aft->json_buffer);
+        HttpXFFCfg *xff_cfg = json_output_ctx->xff_cfg;
+        int have_xff_ip = 0;
+        char xff_buffer[XFF_MAXLEN];
+        const char *src_ip = NULL;
+        const char *dest_ip = NULL;
 
-        /* alert */
-        AlertJsonHeader(p, pa, js);
-
-        if (json_output_ctx->flags & LOG_JSON_HTTP) {
-            if (p->flow != NULL) {
-                FLOWLOCK_RDLOCK(p->flow);
-                uint16_t proto = FlowGetAppProtocol(p->flow);
-
-                /* http alert */
-                if (proto == ALPROTO_HTTP) {
-                    hjs = JsonHttpAddMetadata(p->flow, pa->tx_id);
-                    if (hjs)
-                        json_object_set_new(js, "http", hjs);
+        /* xff header, looked up first as it may replace the tuple */
+        if ((xff_cfg != NULL) && !(xff_cfg->flags & XFF_DISABLED) && p->flow != NULL) {
+            FLOWLOCK_RDLOCK(p->flow);
+            if (FlowGetAppProtocol(p->flow) == ALPROTO_HTTP) {
+                if (pa->flags & PACKET_ALERT_FLAG_TX) {
+                    have_xff_ip = HttpXFFGetIPFromTx(p, pa->tx_id, xff_cfg, xff_buffer, XFF_MAXLEN);
+                } else {
+                    have_xff_ip = HttpXFFGetIP(p, xff_cfg, xff_buffer, XFF_MAXLEN);
                 }
-
-                FLOWLOCK_UNLOCK(p->flow);
             }
-        }
-
-        if (json_output_ctx->flags & LOG_JSON_TLS) {
-            if (p->flow != NULL) {
-                FLOWLOCK_RDLOCK(p->flow);
-                uint16_t proto = FlowGetAppProtocol(p->flow);
-
-                /* http alert */
-                if (proto == ALPROTO_TLS)
-                    AlertJsonTls(p->flow, js);
+            FLOWLOCK_UNLOCK(p->flow);
 
-                FLOWLOCK_UNLOCK(p->flow);
+            if (have_xff_ip && !(xff_cfg->flags & XFF_EXTRADATA) &&
+                    (xff_cfg->flags & XFF_OVERWRITE)) {
+                if (p->flowflags & FLOW_PKT_TOCLIENT) {
+                    dest_ip = xff_buffer;
+                } else {
+                    src_ip = xff_buffer;
+                }
             }
         }
 
-        if (json_output_ctx->flags & LOG_JSON_SSH) {
-            if (p->flow != NULL) {
-                FLOWLOCK_RDLOCK(p->flow);
-                uint16_t proto = FlowGetAppProtocol(p->flow);
+        OutputJsonWriterStart(&jw, aft->file_ctx, &aft->json_buffer);
+        OutputJsonWriterHeader(&jw, p, 0, "alert", src_ip, dest_ip);
 
-                /* http alert */
-                if (proto == ALPROTO_SSH)
-                    AlertJsonSsh(p->flow, js);
+        /* alert */
+        AlertJsonWriterHeader(&jw, p, pa);
 
-                FLOWLOCK_UNLOCK(p->flow);
-            }
-        }
-
-        if (json_output_ctx->flags & LOG_JSON_SMTP) {
-            if (p->flow != NULL) {
-                FLOWLOCK_RDLOCK(p->flow);
-                uint16_t proto = FlowGetAppProtocol(p->flow);
-
-                /* http alert */
-                if (proto == ALPROTO_SMTP) {
-                    hjs = JsonSMTPAddMetadata(p->flow, pa->tx_id);
-                    if (hjs)
-                        json_object_set_new(js, "smtp", hjs);
-
-                    hjs = JsonEmailAddMetadata(p->flow, pa->tx_id);
-                    if (hjs)
-                        json_object_set_new(js, "email", hjs);
-                }
-
-                FLOWLOCK_UNLOCK(p->flow);
-            }
+        if (p->flow != NULL && (json_output_ctx->flags &
+                    (LOG_JSON_HTTP|LOG_JSON_TLS|LOG_JSON_SSH|LOG_JSON_SMTP))) {
+            AlertJsonAppLayer(&jw, json_output_ctx, p, pa);
         }
 
         /* payload */
@@ -289,7 +323,7 @@ static int AlertJson(ThreadVars *tv, JsonAlertLogThread *aft, const Packet *p)
                     unsigned long len = json_output_ctx->payload_buffer_size * 2;
                     uint8_t encoded[len];
                     Base64Encode(payload->buffer, payload->offset, encoded, &len);
-                    json_object_set_new(js, "payload", json_string((char *)encoded));
+                    JsonWriterString(&jw, "payload", (char *)encoded);
                 }
 
                 if (json_output_ctx->flags & LOG_JSON_PAYLOAD) {
@@ -298,8 +332,8 @@ static int AlertJson(ThreadVars *tv, JsonAlertLogThread *aft, const Packet *p)
                     PrintStringsToBuffer(printable_buf, &offset,
                                      sizeof(printable_buf),
                                      payload->buffer, payload->offset);
-                    json_object_set_new(js, "payload_printable",
-                                        json_string((char *)printable_buf));
+                    JsonWriterString(&jw, "payload_printable",
+                                     (char *)printable_buf);
                 }
             } else {
                 /* This is a single packet and not a stream */
@@ -307,7 +341,7 @@ static int AlertJson(ThreadVars *tv, JsonAlertLogThread *aft, const Packet *p)
                     unsigned long len = p->payload_len * 2 + 1;
                     uint8_t encoded[len];
                     Base64Encode(p->payload, p->payload_len, encoded, &len);
-                    json_object_set_new(js, "payload", json_string((char *)encoded));
+                    JsonWriterString(&jw, "payload", (char *)encoded);
                 }
 
                 if (json_output_ctx->flags & LOG_JSON_PAYLOAD) {
@@ -316,11 +350,11 @@ static int AlertJson(ThreadVars *tv, JsonAlertLogThread *aft, const Packet *p)
                     PrintStringsToBuffer(printable_buf, &offset,
                                      p->payload_len + 1,
                                      p->payload, p->payload_len);
-                    json_object_set_new(js, "payload_printable", json_string((char *)printable_buf));
+                    JsonWriterString(&jw, "payload_printable", (char *)printable_buf);
                 }
             }
 
-            json_object_set_new(js, "stream", json_integer(stream));
+            JsonWriterInt(&jw, "stream", stream);
         }
 
         /* base64-encoded full packet */
@@ -328,45 +362,15 @@ static int AlertJson(ThreadVars *tv, JsonAlertLogThread *aft, const Packet *p)
             unsigned long len = GET_PKT_LEN(p) * 2;
             uint8_t encoded_packet[len];
             Base64Encode((unsigned char*) GET_PKT_DATA(p), GET_PKT_LEN(p), encoded_packet, &len);
-            json_object_set_new(js, "packet", json_string((char *)encoded_packet));
+            JsonWriterString(&jw, "packet", (char *)encoded_packet);
         }
 
-        HttpXFFCfg *xff_cfg = json_output_ctx->xff_cfg;
-
-        /* xff header */
-        if ((xff_cfg != NULL) && !(xff_cfg->flags & XFF_DISABLED) && p->flow != NULL) {
-            int have_xff_ip = 0;
-            char buffer[XFF_MAXLEN];
-
-            FLOWLOCK_RDLOCK(p->flow);
-            if (FlowGetAppProtocol(p->flow) == ALPROTO_HTTP) {
-                if (pa->flags & PACKET_ALERT_FLAG_TX) {
-                    have_xff_ip = HttpXFFGetIPFromTx(p, pa->tx_id, xff_cfg, buffer, XFF_MAXLEN);
-                } else {
-                    have_xff_ip = HttpXFFGetIP(p, xff_cfg, buffer, XFF_MAXLEN);
-                }
-            }
-            FLOWLOCK_UNLOCK(p->flow);
-
-            if (have_xff_ip) {
-                if (xff_cfg->flags & XFF_EXTRADATA) {
-                    json_object_set_new(js, "xff", json_string(buffer));
-                }
-                else if (xff_cfg->flags & XFF_OVERWRITE) {
-                    if (p->flowflags & FLOW_PKT_TOCLIENT) {
-                        json_object_set(js, "dest_ip", json_string(buffer));
-                    } else {
-                        json_object_set(js, "src_ip", json_string(buffer));
-                    }
-                }
-            }
+        if (have_xff_ip && (xff_cfg->flags & XFF_EXTRADATA)) {
+            JsonWriterString(&jw, "xff", xff_buffer);
         }
 
-        OutputJSONBuffer(js, aft->file_ctx, &aft->json_buffer);
-        json_object_del(js, "alert");
+        OutputJsonWriterFinish(&jw, aft->file_ctx);
     }
-    json_object_clear(js);
-    json_decref(js);
 
     return TM_ECODE_OK;
 }
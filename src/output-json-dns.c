@@ -69,109 +69,117 @@ typedef struct LogDnsLogThread_ {
     MemBuffer *buffer;
 } LogDnsLogThread;
 
-static void LogQuery(LogDnsLogThread *aft, json_t *js, DNSTransaction *tx,
+/** \brief write a domain name. Names with NUL bytes in them go through
+ *         BytesToString so they are logged the same way as before. */
+static void JsonDnsWriteName(JsonWriter *jw, const char *key,
+        const uint8_t *name, uint32_t name_len)
+{
+    if (memchr(name, '\0', name_len) == NULL) {
+        JsonWriterStringLen(jw, key, name, name_len);
+        return;
+    }
+
+    char *c = BytesToString(name, name_len);
+    if (c != NULL) {
+        JsonWriterString(jw, key, c);
+        SCFree(c);
+    }
+}
+
+static void LogQuery(LogDnsLogThread *aft, const Packet *p, DNSTransaction *tx,
         uint64_t tx_id, DNSQueryEntry *entry)
 {
+    LogFileCtx *file_ctx = aft->dnslog_ctx->file_ctx;
+    JsonWriter jw;
+
     SCLogDebug("got a DNS request and now logging !!");
 
-    json_t *djs = json_object();
-    if (djs == NULL) {
-        return;
-    }
+    OutputJsonWriterStart(&jw, file_ctx, &aft->buffer);
+    OutputJsonWriterHeader(&jw, p, 1, "dns", NULL, NULL);
 
-    /* reset */
-    MemBufferReset(aft->buffer);
+    JsonWriterOpenObject(&jw, "dns");
 
     /* type */
-    json_object_set_new(djs, "type", json_string("query"));
+    JsonWriterString(&jw, "type", "query");
 
     /* id */
-    json_object_set_new(djs, "id", json_integer(tx->tx_id));
+    JsonWriterUint(&jw, "id", tx->tx_id);
 
     /* query */
-    char *c;
-    c = BytesToString((uint8_t *)((uint8_t *)entry + sizeof(DNSQueryEntry)), entry->len);
-    if (c != NULL) {
-        json_object_set_new(djs, "rrname", json_string(c));
-        SCFree(c);
-    }
+    JsonDnsWriteName(&jw, "rrname",
+            (uint8_t *)((uint8_t *)entry + sizeof(DNSQueryEntry)), entry->len);
 
     /* name */
     char record[16] = "";
     DNSCreateTypeString(entry->type, record, sizeof(record));
-    json_object_set_new(djs, "rrtype", json_string(record));
+    JsonWriterString(&jw, "rrtype", record);
 
     /* tx id (tx counter) */
-    json_object_set_new(djs, "tx_id", json_integer(tx_id));
+    JsonWriterUint(&jw, "tx_id", tx_id);
 
-    /* dns */
-    json_object_set_new(js, "dns", djs);
-    OutputJSONBuffer(js, aft->dnslog_ctx->file_ctx, &aft->buffer);
-    json_object_del(js, "dns");
+    JsonWriterCloseObject(&jw);
+
+    OutputJsonWriterFinish(&jw, file_ctx);
 }
 
-static void OutputAnswer(LogDnsLogThread *aft, json_t *djs, DNSTransaction *tx, DNSAnswerEntry *entry)
+static void OutputAnswer(LogDnsLogThread *aft, const Packet *p, DNSTransaction *tx, DNSAnswerEntry *entry)
 {
-    json_t *js = json_object();
-    if (js == NULL)
-        return;
+    LogFileCtx *file_ctx = aft->dnslog_ctx->file_ctx;
+    JsonWriter jw;
+
+    OutputJsonWriterStart(&jw, file_ctx, &aft->buffer);
+    OutputJsonWriterHeader(&jw, p, 0, "dns", NULL, NULL);
+
+    JsonWriterOpenObject(&jw, "dns");
 
     /* type */
-    json_object_set_new(js, "type", json_string("answer"));
+    JsonWriterString(&jw, "type", "answer");
 
     /* id */
-    json_object_set_new(js, "id", json_integer(tx->tx_id));
+    JsonWriterUint(&jw, "id", tx->tx_id);
 
     /* rcode */
     char rcode[16] = "";
     DNSCreateRcodeString(tx->rcode, rcode, sizeof(rcode));
-    json_object_set_new(js, "rcode", json_string(rcode));
+    JsonWriterString(&jw, "rcode", rcode);
 
     /* we are logging an answer RR */
     if (entry != NULL) {
         /* query */
         if (entry->fqdn_len > 0) {
-            char *c;
-            c = BytesToString((uint8_t *)((uint8_t *)entry + sizeof(DNSAnswerEntry)),
+            JsonDnsWriteName(&jw, "rrname",
+                    (uint8_t *)((uint8_t *)entry + sizeof(DNSAnswerEntry)),
                     entry->fqdn_len);
-            if (c != NULL) {
-                json_object_set_new(js, "rrname", json_string(c));
-                SCFree(c);
-            }
         }
 
         /* name */
         char record[16] = "";
         DNSCreateTypeString(entry->type, record, sizeof(record));
-        json_object_set_new(js, "rrtype", json_string(record));
+        JsonWriterString(&jw, "rrtype", record);
 
         /* ttl */
-        json_object_set_new(js, "ttl", json_integer(entry->ttl));
+        JsonWriterUint(&jw, "ttl", entry->ttl);
 
         uint8_t *ptr = (uint8_t *)((uint8_t *)entry + sizeof(DNSAnswerEntry)+ entry->fqdn_len);
         if (entry->type == DNS_RECORD_TYPE_A) {
             char a[16] = "";
             PrintInet(AF_INET, (const void *)ptr, a, sizeof(a));
-            json_object_set_new(js, "rdata", json_string(a));
+            JsonWriterString(&jw, "rdata", a);
         } else if (entry->type == DNS_RECORD_TYPE_AAAA) {
             char a[46] = "";
             PrintInet(AF_INET6, (const void *)ptr, a, sizeof(a));
-            json_object_set_new(js, "rdata", json_string(a));
+            JsonWriterString(&jw, "rdata", a);
         } else if (entry->data_len == 0) {
-            json_object_set_new(js, "rdata", json_string(""));
+            JsonWriterString(&jw, "rdata", "");
         } else if (entry->type == DNS_RECORD_TYPE_TXT || entry->type == DNS_RECORD_TYPE_CNAME ||
                    entry->type == DNS_RECORD_TYPE_MX || entry->type == DNS_RECORD_TYPE_PTR ||
                    entry->type == DNS_RECORD_TYPE_NS) {
-            if (entry->data_len != 0) {
-                char buffer[256] = "";
-                uint16_t copy_len = entry->data_len < (sizeof(buffer) - 1) ?
-                    entry->data_len : sizeof(buffer) - 1;
-                memcpy(buffer, ptr, copy_len);
-                buffer[copy_len] = '\0';
-                json_object_set_new(js, "rdata", json_string(buffer));
-            } else {
-                json_object_set_new(js, "rdata", json_string(""));
-            }
+            /* rdata is logged up to the first NUL and at most 255 bytes */
+            const uint8_t *end = memchr(ptr, '\0', entry->data_len);
+            uint32_t copy_len = end ? (uint32_t)(end - ptr) : entry->data_len;
+            if (copy_len > 255)
+                copy_len = 255;
+            JsonWriterStringLen(&jw, "rdata", ptr, copy_len);
         } else if (entry->type == DNS_RECORD_TYPE_SSHFP) {
             if (entry->data_len > 2) {
                 /* get algo and type */
@@ -182,71 +190,60 @@ static void OutputAnswer(LogDnsLogThread *aft, json_t *djs, DNSTransaction *tx,
                 uint16_t fp_len = (entry->data_len - 2);
                 uint8_t *dptr = ptr+2;
                 uint32_t output_len = fp_len * 2 + 1; // create c-string, so add space for 0.
-                char hexstring[output_len], *p = hexstring;
+                char hexstring[output_len], *hp = hexstring;
                 memset(hexstring, 0x00, output_len);
 
                 uint16_t x;
-                for (x = 0; x < fp_len; x++, p += 3) {
-                    snprintf(p, 4, x == fp_len - 1 ? "%02x" : "%02x:", dptr[x]);
+                for (x = 0; x < fp_len; x++, hp += 3) {
+                    snprintf(hp, 4, x == fp_len - 1 ? "%02x" : "%02x:", dptr[x]);
                 }
 
                 /* wrap the whole thing in it's own structure */
-                json_t *hjs = json_object();
-                if (hjs != NULL) {
-                    json_object_set_new(hjs, "fingerprint", json_string(hexstring));
-                    json_object_set_new(hjs, "algo", json_integer(algo));
-                    json_object_set_new(hjs, "type", json_integer(fptype));
-
-                    json_object_set_new(js, "sshfp", hjs);
-                }
+                JsonWriterOpenObject(&jw, "sshfp");
+                JsonWriterString(&jw, "fingerprint", hexstring);
+                JsonWriterUint(&jw, "algo", algo);
+                JsonWriterUint(&jw, "type", fptype);
+                JsonWriterCloseObject(&jw);
             }
         }
     }
 
-    /* reset */
-    MemBufferReset(aft->buffer);
-    json_object_set_new(djs, "dns", js);
-    OutputJSONBuffer(djs, aft->dnslog_ctx->file_ctx, &aft->buffer);
-    json_object_del(djs, "dns");
+    JsonWriterCloseObject(&jw);
 
-    return;
+    OutputJsonWriterFinish(&jw, file_ctx);
 }
 
-static void OutputFailure(LogDnsLogThread *aft, json_t *djs, DNSTransaction *tx, DNSQueryEntry *entry)
+static void OutputFailure(LogDnsLogThread *aft, const Packet *p, DNSTransaction *tx, DNSQueryEntry *entry)
 {
-    json_t *js = json_object();
-    if (js == NULL)
-        return;
+    LogFileCtx *file_ctx = aft->dnslog_ctx->file_ctx;
+    JsonWriter jw;
+
+    OutputJsonWriterStart(&jw, file_ctx, &aft->buffer);
+    OutputJsonWriterHeader(&jw, p, 0, "dns", NULL, NULL);
+
+    JsonWriterOpenObject(&jw, "dns");
 
     /* type */
-    json_object_set_new(js, "type", json_string("answer"));
+    JsonWriterString(&jw, "type", "answer");
 
     /* id */
-    json_object_set_new(js, "id", json_integer(tx->tx_id));
+    JsonWriterUint(&jw, "id", tx->tx_id);
 
     /* rcode */
     char rcode[16] = "";
     DNSCreateRcodeString(tx->rcode, rcode, sizeof(rcode));
-    json_object_set_new(js, "rcode", json_string(rcode));
+    JsonWriterString(&jw, "rcode", rcode);
 
     /* no answer RRs, use query for rname */
-    char *c;
-    c = BytesToString((uint8_t *)((uint8_t *)entry + sizeof(DNSQueryEntry)), entry->len);
-    if (c != NULL) {
-        json_object_set_new(js, "rrname", json_string(c));
-        SCFree(c);
-    }
+    JsonDnsWriteName(&jw, "rrname",
+            (uint8_t *)((uint8_t *)entry + sizeof(DNSQueryEntry)), entry->len);
 
-    /* reset */
-    MemBufferReset(aft->buffer);
-    json_object_set_new(djs, "dns", js);
-    OutputJSONBuffer(djs, aft->dnslog_ctx->file_ctx, &aft->buffer);
-    json_object_del(djs, "dns");
+    JsonWriterCloseObject(&jw);
 
-    return;
+    OutputJsonWriterFinish(&jw, file_ctx);
 }
 
-static void LogAnswers(LogDnsLogThread *aft, json_t *js, DNSTransaction *tx, uint64_t tx_id)
+static void LogAnswers(LogDnsLogThread *aft, const Packet *p, DNSTransaction *tx, uint64_t tx_id)
 {
 
     SCLogDebug("got a DNS response and now logging !!");
@@ -258,18 +255,18 @@ static void LogAnswers(LogDnsLogThread *aft, json_t *js, DNSTransaction *tx, uin
          * are likely to lead to FORMERR, so log this. */
         DNSQueryEntry *query = NULL;
         TAILQ_FOREACH(query, &tx->query_list, next) {
-            OutputFailure(aft, js, tx, query);
+            OutputFailure(aft, p, tx, query);
         }
     }
 
     DNSAnswerEntry *entry = NULL;
     TAILQ_FOREACH(entry, &tx->answer_list, next) {
-        OutputAnswer(aft, js, tx, entry);
+        OutputAnswer(aft, p, tx, entry);
     }
 
     entry = NULL;
     TAILQ_FOREACH(entry, &tx->authority_list, next) {
-        OutputAnswer(aft, js, tx, entry);
+        OutputAnswer(aft, p, tx, entry);
     }
 
 }
@@ -280,26 +277,13 @@ static int JsonDnsLogger(ThreadVars *tv, void *thread_data, const Packet *p, Flo
 
     LogDnsLogThread *td = (LogDnsLogThread *)thread_data;
     DNSTransaction *tx = txptr;
-    json_t *js;
 
     DNSQueryEntry *query = NULL;
     TAILQ_FOREACH(query, &tx->query_list, next) {
-        js = CreateJSONHeader((Packet *)p, 1, "dns");
-        if (unlikely(js == NULL))
-            return TM_ECODE_OK;
-
-        LogQuery(td, js, tx, tx_id, query);
-
-        json_decref(js);
+        LogQuery(td, p, tx, tx_id, query);
     }
 
-    js = CreateJSONHeader((Packet *)p, 0, "dns");
-    if (unlikely(js == NULL))
-        return TM_ECODE_OK;
-
-    LogAnswers(td, js, tx, tx_id);
-
-    json_decref(js);
+    LogAnswers(td, p, tx, tx_id);
 
     SCReturnInt(TM_ECODE_OK);
 }
@@ -82,48 +82,45 @@ typedef struct JsonFileLogThread_ {
  */
 static void FileWriteJsonRecord(JsonFileLogThread *aft, const Packet *p, const File *ff)
 {
-    json_t *js = CreateJSONHeader((Packet *)p, 0, "fileinfo"); //TODO const
+    LogFileCtx *file_ctx = aft->filelog_ctx->file_ctx;
     json_t *hjs = NULL;
-    if (unlikely(js == NULL))
-        return;
+    JsonWriter jw;
 
-    /* reset */
-    MemBufferReset(aft->buffer);
+    OutputJsonWriterStart(&jw, file_ctx, &aft->buffer);
+    OutputJsonWriterHeader(&jw, p, 0, "fileinfo", NULL, NULL);
 
     switch (p->flow->alproto) {
         case ALPROTO_HTTP:
-            hjs = JsonHttpAddMetadata(p->flow, ff->txid);
-            if (hjs)
-                json_object_set_new(js, "http", hjs);
+            (void)JsonHttpWriteMetadata(&jw, "http", p->flow, ff->txid);
             break;
         case ALPROTO_SMTP:
             hjs = JsonSMTPAddMetadata(p->flow, ff->txid);
-            if (hjs)
-                json_object_set_new(js, "smtp", hjs);
+            if (hjs) {
+                JsonWriterJson(&jw, "smtp", hjs);
+                json_decref(hjs);
+            }
             hjs = JsonEmailAddMetadata(p->flow, ff->txid);
-            if (hjs)
-                json_object_set_new(js, "email", hjs);
+            if (hjs) {
+                JsonWriterJson(&jw, "email", hjs);
+                json_decref(hjs);
+            }
             break;
     }
 
-    json_object_set_new(js, "app_proto",
-            json_string(AppProtoToString(p->flow->alproto)));
+    JsonWriterString(&jw, "app_proto", AppProtoToString(p->flow->alproto));
 
-    json_t *fjs = json_object();
-    if (unlikely(fjs == NULL)) {
-        json_decref(js);
-        return;
-    }
+    /* originally just 'file', but due to bug 1127 naming it fileinfo */
+    JsonWriterOpenObject(&jw, "fileinfo");
 
     char *s = BytesToString(ff->name, ff->name_len);
-    json_object_set_new(fjs, "filename", json_string(s));
+    JsonWriterString(&jw, "filename", s);
     if (s != NULL)
         SCFree(s);
     if (ff->magic)
-        json_object_set_new(fjs, "magic", json_string((char *)ff->magic));
+        JsonWriterString(&jw, "magic", (char *)ff->magic);
     switch (ff->state) {
         case FILE_STATE_CLOSED:
-            json_object_set_new(fjs, "state", json_string("CLOSED"));
+            JsonWriterString(&jw, "state", "CLOSED");
 #ifdef HAVE_NSS
             if (ff->flags & FILE_MD5) {
                 size_t x;
@@ -132,45 +129,29 @@ static void FileWriteJsonRecord(JsonFileLogThread *aft, const Packet *p, const F
                 for (i = 0, x = 0; x < sizeof(ff->md5); x++) {
                     i += snprintf(&s[i], 255-i, "%02x", ff->md5[x]);
                 }
-                json_object_set_new(fjs, "md5", json_string(s));
+                JsonWriterString(&jw, "md5", s);
             }
 #endif
             break;
         case FILE_STATE_TRUNCATED:
-            json_object_set_new(fjs, "state", json_string("TRUNCATED"));
+            JsonWriterString(&jw, "state", "TRUNCATED");
             break;
         case FILE_STATE_ERROR:
-            json_object_set_new(fjs, "state", json_string("ERROR"));
+            JsonWriterString(&jw, "state", "ERROR");
             break;
         default:
-            json_object_set_new(fjs, "state", json_string("UNKNOWN"));
+            JsonWriterString(&jw, "state", "UNKNOWN");
             break;
     }
-    json_object_set_new(fjs, "stored",
-                        (ff->flags & FILE_STORED) ? json_true() : json_false());
+    JsonWriterBool(&jw, "stored", (ff->flags & FILE_STORED) ? 1 : 0);
     if (ff->flags & FILE_STORED) {
-        json_object_set_new(fjs, "file_id", json_integer(ff->file_id));
-    }
-    json_object_set_new(fjs, "size", json_integer(FileSize(ff)));
-    json_object_set_new(fjs, "tx_id", json_integer(ff->txid));
-
-    /* originally just 'file', but due to bug 1127 naming it fileinfo */
-    json_object_set_new(js, "fileinfo", fjs);
-    OutputJSONBuffer(js, aft->filelog_ctx->file_ctx, &aft->buffer);
-    json_object_del(js, "fileinfo");
-
-    switch (p->flow->alproto) {
-        case ALPROTO_HTTP:
-            json_object_del(js, "http");
-            break;
-        case ALPROTO_SMTP:
-            json_object_del(js, "smtp");
-            json_object_del(js, "email");
-            break;
+        JsonWriterUint(&jw, "file_id", ff->file_id);
     }
+    JsonWriterUint(&jw, "size", FileSize(ff));
+    JsonWriterUint(&jw, "tx_id", ff->txid);
+    JsonWriterCloseObject(&jw);
 
-    json_object_clear(js);
-    json_decref(js);
+    OutputJsonWriterFinish(&jw, file_ctx);
 }
 
 static int JsonFileLogger(ThreadVars *tv, void *thread_data, const Packet *p, const File *ff)
@@ -68,16 +68,12 @@ typedef struct JsonFlowLogThread_ {
 #define LOG_HTTP_EXTENDED 1
 #define LOG_HTTP_CUSTOM 2
 
-static json_t *CreateJSONHeaderFromFlow(Flow *f, char *event_type)
+static void CreateJSONHeaderFromFlow(JsonWriter *jw, Flow *f, const char *event_type)
 {
     char timebuf[64];
     char srcip[46], dstip[46];
     Port sp, dp;
 
-    json_t *js = json_object();
-    if (unlikely(js == NULL))
-        return NULL;
-
     struct timeval tv;
     memset(&tv, 0x00, sizeof(tv));
     TimeGet(&tv);
@@ -105,113 +101,68 @@ static json_t *CreateJSONHeaderFromFlow(Flow *f, char *event_type)
     }
 
     /* time */
-    json_object_set_new(js, "timestamp", json_string(timebuf));
+    JsonWriterString(jw, "timestamp", timebuf);
 
-    CreateJSONFlowId(js, (const Flow *)f);
+    JsonWriterUint(jw, "flow_id", f->flow_hash);
+
+    /* TODO sensor id, vlan */
+    JsonWriterString(jw, "event_type", event_type);
 
-#if 0 // TODO
-    /* sensor id */
-    if (sensor_id >= 0)
-        json_object_set_new(js, "sensor_id", json_integer(sensor_id));
-#endif
-    if (event_type) {
-        json_object_set_new(js, "event_type", json_string(event_type));
-    }
-#if 0
-    /* vlan */
-    if (f->vlan_id[0] > 0) {
-        json_t *js_vlan;
-        switch (f->vlan_idx) {
-            case 1:
-                json_object_set_new(js, "vlan",
-                                    json_integer(f->vlan_id[0]));
-                break;
-            case 2:
-                js_vlan = json_array();
-                if (unlikely(js != NULL)) {
-                    json_array_append_new(js_vlan,
-                                    json_integer(VLAN_GET_ID1(p)));
-                    json_array_append_new(js_vlan,
-                                    json_integer(VLAN_GET_ID2(p)));
-                    json_object_set_new(js, "vlan", js_vlan);
-                }
-                break;
-            default:
-                /* shouldn't get here */
-                break;
-        }
-    }
-#endif
     /* tuple */
-    json_object_set_new(js, "src_ip", json_string(srcip));
+    JsonWriterString(jw, "src_ip", srcip);
     switch(f->proto) {
         case IPPROTO_ICMP:
             break;
         case IPPROTO_UDP:
         case IPPROTO_TCP:
         case IPPROTO_SCTP:
-            json_object_set_new(js, "src_port", json_integer(sp));
+            JsonWriterUint(jw, "src_port", sp);
             break;
     }
-    json_object_set_new(js, "dest_ip", json_string(dstip));
+    JsonWriterString(jw, "dest_ip", dstip);
     switch(f->proto) {
         case IPPROTO_ICMP:
             break;
         case IPPROTO_UDP:
         case IPPROTO_TCP:
         case IPPROTO_SCTP:
-            json_object_set_new(js, "dest_port", json_integer(dp));
+            JsonWriterUint(jw, "dest_port", dp);
             break;
     }
-    json_object_set_new(js, "proto", json_string(proto));
+    JsonWriterString(jw, "proto", proto);
     switch (f->proto) {
         case IPPROTO_ICMP:
         case IPPROTO_ICMPV6:
-            json_object_set_new(js, "icmp_type",
-                    json_integer(f->type));
-            json_object_set_new(js, "icmp_code",
-                    json_integer(f->code));
+            JsonWriterUint(jw, "icmp_type", f->type);
+            JsonWriterUint(jw, "icmp_code", f->code);
             break;
     }
-    return js;
 }
 
 /* JSON format logging */
-static void JsonFlowLogJSON(JsonFlowLogThread *aft, json_t *js, Flow *f)
+static void JsonFlowLogJSON(JsonFlowLogThread *aft, JsonWriter *jw, Flow *f)
 {
-#if 0
-    LogJsonFileCtx *flow_ctx = aft->flowlog_ctx;
-#endif
-    json_t *hjs = json_object();
-    if (hjs == NULL) {
-        return;
-    }
-
-    json_object_set_new(js, "app_proto", json_string(AppProtoToString(f->alproto)));
+    JsonWriterString(jw, "app_proto", AppProtoToString(f->alproto));
 
-    json_object_set_new(hjs, "pkts_toserver",
-            json_integer(f->todstpktcnt));
-    json_object_set_new(hjs, "pkts_toclient",
-            json_integer(f->tosrcpktcnt));
-    json_object_set_new(hjs, "bytes_toserver",
-            json_integer(f->todstbytecnt));
-    json_object_set_new(hjs, "bytes_toclient",
-            json_integer(f->tosrcbytecnt));
+    JsonWriterOpenObject(jw, "flow");
+    JsonWriterUint(jw, "pkts_toserver", f->todstpktcnt);
+    JsonWriterUint(jw, "pkts_toclient", f->tosrcpktcnt);
+    JsonWriterUint(jw, "bytes_toserver", f->todstbytecnt);
+    JsonWriterUint(jw, "bytes_toclient", f->tosrcbytecnt);
 
     char timebuf1[64], timebuf2[64];
 
     CreateIsoTimeString(&f->startts, timebuf1, sizeof(timebuf1));
     CreateIsoTimeString(&f->lastts, timebuf2, sizeof(timebuf2));
 
-    json_object_set_new(hjs, "start", json_string(timebuf1));
-    json_object_set_new(hjs, "end", json_string(timebuf2));
+    JsonWriterString(jw, "start", timebuf1);
+    JsonWriterString(jw, "end", timebuf2);
 
     int32_t age = f->lastts.tv_sec - f->startts.tv_sec;
-    json_object_set_new(hjs, "age",
-            json_integer(age));
+    JsonWriterInt(jw, "age", age);
 
     if (f->flow_end_flags & FLOW_END_FLAG_EMERGENCY)
-        json_object_set_new(hjs, "emergency", json_true());
+        JsonWriterBool(jw, "emergency", 1);
     const char *state = NULL;
     if (f->flow_end_flags & FLOW_END_FLAG_STATE_NEW)
         state = "new";
@@ -220,8 +171,7 @@ static void JsonFlowLogJSON(JsonFlowLogThread *aft, json_t *js, Flow *f)
     else if (f->flow_end_flags & FLOW_END_FLAG_STATE_CLOSED)
         state = "closed";
 
-    json_object_set_new(hjs, "state",
-            json_string(state));
+    JsonWriterString(jw, "state", state);
 
     const char *reason = NULL;
     if (f->flow_end_flags & FLOW_END_FLAG_TIMEOUT)
@@ -231,35 +181,30 @@ static void JsonFlowLogJSON(JsonFlowLogThread *aft, json_t *js, Flow *f)
     else if (f->flow_end_flags & FLOW_END_FLAG_SHUTDOWN)
         reason = "shutdown";
 
-    json_object_set_new(hjs, "reason",
-            json_string(reason));
-
-    json_object_set_new(js, "flow", hjs);
+    JsonWriterString(jw, "reason", reason);
 
+    JsonWriterCloseObject(jw);
 
     /* TCP */
     if (f->proto == IPPROTO_TCP) {
-        json_t *tjs = json_object();
-        if (tjs == NULL) {
-            return;
-        }
-
         TcpSession *ssn = f->protoctx;
 
+        JsonWriterOpenObject(jw, "tcp");
+
         char hexflags[3];
         snprintf(hexflags, sizeof(hexflags), "%02x",
                 ssn ? ssn->tcp_packet_flags : 0);
-        json_object_set_new(tjs, "tcp_flags", json_string(hexflags));
+        JsonWriterString(jw, "tcp_flags", hexflags);
 
         snprintf(hexflags, sizeof(hexflags), "%02x",
                 ssn ? ssn->client.tcp_flags : 0);
-        json_object_set_new(tjs, "tcp_flags_ts", json_string(hexflags));
+        JsonWriterString(jw, "tcp_flags_ts", hexflags);
 
         snprintf(hexflags, sizeof(hexflags), "%02x",
                 ssn ? ssn->server.tcp_flags : 0);
-        json_object_set_new(tjs, "tcp_flags_tc", json_string(hexflags));
+        JsonWriterString(jw, "tcp_flags_tc", hexflags);
 
-        JsonTcpFlags(ssn ? ssn->tcp_packet_flags : 0, tjs);
+        JsonWriterTcpFlags(jw, ssn ? ssn->tcp_packet_flags : 0);
 
         if (ssn) {
             char *state = NULL;
@@ -301,10 +246,10 @@ static void JsonFlowLogJSON(JsonFlowLogThread *aft, json_t *js, Flow *f)
                     state = "closed";
                     break;
             }
-            json_object_set_new(tjs, "state", json_string(state));
+            JsonWriterString(jw, "state", state);
         }
 
-        json_object_set_new(js, "tcp", tjs);
+        JsonWriterCloseObject(jw);
     }
 }
 
@@ -312,21 +257,15 @@ static int JsonFlowLogger(ThreadVars *tv, void *thread_data, Flow *f)
 {
     SCEnter();
     JsonFlowLogThread *jhl = (JsonFlowLogThread *)thread_data;
+    LogFileCtx *file_ctx = jhl->flowlog_ctx->file_ctx;
+    JsonWriter jw;
 
-    /* reset */
-    MemBufferReset(jhl->buffer);
-
-    json_t *js = CreateJSONHeaderFromFlow(f, "flow"); //TODO const
-    if (unlikely(js == NULL))
-        return TM_ECODE_OK;
-
-    JsonFlowLogJSON(jhl, js, f);
+    OutputJsonWriterStart(&jw, file_ctx, &jhl->buffer);
 
-    OutputJSONBuffer(js, jhl->flowlog_ctx->file_ctx, &jhl->buffer);
-    json_object_del(js, "http");
+    CreateJSONHeaderFromFlow(&jw, f, "flow");
+    JsonFlowLogJSON(jhl, &jw, f);
 
-    json_object_clear(js);
-    json_decref(js);
+    OutputJsonWriterFinish(&jw, file_ctx);
 
     SCReturnInt(TM_ECODE_OK);
 }
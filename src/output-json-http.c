@@ -181,28 +181,42 @@ struct {
     { "www_authenticate", "www-authenticate", 0 },
 };
 
-void JsonHttpLogJSONBasic(json_t *js, htp_tx_t *tx)
+/** \brief write a bstr as string value without copying it
+ *
+ *  Values with NUL bytes in them go through bstr_util_strdup_to_c, so they
+ *  are logged the same way as before.
+ */
+static void JsonHttpWriteBstrLen(JsonWriter *jw, const char *key, bstr *b, size_t len)
+{
+    if (memchr(bstr_ptr(b), '\0', len) == NULL) {
+        JsonWriterStringLen(jw, key, bstr_ptr(b), len);
+        return;
+    }
+
+    char *c = bstr_util_memdup_to_c(bstr_ptr(b), len);
+    if (c != NULL) {
+        JsonWriterString(jw, key, c);
+        SCFree(c);
+    }
+}
+
+static void JsonHttpWriteBstr(JsonWriter *jw, const char *key, bstr *b)
 {
-    char *c;
+    JsonHttpWriteBstrLen(jw, key, b, bstr_len(b));
+}
 
+void JsonHttpLogJSONBasic(JsonWriter *jw, htp_tx_t *tx)
+{
     /* hostname */
     if (tx->request_hostname != NULL)
     {
-        c = bstr_util_strdup_to_c(tx->request_hostname);
-        if (c != NULL) {
-            json_object_set_new(js, "hostname", json_string(c));
-            SCFree(c);
-        }
+        JsonHttpWriteBstr(jw, "hostname", tx->request_hostname);
     }
 
     /* uri */
     if (tx->request_uri != NULL)
     {
-        c = bstr_util_strdup_to_c(tx->request_uri);
-        if (c != NULL) {
-            json_object_set_new(js, "url", json_string(c));
-            SCFree(c);
-        }
+        JsonHttpWriteBstr(jw, "url", tx->request_uri);
     }
 
     /* user agent */
@@ -211,11 +225,7 @@ void JsonHttpLogJSONBasic(json_t *js, htp_tx_t *tx)
         h_user_agent = htp_table_get_c(tx->request_headers, "user-agent");
     }
     if (h_user_agent != NULL) {
-        c = bstr_util_strdup_to_c(h_user_agent->value);
-        if (c != NULL) {
-            json_object_set_new(js, "http_user_agent", json_string(c));
-            SCFree(c);
-        }
+        JsonHttpWriteBstr(jw, "http_user_agent", h_user_agent->value);
     }
 
     /* x-forwarded-for */
@@ -224,11 +234,7 @@ void JsonHttpLogJSONBasic(json_t *js, htp_tx_t *tx)
         h_x_forwarded_for = htp_table_get_c(tx->request_headers, "x-forwarded-for");
     }
     if (h_x_forwarded_for != NULL) {
-        c = bstr_util_strdup_to_c(h_x_forwarded_for->value);
-        if (c != NULL) {
-            json_object_set_new(js, "xff", json_string(c));
-            SCFree(c);
-        }
+        JsonHttpWriteBstr(jw, "xff", h_x_forwarded_for->value);
     }
 
     /* content-type */
@@ -237,21 +243,17 @@ void JsonHttpLogJSONBasic(json_t *js, htp_tx_t *tx)
         h_content_type = htp_table_get_c(tx->response_headers, "content-type");
     }
     if (h_content_type != NULL) {
-        char *p;
-        c = bstr_util_strdup_to_c(h_content_type->value);
-        if (c != NULL) {
-            p = strchr(c, ';');
-            if (p != NULL)
-                *p = '\0';
-            json_object_set_new(js, "http_content_type", json_string(c));
-            SCFree(c);
-        }
+        /* only log the part before the parameters */
+        size_t len = bstr_len(h_content_type->value);
+        const uint8_t *p = memchr(bstr_ptr(h_content_type->value), ';', len);
+        if (p != NULL)
+            len = p - bstr_ptr(h_content_type->value);
+        JsonHttpWriteBstrLen(jw, "http_content_type", h_content_type->value, len);
     }
 }
 
-static void JsonHttpLogJSONCustom(LogHttpFileCtx *http_ctx, json_t *js, htp_tx_t *tx)
+static void JsonHttpLogJSONCustom(LogHttpFileCtx *http_ctx, JsonWriter *jw, htp_tx_t *tx)
 {
-    char *c;
     HttpField f;
 
     for (f = HTTP_FIELD_ACCEPT; f < HTTP_FIELD_SIZE; f++)
@@ -278,94 +280,69 @@ static void JsonHttpLogJSONCustom(LogHttpFileCtx *http_ctx, json_t *js, htp_tx_t
                     }
                 }
                 if (h_field != NULL) {
-                    c = bstr_util_strdup_to_c(h_field->value);
-                    if (c != NULL) {
-                        json_object_set_new(js,
-                                http_fields[f].config_field,
-                                json_string(c));
-                        SCFree(c);
-                    }
+                    JsonHttpWriteBstr(jw, http_fields[f].config_field,
+                            h_field->value);
                 }
             }
         }
     }
 }
 
-void JsonHttpLogJSONExtended(json_t *js, htp_tx_t *tx)
+void JsonHttpLogJSONExtended(JsonWriter *jw, htp_tx_t *tx)
 {
-    char *c;
-
     /* referer */
     htp_header_t *h_referer = NULL;
     if (tx->request_headers != NULL) {
         h_referer = htp_table_get_c(tx->request_headers, "referer");
     }
     if (h_referer != NULL) {
-        c = bstr_util_strdup_to_c(h_referer->value);
-        if (c != NULL) {
-            json_object_set_new(js, "http_refer", json_string(c));
-            SCFree(c);
-        }
+        JsonHttpWriteBstr(jw, "http_refer", h_referer->value);
     }
 
     /* method */
     if (tx->request_method != NULL) {
-        c = bstr_util_strdup_to_c(tx->request_method);
-        if (c != NULL) {
-            json_object_set_new(js, "http_method", json_string(c));
-            SCFree(c);
-        }
+        JsonHttpWriteBstr(jw, "http_method", tx->request_method);
     }
 
     /* protocol */
     if (tx->request_protocol != NULL) {
-        c = bstr_util_strdup_to_c(tx->request_protocol);
-        if (c != NULL) {
-            json_object_set_new(js, "protocol", json_string(c));
-            SCFree(c);
-        }
+        JsonHttpWriteBstr(jw, "protocol", tx->request_protocol);
     }
 
     /* response status */
     if (tx->response_status != NULL) {
-        c = bstr_util_strdup_to_c(tx->response_status);
+        char *c = bstr_util_strdup_to_c(tx->response_status);
         if (c != NULL) {
             unsigned int val = strtoul(c, NULL, 10);
-            json_object_set_new(js, "status", json_integer(val));
+            JsonWriterUint(jw, "status", val);
             SCFree(c);
         }
 
         htp_header_t *h_location = htp_table_get_c(tx->response_headers, "location");
         if (h_location != NULL) {
-            c = bstr_util_strdup_to_c(h_location->value);
-            if (c != NULL) {
-                json_object_set_new(js, "redirect", json_string(c));
-                SCFree(c);
-            }
+            JsonHttpWriteBstr(jw, "redirect", h_location->value);
         }
     }
 
     /* length */
-    json_object_set_new(js, "length", json_integer(tx->response_message_len));
+    JsonWriterUint(jw, "length", tx->response_message_len);
 }
 
 /* JSON format logging */
-static void JsonHttpLogJSON(JsonHttpLogThread *aft, json_t *js, htp_tx_t *tx, uint64_t tx_id)
+static void JsonHttpLogJSON(JsonHttpLogThread *aft, JsonWriter *jw, htp_tx_t *tx, uint64_t tx_id)
 {
     LogHttpFileCtx *http_ctx = aft->httplog_ctx;
-    json_t *hjs = json_object();
-    if (hjs == NULL) {
-        return;
-    }
 
-    JsonHttpLogJSONBasic(hjs, tx);
+    JsonWriterOpenObject(jw, "http");
+
+    JsonHttpLogJSONBasic(jw, tx);
     /* log custom fields if configured */
     if (http_ctx->fields != 0)
-        JsonHttpLogJSONCustom(http_ctx, hjs, tx);
+        JsonHttpLogJSONCustom(http_ctx, jw, tx);
     if (http_ctx->flags & LOG_HTTP_EXTENDED)
-        JsonHttpLogJSONExtended(hjs, tx);
+        JsonHttpLogJSONExtended(jw, tx);
 
-    json_object_set_new(js, "http", hjs);
+    JsonWriterCloseObject(jw);
 }
 
 static int JsonHttpLogger(ThreadVars *tv, void *thread_data, const Packet *p, Flow *f, void *alstate, void *txptr, uint64_t tx_id)
@@ -374,46 +351,43 @@ static int JsonHttpLogger(ThreadVars *tv, void *thread_data, const Packet *p, Fl
 
     htp_tx_t *tx = txptr;
     JsonHttpLogThread *jhl = (JsonHttpLogThread *)thread_data;
-
-    json_t *js = CreateJSONHeaderWithTxId((Packet *)p, 1, "http", tx_id); //TODO const
-    if (unlikely(js == NULL))
-        return TM_ECODE_OK;
+    LogFileCtx *file_ctx = jhl->httplog_ctx->file_ctx;
+    JsonWriter jw;
 
     SCLogDebug("got a HTTP request and now logging !!");
 
-    /* reset */
-    MemBufferReset(jhl->buffer);
+    OutputJsonWriterStart(&jw, file_ctx, &jhl->buffer);
+    OutputJsonWriterHeader(&jw, p, 1, "http", NULL, NULL);
 
-    JsonHttpLogJSON(jhl, js, tx, tx_id);
+    /* tx id for correlation with other events */
+    JsonWriterUint(&jw, "tx_id", tx_id);
 
-    OutputJSONBuffer(js, jhl->httplog_ctx->file_ctx, &jhl->buffer);
-    json_object_del(js, "http");
+    JsonHttpLogJSON(jhl, &jw, tx, tx_id);
 
-    json_object_clear(js);
-    json_decref(js);
+    OutputJsonWriterFinish(&jw, file_ctx);
 
     SCReturnInt(TM_ECODE_OK);
 }
 
-json_t *JsonHttpAddMetadata(const Flow *f, uint64_t tx_id)
+/** \brief write the basic and extended http fields of a tx as object
+ *  \retval 1 if the object was written, 0 if there is no such tx
+ */
+int JsonHttpWriteMetadata(JsonWriter *jw, const char *key, const Flow *f, uint64_t tx_id)
 {
     HtpState *htp_state = (HtpState *)FlowGetAppState(f);
     if (htp_state) {
         htp_tx_t *tx = AppLayerParserGetTx(IPPROTO_TCP, ALPROTO_HTTP, htp_state, tx_id);
 
         if (tx) {
-            json_t *hjs = json_object();
-            if (unlikely(hjs == NULL))
-                return NULL;
-
-            JsonHttpLogJSONBasic(hjs, tx);
-            JsonHttpLogJSONExtended(hjs, tx);
-
-            return hjs;
+            JsonWriterOpenObject(jw, key);
+            JsonHttpLogJSONBasic(jw, tx);
+            JsonHttpLogJSONExtended(jw, tx);
+            JsonWriterCloseObject(jw);
+            return 1;
         }
     }
 
-    return NULL;
+    return 0;
 }
 
 static void OutputHttpLogDeinit(OutputCtx *output_ctx)
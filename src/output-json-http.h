@@ -27,9 +27,11 @@
 void TmModuleJsonHttpLogRegister (void);
 
 #ifdef HAVE_LIBJANSSON
-void JsonHttpLogJSONBasic(json_t *js, htp_tx_t *tx);
-void JsonHttpLogJSONExtended(json_t *js, htp_tx_t *tx);
-json_t *JsonHttpAddMetadata(const Flow *f, uint64_t tx_id);
+#include "util-json-writer.h"
+
+void JsonHttpLogJSONBasic(JsonWriter *jw, htp_tx_t *tx);
+void JsonHttpLogJSONExtended(JsonWriter *jw, htp_tx_t *tx);
+int JsonHttpWriteMetadata(JsonWriter *jw, const char *key, const Flow *f, uint64_t tx_id);
 #endif /* HAVE_LIBJANSSON */
 
 #endif /* __OUTPUT_JSON_HTTP_H__ */
@@ -71,30 +71,26 @@ typedef struct JsonTlsLogThread_ {
 
 #define SSL_VERSION_LENGTH 13
 
-void JsonTlsLogJSONBasic(json_t *js, SSLState *ssl_state)
+void JsonTlsLogJSONBasic(JsonWriter *jw, SSLState *ssl_state)
 {
     /* tls.subject */
-    json_object_set_new(js, "subject",
-                        json_string(ssl_state->server_connp.cert0_subject));
+    JsonWriterString(jw, "subject", ssl_state->server_connp.cert0_subject);
 
     /* tls.issuerdn */
-    json_object_set_new(js, "issuerdn",
-                        json_string(ssl_state->server_connp.cert0_issuerdn));
+    JsonWriterString(jw, "issuerdn", ssl_state->server_connp.cert0_issuerdn);
 
 }
 
-void JsonTlsLogJSONExtended(json_t *tjs, SSLState * state)
+void JsonTlsLogJSONExtended(JsonWriter *jw, SSLState * state)
 {
     char ssl_version[SSL_VERSION_LENGTH + 1];
 
     /* tls.fingerprint */
-    json_object_set_new(tjs, "fingerprint",
-                        json_string(state->server_connp.cert0_fingerprint));
+    JsonWriterString(jw, "fingerprint", state->server_connp.cert0_fingerprint);
 
     /* tls.sni */
     if (state->client_connp.sni) {
-        json_object_set_new(tjs, "sni",
-                            json_string(state->client_connp.sni));
+        JsonWriterString(jw, "sni", state->client_connp.sni);
     }
 
     /* tls.version */
@@ -122,7 +118,7 @@ void JsonTlsLogJSONExtended(json_t *tjs, SSLState * state)
                      state->server_connp.version);
             break;
     }
-    json_object_set_new(tjs, "version", json_string(ssl_version));
+    JsonWriterString(jw, "version", ssl_version);
 }
 
 static int JsonTlsLogger(ThreadVars *tv, void *thread_data, const Packet *p,
@@ -140,30 +136,21 @@ static int JsonTlsLogger(ThreadVars *tv, void *thread_data, const Packet *p,
             ssl_state->server_connp.cert0_subject == NULL)
         return 0;
 
-    json_t *js = CreateJSONHeader((Packet *)p, 0, "tls");
-    if (unlikely(js == NULL))
-        return 0;
-
-    json_t *tjs = json_object();
-    if (tjs == NULL) {
-        free(js);
-        return 0;
-    }
+    JsonWriter jw;
+    OutputJsonWriterStart(&jw, tls_ctx->file_ctx, &aft->buffer);
+    OutputJsonWriterHeader(&jw, p, 0, "tls", NULL, NULL);
 
-    /* reset */
-    MemBufferReset(aft->buffer);
+    JsonWriterOpenObject(&jw, "tls");
 
-    JsonTlsLogJSONBasic(tjs, ssl_state);
+    JsonTlsLogJSONBasic(&jw, ssl_state);
 
     if (tls_ctx->flags & LOG_TLS_EXTENDED) {
-        JsonTlsLogJSONExtended(tjs, ssl_state);
+        JsonTlsLogJSONExtended(&jw, ssl_state);
     }
 
-    json_object_set_new(js, "tls", tjs);
+    JsonWriterCloseObject(&jw);
 
-    OutputJSONBuffer(js, tls_ctx->file_ctx, &aft->buffer);
-    json_object_clear(js);
-    json_decref(js);
+    OutputJsonWriterFinish(&jw, tls_ctx->file_ctx);
 
     return 0;
 }
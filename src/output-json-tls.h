@@ -28,9 +28,10 @@ void TmModuleJsonTlsLogRegister (void);
 
 #ifdef HAVE_LIBJANSSON
 #include "app-layer-ssl.h"
+#include "util-json-writer.h"
 
-void JsonTlsLogJSONBasic(json_t *js, SSLState *ssl_state);
-void JsonTlsLogJSONExtended(json_t *js, SSLState *ssl_state);
+void JsonTlsLogJSONBasic(JsonWriter *jw, SSLState *ssl_state);
+void JsonTlsLogJSONExtended(JsonWriter *jw, SSLState *ssl_state);
 #endif /* HAVE_LIBJANSSON */
 
 #endif /* __OUTPUT_JSON_TLS_H__ */
@@ -169,6 +169,49 @@ void CreateJSONFlowId(json_t *js, const Flow *f)
     json_object_set_new(js, "flow_id", json_integer(f->flow_hash));
 }
 
+/** \brief get the printable addresses and the ports of a packet
+ *
+ *  \param direction_sensitive if set, the tuple is swapped for packets
+ *         going to the client so that src is always the client
+ */
+static void JsonPacketTuple(const Packet *p, int direction_sensitive,
+                            char *srcip, char *dstip, size_t ip_size,
+                            Port *sp, Port *dp)
+{
+    srcip[0] = '\0';
+    dstip[0] = '\0';
+    if (direction_sensitive && !(PKT_IS_TOSERVER(p))) {
+        if (PKT_IS_IPV4(p)) {
+            PrintInet(AF_INET, (const void *)GET_IPV4_DST_ADDR_PTR(p), srcip, ip_size);
+            PrintInet(AF_INET, (const void *)GET_IPV4_SRC_ADDR_PTR(p), dstip, ip_size);
+        } else if (PKT_IS_IPV6(p)) {
+            PrintInet(AF_INET6, (const void *)GET_IPV6_DST_ADDR(p), srcip, ip_size);
+            PrintInet(AF_INET6, (const void *)GET_IPV6_SRC_ADDR(p), dstip, ip_size);
+        }
+        *sp = p->dp;
+        *dp = p->sp;
+    } else {
+        if (PKT_IS_IPV4(p)) {
+            PrintInet(AF_INET, (const void *)GET_IPV4_SRC_ADDR_PTR(p), srcip, ip_size);
+            PrintInet(AF_INET, (const void *)GET_IPV4_DST_ADDR_PTR(p), dstip, ip_size);
+        } else if (PKT_IS_IPV6(p)) {
+            PrintInet(AF_INET6, (const void *)GET_IPV6_SRC_ADDR(p), srcip, ip_size);
+            PrintInet(AF_INET6, (const void *)GET_IPV6_DST_ADDR(p), dstip, ip_size);
+        }
+        *sp = p->sp;
+        *dp = p->dp;
+    }
+}
+
+static void JsonPacketProto(const Packet *p, char *proto, size_t proto_size)
+{
+    if (SCProtoNameValid(IP_GET_IPPROTO(p)) == TRUE) {
+        strlcpy(proto, known_proto[IP_GET_IPPROTO(p)], proto_size);
+    } else {
+        snprintf(proto, proto_size, "%03" PRIu32, IP_GET_IPPROTO(p));
+    }
+}
+
 json_t *CreateJSONHeader(const Packet *p, int direction_sensitive,
                          const char *event_type)
 {
@@ -182,48 +225,11 @@ json_t *CreateJSONHeader(const Packet *p, int direction_sensitive,
 
     CreateIsoTimeString(&p->ts, timebuf, sizeof(timebuf));
 
-    srcip[0] = '\0';
-    dstip[0] = '\0';
-    if (direction_sensitive) {
-        if ((PKT_IS_TOSERVER(p))) {
-            if (PKT_IS_IPV4(p)) {
-                PrintInet(AF_INET, (const void *)GET_IPV4_SRC_ADDR_PTR(p), srcip, sizeof(srcip));
-                PrintInet(AF_INET, (const void *)GET_IPV4_DST_ADDR_PTR(p), dstip, sizeof(dstip));
-            } else if (PKT_IS_IPV6(p)) {
-                PrintInet(AF_INET6, (const void *)GET_IPV6_SRC_ADDR(p), srcip, sizeof(srcip));
-                PrintInet(AF_INET6, (const void *)GET_IPV6_DST_ADDR(p), dstip, sizeof(dstip));
-            }
-            sp = p->sp;
-            dp = p->dp;
-        } else {
-            if (PKT_IS_IPV4(p)) {
-                PrintInet(AF_INET, (const void *)GET_IPV4_DST_ADDR_PTR(p), srcip, sizeof(srcip));
-                PrintInet(AF_INET, (const void *)GET_IPV4_SRC_ADDR_PTR(p), dstip, sizeof(dstip));
-            } else if (PKT_IS_IPV6(p)) {
-                PrintInet(AF_INET6, (const void *)GET_IPV6_DST_ADDR(p), srcip, sizeof(srcip));
-                PrintInet(AF_INET6, (const void *)GET_IPV6_SRC_ADDR(p), dstip, sizeof(dstip));
-            }
-            sp = p->dp;
-            dp = p->sp;
-        }
-    } else {
-        if (PKT_IS_IPV4(p)) {
-            PrintInet(AF_INET, (const void *)GET_IPV4_SRC_ADDR_PTR(p), srcip, sizeof(srcip));
-            PrintInet(AF_INET, (const void *)GET_IPV4_DST_ADDR_PTR(p), dstip, sizeof(dstip));
-        } else if (PKT_IS_IPV6(p)) {
-            PrintInet(AF_INET6, (const void *)GET_IPV6_SRC_ADDR(p), srcip, sizeof(srcip));
-            PrintInet(AF_INET6, (const void *)GET_IPV6_DST_ADDR(p), dstip, sizeof(dstip));
-        }
-        sp = p->sp;
-        dp = p->dp;
-    }
+    JsonPacketTuple(p, direction_sensitive, srcip, dstip, sizeof(srcip),
+                    &sp, &dp);
 
     char proto[16];
-    if (SCProtoNameValid(IP_GET_IPPROTO(p)) == TRUE) {
-        strlcpy(proto, known_proto[IP_GET_IPPROTO(p)], sizeof(proto));
-    } else {
-        snprintf(proto, sizeof(proto), "%03" PRIu32, IP_GET_IPPROTO(p));
-    }
+    JsonPacketProto(p, proto, sizeof(proto));
 
     /* time & tx */
     json_object_set_new(js, "timestamp", json_string(timebuf));
@@ -368,6 +374,142 @@ int OutputJSONBuffer(json_t *js, LogFileCtx *file_ctx, MemBuffer **buffer)
     return 0;
 }
 
+/** \brief JsonWriter version of JsonTcpFlags */
+void JsonWriterTcpFlags(JsonWriter *jw, uint8_t flags)
+{
+    if (flags & TH_SYN)
+        JsonWriterBool(jw, "syn", 1);
+    if (flags & TH_FIN)
+        JsonWriterBool(jw, "fin", 1);
+    if (flags & TH_RST)
+        JsonWriterBool(jw, "rst", 1);
+    if (flags & TH_PUSH)
+        JsonWriterBool(jw, "psh", 1);
+    if (flags & TH_ACK)
+        JsonWriterBool(jw, "ack", 1);
+    if (flags & TH_URG)
+        JsonWriterBool(jw, "urg", 1);
+    if (flags & TH_ECN)
+        JsonWriterBool(jw, "ecn", 1);
+    if (flags & TH_CWR)
+        JsonWriterBool(jw, "cwr", 1);
+}
+
+/** \brief start a record in the buffer: reset it, write the prefix and
+ *         open the top level object */
+void OutputJsonWriterStart(JsonWriter *jw, LogFileCtx *file_ctx, MemBuffer **buffer)
+{
+    MemBufferReset(*buffer);
+
+    if (file_ctx->prefix) {
+        MemBufferWriteRaw((*buffer), file_ctx->prefix, file_ctx->prefix_len);
+    }
+
+    JsonWriterInit(jw, buffer, OUTPUT_BUFFER_SIZE);
+    JsonWriterOpenObject(jw, NULL);
+}
+
+/** \brief JsonWriter version of CreateJSONHeader
+ *
+ *  \param src_ip if not NULL, written instead of the packet's source
+ *  \param dest_ip if not NULL, written instead of the packet's destination
+ */
+void OutputJsonWriterHeader(JsonWriter *jw, const Packet *p,
+        int direction_sensitive, const char *event_type,
+        const char *src_ip, const char *dest_ip)
+{
+    char timebuf[64];
+    char srcip[46], dstip[46];
+    Port sp, dp;
+
+    CreateIsoTimeString(&p->ts, timebuf, sizeof(timebuf));
+
+    JsonPacketTuple(p, direction_sensitive, srcip, dstip, sizeof(srcip),
+                    &sp, &dp);
+
+    char proto[16];
+    JsonPacketProto(p, proto, sizeof(proto));
+
+    JsonWriterString(jw, "timestamp", timebuf);
+
+    if (p->flow != NULL)
+        JsonWriterUint(jw, "flow_id", p->flow->flow_hash);
+
+    if (sensor_id >= 0)
+        JsonWriterInt(jw, "sensor_id", sensor_id);
+
+    if (p->livedev) {
+        JsonWriterString(jw, "in_iface", p->livedev->dev);
+    }
+
+    if (p->pcap_cnt != 0) {
+        JsonWriterUint(jw, "pcap_cnt", p->pcap_cnt);
+    }
+
+    JsonWriterString(jw, "event_type", event_type);
+
+    switch (p->vlan_idx) {
+        case 1:
+            JsonWriterUint(jw, "vlan", VLAN_GET_ID1(p));
+            break;
+        case 2:
+            JsonWriterOpenArray(jw, "vlan");
+            JsonWriterUint(jw, NULL, VLAN_GET_ID1(p));
+            JsonWriterUint(jw, NULL, VLAN_GET_ID2(p));
+            JsonWriterCloseArray(jw);
+            break;
+    }
+
+    /* tuple */
+    JsonWriterString(jw, "src_ip", src_ip ? src_ip : srcip);
+    switch(p->proto) {
+        case IPPROTO_UDP:
+        case IPPROTO_TCP:
+        case IPPROTO_SCTP:
+            JsonWriterUint(jw, "src_port", sp);
+            break;
+    }
+    JsonWriterString(jw, "dest_ip", dest_ip ? dest_ip : dstip);
+    switch(p->proto) {
+        case IPPROTO_UDP:
+        case IPPROTO_TCP:
+        case IPPROTO_SCTP:
+            JsonWriterUint(jw, "dest_port", dp);
+            break;
+    }
+    JsonWriterString(jw, "proto", proto);
+    switch (p->proto) {
+        case IPPROTO_ICMP:
+            if (p->icmpv4h) {
+                JsonWriterUint(jw, "icmp_type", p->icmpv4h->type);
+                JsonWriterUint(jw, "icmp_code", p->icmpv4h->code);
+            }
+            break;
+        case IPPROTO_ICMPV6:
+            if (p->icmpv6h) {
+                JsonWriterUint(jw, "icmp_type", p->icmpv6h->type);
+                JsonWriterUint(jw, "icmp_code", p->icmpv6h->code);
+            }
+            break;
+    }
+}
+
+/** \brief close the record started by OutputJsonWriterStart and write
+ *         it out. A record the buffer couldn't hold is dropped. */
+int OutputJsonWriterFinish(JsonWriter *jw, LogFileCtx *file_ctx)
+{
+    if (file_ctx->sensor_name) {
+        JsonWriterString(jw, "host", file_ctx->sensor_name);
+    }
+    JsonWriterCloseObject(jw);
+
+    if (JsonWriterHasError(jw))
+        return TM_ECODE_OK;
+
+    LogFileWrite(file_ctx, *jw->buffer);
+    return 0;
+}
+
 TmEcode OutputJson (ThreadVars *tv, Packet *p, void *data, PacketQueue *pq, PacketQueue *postpq)
 {
     return TM_ECODE_OK;
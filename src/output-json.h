@@ -27,6 +27,7 @@
 #include "suricata-common.h"
 #include "util-buffer.h"
 #include "util-logopenfile.h"
+#include "util-json-writer.h"
 
 void TmModuleOutputJsonRegister (void);
 
@@ -45,6 +46,13 @@ json_t *CreateJSONHeader(const Packet *p, int direction_sensative, const char *e
 json_t *CreateJSONHeaderWithTxId(const Packet *p, int direction_sensitive, const char *event_type, uint64_t tx_id);
 TmEcode OutputJSON(json_t *js, void *data, uint64_t *count);
 int OutputJSONBuffer(json_t *js, LogFileCtx *file_ctx, MemBuffer **buffer);
+
+void JsonWriterTcpFlags(JsonWriter *jw, uint8_t flags);
+void OutputJsonWriterStart(JsonWriter *jw, LogFileCtx *file_ctx, MemBuffer **buffer);
+void OutputJsonWriterHeader(JsonWriter *jw, const Packet *p,
+        int direction_sensitive, const char *event_type,
+        const char *src_ip, const char *dest_ip);
+int OutputJsonWriterFinish(JsonWriter *jw, LogFileCtx *file_ctx);
 OutputCtx *OutputJsonInitCtx(ConfNode *);
 
 enum JsonFormat { COMPACT, INDENT };
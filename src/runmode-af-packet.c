@@ -147,6 +147,7 @@ void *ParseAFPConfig(const char *iface)
     aconf->bpf_filter = NULL;
     aconf->out_iface = NULL;
     aconf->copy_mode = AFP_COPY_MODE_NONE;
+    aconf->batch_size = 0;
 
     if (ConfGet("bpf-filter", &bpf_filter) == 1) {
         if (strlen(bpf_filter) > 0) {
@@ -403,6 +404,22 @@ void *ParseAFPConfig(const char *iface)
         aconf->block_timeout = 10;
     }
 
+    if ((ConfGetChildValueIntWithDefault(if_root, if_default, "batch-size", &value)) == 1) {
+        if (!(aconf->flags & AFP_TPACKET_V3)) {
+            SCLogWarning(SC_ERR_INVALID_VALUE, "%s: batch-size is only "
+                    "supported with tpacket-v3, ignoring", aconf->iface);
+        } else if (value < 0 || value > AFP_BATCH_SIZE_MAX) {
+            SCLogError(SC_ERR_INVALID_VALUE, "%s: batch-size must be between "
+                    "0 and %d", aconf->iface, AFP_BATCH_SIZE_MAX);
+        } else {
+            aconf->batch_size = (int)value;
+            if (aconf->batch_size > 1) {
+                SCLogInfo("%s: processing packets in batches of %d",
+                        aconf->iface, aconf->batch_size);
+            }
+        }
+    }
+
     (void)ConfGetChildValueBoolWithDefault(if_root, if_default, "disable-promisc", (int *)&boolval);
     if (boolval) {
         SCLogInfo("Disabling promiscuous mode on iface %s",
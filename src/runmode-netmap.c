@@ -263,6 +263,20 @@ static void *ParseNetmapConfig(const char *iface_name)
         }
     }
 
+    intmax_t batch_size = 0;
+    if (ConfGetChildValueIntWithDefault(if_root, if_default, "batch-size", &batch_size) == 1) {
+        if (batch_size < 0 || batch_size > NETMAP_BATCH_SIZE_MAX) {
+            SCLogError(SC_ERR_INVALID_VALUE, "%s: batch-size must be between "
+                    "0 and %d", aconf->iface_name, NETMAP_BATCH_SIZE_MAX);
+        } else {
+            aconf->batch_size = (int)batch_size;
+            if (aconf->batch_size > 1) {
+                SCLogInfo("%s: processing packets in batches of %d",
+                        aconf->iface_name, aconf->batch_size);
+            }
+        }
+    }
+
     return aconf;
 }
 
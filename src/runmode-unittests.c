@@ -52,6 +52,7 @@
 #include "detect-engine-tag.h"
 #include "detect-engine-modbus.h"
 #include "detect-engine-filedata-smtp.h"
+#include "detect-engine-prefilter.h"
 #include "detect-fast-pattern.h"
 #include "flow.h"
 #include "flow-timeout.h"
@@ -92,6 +93,7 @@
 #include "util-magic.h"
 #include "util-memcmp.h"
 #include "util-misc.h"
+#include "util-logopenfile.h"
 #include "util-ringbuffer.h"
 #include "util-signal.h"
 
@@ -119,6 +121,10 @@
 #include "detect-engine-siggroup.h"
 
 #include "util-streaming-buffer.h"
+#include "util-json-writer.h"
+#include "util-numa.h"
+#include "util-hugepage.h"
+#include "util-hyperscan.h"
 
 #endif /* UNITTESTS */
 
@@ -267,9 +273,11 @@ void RunUnittests(int list_unittests, char *regex_arg)
     DetectEngineInspectModbusRegisterTests();
     DetectEngineRegisterTests();
     DetectEngineSMTPFiledataRegisterTests();
+    PrefilterRegisterTests();
     SCLogRegisterTests();
     MagicRegisterTests();
     UtilMiscRegisterTests();
+    LogFileRegisterTests();
     DetectAddressTests();
     DetectProtoTests();
     DetectPortTests();
@@ -281,6 +289,12 @@ void RunUnittests(int list_unittests, char *regex_arg)
     AppLayerUnittestsRegister();
     MimeDecRegisterTests();
     StreamingBufferRegisterTests();
+    JsonWriterRegisterTests();
+    NumaRegisterTests();
+    HugepageRegisterTests();
+#ifdef BUILD_HYPERSCAN
+    HSCacheRegisterTests();
+#endif
 
     if (list_unittests) {
         UtListTests(regex_arg);
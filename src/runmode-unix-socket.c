@@ -31,6 +31,7 @@
 #include "detect-engine.h"
 
 #include "flow-manager.h"
+#include "util-logopenfile.h"
 #include "flow-timeout.h"
 #include "stream-tcp.h"
 #include "host.h"
@@ -391,6 +392,7 @@ TmEcode UnixSocketPcapFilesCheck(void *data)
         RunModeDispatch(RUNMODE_PCAP_FILE, NULL);
         FlowManagerThreadSpawn();
         FlowRecyclerThreadSpawn();
+        LogFileWriterThreadSpawn();
         StatsSpawnThreads();
         /* Un-pause all the paused threads */
         TmThreadContinueThreads();
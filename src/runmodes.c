@@ -69,6 +69,7 @@ const char *thread_name_unix_socket = "US";
 const char *thread_name_detect_loader = "DL";
 const char *thread_name_counter_stats = "CS";
 const char *thread_name_counter_wakeup = "CW";
+const char *thread_name_logfile_writer = "LW";
 
 /**
  * \brief Holds description for a runmode.
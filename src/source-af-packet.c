@@ -264,6 +264,10 @@ typedef struct AFPThreadVars_
     /* IPS output iface */
     char out_iface[AFP_IFACE_NAME_LENGTH];
 
+    /* tpacket_v3 batch processing, disabled if batch_size <= 1 */
+    uint32_t batch_size;
+    Packet *batch[AFP_BATCH_SIZE_MAX];
+
 } AFPThreadVars;
 
 TmEcode ReceiveAFP(ThreadVars *, Packet *, void *, PacketQueue *, PacketQueue *);
@@ -917,11 +921,16 @@ static inline void AFPFlushBlock(struct tpacket_block_desc *pbd)
     pbd->hdr.bh1.block_status = TP_STATUS_KERNEL;
 }
 
-static inline int AFPParsePacketV3(AFPThreadVars *ptv, struct tpacket_block_desc *pbd, struct tpacket3_hdr *ppd)
+/**
+ * \brief Setup a packet for a tpacket_v3 frame
+ *
+ * \retval p packet or NULL on failure
+ */
+static inline Packet *AFPPacketGetV3(AFPThreadVars *ptv, struct tpacket_block_desc *pbd, struct tpacket3_hdr *ppd)
 {
     Packet *p = PacketGetFromQueueOrAlloc();
     if (p == NULL) {
-        SCReturnInt(AFP_FAILURE);
+        return NULL;
     }
     PKT_SET_SRC(p, PKT_SRC_WIRE);
 
@@ -932,7 +941,7 @@ static inline int AFPParsePacketV3(AFPThreadVars *ptv, struct tpacket_block_desc
     if (ptv->flags & AFP_ZERO_COPY) {
         if (PacketSetData(p, (unsigned char*)ppd + ppd->tp_mac, ppd->tp_snaplen) == -1) {
             TmqhOutputPacketpool(ptv->tv, p);
-            SCReturnInt(AFP_FAILURE);
+            return NULL;
         }
         p->afp_v.relptr = pbd;
         p->ReleasePacket = AFPReleasePacketV3;
@@ -948,7 +957,7 @@ static inline int AFPParsePacketV3(AFPThreadVars *ptv, struct tpacket_block_desc
     } else {
         if (PacketCopyData(p, (unsigned char*)ppd + ppd->tp_mac, ppd->tp_snaplen) == -1) {
             TmqhOutputPacketpool(ptv->tv, p);
-            SCReturnInt(AFP_FAILURE);
+            return NULL;
         }
     }
     /* Timestamp */
@@ -975,6 +984,16 @@ static inline int AFPParsePacketV3(AFPThreadVars *ptv, struct tpacket_block_desc
         }
     }
 
+    return p;
+}
+
+static inline int AFPParsePacketV3(AFPThreadVars *ptv, struct tpacket_block_desc *pbd, struct tpacket3_hdr *ppd)
+{
+    Packet *p = AFPPacketGetV3(ptv, pbd, ppd);
+    if (p == NULL) {
+        SCReturnInt(AFP_FAILURE);
+    }
+
     if (TmThreadsSlotProcessPkt(ptv->tv, ptv->slot, p) != TM_ECODE_OK) {
         TmqhOutputPacketpool(ptv->tv, p);
         SCReturnInt(AFP_FAILURE);
@@ -983,11 +1002,56 @@ static inline int AFPParsePacketV3(AFPThreadVars *ptv, struct tpacket_block_desc
     SCReturnInt(AFP_READ_OK);
 }
 
+/**
+ * \brief Walk a block in batch mode
+ *
+ * The packets of the block are passed to the slots in batches of up
+ * to batch_size packets, see TmThreadsSlotProcessPktBatch().
+ */
+static inline int AFPWalkBlockBatch(AFPThreadVars *ptv, struct tpacket_block_desc *pbd)
+{
+    int num_pkts = pbd->hdr.bh1.num_pkts, i;
+    uint32_t cnt = 0;
+    uint8_t *ppd;
+
+    ppd = (uint8_t *)pbd + pbd->hdr.bh1.offset_to_first_pkt;
+    for (i = 0; i < num_pkts; ++i) {
+        Packet *p = AFPPacketGetV3(ptv, pbd, (struct tpacket3_hdr *)ppd);
+        if (unlikely(p == NULL)) {
+            /* process what we have so far */
+            if (cnt > 0)
+                (void)TmThreadsSlotProcessPktBatch(ptv->tv, ptv->slot, ptv->batch, cnt);
+            SCReturnInt(AFP_READ_FAILURE);
+        }
+        ptv->batch[cnt++] = p;
+
+        if (cnt == ptv->batch_size) {
+            if (TmThreadsSlotProcessPktBatch(ptv->tv, ptv->slot, ptv->batch, cnt) != TM_ECODE_OK) {
+                SCReturnInt(AFP_READ_FAILURE);
+            }
+            cnt = 0;
+        }
+        ppd = ppd + ((struct tpacket3_hdr *)ppd)->tp_next_offset;
+    }
+
+    if (cnt > 0) {
+        if (TmThreadsSlotProcessPktBatch(ptv->tv, ptv->slot, ptv->batch, cnt) != TM_ECODE_OK) {
+            SCReturnInt(AFP_READ_FAILURE);
+        }
+    }
+
+    SCReturnInt(AFP_READ_OK);
+}
+
 static inline int AFPWalkBlock(AFPThreadVars *ptv, struct tpacket_block_desc *pbd)
 {
     int num_pkts = pbd->hdr.bh1.num_pkts, i;
     uint8_t *ppd;
 
+    if (ptv->batch_size > 1) {
+        return AFPWalkBlockBatch(ptv, pbd);
+    }
+
     ppd = (uint8_t *)pbd + pbd->hdr.bh1.offset_to_first_pkt;
     for (i = 0; i < num_pkts; ++i) {
         if (unlikely(AFPParsePacketV3(ptv, pbd,
@@ -2054,6 +2118,7 @@ TmEcode ReceiveAFPThreadInit(ThreadVars *tv, void *initdata, void **data)
     ptv->buffer_size = afpconfig->buffer_size;
     ptv->ring_size = afpconfig->ring_size;
     ptv->block_size = afpconfig->block_size;
+    ptv->batch_size = afpconfig->batch_size;
 
     ptv->promisc = afpconfig->promisc;
     ptv->checksum_mode = afpconfig->checksum_mode;
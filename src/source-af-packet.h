@@ -65,6 +65,9 @@
  * to standard frame size */
 #define AFP_BLOCK_SIZE_DEFAULT_ORDER 3
 
+/* max number of packets passed through the slots as one batch */
+#define AFP_BATCH_SIZE_MAX 256
+
 typedef struct AFPIfaceConfig_
 {
     char iface[AFP_IFACE_NAME_LENGTH];
@@ -78,6 +81,8 @@ typedef struct AFPIfaceConfig_
     int block_size;
     /* block timeout for tpacket_v3 in milliseconds */
     int block_timeout;
+    /* tpacket_v3 batch size in packets, 0 or 1 to disable */
+    int batch_size;
     /* cluster param */
     int cluster_id;
     int cluster_type;
@@ -211,7 +211,10 @@ typedef struct NetmapThreadVars_
     uint16_t capture_kernel_packets;
     uint16_t capture_kernel_drops;
 
-
+    /* batch processing, disabled if batch_size <= 1 */
+    uint32_t batch_size;
+    uint32_t batch_cnt;
+    Packet *batch[NETMAP_BATCH_SIZE_MAX];
 } NetmapThreadVars;
 
 typedef TAILQ_HEAD(NetmapDeviceList_, NetmapDevice_) NetmapDeviceList;
@@ -532,6 +535,7 @@ static TmEcode ReceiveNetmapThreadInit(ThreadVars *tv, void *initdata, void **da
     ntv->tv = tv;
     ntv->checksum_mode = aconf->checksum_mode;
     ntv->copy_mode = aconf->copy_mode;
+    ntv->batch_size = aconf->batch_size;
 
     ntv->livedev = LiveGetDevice(aconf->iface_name);
     if (ntv->livedev == NULL) {
@@ -757,8 +761,28 @@ static void NetmapReleasePacket(Packet *p)
     PacketFreeOrRelease(p);
 }
 
+/**
+ * \brief Pass the batched packets through the slots.
+ */
+static int NetmapProcessBatch(NetmapThreadVars *ntv)
+{
+    uint32_t cnt = ntv->batch_cnt;
+
+    ntv->batch_cnt = 0;
+    if (cnt > 0 &&
+        TmThreadsSlotProcessPktBatch(ntv->tv, ntv->slot, ntv->batch, cnt) != TM_ECODE_OK)
+    {
+        return NETMAP_FAILURE;
+    }
+    return NETMAP_OK;
+}
+
 /**
  * \brief Read packets from ring and pass them further.
+ *
+ * If batching is enabled, the packets are passed to the slots in batches
+ * of up to batch_size packets, see TmThreadsSlotProcessPktBatch(). All
+ * batched packets are processed before the ring is given back.
  * \param ntv Thread local variables.
  * \param ring_id Ring id to read.
  */
@@ -790,6 +814,7 @@ static int NetmapRingRead(NetmapThreadVars *ntv, int ring_id)
 
         Packet *p = PacketPoolGetPacket();
         if (unlikely(p == NULL)) {
+            (void)NetmapProcessBatch(ntv);
             SCReturnInt(NETMAP_FAILURE);
         }
 
@@ -817,11 +842,13 @@ static int NetmapRingRead(NetmapThreadVars *ntv, int ring_id)
         if (ntv->flags & NETMAP_FLAG_ZERO_COPY) {
             if (PacketSetData(p, slot_data, slot->len) == -1) {
                 TmqhOutputPacketpool(ntv->tv, p);
+                (void)NetmapProcessBatch(ntv);
                 SCReturnInt(NETMAP_FAILURE);
             }
         } else {
             if (PacketCopyData(p, slot_data, slot->len) == -1) {
                 TmqhOutputPacketpool(ntv->tv, p);
+                (void)NetmapProcessBatch(ntv);
                 SCReturnInt(NETMAP_FAILURE);
             }
         }
@@ -842,13 +869,23 @@ static int NetmapRingRead(NetmapThreadVars *ntv, int ring_id)
         SCLogDebug("pktlen: %" PRIu32 " (pkt %p, pkt data %p)",
                    GET_PKT_LEN(p), p, GET_PKT_DATA(p));
 
-        if (TmThreadsSlotProcessPkt(ntv->tv, ntv->slot, p) != TM_ECODE_OK) {
+        if (ntv->batch_size > 1) {
+            ntv->batch[ntv->batch_cnt++] = p;
+            if (ntv->batch_cnt == ntv->batch_size &&
+                NetmapProcessBatch(ntv) != NETMAP_OK)
+            {
+                SCReturnInt(NETMAP_FAILURE);
+            }
+        } else if (TmThreadsSlotProcessPkt(ntv->tv, ntv->slot, p) != TM_ECODE_OK) {
             TmqhOutputPacketpool(ntv->tv, p);
             SCReturnInt(NETMAP_FAILURE);
         }
 
         cur = nm_ring_next(rx, cur);
     }
+    if (NetmapProcessBatch(ntv) != NETMAP_OK) {
+        SCReturnInt(NETMAP_FAILURE);
+    }
     rx->head = rx->cur = cur;
 
     SCReturnInt(NETMAP_OK);
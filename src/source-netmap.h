@@ -35,6 +35,9 @@ enum {
 
 #define NETMAP_IFACE_NAME_LENGTH    48
 
+/* max number of packets passed through the slots as one batch */
+#define NETMAP_BATCH_SIZE_MAX 256
+
 typedef struct NetmapIfaceConfig_
 {
     /* semantic interface name */
@@ -54,6 +57,8 @@ typedef struct NetmapIfaceConfig_
     char out_iface[NETMAP_IFACE_NAME_LENGTH];
     /* sw ring flag for out_iface */
     int out_iface_sw;
+    /* batch size in packets, 0 or 1 to disable */
+    int batch_size;
     SC_ATOMIC_DECLARE(unsigned int, ref);
     void (*DerefFunc)(void *);
 } NetmapIfaceConfig;
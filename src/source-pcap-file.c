@@ -59,6 +59,9 @@
 
 extern int max_pending_packets;
 
+/* max number of packets passed through the slots as one batch */
+#define PCAP_FILE_BATCH_SIZE_MAX 256
+
 typedef struct PcapFileGlobalVars_ {
     pcap_t *pcap_handle;
     int (*Decoder)(ThreadVars *, DecodeThreadVars *, Packet *, u_int8_t *, u_int16_t, PacketQueue *);
@@ -87,6 +90,11 @@ typedef struct PcapFileThreadVars_
 
     uint8_t done;
     uint32_t errs;
+
+    /* batch processing, disabled if batch_size <= 1 */
+    uint32_t batch_size;
+    uint32_t batch_cnt;
+    Packet *batch[PCAP_FILE_BATCH_SIZE_MAX];
 } PcapFileThreadVars;
 
 static PcapFileGlobalVars pcap_g;
@@ -133,6 +141,19 @@ void PcapFileGlobalInit()
     SC_ATOMIC_INIT(pcap_g.invalid_checksums);
 }
 
+/**
+ *  \brief Pass the batched packets through the slots
+ */
+static TmEcode PcapFileProcessBatch(PcapFileThreadVars *ptv)
+{
+    uint32_t cnt = ptv->batch_cnt;
+
+    ptv->batch_cnt = 0;
+    if (cnt == 0)
+        return TM_ECODE_OK;
+    return TmThreadsSlotProcessPktBatch(ptv->tv, ptv->slot, ptv->batch, cnt);
+}
+
 void PcapFileCallbackLoop(char *user, struct pcap_pkthdr *h, u_char *pkt)
 {
     SCEnter();
@@ -175,7 +196,16 @@ void PcapFileCallbackLoop(char *user, struct pcap_pkthdr *h, u_char *pkt)
 
     PACKET_PROFILING_TMM_END(p, TMM_RECEIVEPCAPFILE);
 
-    if (TmThreadsSlotProcessPkt(ptv->tv, ptv->slot, p) != TM_ECODE_OK) {
+    if (ptv->batch_size > 1) {
+        /* the rest of the batch is processed when pcap_dispatch returns */
+        ptv->batch[ptv->batch_cnt++] = p;
+        if (ptv->batch_cnt == ptv->batch_size &&
+            PcapFileProcessBatch(ptv) != TM_ECODE_OK)
+        {
+            pcap_breakloop(pcap_g.pcap_handle);
+            ptv->cb_result = TM_ECODE_FAILED;
+        }
+    } else if (TmThreadsSlotProcessPkt(ptv->tv, ptv->slot, p) != TM_ECODE_OK) {
         pcap_breakloop(pcap_g.pcap_handle);
         ptv->cb_result = TM_ECODE_FAILED;
     }
@@ -197,6 +227,8 @@ TmEcode ReceivePcapFileLoop(ThreadVars *tv, void *data, void *slot)
 
     ptv->slot = s->slot_next;
     ptv->cb_result = TM_ECODE_OK;
+    if ((int)ptv->batch_size > packet_q_len)
+        packet_q_len = (int)ptv->batch_size;
 
     while (1) {
         if (suricata_ctl_flags & (SURICATA_STOP | SURICATA_KILL)) {
@@ -210,6 +242,9 @@ TmEcode ReceivePcapFileLoop(ThreadVars *tv, void *data, void *slot)
         /* Right now we just support reading packets one at a time. */
         r = pcap_dispatch(pcap_g.pcap_handle, packet_q_len,
                           (pcap_handler)PcapFileCallbackLoop, (u_char *)ptv);
+        if (PcapFileProcessBatch(ptv) != TM_ECODE_OK) {
+            ptv->cb_result = TM_ECODE_FAILED;
+        }
         if (unlikely(r == -1)) {
             SCLogError(SC_ERR_PCAP_DISPATCH, "error code %" PRId32 " %s",
                        r, pcap_geterr(pcap_g.pcap_handle));
@@ -281,6 +316,18 @@ TmEcode ReceivePcapFileThreadInit(ThreadVars *tv, void *initdata, void **data)
         }
     }
 
+    intmax_t batch_size = 0;
+    if (ConfGetInt("pcap-file.batch-size", &batch_size) == 1) {
+        if (batch_size < 0 || batch_size > PCAP_FILE_BATCH_SIZE_MAX) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "pcap-file.batch-size must be "
+                    "between 0 and %d", PCAP_FILE_BATCH_SIZE_MAX);
+        } else {
+            ptv->batch_size = (uint32_t)batch_size;
+            if (ptv->batch_size > 1)
+                SCLogInfo("processing packets in batches of %u", ptv->batch_size);
+        }
+    }
+
     char errbuf[PCAP_ERRBUF_SIZE] = "";
     pcap_g.pcap_handle = pcap_open_offline((char *)initdata, errbuf);
     if (pcap_g.pcap_handle == NULL) {
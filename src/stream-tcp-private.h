@@ -27,6 +27,7 @@
 #include "decode.h"
 #include "util-pool.h"
 #include "util-pool-thread.h"
+#include "util-streaming-buffer.h"
 
 #define STREAMTCP_QUEUE_FLAG_TS     0x01
 #define STREAMTCP_QUEUE_FLAG_WS     0x02
@@ -53,14 +54,28 @@ typedef struct StreamTcpSackRecord_ {
 typedef struct TcpSegment_ {
     uint8_t *payload;
     uint16_t payload_len;       /**< actual size of the payload */
-    uint16_t pool_size;         /**< size of the memory */
+    uint16_t pool_size;         /**< size of the memory, 0 if the payload
+                                 *   lives in TcpStream::sb */
     uint32_t seq;
+    StreamingBufferSegment sbseg; /**< location of the payload in
+                                   *   TcpStream::sb if pool_size is 0 */
     struct TcpSegment_ *next;
     struct TcpSegment_ *prev;
     /* coccinelle: TcpSegment:flags:SEGMENTTCP_FLAG */
     uint8_t flags;
+    uint8_t numa_node;          /**< NUMA node of the segment's pool */
 } TcpSegment;
 
+/** segments of a stream sorted by seq, for segment storage "buffer".
+ *  Used slots are segs[head] to segs[head + cnt - 1], so removing the
+ *  list head doesn't move the array. */
+typedef struct TcpSegmentIndex_ {
+    TcpSegment **segs;
+    uint32_t head;                  /**< first used slot */
+    uint32_t cnt;                   /**< number of used slots */
+    uint32_t size;                  /**< number of slots in segs */
+} TcpSegmentIndex;
+
 typedef struct TcpStream_ {
     uint16_t flags:12;              /**< Flag specific to the stream e.g. Timestamp */
     /* coccinelle: TcpStream:flags:STREAMTCP_STREAM_FLAG_ */
@@ -85,6 +100,13 @@ typedef struct TcpStream_ {
     TcpSegment *seg_list;           /**< list of TCP segments that are not yet (fully) used in reassembly */
     TcpSegment *seg_list_tail;      /**< Last segment in the reassembled stream seg list*/
 
+    StreamingBuffer *sb;            /**< segment payloads if segment storage
+                                         is "buffer", NULL otherwise */
+    uint32_t sb_base_seq;           /**< seq of the first byte in sb */
+    TcpSegmentIndex seg_idx;        /**< seg_list sorted array if sb is used */
+    uint32_t app_proto_pm_scanned;  /**< bytes of the stream start already
+                                         scanned by the proto detection pm */
+
     StreamTcpSackRecord *sack_head; /**< head of list of SACK records */
     StreamTcpSackRecord *sack_tail; /**< tail of list of SACK records */
 } TcpStream;
@@ -232,6 +254,21 @@ typedef struct TcpSession_ {
     TcpStateQueue *queue;                   /**< list of SYN/ACK candidates */
 } TcpSession;
 
+/**
+ *  \brief get a segment's payload, either from the segment itself or
+ *         from the stream's StreamingBuffer.
+ */
+static inline void StreamTcpSegmentGetData(const TcpStream *stream,
+        const TcpSegment *seg, const uint8_t **data, uint32_t *data_len)
+{
+    if (likely(seg->pool_size != 0)) {
+        *data = seg->payload;
+        *data_len = seg->payload_len;
+    } else {
+        StreamingBufferSegmentGetData(stream->sb, &seg->sbseg, data, data_len);
+    }
+}
+
 #define StreamTcpSetStreamFlagAppProtoDetectionCompleted(stream) \
     ((stream)->flags |= STREAMTCP_STREAM_FLAG_APPPROTO_DETECTION_COMPLETED)
 #define StreamTcpIsSetStreamFlagAppProtoDetectionCompleted(stream) \
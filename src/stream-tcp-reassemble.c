@@ -45,6 +45,7 @@
 #include "util-host-os-info.h"
 #include "util-unittest-helper.h"
 #include "util-byte.h"
+#include "util-misc.h"
 
 #include "stream-tcp.h"
 #include "stream-tcp-private.h"
@@ -62,6 +63,7 @@
 #include "detect-engine-state.h"
 
 #include "util-profiling.h"
+#include "util-numa.h"
 
 #define PSEUDO_PACKET_PAYLOAD_SIZE  65416 /* 64 Kb minus max IP and TCP header */
 
@@ -77,6 +79,8 @@ static uint64_t segment_pool_memcnt = 0;
  * The cost is in memory of course. The number of pools and the properties
  * of the pools are determined by the yaml. */
 static int segment_pool_num = 0;
+/* each NUMA node has its own set of segment_pool_num pools */
+static uint32_t segment_pool_nodes = 1;
 static Pool **segment_pool = NULL;
 static SCMutex *segment_pool_mutex = NULL;
 static uint16_t *segment_pool_pktsizes = NULL;
@@ -86,11 +90,33 @@ static uint64_t segment_pool_cnt = 0;
 #endif
 /* index to the right pool for all packet sizes. */
 static uint16_t segment_pool_idx[65536]; /* O(1) lookups of the pool */
+/* index of the pool for size index 'idx' on a NUMA node */
+#define SEGMENT_POOL_NODE_IDX(node, idx) ((node) * segment_pool_num + (idx))
 static int check_overlap_different_data = 0;
 
 /* Memory use counter */
 SC_ATOMIC_DECLARE(uint64_t, ra_memuse);
 
+/* StreamingBuffer memory handlers, accounted against the reassembly memcap */
+static void *StreamTcpSbMalloc(size_t size);
+static void *StreamTcpSbCalloc(size_t n, size_t size);
+static void *StreamTcpSbRealloc(void *optr, size_t orig_size, size_t size);
+static void StreamTcpSbFree(void *ptr, size_t size);
+
+/* config for the per stream buffers used by segment storage "buffer" */
+static StreamingBufferConfig segment_sb_cfg = { STREAMING_BUFFER_NOFLAGS, 0, 2048,
+    StreamTcpSbMalloc, StreamTcpSbCalloc, StreamTcpSbRealloc, StreamTcpSbFree };
+
+/* segment storage "buffer": window used if the receiver's window is
+ * unknown or smaller, and the default max distance from last_ack */
+#define SEGMENT_BUFFER_MIN_WINDOW       65535
+#define SEGMENT_BUFFER_MAX_GAP_DEFAULT  (16 * 1024 * 1024)
+/* max distance of data from last_ack in segment storage "buffer" */
+static uint32_t segment_buffer_max_gap = SEGMENT_BUFFER_MAX_GAP_DEFAULT;
+
+/* initial number of slots of a stream's TcpSegmentIndex */
+#define SEGMENT_INDEX_INIT_SIZE 16
+
 /* prototypes */
 static int HandleSegmentStartsBeforeListSegment(ThreadVars *, TcpReassemblyThreadCtx *,
                                     TcpStream *, TcpSegment *, TcpSegment *, Packet *);
@@ -157,6 +183,57 @@ int StreamTcpReassembleCheckMemcap(uint32_t size)
     return 0;
 }
 
+static void *StreamTcpSbMalloc(size_t size)
+{
+    if (StreamTcpReassembleCheckMemcap((uint32_t)size) == 0)
+        return NULL;
+
+    void *ptr = SCMalloc(size);
+    if (ptr == NULL)
+        return NULL;
+
+    StreamTcpReassembleIncrMemuse((uint64_t)size);
+    return ptr;
+}
+
+static void *StreamTcpSbCalloc(size_t n, size_t size)
+{
+    if (StreamTcpReassembleCheckMemcap((uint32_t)(n * size)) == 0)
+        return NULL;
+
+    void *ptr = SCCalloc(n, size);
+    if (ptr == NULL)
+        return NULL;
+
+    StreamTcpReassembleIncrMemuse((uint64_t)(n * size));
+    return ptr;
+}
+
+static void *StreamTcpSbRealloc(void *optr, size_t orig_size, size_t size)
+{
+    if (size > orig_size) {
+        if (StreamTcpReassembleCheckMemcap((uint32_t)(size - orig_size)) == 0)
+            return NULL;
+    }
+
+    void *nptr = SCRealloc(optr, size);
+    if (nptr == NULL)
+        return NULL;
+
+    if (size > orig_size) {
+        StreamTcpReassembleIncrMemuse((uint64_t)(size - orig_size));
+    } else {
+        StreamTcpReassembleDecrMemuse((uint64_t)(orig_size - size));
+    }
+    return nptr;
+}
+
+static void StreamTcpSbFree(void *ptr, size_t size)
+{
+    SCFree(ptr);
+    StreamTcpReassembleDecrMemuse((uint64_t)size);
+}
+
 /** \brief alloc a tcp segment pool entry */
 void *TcpSegmentPoolAlloc()
 {
@@ -180,6 +257,7 @@ int TcpSegmentPoolInit(void *data, void *payload_len)
     /* do this before the can bail, so TcpSegmentPoolCleanup
      * won't have uninitialized memory to consider. */
     memset(seg, 0, sizeof (TcpSegment));
+    seg->numa_node = (uint8_t)NumaThreadNode();
 
     if (StreamTcpReassembleCheckMemcap((uint32_t)size + (uint32_t)sizeof(TcpSegment)) == 0) {
         return 0;
@@ -188,9 +266,13 @@ int TcpSegmentPoolInit(void *data, void *payload_len)
     seg->pool_size = size;
     seg->payload_len = seg->pool_size;
 
-    seg->payload = SCMalloc(seg->payload_len);
-    if (seg->payload == NULL) {
-        return 0;
+    /* segment storage "buffer": the payload lives in the stream's
+     * StreamingBuffer, so we only need the segment itself */
+    if (size > 0) {
+        seg->payload = SCMalloc(seg->payload_len);
+        if (seg->payload == NULL) {
+            return 0;
+        }
     }
 
 #ifdef DEBUG
@@ -202,6 +284,7 @@ int TcpSegmentPoolInit(void *data, void *payload_len)
 #endif
 
     StreamTcpReassembleIncrMemuse((uint32_t)seg->pool_size + sizeof(TcpSegment));
+    NumaMemuseAdd(seg->numa_node, (uint32_t)seg->pool_size + sizeof(TcpSegment));
     return 1;
 }
 
@@ -214,6 +297,7 @@ void TcpSegmentPoolCleanup(void *ptr)
     TcpSegment *seg = (TcpSegment *) ptr;
 
     StreamTcpReassembleDecrMemuse((uint32_t)seg->pool_size + sizeof(TcpSegment));
+    NumaMemuseSub(seg->numa_node, (uint32_t)seg->pool_size + sizeof(TcpSegment));
 
 #ifdef DEBUG
     SCMutexLock(&segment_pool_memuse_mutex);
@@ -240,10 +324,12 @@ void StreamTcpSegmentReturntoPool(TcpSegment *seg)
     seg->next = NULL;
     seg->prev = NULL;
 
-    uint16_t idx = segment_pool_idx[seg->pool_size];
+    /* return to the pool of the node the segment was allocated on */
+    uint32_t idx = SEGMENT_POOL_NODE_IDX(seg->numa_node,
+            segment_pool_idx[seg->pool_size]);
     SCMutexLock(&segment_pool_mutex[idx]);
     PoolReturn(segment_pool[idx], (void *) seg);
-    SCLogDebug("segment_pool[%"PRIu16"]->empty_stack_size %"PRIu32"",
+    SCLogDebug("segment_pool[%"PRIu32"]->empty_stack_size %"PRIu32"",
                idx,segment_pool[idx]->empty_stack_size);
     SCMutexUnlock(&segment_pool_mutex[idx]);
 
@@ -264,6 +350,17 @@ void StreamTcpReturnStreamSegments (TcpStream *stream)
     TcpSegment *seg = stream->seg_list;
     TcpSegment *next_seg;
 
+    if (stream->sb != NULL) {
+        StreamingBufferFree(stream->sb);
+        stream->sb = NULL;
+        stream->sb_base_seq = 0;
+    }
+    if (stream->seg_idx.segs != NULL) {
+        StreamTcpSbFree(stream->seg_idx.segs,
+                stream->seg_idx.size * sizeof(TcpSegment *));
+        memset(&stream->seg_idx, 0x00, sizeof(stream->seg_idx));
+    }
+
     if (seg == NULL)
         return;
 
@@ -306,6 +403,24 @@ typedef struct SegmentSizes_
 } SegmentSizes;
 
 /* sort small to big */
+typedef struct TcpSegmentPoolSetup_ {
+    Pool *pool;
+    uint32_t prealloc;
+    uint16_t *pktsize;
+} TcpSegmentPoolSetup;
+
+/** \brief set up a segment pool, runs on the pool's NUMA node so the
+ *         preallocated segments are in its local memory */
+static void TcpSegmentPoolSetupOnNode(void *data)
+{
+    TcpSegmentPoolSetup *setup = (TcpSegmentPoolSetup *)data;
+
+    setup->pool = PoolInit(0, setup->prealloc, 0,
+            TcpSegmentPoolAlloc, TcpSegmentPoolInit,
+            (void *) setup->pktsize,
+            TcpSegmentPoolCleanup, NULL);
+}
+
 static int SortByPktsize(const void *a, const void *b)
 {
     const SegmentSizes *s0 = a;
@@ -318,9 +433,52 @@ int StreamTcpReassemblyConfig(char quiet)
     Pool **my_segment_pool = NULL;
     SCMutex *my_segment_lock = NULL;
     uint16_t *my_segment_pktsizes = NULL;
-    SegmentSizes sizes[256];
+    /* room for the 256 configured pools, the 0xffff pool that may be
+     * appended and the segment pool for the "buffer" storage */
+    SegmentSizes sizes[258];
     memset(&sizes, 0x00, sizeof(sizes));
 
+    char *storage = NULL;
+    if (ConfGet("stream.reassembly.segment-storage", &storage) == 1 &&
+            storage != NULL)
+    {
+        if (strcmp(storage, "buffer") == 0) {
+            if (StreamTcpInlineMode()) {
+                SCLogWarning(SC_ERR_INVALID_VALUE, "stream.reassembly "
+                        "\"segment-storage\": buffer is not supported in "
+                        "inline mode, using \"list\"");
+            } else {
+                stream_config.flags |= STREAMTCP_INIT_FLAG_SEGMENT_BUFFER;
+            }
+        } else if (strcmp(storage, "list") != 0) {
+            SCLogError(SC_ERR_INVALID_ARGUMENT, "stream.reassembly "
+                    "\"segment-storage\" of %s is invalid: valid values "
+                    "are \"list\" and \"buffer\"", storage);
+            return -1;
+        }
+    }
+    if (!quiet)
+        SCLogInfo("stream.reassembly \"segment-storage\": %s",
+                (stream_config.flags & STREAMTCP_INIT_FLAG_SEGMENT_BUFFER) ?
+                "buffer" : "list");
+
+    segment_buffer_max_gap = SEGMENT_BUFFER_MAX_GAP_DEFAULT;
+    char *max_gap = NULL;
+    if (ConfGet("stream.reassembly.segment-buffer-max-gap", &max_gap) == 1 &&
+            max_gap != NULL)
+    {
+        if (ParseSizeStringU32(max_gap, &segment_buffer_max_gap) < 0 ||
+                segment_buffer_max_gap < SEGMENT_BUFFER_MIN_WINDOW) {
+            SCLogError(SC_ERR_SIZE_PARSE, "stream.reassembly "
+                    "\"segment-buffer-max-gap\" of %s is invalid: must be "
+                    "a size of at least %u", max_gap, SEGMENT_BUFFER_MIN_WINDOW);
+            return -1;
+        }
+    }
+    if (!quiet && (stream_config.flags & STREAMTCP_INIT_FLAG_SEGMENT_BUFFER))
+        SCLogInfo("stream.reassembly \"segment-buffer-max-gap\": %"PRIu32,
+                segment_buffer_max_gap);
+
     int npools = 0;
     ConfNode *segs = ConfGetNode("stream.reassembly.segments");
     if (segs != NULL) {
@@ -344,7 +502,7 @@ int StreamTcpReassemblyConfig(char quiet)
 
             uint16_t pktsize = 0;
             if (ByteExtractStringUint16(&pktsize, 10, strlen(segsize->val),
-                                        segsize->val) == -1)
+                                        segsize->val) == -1 || pktsize == 0)
             {
                 SCLogError(SC_ERR_INVALID_ARGUMENT, "segment packet size "
                                                     "of %s is invalid", segsize->val);
@@ -398,17 +556,35 @@ int StreamTcpReassemblyConfig(char quiet)
         npools = 8;
     }
 
+    /* pool 0 holds segments without payload memory, used by the
+     * "buffer" segment storage. It takes over the preallocation of
+     * the payload pools then, which are only used on demand. */
+    uint32_t segment_prealloc = 0;
     int i = 0;
+    for (i = npools; i > 0; i--) {
+        sizes[i] = sizes[i - 1];
+        if (stream_config.flags & STREAMTCP_INIT_FLAG_SEGMENT_BUFFER) {
+            segment_prealloc += sizes[i].prealloc;
+            sizes[i].prealloc = 0;
+        }
+    }
+    sizes[0].pktsize = 0;
+    sizes[0].prealloc = segment_prealloc;
+    npools++;
+
     for (i = 0; i < npools; i++) {
         SCLogDebug("pktsize %u, prealloc %u", sizes[i].pktsize, sizes[i].prealloc);
     }
 
-    my_segment_pool = SCMalloc(npools * sizeof(Pool *));
+    /* a set of pools per NUMA node */
+    uint32_t nodes = NumaNodeCount();
+
+    my_segment_pool = SCMalloc(npools * nodes * sizeof(Pool *));
     if (my_segment_pool == NULL) {
         SCLogError(SC_ERR_MEM_ALLOC, "malloc failed");
         return -1;
     }
-    my_segment_lock = SCMalloc(npools * sizeof(SCMutex));
+    my_segment_lock = SCMalloc(npools * nodes * sizeof(SCMutex));
     if (my_segment_lock == NULL) {
         SCLogError(SC_ERR_MEM_ALLOC, "malloc failed");
 
@@ -428,20 +604,26 @@ int StreamTcpReassemblyConfig(char quiet)
     for (i = 0; i < npools; i++) {
         my_segment_pktsizes[i] = sizes[i].pktsize;
         my_segment_poolsizes[i] = sizes[i].prealloc;
-        SCMutexInit(&my_segment_lock[i], NULL);
-
-        /* setup the pool */
-        SCMutexLock(&my_segment_lock[i]);
-        my_segment_pool[i] = PoolInit(0, my_segment_poolsizes[i], 0,
-                TcpSegmentPoolAlloc, TcpSegmentPoolInit,
-                (void *) &my_segment_pktsizes[i],
-                TcpSegmentPoolCleanup, NULL);
-        SCMutexUnlock(&my_segment_lock[i]);
-
-        if (my_segment_pool[i] == NULL) {
-            SCLogError(SC_ERR_INITIALIZATION, "couldn't set up segment pool "
-                    "for packet size %u. Memcap too low?", my_segment_pktsizes[i]);
-            exit(EXIT_FAILURE);
+
+        /* setup the pool of each node, the prealloc is spread over them */
+        uint32_t node;
+        for (node = 0; node < nodes; node++) {
+            uint32_t u = node * npools + i;
+            TcpSegmentPoolSetup setup = { NULL,
+                NumaNodeShare(node, my_segment_poolsizes[i]),
+                &my_segment_pktsizes[i] };
+
+            SCMutexInit(&my_segment_lock[u], NULL);
+            SCMutexLock(&my_segment_lock[u]);
+            NumaRunOnNode(node, TcpSegmentPoolSetupOnNode, &setup);
+            my_segment_pool[u] = setup.pool;
+            SCMutexUnlock(&my_segment_lock[u]);
+
+            if (my_segment_pool[u] == NULL) {
+                SCLogError(SC_ERR_INITIALIZATION, "couldn't set up segment pool "
+                        "for packet size %u. Memcap too low?", my_segment_pktsizes[i]);
+                exit(EXIT_FAILURE);
+            }
         }
 
         SCLogDebug("my_segment_pktsizes[i] %u, my_segment_poolsizes[i] %u",
@@ -470,6 +652,7 @@ int StreamTcpReassemblyConfig(char quiet)
     segment_pool_mutex = my_segment_lock;
     segment_pool_pktsizes = my_segment_pktsizes;
     segment_pool_num = npools;
+    segment_pool_nodes = nodes;
 
     uint32_t stream_chunk_prealloc = 250;
     ConfNode *chunk = ConfGetNode("stream.reassembly.chunk-prealloc");
@@ -526,28 +709,29 @@ static uint32_t dbg_app_layer_gap_candidate;
 
 void StreamTcpReassembleFree(char quiet)
 {
-    uint16_t u16 = 0;
-    for (u16 = 0; u16 < segment_pool_num; u16++) {
-        SCMutexLock(&segment_pool_mutex[u16]);
+    uint32_t u = 0;
+    for (u = 0; u < segment_pool_num * segment_pool_nodes; u++) {
+        SCMutexLock(&segment_pool_mutex[u]);
 
         if (quiet == FALSE) {
-            PoolPrintSaturation(segment_pool[u16]);
-            SCLogDebug("segment_pool[u16]->empty_stack_size %"PRIu32", "
-                       "segment_pool[u16]->alloc_stack_size %"PRIu32", alloced "
-                       "%"PRIu32"", segment_pool[u16]->empty_stack_size,
-                       segment_pool[u16]->alloc_stack_size,
-                       segment_pool[u16]->allocated);
-
-            if (segment_pool[u16]->max_outstanding > segment_pool[u16]->allocated) {
+            PoolPrintSaturation(segment_pool[u]);
+            SCLogDebug("segment_pool[u]->empty_stack_size %"PRIu32", "
+                       "segment_pool[u]->alloc_stack_size %"PRIu32", alloced "
+                       "%"PRIu32"", segment_pool[u]->empty_stack_size,
+                       segment_pool[u]->alloc_stack_size,
+                       segment_pool[u]->allocated);
+
+            if (segment_pool[u]->max_outstanding > segment_pool[u]->allocated) {
                 SCLogInfo("TCP segment pool of size %u had a peak use of %u segments, "
-                        "more than the prealloc setting of %u", segment_pool_pktsizes[u16],
-                        segment_pool[u16]->max_outstanding, segment_pool[u16]->allocated);
+                        "more than the prealloc setting of %u",
+                        segment_pool_pktsizes[u % segment_pool_num],
+                        segment_pool[u]->max_outstanding, segment_pool[u]->allocated);
             }
         }
-        PoolFree(segment_pool[u16]);
+        PoolFree(segment_pool[u]);
 
-        SCMutexUnlock(&segment_pool_mutex[u16]);
-        SCMutexDestroy(&segment_pool_mutex[u16]);
+        SCMutexUnlock(&segment_pool_mutex[u]);
+        SCMutexDestroy(&segment_pool_mutex[u]);
     }
     SCFree(segment_pool);
     SCFree(segment_pool_mutex);
@@ -893,6 +1077,390 @@ end:
     SCReturnInt(ret_value);
 }
 
+/**
+ *  \internal
+ *  \brief get the absolute StreamingBuffer offset for a sequence number
+ */
+static inline uint64_t StreamTcpBufferedSeqToOffset(const TcpStream *stream,
+        const uint32_t seq)
+{
+    return stream->sb->stream_offset + (uint32_t)(seq - stream->sb_base_seq);
+}
+
+/**
+ *  \internal
+ *  \brief get the seq up to which data is accepted into the buffer
+ *
+ *  That is the receiver's window from last_ack, or from the start of the
+ *  buffer if last_ack lags behind it. Unknown or tiny windows are treated
+ *  as SEGMENT_BUFFER_MIN_WINDOW, huge ones are capped at
+ *  segment_buffer_max_gap.
+ */
+static inline uint32_t StreamTcpBufferedRightEdge(const TcpStream *stream)
+{
+    uint32_t window = stream->window;
+    if (window < SEGMENT_BUFFER_MIN_WINDOW)
+        window = SEGMENT_BUFFER_MIN_WINDOW;
+    if (window > segment_buffer_max_gap)
+        window = segment_buffer_max_gap;
+
+    const uint32_t base = SEQ_GT(stream->sb_base_seq, stream->last_ack) ?
+        stream->sb_base_seq : stream->last_ack;
+    return base + window;
+}
+
+/**
+ *  \internal
+ *  \brief get the number of segments in the index starting at or before seq
+ *
+ *  Binary search, so the segment preceding seq is idx->segs[idx->head +
+ *  retval - 1] if retval > 0.
+ */
+static uint32_t StreamTcpSegmentIndexUpperBound(const TcpSegmentIndex *idx,
+        const uint32_t seq)
+{
+    TcpSegment * const *segs = idx->segs + idx->head;
+    uint32_t lo = 0;
+    uint32_t hi = idx->cnt;
+
+    while (lo < hi) {
+        const uint32_t mid = lo + (hi - lo) / 2;
+        if (SEQ_GT(segs[mid]->seq, seq))
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return lo;
+}
+
+/**
+ *  \internal
+ *  \brief make sure the index has room for one more segment
+ *
+ *  \retval 0 ok
+ *  \retval -1 memcap reached or out of memory
+ */
+static int StreamTcpSegmentIndexReserve(TcpSegmentIndex *idx)
+{
+    if (idx->head + idx->cnt < idx->size)
+        return 0;
+
+    /* plenty of room in front after removing list heads: move down
+     * instead of growing */
+    if (idx->head > 0 && idx->head >= idx->size / 4) {
+        memmove(idx->segs, idx->segs + idx->head,
+                idx->cnt * sizeof(TcpSegment *));
+        idx->head = 0;
+        return 0;
+    }
+
+    const uint32_t size = idx->size ? idx->size * 2 : SEGMENT_INDEX_INIT_SIZE;
+    TcpSegment **segs = StreamTcpSbRealloc(idx->segs,
+            idx->size * sizeof(TcpSegment *), size * sizeof(TcpSegment *));
+    if (segs == NULL)
+        return -1;
+    idx->segs = segs;
+    idx->size = size;
+    return 0;
+}
+
+/**
+ *  \internal
+ *  \brief add a segment to the index at position pos (relative to the head)
+ *
+ *  Room has to be reserved with StreamTcpSegmentIndexReserve() first.
+ */
+static void StreamTcpSegmentIndexInsert(TcpSegmentIndex *idx, const uint32_t pos,
+        TcpSegment *seg)
+{
+    BUG_ON(idx->head + idx->cnt >= idx->size || pos > idx->cnt);
+
+    TcpSegment **segs = idx->segs + idx->head;
+    memmove(&segs[pos + 1], &segs[pos], (idx->cnt - pos) * sizeof(TcpSegment *));
+    segs[pos] = seg;
+    idx->cnt++;
+}
+
+/**
+ *  \internal
+ *  \brief remove a segment from the index
+ */
+static void StreamTcpSegmentIndexRemove(TcpSegmentIndex *idx, const TcpSegment *seg)
+{
+    TcpSegment **segs = idx->segs + idx->head;
+
+    /* common case: the list head is removed */
+    if (idx->cnt > 0 && segs[0] == seg) {
+        idx->cnt--;
+        idx->head = (idx->cnt > 0) ? idx->head + 1 : 0;
+        return;
+    }
+
+    uint32_t pos = StreamTcpSegmentIndexUpperBound(idx, seg->seq);
+    BUG_ON(pos == 0 || segs[pos - 1] != seg);
+    pos--;
+    memmove(&segs[pos], &segs[pos + 1], (idx->cnt - pos - 1) * sizeof(TcpSegment *));
+    idx->cnt--;
+}
+
+/**
+ *  \internal
+ *  \brief Decide if overlapping new data replaces the data of a segment
+ *         in the list, based on the target OS policy. Follows the same
+ *         rules as the HandleSegmentStarts* functions.
+ *
+ *  \param os_policy target OS policy of the stream
+ *  \param seq start of the new data
+ *  \param end end of the new data (seq + len)
+ *  \param list_seg segment the new data overlaps with
+ *
+ *  \retval 1 new data wins
+ *  \retval 0 old data is kept
+ */
+static int StreamTcpBufferedOverlapNewDataWins(const uint8_t os_policy,
+        const uint32_t seq, const uint32_t end, const TcpSegment *list_seg)
+{
+    const uint32_t list_end = list_seg->seq + list_seg->payload_len;
+    const int end_after = SEQ_GT(end, list_end);
+    const int end_same = SEQ_EQ(end, list_end);
+
+    if (SEQ_LT(seq, list_seg->seq)) {
+        switch (os_policy) {
+            case OS_POLICY_SOLARIS:
+            case OS_POLICY_HPUX11:
+                return (end_after || end_same);
+            case OS_POLICY_VISTA:
+            case OS_POLICY_FIRST:
+                return 0;
+            default:
+                return 1;
+        }
+    } else if (SEQ_EQ(seq, list_seg->seq)) {
+        switch (os_policy) {
+            case OS_POLICY_OLD_LINUX:
+            case OS_POLICY_SOLARIS:
+            case OS_POLICY_HPUX11:
+                return (end_after || end_same);
+            case OS_POLICY_LAST:
+                return 1;
+            case OS_POLICY_LINUX:
+                return end_after;
+            default:
+                return 0;
+        }
+    } else {
+        switch (os_policy) {
+            case OS_POLICY_SOLARIS:
+            case OS_POLICY_HPUX11:
+                return end_after;
+            case OS_POLICY_LAST:
+                return 1;
+            default:
+                return 0;
+        }
+    }
+}
+
+/**
+ *  \internal
+ *  \brief handle new data overlapping with data of a segment in the list
+ *
+ *  \param data new data for the overlapping part
+ *  \param ovl_seq start of the overlapping part
+ *  \param ovl_len length of the overlapping part
+ */
+static void StreamTcpBufferedHandleOverlap(TcpStream *stream, TcpSegment *list_seg,
+        Packet *p, const uint32_t seq, const uint32_t end,
+        const uint8_t *data, const uint32_t ovl_seq, const uint32_t ovl_len)
+{
+    const uint64_t offset = StreamTcpBufferedSeqToOffset(stream, ovl_seq);
+    const uint8_t *sbdata = NULL;
+    uint32_t sbdata_len = 0;
+
+    if (StreamingBufferGetDataAtOffset(stream->sb, &sbdata, &sbdata_len, offset) == 0 ||
+            sbdata_len < ovl_len)
+        return;
+
+    if (memcmp(sbdata, data, ovl_len) == 0)
+        return;
+
+    if (check_overlap_different_data) {
+        /* interesting, overlap with different data */
+        StreamTcpSetEvent(p, STREAM_REASSEMBLY_OVERLAP_DIFFERENT_DATA);
+    }
+
+    /* If the OS policy is not set then set the OS policy for this stream */
+    if (stream->os_policy == 0) {
+        StreamTcpSetOSPolicy(stream, p);
+    }
+
+    if (StreamTcpBufferedOverlapNewDataWins(stream->os_policy, seq, end, list_seg)) {
+        SCLogDebug("replacing old data of list_seg->seq %"PRIu32" at %"PRIu32
+                " len %"PRIu32, list_seg->seq, ovl_seq, ovl_len);
+        StreamingBufferSegment sbseg;
+        (void)StreamingBufferInsertAt(stream->sb, &sbseg, data, ovl_len, offset);
+    }
+}
+
+/**
+ *  \internal
+ *  \brief Insert packet data into the stream for segment storage "buffer"
+ *
+ *  The payload is written into the stream's StreamingBuffer. Segments only
+ *  describe which parts of the buffer hold data, and never overlap: data
+ *  overlapping existing segments is applied to the buffer according to the
+ *  OS policy, and only the parts not covered yet get a new segment.
+ *
+ *  \param size number of bytes from the packet payload to insert
+ *  \param seg_flags flags to set on the new segment(s)
+ *
+ *  \retval 0 success
+ *  \retval -1 error -- either we hit a memory issue (OOM/memcap) or we
+ *              received data before ra_base_seq.
+ */
+static int StreamTcpReassembleInsertBuffered(ThreadVars *tv,
+        TcpReassemblyThreadCtx *ra_ctx, TcpStream *stream, Packet *p,
+        uint16_t size, const uint8_t seg_flags)
+{
+    SCEnter();
+
+    uint32_t seq = TCP_GET_SEQ(p);
+    const uint8_t *data = p->payload;
+
+    /* before our ra_app_base_seq we don't insert it in our list,
+     * or ra_raw_base_seq if in stream gap state */
+    if (SEQ_LT((seq + p->payload_len), (StreamTcpReassembleGetRaBaseSeq(stream)+1))) {
+        SCLogDebug("not inserting: SEQ+payload %"PRIu32", last_ack %"PRIu32", "
+                "ra_(app|raw)_base_seq %"PRIu32, (seq + p->payload_len),
+                stream->last_ack, StreamTcpReassembleGetRaBaseSeq(stream)+1);
+        StreamTcpSetEvent(p, STREAM_REASSEMBLY_SEGMENT_BEFORE_BASE_SEQ);
+        SCReturnInt(-1);
+    }
+
+    if (stream->sb == NULL) {
+        stream->sb = StreamingBufferInit(&segment_sb_cfg);
+        if (stream->sb == NULL) {
+            StatsIncr(tv, ra_ctx->counter_tcp_segment_memcap);
+            StreamTcpSetEvent(p, STREAM_REASSEMBLY_NO_SEGMENT);
+            SCReturnInt(-1);
+        }
+        /* raw reassembly may lag behind the app layer */
+        stream->sb_base_seq = SEQ_LT(stream->ra_raw_base_seq, stream->ra_app_base_seq) ?
+            stream->ra_raw_base_seq + 1 : stream->ra_app_base_seq + 1;
+    }
+
+    /* data before the start of the buffer was reassembled already */
+    if (SEQ_LT(seq, stream->sb_base_seq)) {
+        const uint32_t skip = stream->sb_base_seq - seq;
+        if (skip >= size)
+            SCReturnInt(0);
+        seq += skip;
+        data += skip;
+        size -= skip;
+    }
+
+    /* data far beyond the receiver's window would grow the buffer to
+     * cover the whole gap, so only accept data up to the right edge */
+    const uint32_t right_edge = StreamTcpBufferedRightEdge(stream);
+    if (SEQ_GEQ(seq, right_edge)) {
+        SCLogDebug("seq %"PRIu32" beyond right edge %"PRIu32, seq, right_edge);
+        StatsIncr(tv, ra_ctx->counter_tcp_segment_window);
+        StreamTcpSetEvent(p, STREAM_REASSEMBLY_SEGMENT_BEYOND_WINDOW);
+        SCReturnInt(-1);
+    }
+    if (SEQ_GT(seq + size, right_edge)) {
+        SCLogDebug("trimming seq %"PRIu32" len %"PRIu16" to right edge "
+                "%"PRIu32, seq, size, right_edge);
+        size = (uint16_t)(right_edge - seq);
+        StatsIncr(tv, ra_ctx->counter_tcp_segment_window);
+        StreamTcpSetEvent(p, STREAM_REASSEMBLY_SEGMENT_BEYOND_WINDOW);
+    }
+    const uint32_t end = seq + size;
+
+    /* find the last segment starting at or before seq. Invariant of the
+     * loop below: prev and next are at index positions pos - 1 and pos. */
+    TcpSegmentIndex *idx = &stream->seg_idx;
+    uint32_t pos = StreamTcpSegmentIndexUpperBound(idx, seq);
+    TcpSegment *prev = (pos > 0) ? idx->segs[idx->head + pos - 1] : NULL;
+    TcpSegment *next = (prev != NULL) ? prev->next : stream->seg_list;
+
+    uint32_t cur = seq;
+    while (SEQ_LT(cur, end)) {
+        TcpSegment *list_seg = NULL;
+        if (prev != NULL && SEQ_GT(prev->seq + prev->payload_len, cur)) {
+            list_seg = prev;
+        } else if (next != NULL && SEQ_LEQ(next->seq, cur)) {
+            list_seg = next;
+        }
+
+        if (list_seg != NULL) {
+            const uint32_t list_end = list_seg->seq + list_seg->payload_len;
+            const uint32_t ovl_end = SEQ_LT(list_end, end) ? list_end : end;
+
+            StreamTcpBufferedHandleOverlap(stream, list_seg, p, seq, end,
+                    data + (cur - seq), cur, ovl_end - cur);
+
+            cur = ovl_end;
+            if (list_seg == next)
+                pos++;
+            prev = list_seg;
+            next = list_seg->next;
+            continue;
+        }
+
+        /* new data up to the next segment or the end of the packet */
+        const uint32_t gap_end = (next != NULL && SEQ_LT(next->seq, end)) ?
+            next->seq : end;
+        const uint16_t len = (uint16_t)(gap_end - cur);
+
+        if (StreamTcpSegmentIndexReserve(idx) != 0) {
+            StatsIncr(tv, ra_ctx->counter_tcp_segment_memcap);
+            StreamTcpSetEvent(p, STREAM_REASSEMBLY_NO_SEGMENT);
+            SCReturnInt(-1);
+        }
+        TcpSegment *seg = StreamTcpGetSegment(tv, ra_ctx, 0);
+        if (seg == NULL) {
+            SCLogDebug("segment_pool[%"PRIu16"] is empty", segment_pool_idx[0]);
+            StreamTcpSetEvent(p, STREAM_REASSEMBLY_NO_SEGMENT);
+            SCReturnInt(-1);
+        }
+        if (StreamingBufferInsertAt(stream->sb, &seg->sbseg, data + (cur - seq),
+                    len, StreamTcpBufferedSeqToOffset(stream, cur)) != 0)
+        {
+            StreamTcpSegmentReturntoPool(seg);
+            StatsIncr(tv, ra_ctx->counter_tcp_segment_memcap);
+            StreamTcpSetEvent(p, STREAM_REASSEMBLY_NO_SEGMENT);
+            SCReturnInt(-1);
+        }
+        seg->seq = cur;
+        seg->payload_len = len;
+        seg->flags |= seg_flags;
+
+        seg->prev = prev;
+        seg->next = next;
+        if (prev != NULL)
+            prev->next = seg;
+        else
+            stream->seg_list = seg;
+        if (next != NULL)
+            next->prev = seg;
+        else
+            stream->seg_list_tail = seg;
+        StreamTcpSegmentIndexInsert(idx, pos, seg);
+
+        SCLogDebug("inserted seg %p seq %"PRIu32" len %"PRIu16, seg, seg->seq,
+                seg->payload_len);
+        prev = seg;
+        pos++;
+        cur = gap_end;
+    }
+
+#ifdef DEBUG
+    PrintList(stream->seg_list);
+#endif
+    SCReturnInt(0);
+}
+
 /**
  *  \brief Function to handle the newly arrived segment, when newly arrived
  *         starts with the sequence number lower than the original segment and
@@ -1924,27 +2492,15 @@ int StreamTcpReassembleHandleSegmentHandleData(ThreadVars *tv, TcpReassemblyThre
         size = p->payload_len;
 #endif
 
-    TcpSegment *seg = StreamTcpGetSegment(tv, ra_ctx, size);
-    if (seg == NULL) {
-        SCLogDebug("segment_pool[%"PRIu16"] is empty", segment_pool_idx[size]);
-
-        StreamTcpSetEvent(p, STREAM_REASSEMBLY_NO_SEGMENT);
-        SCReturnInt(-1);
-    }
-
-    memcpy(seg->payload, p->payload, size);
-    seg->payload_len = size;
-    seg->seq = TCP_GET_SEQ(p);
-
+    uint8_t seg_flags = 0;
     if (ssn->flags & STREAMTCP_FLAG_APP_LAYER_DISABLED)
-        seg->flags |= SEGMENTTCP_FLAG_APPLAYER_PROCESSED;
+        seg_flags |= SEGMENTTCP_FLAG_APPLAYER_PROCESSED;
 
     /* if raw reassembly is disabled for new segments, flag each
      * segment as complete for raw before insert */
     if (stream->flags & STREAMTCP_STREAM_FLAG_NEW_RAW_DISABLED) {
-        seg->flags |= SEGMENTTCP_FLAG_RAW_PROCESSED;
-        SCLogDebug("segment %p flagged with SEGMENTTCP_FLAG_RAW_PROCESSED, "
-                   "flags %02x", seg, seg->flags);
+        seg_flags |= SEGMENTTCP_FLAG_RAW_PROCESSED;
+        SCLogDebug("new segments flagged with SEGMENTTCP_FLAG_RAW_PROCESSED");
     }
 
     /* proto detection skipped, but now we do get data. Set event. */
@@ -1955,6 +2511,28 @@ int StreamTcpReassembleHandleSegmentHandleData(ThreadVars *tv, TcpReassemblyThre
                 APPLAYER_PROTO_DETECTION_SKIPPED);
     }
 
+    if (stream_config.flags & STREAMTCP_INIT_FLAG_SEGMENT_BUFFER) {
+        if (StreamTcpReassembleInsertBuffered(tv, ra_ctx, stream, p,
+                    (uint16_t)size, seg_flags) != 0) {
+            SCLogDebug("StreamTcpReassembleInsertBuffered failed");
+            SCReturnInt(-1);
+        }
+        SCReturnInt(0);
+    }
+
+    TcpSegment *seg = StreamTcpGetSegment(tv, ra_ctx, size);
+    if (seg == NULL) {
+        SCLogDebug("segment_pool[%"PRIu16"] is empty", segment_pool_idx[size]);
+
+        StreamTcpSetEvent(p, STREAM_REASSEMBLY_NO_SEGMENT);
+        SCReturnInt(-1);
+    }
+
+    memcpy(seg->payload, p->payload, size);
+    seg->payload_len = size;
+    seg->seq = TCP_GET_SEQ(p);
+    seg->flags |= seg_flags;
+
     if (StreamTcpReassembleInsertSegment(tv, ra_ctx, stream, seg, p) != 0) {
         SCLogDebug("StreamTcpReassembleInsertSegment failed");
         SCReturnInt(-1);
@@ -2004,6 +2582,7 @@ static void StreamTcpSetupMsg(TcpSession *ssn, TcpStream *stream, Packet *p,
 {
     SCEnter();
     smsg->data_len = 0;
+    smsg->stream = NULL;
     SCLogDebug("smsg %p", smsg);
     SCReturn;
 }
@@ -2129,10 +2708,23 @@ static inline int StreamTcpReturnSegmentCheck(const Flow *f, TcpSession *ssn, Tc
 
 static void StreamTcpRemoveSegmentFromStream(TcpStream *stream, TcpSegment *seg)
 {
+    if (seg->pool_size == 0 && stream->seg_idx.segs != NULL)
+        StreamTcpSegmentIndexRemove(&stream->seg_idx, seg);
+
     if (seg->prev == NULL) {
         stream->seg_list = seg->next;
         if (stream->seg_list != NULL)
             stream->seg_list->prev = NULL;
+
+        /* segments don't overlap in the buffer, so the data up to the
+         * end of the list head is no longer needed */
+        if (seg->pool_size == 0 && stream->sb != NULL) {
+            const uint64_t seg_end = seg->sbseg.stream_offset + seg->sbseg.segment_len;
+            if (seg_end > stream->sb->stream_offset) {
+                stream->sb_base_seq += (uint32_t)(seg_end - stream->sb->stream_offset);
+                StreamingBufferSlideToOffset(stream->sb, seg_end);
+            }
+        }
     } else {
         seg->prev->next = seg->next;
         if (seg->next != NULL)
@@ -2322,7 +2914,10 @@ static int StreamTcpReassembleInlineRaw (TcpReassemblyThreadCtx *ra_ctx,
                 BUG_ON(copy_size > smsg->data_size);
             }
             SCLogDebug("copy_size is %"PRIu16"", copy_size);
-            memcpy(smsg->data + smsg_offset, seg->payload + payload_offset,
+            const uint8_t *seg_data = NULL;
+            uint32_t seg_data_len = 0;
+            StreamTcpSegmentGetData(stream, seg, &seg_data, &seg_data_len);
+            memcpy(smsg->data + smsg_offset, seg_data + payload_offset,
                     copy_size);
             smsg_offset += copy_size;
 
@@ -2387,7 +2982,7 @@ static int StreamTcpReassembleInlineRaw (TcpReassemblyThreadCtx *ra_ctx,
                     SCLogDebug("copy payload_offset %" PRIu32 ", smsg_offset "
                                 "%" PRIu32 ", copy_size %" PRIu32 "",
                                 payload_offset, smsg_offset, copy_size);
-                    memcpy(smsg->data + smsg_offset, seg->payload +
+                    memcpy(smsg->data + smsg_offset, seg_data +
                             payload_offset, copy_size);
                     smsg_offset += copy_size;
                     if (gap == 0 && SEQ_GT((seg->seq + payload_offset + copy_size),ra_base_seq+1)) {
@@ -2632,8 +3227,11 @@ static inline int DoReassemble(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
                     SEQ_EQ(stream->last_ack, (seg->seq + seg->payload_len))))
         {
             /* process single segment directly */
+            const uint8_t *seg_data = NULL;
+            uint32_t seg_data_len = 0;
+            StreamTcpSegmentGetData(stream, seg, &seg_data, &seg_data_len);
             AppLayerHandleTCPData(tv, ra_ctx, p, p->flow, ssn, stream,
-                    seg->payload, seg->payload_len,
+                    (uint8_t *)seg_data, seg_data_len,
                     StreamGetAppLayerFlags(ssn, stream, p));
             AppLayerProfilingStore(ra_ctx->app_tctx, p);
             rd->data_sent += seg->payload_len;
@@ -2655,8 +3253,11 @@ static inline int DoReassemble(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
                 seg->payload_len >= stream_config.zero_copy_size)
         {
             /* process single segment directly */
+            const uint8_t *seg_data = NULL;
+            uint32_t seg_data_len = 0;
+            StreamTcpSegmentGetData(stream, seg, &seg_data, &seg_data_len);
             AppLayerHandleTCPData(tv, ra_ctx, p, p->flow, ssn, stream,
-                    seg->payload, seg->payload_len,
+                    (uint8_t *)seg_data, seg_data_len,
                     StreamGetAppLayerFlags(ssn, stream, p));
             AppLayerProfilingStore(ra_ctx->app_tctx, p);
             rd->data_sent += seg->payload_len;
@@ -2760,11 +3361,15 @@ static inline int DoReassemble(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
         if (SCLogDebugEnabled()) {
             BUG_ON(copy_size > sizeof(rd->data));
             BUG_ON(copy_size+payload_offset > seg->payload_len);
-            BUG_ON(copy_size+payload_offset > seg->pool_size);
+            BUG_ON(seg->pool_size != 0 &&
+                    copy_size+payload_offset > seg->pool_size);
         }
 
         SCLogDebug("copy_size is %"PRIu16"", copy_size);
-        memcpy(rd->data + rd->data_len, seg->payload + payload_offset, copy_size);
+        const uint8_t *seg_data = NULL;
+        uint32_t seg_data_len = 0;
+        StreamTcpSegmentGetData(stream, seg, &seg_data, &seg_data_len);
+        memcpy(rd->data + rd->data_len, seg_data + payload_offset, copy_size);
         rd->data_len += copy_size;
         rd->ra_base_seq += copy_size;
         SCLogDebug("ra_base_seq %"PRIu32", data_len %"PRIu32, rd->ra_base_seq, rd->data_len);
@@ -2821,7 +3426,7 @@ static inline int DoReassemble(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
                 SCLogDebug("copy payload_offset %" PRIu32 ", data_len "
                         "%" PRIu32 ", copy_size %" PRIu32 "",
                         payload_offset, rd->data_len, copy_size);
-                memcpy(rd->data + rd->data_len, seg->payload +
+                memcpy(rd->data + rd->data_len, seg_data +
                         payload_offset, copy_size);
                 rd->data_len += copy_size;
                 rd->ra_base_seq += copy_size;
@@ -3082,6 +3687,9 @@ int StreamTcpReassembleAppLayer (ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx,
     SCReturnInt(0);
 }
 
+/** max size of a smsg referencing the segment buffer */
+#define STREAM_MSG_VIEW_MAX_LEN UINT16_MAX
+
 typedef struct ReassembleRawData_ {
     uint32_t ra_base_seq;
     int partial;        /* last segment was processed only partially */
@@ -3178,6 +3786,45 @@ static int DoRawReassemble(TcpSession *ssn, TcpStream *stream, TcpSegment *seg,
             return 1; // TODO
         }
 
+        /* with the segment buffer the smsg references the stream data
+         * instead of holding a copy. Gaps close the smsg, so contiguous
+         * segments extend the same view. */
+        if (seg->pool_size == 0) {
+            /* the mpm search length is 16 bit, so cap the view */
+            if (rd->smsg != NULL &&
+                    rd->smsg->data_len + payload_len > STREAM_MSG_VIEW_MAX_LEN) {
+                StreamTcpStoreStreamChunk(ssn, rd->smsg, p, 0);
+                stream->ra_raw_base_seq = rd->ra_base_seq;
+                rd->smsg = NULL;
+            }
+            if (rd->smsg == NULL) {
+                rd->smsg = StreamMsgGetFromPool();
+                if (rd->smsg == NULL) {
+                    SCLogDebug("stream_msg_pool is empty");
+                    return -1;
+                }
+                rd->smsg_offset = 0;
+
+                StreamTcpSetupMsg(ssn, stream, p, rd->smsg);
+                rd->smsg->seq = rd->ra_base_seq + 1;
+                rd->smsg->stream = stream;
+                rd->smsg->stream_offset = seg->sbseg.stream_offset + payload_offset;
+                SCLogDebug("smsg->seq %u, stream_offset %"PRIu64, rd->smsg->seq,
+                        rd->smsg->stream_offset);
+            }
+            if (SCLogDebugEnabled()) {
+                BUG_ON(rd->smsg->stream == NULL);
+                BUG_ON(rd->smsg->stream_offset + rd->smsg->data_len !=
+                        seg->sbseg.stream_offset + payload_offset);
+            }
+
+            rd->smsg->data_len += payload_len;
+            rd->smsg_offset += payload_len;
+            rd->ra_base_seq += payload_len;
+            SCLogDebug("ra_base_seq %"PRIu32, rd->ra_base_seq);
+            return 1;
+        }
+
         if (rd->smsg == NULL) {
             rd->smsg = StreamMsgGetFromPool();
             if (rd->smsg == NULL) {
@@ -3204,7 +3851,10 @@ static int DoRawReassemble(TcpSession *ssn, TcpStream *stream, TcpSegment *seg,
             BUG_ON(copy_size > rd->smsg->data_size);
         }
         SCLogDebug("copy_size is %"PRIu16"", copy_size);
-        memcpy(rd->smsg->data + rd->smsg_offset, seg->payload + payload_offset,
+        const uint8_t *seg_data = NULL;
+        uint32_t seg_data_len = 0;
+        StreamTcpSegmentGetData(stream, seg, &seg_data, &seg_data_len);
+        memcpy(rd->smsg->data + rd->smsg_offset, seg_data + payload_offset,
                 copy_size);
         rd->smsg_offset += copy_size;
         rd->ra_base_seq += copy_size;
@@ -3264,7 +3914,7 @@ static int DoRawReassemble(TcpSession *ssn, TcpStream *stream, TcpSegment *seg,
                 SCLogDebug("copy payload_offset %" PRIu32 ", smsg_offset "
                         "%" PRIu32 ", copy_size %" PRIu32 "",
                         payload_offset, rd->smsg_offset, copy_size);
-                memcpy(rd->smsg->data + rd->smsg_offset, seg->payload +
+                memcpy(rd->smsg->data + rd->smsg_offset, seg_data +
                         payload_offset, copy_size);
                 rd->smsg_offset += copy_size;
                 rd->ra_base_seq += copy_size;
@@ -3618,7 +4268,8 @@ void StreamTcpSegmentDataCopy(TcpSegment *dst_seg, TcpSegment *src_seg)
  */
 TcpSegment* StreamTcpGetSegment(ThreadVars *tv, TcpReassemblyThreadCtx *ra_ctx, uint16_t len)
 {
-    uint16_t idx = segment_pool_idx[len];
+    /* use the pools of our NUMA node */
+    uint32_t idx = SEGMENT_POOL_NODE_IDX(NumaThreadNode(), segment_pool_idx[len]);
     SCLogDebug("segment_pool_idx %" PRIu32 " for payload_len %" PRIu32 "",
                 idx, len);
 
@@ -3687,15 +4338,19 @@ static int UtTestSmsg(StreamMsg *smsg, const uint8_t *buf, uint32_t buf_len)
     if (smsg == NULL)
         return 0;
 
-    if (smsg->data_len != buf_len) {
+    const uint8_t *data = NULL;
+    uint32_t data_len = 0;
+    StreamMsgGetData(smsg, &data, &data_len);
+
+    if (data_len != buf_len) {
         return 0;
     }
 
-    if (!(memcmp(buf, smsg->data, buf_len) == 0)) {
+    if (!(memcmp(buf, data, buf_len) == 0)) {
         printf("data is not what we expected:\nExpected:\n");
         PrintRawDataFp(stdout, (uint8_t *)buf, buf_len);
         printf("Got:\n");
-        PrintRawDataFp(stdout, smsg->data, smsg->data_len);
+        PrintRawDataFp(stdout, (uint8_t *)data, data_len);
         return 0;
     }
     return 1;
@@ -3978,20 +4633,30 @@ int StreamTcpCheckStreamContents(uint8_t *stream_policy, uint16_t sp_size, TcpSt
 #ifdef DEBUG
     if (SCLogDebugEnabled()) {
         TcpSegment *temp1;
-        for (temp1 = stream->seg_list; temp1 != NULL; temp1 = temp1->next)
-            PrintRawDataFp(stdout, temp1->payload, temp1->payload_len);
+        for (temp1 = stream->seg_list; temp1 != NULL; temp1 = temp1->next) {
+            const uint8_t *data = NULL;
+            uint32_t data_len = 0;
+            StreamTcpSegmentGetData(stream, temp1, &data, &data_len);
+            PrintRawDataFp(stdout, data, data_len);
+        }
 
         PrintRawDataFp(stdout, stream_policy, sp_size);
     }
 #endif
 
     for (temp = stream->seg_list; temp != NULL; temp = temp->next) {
+        const uint8_t *data = NULL;
+        uint32_t data_len = 0;
+        StreamTcpSegmentGetData(stream, temp, &data, &data_len);
+        if (data == NULL || data_len != temp->payload_len)
+            return 0;
+
         j = 0;
         for (; j < temp->payload_len; j++) {
             SCLogDebug("i %"PRIu16", len %"PRIu32", stream %"PRIx32" and temp is %"PRIx8"",
-                i, temp->payload_len, stream_policy[i], temp->payload[j]);
+                i, temp->payload_len, stream_policy[i], data[j]);
 
-            if (stream_policy[i] == temp->payload[j]) {
+            if (i < sp_size && stream_policy[i] == data[j]) {
                 i++;
                 continue;
             } else
@@ -8688,6 +9353,307 @@ end:
     return ret;
 }
 
+/** \test segment storage "buffer", new segment starts before the list
+ *        segments, BSD policy: new data wins. */
+static int StreamTcpReassembleBufferedTest01(void)
+{
+    TcpStream stream;
+    uint8_t stream_before_bsd[10] = {0x4a, 0x4a, 0x4a, 0x4a, 0x4c, 0x4c,
+                                      0x4c, 0x4d, 0x4d, 0x4d};
+    memset(&stream, 0, sizeof (TcpStream));
+    stream.os_policy = OS_POLICY_BSD;
+
+    StreamTcpInitConfig(TRUE);
+    stream_config.flags |= STREAMTCP_INIT_FLAG_SEGMENT_BUFFER;
+
+    int result = 0;
+    if (StreamTcpTestStartsBeforeListSegment(&stream) == 0) {
+        printf("failed in segments reassembly!!\n");
+        goto end;
+    }
+    if (stream.sb == NULL || stream.seg_list == NULL ||
+            stream.seg_list->pool_size != 0) {
+        printf("segments not stored in the stream buffer: ");
+        goto end;
+    }
+    if (StreamTcpCheckStreamContents(stream_before_bsd, sizeof(stream_before_bsd), &stream) == 0) {
+        printf("failed in stream matching!!\n");
+        goto end;
+    }
+    result = 1;
+end:
+    StreamTcpReturnStreamSegments(&stream);
+    StreamTcpFreeConfig(TRUE);
+    return result;
+}
+
+/** \test segment storage "buffer", new segment starts before the list
+ *        segments, VISTA policy: old data wins. */
+static int StreamTcpReassembleBufferedTest02(void)
+{
+    TcpStream stream;
+    uint8_t stream_before_vista[10] = {0x4a, 0x41, 0x42, 0x4a, 0x4c, 0x44,
+                                        0x4c, 0x4d, 0x45, 0x45};
+    memset(&stream, 0, sizeof (TcpStream));
+    stream.os_policy = OS_POLICY_VISTA;
+
+    StreamTcpInitConfig(TRUE);
+    stream_config.flags |= STREAMTCP_INIT_FLAG_SEGMENT_BUFFER;
+
+    int result = 0;
+    if (StreamTcpTestStartsBeforeListSegment(&stream) == 0) {
+        printf("failed in segments reassembly!!\n");
+        goto end;
+    }
+    if (StreamTcpCheckStreamContents(stream_before_vista, sizeof(stream_before_vista), &stream) == 0) {
+        printf("failed in stream matching!!\n");
+        goto end;
+    }
+    result = 1;
+end:
+    StreamTcpReturnStreamSegments(&stream);
+    StreamTcpFreeConfig(TRUE);
+    return result;
+}
+
+/** \test segment storage "buffer": removing the list head slides the
+ *        buffer and keeps the other segments' data reachable. */
+static int StreamTcpReassembleBufferedTest03(void)
+{
+    TcpStream stream;
+    uint8_t expected[6] = { 0x4c, 0x4c, 0x4c, 0x4d, 0x4d, 0x4d };
+    memset(&stream, 0, sizeof (TcpStream));
+    stream.os_policy = OS_POLICY_BSD;
+
+    StreamTcpInitConfig(TRUE);
+    stream_config.flags |= STREAMTCP_INIT_FLAG_SEGMENT_BUFFER;
+
+    int result = 0;
+    if (StreamTcpTestStartsBeforeListSegment(&stream) == 0) {
+        printf("failed in segments reassembly!!\n");
+        goto end;
+    }
+
+    /* drop everything up to and including the JJJJ data */
+    while (stream.seg_list != NULL && SEQ_LT(stream.seg_list->seq, 21)) {
+        TcpSegment *seg = stream.seg_list;
+        StreamTcpRemoveSegmentFromStream(&stream, seg);
+        StreamTcpSegmentReturntoPool(seg);
+    }
+    if (stream.sb_base_seq != 18 || stream.sb->stream_offset != 17) {
+        printf("buffer not slid as expected: base %u offset %"PRIu64": ",
+                stream.sb_base_seq, stream.sb->stream_offset);
+        goto end;
+    }
+    if (StreamTcpCheckStreamContents(expected, sizeof(expected), &stream) == 0) {
+        printf("failed in stream matching!!\n");
+        goto end;
+    }
+    result = 1;
+end:
+    StreamTcpReturnStreamSegments(&stream);
+    StreamTcpFreeConfig(TRUE);
+    return result;
+}
+
+/** \test segment storage "buffer": raw reassembly hands out a single smsg
+ *        referencing the segment buffer instead of copying the data. */
+static int StreamTcpReassembleBufferedTest04(void)
+{
+    TcpSession ssn;
+    Flow f;
+    TCPHdr tcph;
+    ThreadVars tv;
+    uint8_t payload[4];
+    int result = 0;
+    Packet *p = PacketGetFromAlloc();
+    if (unlikely(p == NULL))
+        return 0;
+
+    StreamTcpInitConfig(TRUE);
+    stream_config.flags |= STREAMTCP_INIT_FLAG_SEGMENT_BUFFER;
+    TcpReassemblyThreadCtx *ra_ctx = StreamTcpReassembleInitThreadCtx(NULL);
+
+    memset(&ssn, 0, sizeof (TcpSession));
+    memset(&f, 0, sizeof (Flow));
+    memset(&tcph, 0, sizeof (TCPHdr));
+    memset(&tv, 0, sizeof (ThreadVars));
+    FLOW_INITIALIZE(&f);
+    f.protoctx = &ssn;
+    f.proto = IPPROTO_TCP;
+    p->src.family = AF_INET;
+    p->dst.family = AF_INET;
+    p->proto = IPPROTO_TCP;
+    p->flow = &f;
+    tcph.th_win = 5480;
+    tcph.th_flags = TH_PUSH | TH_ACK;
+    p->tcph = &tcph;
+    p->flowflags = FLOW_PKT_TOSERVER;
+
+    ssn.client.isn = 9;
+    STREAMTCP_SET_RA_BASE_SEQ(&ssn.client, 9);
+
+    uint32_t seq;
+    uint8_t byte = 0x41;
+    for (seq = 10; seq < 22; seq += 4, byte++) {
+        StreamTcpCreateTestPacket(payload, byte, 4, 4);
+        p->tcph->th_seq = htonl(seq);
+        p->payload = payload;
+        p->payload_len = 4;
+        if (StreamTcpReassembleHandleSegmentHandleData(&tv, ra_ctx, &ssn,
+                    &ssn.client, p) == -1) {
+            printf("failed to add segment %u: ", seq);
+            goto end;
+        }
+    }
+
+    /* ack all of it and force the raw reassembly */
+    ssn.client.last_ack = 22;
+    ssn.flags |= STREAMTCP_FLAG_TRIGGER_RAW_REASSEMBLY;
+    p->flowflags = FLOW_PKT_TOCLIENT;
+    if (StreamTcpReassembleRaw(ra_ctx, &ssn, &ssn.client, p) < 0) {
+        printf("raw reassembly failed: ");
+        goto end;
+    }
+
+    if (UtSsnSmsgCnt(&ssn, STREAM_TOSERVER) != 1) {
+        printf("expected a single smsg, got %u: ",
+                UtSsnSmsgCnt(&ssn, STREAM_TOSERVER));
+        goto end;
+    }
+    StreamMsg *smsg = ssn.toserver_smsg_head;
+    if (smsg->stream != &ssn.client || smsg->seq != 10) {
+        printf("smsg doesn't reference the stream: ");
+        goto end;
+    }
+    if (UtTestSmsg(smsg, (const uint8_t *)"AAAABBBBCCCC", 12) == 0) {
+        printf("smsg data mismatch: ");
+        goto end;
+    }
+    if (ssn.client.ra_raw_base_seq != 21) {
+        printf("raw progress %u, expected 21: ", ssn.client.ra_raw_base_seq);
+        goto end;
+    }
+    result = 1;
+end:
+    StreamMsgReturnListToPool(ssn.toserver_smsg_head);
+    StreamTcpReturnStreamSegments(&ssn.client);
+    StreamTcpReassembleFreeThreadCtx(ra_ctx);
+    StreamTcpFreeConfig(TRUE);
+    SCFree(p);
+    return result;
+}
+
+/** \test segment storage "buffer": out of order segments are kept sorted
+ *        in the index and data beyond the receiver's window is trimmed or
+ *        dropped instead of growing the buffer over the gap. */
+static int StreamTcpReassembleBufferedTest05(void)
+{
+    TcpSession ssn;
+    Flow f;
+    TCPHdr tcph;
+    ThreadVars tv;
+    uint8_t payload[4];
+    int result = 0;
+    Packet *p = PacketGetFromAlloc();
+    if (unlikely(p == NULL))
+        return 0;
+
+    StreamTcpInitConfig(TRUE);
+    stream_config.flags |= STREAMTCP_INIT_FLAG_SEGMENT_BUFFER;
+    TcpReassemblyThreadCtx *ra_ctx = StreamTcpReassembleInitThreadCtx(NULL);
+
+    memset(&ssn, 0, sizeof (TcpSession));
+    memset(&f, 0, sizeof (Flow));
+    memset(&tcph, 0, sizeof (TCPHdr));
+    memset(&tv, 0, sizeof (ThreadVars));
+    FLOW_INITIALIZE(&f);
+    f.protoctx = &ssn;
+    f.proto = IPPROTO_TCP;
+    p->src.family = AF_INET;
+    p->dst.family = AF_INET;
+    p->proto = IPPROTO_TCP;
+    p->flow = &f;
+    tcph.th_win = 5480;
+    tcph.th_flags = TH_PUSH | TH_ACK;
+    p->tcph = &tcph;
+    p->flowflags = FLOW_PKT_TOSERVER;
+
+    ssn.client.isn = 9;
+    ssn.client.last_ack = 10;
+    STREAMTCP_SET_RA_BASE_SEQ(&ssn.client, 9);
+
+    /* out of order, with a gap at 22-26 */
+    uint32_t seqs[] = { 30, 18, 10, 26, 14 };
+    uint32_t i;
+    for (i = 0; i < sizeof(seqs) / sizeof(seqs[0]); i++) {
+        StreamTcpCreateTestPacket(payload, 0x41 + i, 4, 4);
+        p->tcph->th_seq = htonl(seqs[i]);
+        p->payload = payload;
+        p->payload_len = 4;
+        if (StreamTcpReassembleHandleSegmentHandleData(&tv, ra_ctx, &ssn,
+                    &ssn.client, p) == -1) {
+            printf("failed to add segment %u: ", seqs[i]);
+            goto end;
+        }
+    }
+
+    TcpSegmentIndex *idx = &ssn.client.seg_idx;
+    TcpSegment *seg = ssn.client.seg_list;
+    for (i = 0; i < idx->cnt; i++, seg = seg->next) {
+        if (seg == NULL || idx->segs[idx->head + i] != seg) {
+            printf("index and list differ at %u: ", i);
+            goto end;
+        }
+    }
+    if (idx->cnt != 5 || seg != NULL) {
+        printf("expected 5 indexed segments, got %u: ", idx->cnt);
+        goto end;
+    }
+
+    /* removing from the middle and the head keeps the index in sync */
+    seg = ssn.client.seg_list->next->next;
+    StreamTcpRemoveSegmentFromStream(&ssn.client, seg);
+    StreamTcpSegmentReturntoPool(seg);
+    seg = ssn.client.seg_list;
+    StreamTcpRemoveSegmentFromStream(&ssn.client, seg);
+    StreamTcpSegmentReturntoPool(seg);
+    if (idx->cnt != 3 || idx->segs[idx->head] != ssn.client.seg_list ||
+            idx->segs[idx->head]->seq != 14 ||
+            idx->segs[idx->head + 1]->seq != 26 ||
+            idx->segs[idx->head + 2] != ssn.client.seg_list_tail) {
+        printf("index out of sync after removal: ");
+        goto end;
+    }
+
+    /* far beyond the window of at least 64k from the buffer start: dropped */
+    uint64_t buf_size = ssn.client.sb->buf_size;
+    p->tcph->th_seq = htonl(10 + 200000);
+    if (StreamTcpReassembleHandleSegmentHandleData(&tv, ra_ctx, &ssn,
+                &ssn.client, p) != -1 || idx->cnt != 3 ||
+            ssn.client.sb->buf_size != buf_size ||
+            !(ENGINE_ISSET_EVENT(p, STREAM_REASSEMBLY_SEGMENT_BEYOND_WINDOW))) {
+        printf("data beyond the window not dropped: ");
+        goto end;
+    }
+
+    /* straddling the right edge: only the part in the window is kept */
+    p->tcph->th_seq = htonl(ssn.client.sb_base_seq + SEGMENT_BUFFER_MIN_WINDOW - 2);
+    if (StreamTcpReassembleHandleSegmentHandleData(&tv, ra_ctx, &ssn,
+                &ssn.client, p) == -1 || idx->cnt != 4 ||
+            ssn.client.seg_list_tail->payload_len != 2) {
+        printf("data straddling the window edge not trimmed: ");
+        goto end;
+    }
+    result = 1;
+end:
+    StreamTcpReturnStreamSegments(&ssn.client);
+    StreamTcpReassembleFreeThreadCtx(ra_ctx);
+    StreamTcpFreeConfig(TRUE);
+    SCFree(p);
+    return result;
+}
+
 #endif /* UNITTESTS */
 
 /** \brief  The Function Register the Unit tests to test the reassembly engine
@@ -8817,6 +9783,17 @@ void StreamTcpReassembleRegisterTests(void)
     UtRegisterTest("StreamTcpReassembleInsertTest03 -- insert with overlap",
                    StreamTcpReassembleInsertTest03);
 
+    UtRegisterTest("StreamTcpReassembleBufferedTest01 -- buffer BSD before",
+                   StreamTcpReassembleBufferedTest01);
+    UtRegisterTest("StreamTcpReassembleBufferedTest02 -- buffer VISTA before",
+                   StreamTcpReassembleBufferedTest02);
+    UtRegisterTest("StreamTcpReassembleBufferedTest03 -- buffer slide",
+                   StreamTcpReassembleBufferedTest03);
+    UtRegisterTest("StreamTcpReassembleBufferedTest04 -- buffer raw smsg view",
+                   StreamTcpReassembleBufferedTest04);
+    UtRegisterTest("StreamTcpReassembleBufferedTest05 -- buffer index and window",
+                   StreamTcpReassembleBufferedTest05);
+
     StreamTcpInlineRegisterTests();
     StreamTcpUtilRegisterTests();
 #endif /* UNITTESTS */
@@ -59,6 +59,9 @@ typedef struct TcpReassemblyThreadCtx_ {
     uint16_t counter_tcp_stream_depth;
     /** count number of streams with a unrecoverable stream gap (missing pkts) */
     uint16_t counter_tcp_reass_gap;
+    /** TCP segments (partially) dropped for being beyond the receiver's
+     *  window in segment storage "buffer" */
+    uint16_t counter_tcp_segment_window;
 #ifdef DEBUG
     uint64_t fp1;
     uint64_t fp2;
@@ -35,6 +35,7 @@
 
 #include "flow.h"
 #include "flow-util.h"
+#include "flow-wheel.h"
 
 #include "conf.h"
 #include "conf-yaml-loader.h"
@@ -683,6 +684,10 @@ static void StreamTcpPacketSetState(Packet *p, TcpSession *ssn,
             SC_ATOMIC_SET(p->flow->flow_state, FLOW_STATE_CLOSED);
             break;
     }
+
+    /* the closed timeout is shorter, the flow may need to be checked
+     * for timeout earlier */
+    FlowWheelFlowUpdate(p->flow);
 }
 
 /**
@@ -4930,6 +4935,7 @@ TmEcode StreamTcpThreadInit(ThreadVars *tv, void *initdata, void **data)
     stt->ra_ctx->counter_tcp_segment_memcap = StatsRegisterCounter("tcp.segment_memcap_drop", tv);
     stt->ra_ctx->counter_tcp_stream_depth = StatsRegisterCounter("tcp.stream_depth_reached", tv);
     stt->ra_ctx->counter_tcp_reass_gap = StatsRegisterCounter("tcp.reassembly_gap", tv);
+    stt->ra_ctx->counter_tcp_segment_window = StatsRegisterCounter("tcp.segment_window_drop", tv);
 
     SCLogDebug("StreamTcp thread specific ctx online at %p, reassembly ctx %p",
                 stt, stt->ra_ctx);
@@ -5780,7 +5786,10 @@ int StreamTcpSegmentForEach(const Packet *p, uint8_t flag, StreamSegmentCallback
     for (; seg != NULL &&
             (stream_inline || SEQ_LT(seg->seq, stream->last_ack));)
     {
-        ret = CallbackFunc(p, data, seg->payload, seg->payload_len);
+        const uint8_t *seg_data = NULL;
+        uint32_t seg_data_len = 0;
+        StreamTcpSegmentGetData(stream, seg, &seg_data, &seg_data_len);
+        ret = CallbackFunc(p, data, (uint8_t *)seg_data, seg_data_len);
         if (ret != 1) {
             SCLogDebug("Callback function has failed");
             FLOWLOCK_UNLOCK(p->flow);
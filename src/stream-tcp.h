@@ -38,6 +38,9 @@
 /* Flag to indicate that the checksum validation for the stream engine
    has been enabled */
 #define STREAMTCP_INIT_FLAG_CHECKSUM_VALIDATION    0x01
+/* Flag to indicate that segment payloads are stored in a per stream
+   StreamingBuffer instead of in the segments themselves */
+#define STREAMTCP_INIT_FLAG_SEGMENT_BUFFER         0x02
 
 /*global flow data*/
 typedef struct TcpStreamCnf_ {
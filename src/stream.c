@@ -30,6 +30,7 @@
 #include "util-pool.h"
 #include "util-debug.h"
 #include "stream-tcp.h"
+#include "stream-tcp-private.h"
 #include "flow-util.h"
 
 #ifdef DEBUG
@@ -109,6 +110,7 @@ StreamMsg *StreamMsgGetFromPool(void)
 void StreamMsgReturnToPool(StreamMsg *s)
 {
     SCLogDebug("s %p", s);
+    s->stream = NULL;
     SCMutexLock(&stream_msg_pool_mutex);
     PoolReturn(stream_msg_pool, (void *)s);
     SCMutexUnlock(&stream_msg_pool_mutex);
@@ -133,6 +135,34 @@ void StreamMsgPutInQueue(StreamMsgQueue *q, StreamMsg *s)
     SCLogDebug("q->len %" PRIu32 "", q->len);
 }
 
+/** \brief get the data of a stream msg
+ *
+ *  Msgs that reference the segment buffer of their stream are resolved
+ *  here, at inspection time, as the buffer may have been reallocated
+ *  since the msg was created.
+ *
+ *  \param smsg stream msg
+ *  \param data pointer to the data, NULL if it's no longer available
+ *  \param data_len length of the data
+ */
+void StreamMsgGetData(const StreamMsg *smsg, const uint8_t **data, uint32_t *data_len)
+{
+    if (likely(smsg->stream == NULL)) {
+        *data = smsg->data;
+        *data_len = smsg->data_len;
+        return;
+    }
+
+    /* segments covering the msg are kept until the msg is consumed,
+     * but a session reset may have returned them already */
+    if (StreamingBufferGetDataAtOffset(smsg->stream->sb, data, data_len,
+                smsg->stream_offset) == 0) {
+        return;
+    }
+    if (*data_len > smsg->data_len)
+        *data_len = smsg->data_len;
+}
+
 #define SIZE 4072
 void *StreamMsgPoolAlloc(void)
 {
@@ -42,6 +42,11 @@ typedef struct StreamMsg_ {
     uint32_t data_size;
     uint8_t *data;                  /**< reassembled data: ptr to after this
                                      *   struct */
+
+    /** if set, the data is not copied into 'data' but lives in the
+     *  segment buffer of this stream at 'stream_offset' */
+    const struct TcpStream_ *stream;
+    uint64_t stream_offset;
 } StreamMsg;
 
 typedef struct StreamMsgQueue_ {
@@ -61,6 +66,7 @@ StreamMsg *StreamMsgGetFromPool(void);
 void StreamMsgReturnToPool(StreamMsg *);
 StreamMsg *StreamMsgGetFromQueue(StreamMsgQueue *);
 void StreamMsgPutInQueue(StreamMsgQueue *, StreamMsg *);
+void StreamMsgGetData(const StreamMsg *, const uint8_t **, uint32_t *);
 
 StreamMsgQueue *StreamMsgQueueGetNew(void);
 void StreamMsgQueueFree(StreamMsgQueue *);
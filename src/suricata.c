@@ -48,6 +48,8 @@
 #include "util-atomic.h"
 #include "util-spm.h"
 #include "util-cpu.h"
+#include "util-numa.h"
+#include "util-hugepage.h"
 #include "util-action.h"
 #include "util-pidfile.h"
 #include "util-ioctl.h"
@@ -132,6 +134,7 @@
 #include "flow.h"
 #include "flow-timeout.h"
 #include "flow-manager.h"
+#include "util-logopenfile.h"
 #include "flow-var.h"
 #include "flow-bit.h"
 #include "pkt-var.h"
@@ -819,6 +822,7 @@ void RegisterAllModules()
     /* managers */
     TmModuleFlowManagerRegister();
     TmModuleFlowRecyclerRegister();
+    TmModuleLogFileWriterRegister();
     /* nfq */
     TmModuleReceiveNFQRegister();
     TmModuleVerdictNFQRegister();
@@ -2290,6 +2294,12 @@ static int PostConfLoadedSetup(SCInstance *suri)
 
     /* Load the Host-OS lookup. */
     SCHInfoLoadFromConfig();
+
+    /* before the flow and stream pools are set up */
+    NumaSetup();
+    /* before the flow, host, ippair and defrag hashes are set up */
+    HugepageSetup();
+
     if (suri->run_mode != RUNMODE_UNIX_SOCKET) {
         DefragInit();
     }
@@ -2480,6 +2490,7 @@ int main(int argc, char **argv)
         StreamTcpInitConfig(STREAM_VERBOSE);
         IPPairInitConfig(IPPAIR_VERBOSE);
         AppLayerRegisterGlobalCounters();
+        NumaRegisterCounters();
     }
 
     DetectEngineCtx *de_ctx = NULL;
@@ -2566,6 +2577,7 @@ int main(int argc, char **argv)
         /* Spawn the flow manager thread */
         FlowManagerThreadSpawn();
         FlowRecyclerThreadSpawn();
+        LogFileWriterThreadSpawn();
         StatsSpawnThreads();
     }
 
@@ -47,6 +47,10 @@ typedef struct TmModule_ {
     /** the packet processing function */
     TmEcode (*Func)(ThreadVars *, Packet *, void *, PacketQueue *, PacketQueue *);
 
+    /** optional batch preparation function, called with all packets of a
+     *  batch before Func is called for each of them (e.g. to prefetch) */
+    void (*FuncBatchPrepare)(ThreadVars *, Packet **, uint32_t, void *);
+
     TmEcode (*PktAcqLoop)(ThreadVars *, void *, void *);
 
     /** terminates the capture loop in PktAcqLoop */
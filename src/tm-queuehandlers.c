@@ -51,6 +51,7 @@ void TmqhSetup (void)
 void TmqhCleanup(void)
 {
     TmqhRingBufferDestroy();
+    TmqhFlowCleanup();
 }
 
 Tmqh* TmqhGetQueueHandlerByName(char *name)
@@ -107,6 +107,7 @@ typedef enum {
     TMM_FLOWMANAGER,
     TMM_FLOWRECYCLER,
     TMM_DETECTLOADER,
+    TMM_LOGFILEWRITER,
 
     TMM_UNIXMANAGER,
 
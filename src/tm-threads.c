@@ -34,10 +34,12 @@
 #include "tm-queuehandlers.h"
 #include "tm-threads.h"
 #include "tmqh-packetpool.h"
+#include "tmqh-flow.h"
 #include "threads.h"
 #include "util-debug.h"
 #include "util-privs.h"
 #include "util-cpu.h"
+#include "util-numa.h"
 #include "util-optimize.h"
 #include "util-profiling.h"
 #include "util-signal.h"
@@ -177,6 +179,87 @@ TmEcode TmThreadsSlotVarRun(ThreadVars *tv, Packet *p,
     return TM_ECODE_OK;
 }
 
+/**
+ * \brief Run a batch of packets through the slots.
+ *
+ * Unlike TmThreadsSlotVarRun() each slot function is called for all
+ * packets of the batch before moving to the next slot. Within a slot
+ * the packets are still handled one at a time, e.g. FlowWorker() runs
+ * flow, stream and detect for a packet before taking the next one, as
+ * a packet keeps its flow locked until it's done. Extra packets
+ * created by a slot are run through the remaining slots right away,
+ * like TmThreadsSlotVarRun() does.
+ */
+TmEcode TmThreadsSlotVarRunBatch(ThreadVars *tv, Packet **packets,
+                                 uint32_t cnt, TmSlot *slot)
+{
+    TmEcode r;
+    TmSlot *s;
+    Packet *extra_p;
+    uint32_t i;
+
+    for (s = slot; s != NULL; s = s->slot_next) {
+        TmSlotFunc SlotFunc = SC_ATOMIC_GET(s->SlotFunc);
+        void *slot_data = SC_ATOMIC_GET(s->slot_data);
+
+        if (s->SlotBatchPrepare != NULL) {
+            s->SlotBatchPrepare(tv, packets, cnt, slot_data);
+        }
+
+        for (i = 0; i < cnt; i++) {
+            Packet *p = packets[i];
+            PACKET_PROFILING_TMM_START(p, s->tm_id);
+
+            if (unlikely(s->id == 0)) {
+                r = SlotFunc(tv, p, slot_data, &s->slot_pre_pq, &s->slot_post_pq);
+            } else {
+                r = SlotFunc(tv, p, slot_data, &s->slot_pre_pq, NULL);
+            }
+
+            PACKET_PROFILING_TMM_END(p, s->tm_id);
+
+            /* handle error */
+            if (unlikely(r == TM_ECODE_FAILED)) {
+                /* Encountered error.  Return packets to packetpool and return */
+                TmqhReleasePacketsToPacketPool(&s->slot_pre_pq);
+
+                SCMutexLock(&s->slot_post_pq.mutex_q);
+                TmqhReleasePacketsToPacketPool(&s->slot_post_pq);
+                SCMutexUnlock(&s->slot_post_pq.mutex_q);
+
+                TmThreadsSetFlag(tv, THV_FAILED);
+                return TM_ECODE_FAILED;
+            }
+
+            /* handle new packets */
+            while (s->slot_pre_pq.top != NULL) {
+                extra_p = PacketDequeue(&s->slot_pre_pq);
+                if (unlikely(extra_p == NULL))
+                    continue;
+
+                /* see if we need to process the packet */
+                if (s->slot_next != NULL) {
+                    r = TmThreadsSlotVarRun(tv, extra_p, s->slot_next);
+                    if (unlikely(r == TM_ECODE_FAILED)) {
+                        TmqhReleasePacketsToPacketPool(&s->slot_pre_pq);
+
+                        SCMutexLock(&s->slot_post_pq.mutex_q);
+                        TmqhReleasePacketsToPacketPool(&s->slot_post_pq);
+                        SCMutexUnlock(&s->slot_post_pq.mutex_q);
+
+                        TmqhOutputPacketpool(tv, extra_p);
+                        TmThreadsSetFlag(tv, THV_FAILED);
+                        return TM_ECODE_FAILED;
+                    }
+                }
+                tv->tmqh_out(tv, extra_p);
+            }
+        }
+    }
+
+    return TM_ECODE_OK;
+}
+
 /** \internal
  *
  *  \brief Process flow timeout packets
@@ -846,6 +929,7 @@ static inline TmSlot * _TmSlotSetFuncAppend(ThreadVars *tv, TmModule *tm, void *
     slot->slot_initdata = data;
     SC_ATOMIC_INIT(slot->SlotFunc);
     (void)SC_ATOMIC_SET(slot->SlotFunc, tm->Func);
+    slot->SlotBatchPrepare = tm->FuncBatchPrepare;
     slot->PktAcqLoop = tm->PktAcqLoop;
     slot->Management = tm->Management;
     slot->SlotThreadExitPrintStats = tm->ThreadExitPrintStats;
@@ -1129,6 +1213,9 @@ TmEcode TmThreadSetupOptions(ThreadVars *tv)
     }
 #endif
 
+    /* pools the thread fills from here on are local to its node */
+    NumaThreadSetup();
+
     return TM_ECODE_OK;
 }
 
@@ -1475,7 +1562,7 @@ void TmThreadKillThread(ThreadVars *tv)
         if (!(strlen(tv->inq->name) == strlen("packetpool") &&
               strcasecmp(tv->inq->name, "packetpool") == 0)) {
             PacketQueue *q = &trans_q[tv->inq->id];
-            while (q->len != 0) {
+            while (q->len != 0 || TmqhFlowRingsLen(tv->inq->id) != 0) {
                 usleep(1000);
             }
         }
@@ -1586,7 +1673,7 @@ again:
                 if (!(strlen(tv->inq->name) == strlen("packetpool") &&
                       strcasecmp(tv->inq->name, "packetpool") == 0)) {
                     PacketQueue *q = &trans_q[tv->inq->id];
-                    if (q->len != 0) {
+                    if (q->len != 0 || TmqhFlowRingsLen(tv->inq->id) != 0) {
                         SCMutexUnlock(&tv_root_lock);
                         /* don't sleep while holding a lock */
                         usleep(1000);
@@ -1665,7 +1752,7 @@ again:
             if (!(strlen(tv->inq->name) == strlen("packetpool") &&
                         strcasecmp(tv->inq->name, "packetpool") == 0)) {
                 PacketQueue *q = &trans_q[tv->inq->id];
-                if (q->len != 0) {
+                if (q->len != 0 || TmqhFlowRingsLen(tv->inq->id) != 0) {
                     SCMutexUnlock(&tv_root_lock);
                     /* don't sleep while holding a lock */
                     usleep(1000);
@@ -42,6 +42,9 @@ typedef struct TmSlot_ {
     /* function pointers */
     SC_ATOMIC_DECLARE(TmSlotFunc, SlotFunc);
 
+    /* optional batch preparation, see TmModule::FuncBatchPrepare */
+    void (*SlotBatchPrepare)(ThreadVars *, Packet **, uint32_t, void *);
+
     TmEcode (*PktAcqLoop)(ThreadVars *, void *, void *);
 
     TmEcode (*SlotThreadInit)(ThreadVars *, void *, void **);
@@ -127,6 +130,8 @@ void TmThreadsUnsetFlag(ThreadVars *, uint16_t);
 void TmThreadWaitForFlag(ThreadVars *, uint16_t);
 
 TmEcode TmThreadsSlotVarRun (ThreadVars *tv, Packet *p, TmSlot *slot);
+TmEcode TmThreadsSlotVarRunBatch(ThreadVars *tv, Packet **packets,
+                                 uint32_t cnt, TmSlot *slot);
 
 ThreadVars *TmThreadsGetTVContainingSlot(TmSlot *);
 void TmThreadDisablePacketThreads(void);
@@ -135,6 +140,62 @@ TmSlot *TmThreadGetFirstTmSlotForPartialPattern(const char *);
 
 uint32_t TmThreadCountThreadsByTmmFlags(uint8_t flags);
 
+/**
+ *  \brief Process the packets the slot functions queued in the post pq's
+ *
+ *  \retval r TM_ECODE_OK or TM_ECODE_FAILED
+ */
+static inline TmEcode TmThreadsSlotHandlePostPQs(ThreadVars *tv, TmSlot *s)
+{
+    TmEcode r = TM_ECODE_OK;
+
+    TmSlot *slot = s;
+    while (slot != NULL) {
+        if (slot->slot_post_pq.top != NULL) {
+            while (1) {
+                SCMutexLock(&slot->slot_post_pq.mutex_q);
+                Packet *extra_p = PacketDequeue(&slot->slot_post_pq);
+                SCMutexUnlock(&slot->slot_post_pq.mutex_q);
+
+                if (extra_p == NULL)
+                    break;
+
+                if (slot->slot_next != NULL) {
+                    r = TmThreadsSlotVarRun(tv, extra_p, slot->slot_next);
+                    if (r == TM_ECODE_FAILED) {
+                        SCMutexLock(&slot->slot_post_pq.mutex_q);
+                        TmqhReleasePacketsToPacketPool(&slot->slot_post_pq);
+                        SCMutexUnlock(&slot->slot_post_pq.mutex_q);
+
+                        TmqhOutputPacketpool(tv, extra_p);
+                        TmThreadsSetFlag(tv, THV_FAILED);
+                        break;
+                    }
+                }
+                tv->tmqh_out(tv, extra_p);
+            }
+        } /* if (slot->slot_post_pq.top != NULL) */
+        slot = slot->slot_next;
+    } /* while (slot != NULL) */
+
+    return r;
+}
+
+/**
+ *  \brief release the post pq's after a slot function failed
+ */
+static inline void TmThreadsSlotReleasePostPQs(TmSlot *s)
+{
+    TmSlot *slot = s;
+    while (slot != NULL) {
+        SCMutexLock(&slot->slot_post_pq.mutex_q);
+        TmqhReleasePacketsToPacketPool(&slot->slot_post_pq);
+        SCMutexUnlock(&slot->slot_post_pq.mutex_q);
+
+        slot = slot->slot_next;
+    }
+}
+
 /**
  *  \brief Process the rest of the functions (if any) and queue.
  */
@@ -149,14 +210,7 @@ static inline TmEcode TmThreadsSlotProcessPkt(ThreadVars *tv, TmSlot *s, Packet
 
     if (TmThreadsSlotVarRun(tv, p, s) == TM_ECODE_FAILED) {
         TmqhOutputPacketpool(tv, p);
-        TmSlot *slot = s;
-        while (slot != NULL) {
-            SCMutexLock(&slot->slot_post_pq.mutex_q);
-            TmqhReleasePacketsToPacketPool(&slot->slot_post_pq);
-            SCMutexUnlock(&slot->slot_post_pq.mutex_q);
-
-            slot = slot->slot_next;
-        }
+        TmThreadsSlotReleasePostPQs(s);
         TmThreadsSetFlag(tv, THV_FAILED);
         r = TM_ECODE_FAILED;
 
@@ -164,34 +218,49 @@ static inline TmEcode TmThreadsSlotProcessPkt(ThreadVars *tv, TmSlot *s, Packet
         tv->tmqh_out(tv, p);
 
         /* post process pq */
-        TmSlot *slot = s;
-        while (slot != NULL) {
-            if (slot->slot_post_pq.top != NULL) {
-                while (1) {
-                    SCMutexLock(&slot->slot_post_pq.mutex_q);
-                    Packet *extra_p = PacketDequeue(&slot->slot_post_pq);
-                    SCMutexUnlock(&slot->slot_post_pq.mutex_q);
-
-                    if (extra_p == NULL)
-                        break;
+        r = TmThreadsSlotHandlePostPQs(tv, s);
+    }
 
-                    if (slot->slot_next != NULL) {
-                        r = TmThreadsSlotVarRun(tv, extra_p, slot->slot_next);
-                        if (r == TM_ECODE_FAILED) {
-                            SCMutexLock(&slot->slot_post_pq.mutex_q);
-                            TmqhReleasePacketsToPacketPool(&slot->slot_post_pq);
-                            SCMutexUnlock(&slot->slot_post_pq.mutex_q);
-
-                            TmqhOutputPacketpool(tv, extra_p);
-                            TmThreadsSetFlag(tv, THV_FAILED);
-                            break;
-                        }
-                    }
-                    tv->tmqh_out(tv, extra_p);
-                }
-            } /* if (slot->slot_post_pq.top != NULL) */
-            slot = slot->slot_next;
-        } /* while (slot != NULL) */
+    return r;
+}
+
+/**
+ *  \brief Process a batch of packets through the rest of the functions
+ *         (if any) and queue them.
+ *
+ *  Each slot handles all packets of the batch before the next slot is
+ *  run, so the per slot code and data stay hot in the cache. In the
+ *  workers runmodes that's decode; the FlowWorker slot runs flow, stream
+ *  and detect per packet, it only prefetches the flow lookups of the
+ *  batch (see FlowWorkerBatchPrepare()).
+ *
+ *  \note on failure all packets in the batch are returned to the pool
+ */
+static inline TmEcode TmThreadsSlotProcessPktBatch(ThreadVars *tv, TmSlot *s,
+        Packet **packets, uint32_t cnt)
+{
+    TmEcode r = TM_ECODE_OK;
+    uint32_t i;
+
+    if (s == NULL) {
+        for (i = 0; i < cnt; i++)
+            tv->tmqh_out(tv, packets[i]);
+        return r;
+    }
+
+    if (TmThreadsSlotVarRunBatch(tv, packets, cnt, s) == TM_ECODE_FAILED) {
+        for (i = 0; i < cnt; i++)
+            TmqhOutputPacketpool(tv, packets[i]);
+        TmThreadsSlotReleasePostPQs(s);
+        TmThreadsSetFlag(tv, THV_FAILED);
+        r = TM_ECODE_FAILED;
+
+    } else {
+        for (i = 0; i < cnt; i++)
+            tv->tmqh_out(tv, packets[i]);
+
+        /* post process pq */
+        r = TmThreadsSlotHandlePostPQs(tv, s);
     }
 
     return r;
@@ -38,8 +38,93 @@
 
 #include "conf.h"
 #include "util-unittest.h"
+#include "util-atomic.h"
+#include "util-ringbuffer.h"
+
+#include "flow-private.h"
+
+/** max writers per queue in ring mode, more use the locked queue */
+#define TMQH_FLOW_MAX_RINGS     64
+/** max packets taken from a ring in one go */
+#define TMQH_FLOW_BATCH         32
+/** times the reader polls the empty rings before going to sleep */
+#define TMQH_FLOW_SPIN          2000
+
+#if defined(__i386__) || defined(__x86_64__)
+#define TMQH_FLOW_CPU_RELAX() __asm__ __volatile__("pause" ::: "memory")
+#else
+#define TMQH_FLOW_CPU_RELAX() __asm__ __volatile__("" ::: "memory")
+#endif
+
+/** Ring mode: every writer (capture thread) has its own single reader,
+ *  single writer ring towards the queue, so the packet hand-off needs no
+ *  lock. The reader takes packets in batches, spins for a while when all
+ *  rings are empty and then sleeps on the queue's cond. Writers only
+ *  signal the cond if the reader announced it is sleeping.
+ *
+ *  The PacketQueue itself is still used for packets injected by other
+ *  code, like the pseudo packets of a detect engine reload. */
+typedef struct TmqhFlowRings_ {
+    RingBuffer8 *rings[TMQH_FLOW_MAX_RINGS];
+    SC_ATOMIC_DECLARE(uint16_t, cnt);
+    SC_ATOMIC_DECLARE(int, sleeping);
+
+    /* reader side */
+    uint16_t next;
+    uint16_t batch_idx;
+    uint16_t batch_cnt;
+    Packet *batch[TMQH_FLOW_BATCH];
+} TmqhFlowRings;
+
+/** ring state per queue id, only set up in ring mode */
+static TmqhFlowRings *flow_rings[256];
+static int flow_rings_enabled = 0;
+
+/** length of a load measuring window in usec */
+#define TMQH_FLOW_LOAD_WINDOW   100000
+/** slots in the flow to queue table, power of 2 */
+#define TMQH_FLOW_TABLE_SIZE    65536
+
+/** Load of a queue's reader thread, for the active-packets scheduler. The
+ *  reader measures how long it is idle, waiting for packets. */
+typedef struct TmqhFlowLoad_ {
+    /* reader side */
+    uint64_t window_start;  /**< usec */
+    uint64_t idle;          /**< usec idle in the current window */
+    uint32_t pkts;
+
+    /** permille of the last window the reader was busy. Read by the
+     *  writers without locking, a stale value is fine. */
+    uint32_t busy;
+} TmqhFlowLoad;
+
+static TmqhFlowLoad flow_load[256];
+static int flow_load_enabled = 0;
+
+/** Flow to queue table of the active-packets scheduler, shared by all
+ *  writers. Slots are indexed by flow hash and hold:
+ *  flow hash (32 bits) | queue idx + 1 (16 bits) | last seen sec (16 bits)
+ *  Only new flows (a tcp syn) are placed on the least loaded queue and
+ *  added here; all later packets of the flow follow the entry. Writers
+ *  only update a slot with a CAS, so the three fields always change
+ *  together.
+ *
+ *  Limitations of the 64 bit entry:
+ *  - one flow per slot: with more than TMQH_FLOW_TABLE_SIZE concurrent
+ *    tcp flows, or a slot taken by a live flow, a new flow isn't balanced
+ *    but falls back to the flow hash.
+ *  - the last seen time wraps every 65536 seconds (~18 hours). The
+ *    timeout is capped below that, but an entry not refreshed for a
+ *    multiple of the wrap period can look recent again. Its slot then
+ *    stays taken until the entry expires once more, the new flows in it
+ *    fall back to the flow hash meanwhile.
+ *  Either way a flow is never moved between queues, only placed less
+ *  evenly. */
+static uint64_t *flow_table = NULL;
 
 Packet *TmqhInputFlow(ThreadVars *t);
+Packet *TmqhInputFlowRings(ThreadVars *t);
+void TmqhOutputFlowActivePackets(ThreadVars *t, Packet *p);
 void TmqhOutputFlowHash(ThreadVars *t, Packet *p);
 void TmqhOutputFlowIPPair(ThreadVars *t, Packet *p);
 void *TmqhOutputFlowSetupCtx(char *queue_str);
@@ -60,8 +145,14 @@ void TmqhFlowRegister(void)
             SCLogNotice("using flow hash instead of round robin");
             tmqh_table[TMQH_FLOW].OutHandler = TmqhOutputFlowHash;
         } else if (strcasecmp(scheduler, "active-packets") == 0) {
-            SCLogNotice("using flow hash instead of active packets");
-            tmqh_table[TMQH_FLOW].OutHandler = TmqhOutputFlowHash;
+            flow_table = SCCalloc(TMQH_FLOW_TABLE_SIZE, sizeof(uint64_t));
+            if (flow_table == NULL) {
+                SCLogError(SC_ERR_MEM_ALLOC, "failed to alloc the "
+                           "active-packets flow table");
+                exit(EXIT_FAILURE);
+            }
+            flow_load_enabled = 1;
+            tmqh_table[TMQH_FLOW].OutHandler = TmqhOutputFlowActivePackets;
         } else if (strcasecmp(scheduler, "hash") == 0) {
             tmqh_table[TMQH_FLOW].OutHandler = TmqhOutputFlowHash;
         } else if (strcasecmp(scheduler, "ippair") == 0) {
@@ -76,6 +167,18 @@ void TmqhFlowRegister(void)
         tmqh_table[TMQH_FLOW].OutHandler = TmqhOutputFlowHash;
     }
 
+    char *queue = NULL;
+    if (ConfGet("autofp-queue", &queue) == 1) {
+        if (strcasecmp(queue, "rings") == 0) {
+            flow_rings_enabled = 1;
+            tmqh_table[TMQH_FLOW].InHandler = TmqhInputFlowRings;
+        } else if (strcasecmp(queue, "mutex") != 0) {
+            SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "Invalid entry \"%s\" "
+                       "for autofp-queue in conf.  Killing engine.", queue);
+            exit(EXIT_FAILURE);
+        }
+    }
+
     return;
 }
 
@@ -87,8 +190,57 @@ void TmqhFlowPrintAutofpHandler(void)
 
     PRINT_IF_FUNC(TmqhOutputFlowHash, "Hash");
     PRINT_IF_FUNC(TmqhOutputFlowIPPair, "IPPair");
+    PRINT_IF_FUNC(TmqhOutputFlowActivePackets, "ActivePackets");
 
 #undef PRINT_IF_FUNC
+    if (flow_rings_enabled)
+        SCLogInfo("AutoFP mode using lock-free rings between threads");
+}
+
+static inline uint64_t TmqhFlowLoadNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/** \internal
+ *  \brief close the load window of a queue if it's complete */
+static void TmqhFlowLoadUpdate(TmqhFlowLoad *l, uint64_t now)
+{
+    uint64_t elapsed = now - l->window_start;
+    if (elapsed < TMQH_FLOW_LOAD_WINDOW)
+        return;
+
+    if (l->window_start != 0) {
+        uint64_t idle = MIN(l->idle, elapsed);
+        l->busy = (uint32_t)(1000 - (idle * 1000 / elapsed));
+    }
+    l->window_start = now;
+    l->idle = 0;
+}
+
+/** \internal
+ *  \brief account a packet handed to the reader of queue 'qid' */
+static inline void TmqhFlowLoadPacket(uint16_t qid)
+{
+    if (flow_load_enabled) {
+        TmqhFlowLoad *l = &flow_load[qid];
+        if ((++l->pkts % 1024) == 0)
+            TmqhFlowLoadUpdate(l, TmqhFlowLoadNow());
+    }
+}
+
+/** \internal
+ *  \brief account time the reader of queue 'qid' was idle since 'start' */
+static inline void TmqhFlowLoadIdle(uint16_t qid, uint64_t start)
+{
+    if (flow_load_enabled) {
+        TmqhFlowLoad *l = &flow_load[qid];
+        uint64_t now = TmqhFlowLoadNow();
+        l->idle += now - start;
+        TmqhFlowLoadUpdate(l, now);
+    }
 }
 
 /* same as 'simple' */
@@ -101,12 +253,15 @@ Packet *TmqhInputFlow(ThreadVars *tv)
     SCMutexLock(&q->mutex_q);
     if (q->len == 0) {
         /* if we have no packets in queue, wait... */
+        uint64_t start = flow_load_enabled ? TmqhFlowLoadNow() : 0;
         SCCondWait(&q->cond_q, &q->mutex_q);
+        TmqhFlowLoadIdle(tv->inq->id, start);
     }
 
     if (q->len > 0) {
         Packet *p = PacketDequeue(q);
         SCMutexUnlock(&q->mutex_q);
+        TmqhFlowLoadPacket(tv->inq->id);
         return p;
     } else {
         /* return NULL if we have no pkt. Should only happen on signals. */
@@ -115,6 +270,233 @@ Packet *TmqhInputFlow(ThreadVars *tv)
     }
 }
 
+/** \brief wake up the reader of a queue in ring mode */
+static void TmqhFlowRingsWake(PacketQueue *q)
+{
+    SCMutexLock(&q->mutex_q);
+    SCCondSignal(&q->cond_q);
+    SCMutexUnlock(&q->mutex_q);
+}
+
+/** \internal
+ *  \brief get the next packet from the rings without waiting
+ *
+ *  Takes a batch from the next non-empty ring, so that one busy writer
+ *  can't starve the others.
+ */
+static Packet *TmqhFlowRingsGet(TmqhFlowRings *fr)
+{
+    if (fr->batch_idx < fr->batch_cnt)
+        return fr->batch[fr->batch_idx++];
+
+    uint16_t cnt = SC_ATOMIC_GET(fr->cnt);
+    uint16_t i;
+    for (i = 0; i < cnt; i++) {
+        uint16_t r = fr->next++;
+        if (fr->next >= cnt)
+            fr->next = 0;
+        if (r >= cnt)
+            r = 0;
+
+        uint16_t n = RingBufferSrSw8GetBatch(fr->rings[r],
+                (void **)fr->batch, TMQH_FLOW_BATCH);
+        if (n > 0) {
+            fr->batch_cnt = n;
+            fr->batch_idx = 1;
+            return fr->batch[0];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * \brief number of packets waiting in the rings of a queue
+ *
+ * \param qid id of the queue
+ *
+ * \retval cnt packets, 0 if the queue is not in ring mode
+ */
+uint32_t TmqhFlowRingsLen(uint16_t qid)
+{
+    TmqhFlowRings *fr = flow_rings[qid];
+    if (fr == NULL)
+        return 0;
+
+    uint32_t len = (uint32_t)(fr->batch_cnt - fr->batch_idx);
+    uint16_t cnt = SC_ATOMIC_GET(fr->cnt);
+    uint16_t i;
+    for (i = 0; i < cnt; i++) {
+        len += RingBuffer8Size(fr->rings[i]);
+    }
+    return len;
+}
+
+/** \brief input handler for ring mode. There must only be one reader
+ *         per queue. */
+Packet *TmqhInputFlowRings(ThreadVars *tv)
+{
+    PacketQueue *q = &trans_q[tv->inq->id];
+    TmqhFlowRings *fr = flow_rings[tv->inq->id];
+    Packet *p = NULL;
+
+    StatsSyncCountersIfSignalled(tv);
+
+    if (fr != NULL) {
+        p = TmqhFlowRingsGet(fr);
+        if (p != NULL) {
+            TmqhFlowLoadPacket(tv->inq->id);
+            return p;
+        }
+    }
+
+    /* nothing ready: we're idle from here until we get a packet */
+    uint64_t start = flow_load_enabled ? TmqhFlowLoadNow() : 0;
+
+    if (fr != NULL) {
+        int spin;
+        for (spin = 0; spin < TMQH_FLOW_SPIN; spin++) {
+            p = TmqhFlowRingsGet(fr);
+            if (p != NULL) {
+                TmqhFlowLoadIdle(tv->inq->id, start);
+                TmqhFlowLoadPacket(tv->inq->id);
+                return p;
+            }
+            if (q->len > 0)
+                break;
+            TMQH_FLOW_CPU_RELAX();
+        }
+    }
+
+    SCMutexLock(&q->mutex_q);
+    if (q->len == 0) {
+        if (fr != NULL) {
+            /* announce we're going to sleep, then check the rings once
+             * more: a writer either sees the flag or we see its packet */
+            SC_ATOMIC_SET(fr->sleeping, 1);
+            p = TmqhFlowRingsGet(fr);
+            if (p == NULL) {
+                SCCondWait(&q->cond_q, &q->mutex_q);
+                p = TmqhFlowRingsGet(fr);
+            }
+            SC_ATOMIC_SET(fr->sleeping, 0);
+        } else {
+            SCCondWait(&q->cond_q, &q->mutex_q);
+        }
+    }
+    if (p == NULL && q->len > 0) {
+        p = PacketDequeue(q);
+    }
+    SCMutexUnlock(&q->mutex_q);
+
+    TmqhFlowLoadIdle(tv->inq->id, start);
+    if (p != NULL)
+        TmqhFlowLoadPacket(tv->inq->id);
+
+    /* NULL if we have no pkt. Should only happen on signals. */
+    return p;
+}
+
+/** \internal
+ *  \brief set up the ring of a writer towards queue 'id'
+ *
+ *  \retval 0 ok, or no ring as the queue has too many writers
+ *  \retval -1 error
+ */
+static int TmqhFlowRingsSetup(TmqhFlowMode *m, uint16_t id)
+{
+    TmqhFlowRings *fr = flow_rings[id];
+    if (fr == NULL) {
+        fr = SCMalloc(sizeof(TmqhFlowRings));
+        if (unlikely(fr == NULL))
+            return -1;
+        memset(fr, 0, sizeof(TmqhFlowRings));
+        SC_ATOMIC_INIT(fr->cnt);
+        SC_ATOMIC_INIT(fr->sleeping);
+        flow_rings[id] = fr;
+    }
+
+    uint16_t cnt = SC_ATOMIC_GET(fr->cnt);
+    if (cnt == TMQH_FLOW_MAX_RINGS) {
+        SCLogWarning(SC_ERR_INVALID_VALUE, "queue %u has more than %u writers, "
+                "using locking for the extra ones", id, TMQH_FLOW_MAX_RINGS);
+        return 0;
+    }
+
+    RingBuffer8 *rb = RingBuffer8Init();
+    if (unlikely(rb == NULL))
+        return -1;
+
+    /* publish the ring before the reader can see the new count */
+    fr->rings[cnt] = rb;
+    (void)SC_ATOMIC_ADD(fr->cnt, 1);
+
+    m->ring = rb;
+    m->rings = fr;
+    return 0;
+}
+
+/**
+ * \brief free the rings of all queues. Only to be called when no
+ *        threads use them anymore.
+ */
+static void TmqhFlowRingsFree(void)
+{
+    int id;
+    for (id = 0; id < 256; id++) {
+        TmqhFlowRings *fr = flow_rings[id];
+        if (fr == NULL)
+            continue;
+
+        uint16_t i;
+        for (i = 0; i < SC_ATOMIC_GET(fr->cnt); i++) {
+            RingBuffer8Destroy(fr->rings[i]);
+        }
+        SC_ATOMIC_DESTROY(fr->cnt);
+        SC_ATOMIC_DESTROY(fr->sleeping);
+        SCFree(fr);
+        flow_rings[id] = NULL;
+    }
+}
+
+/**
+ * \brief free the flow queue handler's global state. Only to be called
+ *        when no threads use it anymore.
+ */
+void TmqhFlowCleanup(void)
+{
+    TmqhFlowRingsFree();
+
+    if (flow_table != NULL) {
+        SCFree(flow_table);
+        flow_table = NULL;
+    }
+}
+
+/** \internal
+ *  \brief hand a packet to the selected queue
+ */
+static inline void TmqhFlowEnqueue(TmqhFlowMode *m, Packet *p)
+{
+    PacketQueue *q = m->q;
+
+    if (m->ring == NULL) {
+        SCMutexLock(&q->mutex_q);
+        PacketEnqueue(q, p);
+        SCCondSignal(&q->cond_q);
+        SCMutexUnlock(&q->mutex_q);
+        return;
+    }
+
+    while (RingBufferSrSw8PutNoWait(m->ring, p) != 0) {
+        /* ring full: make sure the reader is awake and wait for it */
+        if (SC_ATOMIC_GET(m->rings->sleeping))
+            TmqhFlowRingsWake(q);
+        usleep(1);
+    }
+    if (SC_ATOMIC_GET(m->rings->sleeping))
+        TmqhFlowRingsWake(q);
+}
+
 static int StoreQueueId(TmqhFlowCtx *ctx, char *name)
 {
     void *ptmp;
@@ -149,6 +531,11 @@ static int StoreQueueId(TmqhFlowCtx *ctx, char *name)
     }
     ctx->queues[ctx->size - 1].q = &trans_q[id];
 
+    if (flow_rings_enabled) {
+        if (TmqhFlowRingsSetup(&ctx->queues[ctx->size - 1], id) < 0)
+            return -1;
+    }
+
     return 0;
 }
 
@@ -236,12 +623,7 @@ void TmqhOutputFlowHash(ThreadVars *tv, Packet *p)
             ctx->last = 0;
     }
 
-    PacketQueue *q = ctx->queues[qid].q;
-    SCMutexLock(&q->mutex_q);
-    PacketEnqueue(q, p);
-    SCCondSignal(&q->cond_q);
-    SCMutexUnlock(&q->mutex_q);
-
+    TmqhFlowEnqueue(&ctx->queues[qid], p);
     return;
 }
 
@@ -271,15 +653,107 @@ void TmqhOutputFlowIPPair(ThreadVars *tv, Packet *p)
      * ctx->size will be lesser than 2 ** 31 for sure */
     qid = addr_hash % ctx->size;
 
-    PacketQueue *q = ctx->queues[qid].q;
-    SCMutexLock(&q->mutex_q);
-    PacketEnqueue(q, p);
-    SCCondSignal(&q->cond_q);
-    SCMutexUnlock(&q->mutex_q);
-
+    TmqhFlowEnqueue(&ctx->queues[qid], p);
     return;
 }
 
+/** \internal
+ *  \brief packets waiting for the reader of a queue */
+static inline uint32_t TmqhFlowQueueDepth(const PacketQueue *q)
+{
+    return q->len + TmqhFlowRingsLen((uint16_t)(q - trans_q));
+}
+
+/** \internal
+ *  \brief pick the least loaded queue: fewest packets waiting, then the
+ *          least busy reader */
+static uint16_t TmqhFlowLeastLoaded(TmqhFlowCtx *ctx)
+{
+    uint64_t best_score = UINT64_MAX;
+    uint16_t best = 0;
+    uint16_t i;
+
+    /* start at a different queue each time, so that ties are spread */
+    uint16_t qid = ctx->last++;
+    if (ctx->last >= ctx->size)
+        ctx->last = 0;
+
+    for (i = 0; i < ctx->size; i++, qid++) {
+        if (qid >= ctx->size)
+            qid = 0;
+
+        const PacketQueue *q = ctx->queues[qid].q;
+        uint64_t score = (uint64_t)TmqhFlowQueueDepth(q) * 1000 +
+                         flow_load[q - trans_q].busy;
+        if (score < best_score) {
+            best_score = score;
+            best = qid;
+        }
+    }
+    return best;
+}
+
+/**
+ * \brief select the queue to output to based on the load of the readers
+ *
+ * A new tcp flow goes to the least loaded queue, which is then recorded
+ * in the flow table. Packets of known flows follow the table, so a flow
+ * stays on one queue and its packets stay in order. Other flows, and
+ * flows that didn't fit in the table, fall back to the flow hash.
+ *
+ * \param tv thread vars.
+ * \param p packet.
+ */
+void TmqhOutputFlowActivePackets(ThreadVars *tv, Packet *p)
+{
+    TmqhFlowCtx *ctx = (TmqhFlowCtx *)tv->outctx;
+    uint16_t qid;
+
+    if (!(p->flags & PKT_WANTS_FLOW)) {
+        qid = ctx->last++;
+        if (ctx->last >= ctx->size)
+            ctx->last = 0;
+        TmqhFlowEnqueue(&ctx->queues[qid], p);
+        return;
+    }
+
+    const uint32_t hash = p->flow_hash;
+    uint64_t *slot = &flow_table[hash & (TMQH_FLOW_TABLE_SIZE - 1)];
+    const uint16_t now = (uint16_t)p->ts.tv_sec;
+    uint64_t entry = *slot;
+
+    if (entry != 0 && (uint32_t)(entry >> 32) == hash) {
+        qid = (uint16_t)((entry >> 16) & 0xffff) - 1;
+        if (likely(qid < ctx->size)) {
+            /* refresh the last seen time, at most once per second. If the
+             * CAS fails another writer refreshed or replaced the entry. */
+            if ((uint16_t)(entry & 0xffff) != now)
+                (void)SCAtomicCompareAndSwap(slot, entry,
+                        (entry & ~(uint64_t)0xffff) | now);
+            TmqhFlowEnqueue(&ctx->queues[qid], p);
+            return;
+        }
+    }
+
+    qid = hash % ctx->size;
+
+    /* a tcp syn starts a new flow: place it on the least loaded queue if
+     * we can record that in the table. An entry is free if it's empty or
+     * hasn't been seen for longer than the tcp flow timeout. */
+    if (PKT_IS_TCP(p) && (p->tcph->th_flags & (TH_SYN|TH_ACK)) == TH_SYN) {
+        uint32_t timeout = MIN(flow_proto[FLOW_PROTO_TCP].est_timeout, 65000);
+        if (entry == 0 || (uint16_t)(now - (uint16_t)(entry & 0xffff)) > timeout) {
+            uint16_t lqid = TmqhFlowLeastLoaded(ctx);
+            uint64_t new_entry = ((uint64_t)hash << 32) |
+                                 ((uint64_t)(lqid + 1) << 16) | now;
+            if (SCAtomicCompareAndSwap(slot, entry, new_entry))
+                qid = lqid;
+        }
+    }
+
+    TmqhFlowEnqueue(&ctx->queues[qid], p);
+}
+
 #ifdef UNITTESTS
 
 static int TmqhOutputFlowSetupCtxTest01(void)
@@ -418,6 +892,176 @@ end:
     return retval;
 }
 
+#define TMQH_FLOW_TEST_PKTS 20000
+
+typedef struct TmqhFlowRingsTestWriter_ {
+    TmqhFlowCtx *ctx;
+    int *marks;
+} TmqhFlowRingsTestWriter;
+
+static void *TmqhFlowRingsTestWriterThread(void *arg)
+{
+    TmqhFlowRingsTestWriter *w = arg;
+    int i;
+    for (i = 0; i < TMQH_FLOW_TEST_PKTS; i++) {
+        /* only the pointer is used in ring mode */
+        TmqhFlowEnqueue(&w->ctx->queues[0], (Packet *)&w->marks[i]);
+    }
+    return NULL;
+}
+
+/**
+ * \test ring mode: two writer threads hand packets to one reader, which
+ *       must get all of them, in order per writer.
+ */
+static int TmqhOutputFlowRingsTest01(void)
+{
+    static int marks[2][TMQH_FLOW_TEST_PKTS];
+    TmqhFlowRingsTestWriter w[2];
+    pthread_t threads[2];
+    ThreadVars tv;
+    int next[2] = { 0, 0 };
+    int started = 0;
+    int retval = 0;
+    int i;
+
+    TmqResetQueues();
+    flow_rings_enabled = 1;
+    memset(&tv, 0, sizeof(tv));
+    memset(&w, 0, sizeof(w));
+
+    for (i = 0; i < 2; i++) {
+        w[i].ctx = TmqhOutputFlowSetupCtx("queue1");
+        w[i].marks = marks[i];
+        if (w[i].ctx == NULL || w[i].ctx->queues[0].ring == NULL)
+            goto end;
+    }
+    tv.inq = TmqGetQueueByName("queue1");
+    if (tv.inq == NULL || TmqhFlowRingsLen(tv.inq->id) != 0)
+        goto end;
+
+    for (i = 0; i < 2; i++) {
+        if (pthread_create(&threads[i], NULL, TmqhFlowRingsTestWriterThread,
+                    &w[i]) != 0)
+            goto end;
+        started++;
+    }
+
+    int got = 0;
+    while (got < 2 * TMQH_FLOW_TEST_PKTS) {
+        Packet *p = TmqhInputFlowRings(&tv);
+        if (p == NULL)
+            continue;
+
+        int *m = (int *)p;
+        int writer = (m >= marks[0] && m < marks[0] + TMQH_FLOW_TEST_PKTS) ? 0 : 1;
+        if (m != &marks[writer][next[writer]]) {
+            printf("writer %d: got packet %d, expected %d: ", writer,
+                    (int)(m - marks[writer]), next[writer]);
+            goto end;
+        }
+        next[writer]++;
+        got++;
+    }
+
+    if (TmqhFlowRingsLen(tv.inq->id) != 0)
+        goto end;
+
+    retval = 1;
+end:
+    for (i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    for (i = 0; i < 2; i++) {
+        if (w[i].ctx != NULL)
+            TmqhOutputFlowFreeCtx(w[i].ctx);
+    }
+    TmqhFlowCleanup();
+    flow_rings_enabled = 0;
+    TmqResetQueues();
+    return retval;
+}
+
+/**
+ * \test active-packets: a new tcp flow goes to the least busy queue and
+ *       the rest of the flow follows it, other flows use the hash.
+ */
+static int TmqhOutputFlowActivePacketsTest01(void)
+{
+    Packet syn, ack, udp;
+    TCPHdr syn_tcph, ack_tcph;
+    ThreadVars tv;
+    TmqhFlowCtx *ctx = NULL;
+    int retval = 0;
+    int i;
+
+    TmqResetQueues();
+    memset(&tv, 0, sizeof(tv));
+    memset(&syn, 0, sizeof(syn));
+    memset(&ack, 0, sizeof(ack));
+    memset(&udp, 0, sizeof(udp));
+    memset(&syn_tcph, 0, sizeof(syn_tcph));
+    memset(&ack_tcph, 0, sizeof(ack_tcph));
+
+    flow_table = SCCalloc(TMQH_FLOW_TABLE_SIZE, sizeof(uint64_t));
+    if (flow_table == NULL)
+        goto end;
+
+    ctx = TmqhOutputFlowSetupCtx("q0,q1,q2");
+    if (ctx == NULL)
+        goto end;
+    tv.outctx = ctx;
+
+    /* q2 is the least busy reader */
+    flow_load[ctx->queues[0].q - trans_q].busy = 900;
+    flow_load[ctx->queues[1].q - trans_q].busy = 500;
+    flow_load[ctx->queues[2].q - trans_q].busy = 100;
+
+    syn_tcph.th_flags = TH_SYN;
+    syn.tcph = &syn_tcph;
+    syn.flags = PKT_WANTS_FLOW;
+    syn.flow_hash = 3; /* hashes to q0 */
+    syn.ts.tv_sec = 1000;
+
+    TmqhOutputFlowActivePackets(&tv, &syn);
+    if (ctx->queues[2].q->len != 1)
+        goto end;
+
+    /* later packets of the flow follow, even though q2 is busy now */
+    flow_load[ctx->queues[2].q - trans_q].busy = 1000;
+    ack_tcph.th_flags = TH_ACK;
+    ack.tcph = &ack_tcph;
+    ack.flags = PKT_WANTS_FLOW;
+    ack.flow_hash = 3;
+    ack.ts.tv_sec = 1001;
+
+    TmqhOutputFlowActivePackets(&tv, &ack);
+    if (ctx->queues[2].q->len != 2)
+        goto end;
+
+    /* not a new tcp flow: hash */
+    udp.flags = PKT_WANTS_FLOW;
+    udp.flow_hash = 4;
+    udp.ts.tv_sec = 1001;
+
+    TmqhOutputFlowActivePackets(&tv, &udp);
+    if (ctx->queues[1].q->len != 1)
+        goto end;
+
+    retval = 1;
+end:
+    for (i = 0; i < 3 && ctx != NULL; i++) {
+        PacketQueue *q = ctx->queues[i].q;
+        while (q->len > 0)
+            (void)PacketDequeue(q);
+    }
+    if (ctx != NULL)
+        TmqhOutputFlowFreeCtx(ctx);
+    memset(flow_load, 0, sizeof(flow_load));
+    TmqhFlowCleanup();
+    TmqResetQueues();
+    return retval;
+}
+
 #endif /* UNITTESTS */
 
 void TmqhFlowRegisterTests(void)
@@ -429,6 +1073,9 @@ void TmqhFlowRegisterTests(void)
                    TmqhOutputFlowSetupCtxTest02);
     UtRegisterTest("TmqhOutputFlowSetupCtxTest03",
                    TmqhOutputFlowSetupCtxTest03);
+    UtRegisterTest("TmqhOutputFlowRingsTest01", TmqhOutputFlowRingsTest01);
+    UtRegisterTest("TmqhOutputFlowActivePacketsTest01",
+                   TmqhOutputFlowActivePacketsTest01);
 #endif
 
     return;
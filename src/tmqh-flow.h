@@ -24,8 +24,15 @@
 #ifndef __TMQH_FLOW_H__
 #define __TMQH_FLOW_H__
 
+struct RingBuffer8_;
+struct TmqhFlowRings_;
+
 typedef struct TmqhFlowMode_ {
     PacketQueue *q;
+    /* in ring mode: our ring towards the queue, NULL if the queue is
+     * used with locking */
+    struct RingBuffer8_ *ring;
+    struct TmqhFlowRings_ *rings;
 } TmqhFlowMode;
 
 /** \brief Ctx for the flow queue handler
@@ -42,5 +49,7 @@ void TmqhFlowRegister (void);
 void TmqhFlowRegisterTests(void);
 
 void TmqhFlowPrintAutofpHandler(void);
+uint32_t TmqhFlowRingsLen(uint16_t qid);
+void TmqhFlowCleanup(void);
 
 #endif /* __TMQH_FLOW_H__ */
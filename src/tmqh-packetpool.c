@@ -139,25 +139,36 @@ void TmqhPacketpoolRegister (void)
 static int PacketPoolIsEmpty(PktPool *pool)
 {
     /* Check local stack first. */
-    if (pool->head || pool->return_stack.head)
+    if (pool->head || SC_ATOMIC_GET(pool->return_stack.head))
         return 0;
 
     return 1;
 }
 
+/** \internal
+ *  \brief sleep until other threads returned packets to our pool
+ *
+ *  Sets sync_now so that the returning threads flush their pending
+ *  packets and signal us. The flag is set before checking the return
+ *  stack again: a thread pushing after that check sees the flag, and
+ *  it can't signal before we wait, as it needs the mutex to do so.
+ */
+static void PacketPoolWaitForReturn(PktPool *pool)
+{
+    SCMutexLock(&pool->return_stack.mutex);
+    SC_ATOMIC_SET(pool->return_stack.sync_now, 1);
+    if (SC_ATOMIC_GET(pool->return_stack.head) == NULL) {
+        SCCondWait(&pool->return_stack.cond, &pool->return_stack.mutex);
+    }
+    SCMutexUnlock(&pool->return_stack.mutex);
+}
+
 void PacketPoolWait(void)
 {
     PktPool *my_pool = GetThreadPacketPool();
 
-    if (PacketPoolIsEmpty(my_pool)) {
-        SCMutexLock(&my_pool->return_stack.mutex);
-        SC_ATOMIC_ADD(my_pool->return_stack.sync_now, 1);
-        SCCondWait(&my_pool->return_stack.cond, &my_pool->return_stack.mutex);
-        SCMutexUnlock(&my_pool->return_stack.mutex);
-    }
-
-    while(PacketPoolIsEmpty(my_pool))
-        cc_barrier();
+    while (PacketPoolIsEmpty(my_pool))
+        PacketPoolWaitForReturn(my_pool);
 }
 
 /** \brief Wait until we have the requested ammount of packets in the pool
@@ -188,25 +199,20 @@ void PacketPoolWaitForN(int n)
             p = p->next;
         }
 
-        /* continue counting in the return stack */
-        if (my_pool->return_stack.head != NULL) {
-            SCMutexLock(&my_pool->return_stack.mutex);
-            p = my_pool->return_stack.head;
+        /* continue counting in the return stack. Other threads only
+         * push onto it and only we take from it, so the list from the
+         * current head on can be walked without locking. */
+        p = SC_ATOMIC_GET(my_pool->return_stack.head);
+        if (p != NULL) {
             while (p != NULL) {
-                if (++i == n) {
-                    SCMutexUnlock(&my_pool->return_stack.mutex);
+                if (++i == n)
                     return;
-                }
                 p = p->next;
             }
-            SCMutexUnlock(&my_pool->return_stack.mutex);
 
         /* or signal that we need packets and wait */
         } else {
-            SCMutexLock(&my_pool->return_stack.mutex);
-            SC_ATOMIC_ADD(my_pool->return_stack.sync_now, 1);
-            SCCondWait(&my_pool->return_stack.cond, &my_pool->return_stack.mutex);
-            SCMutexUnlock(&my_pool->return_stack.mutex);
+            PacketPoolWaitForReturn(my_pool);
         }
     }
 }
@@ -227,11 +233,38 @@ static void PacketPoolStorePacket(Packet *p)
 
 static void PacketPoolGetReturnedPackets(PktPool *pool)
 {
-    SCMutexLock(&pool->return_stack.mutex);
-    /* Move all the packets from the locked return stack to the local stack. */
-    pool->head = pool->return_stack.head;
-    pool->return_stack.head = NULL;
-    SCMutexUnlock(&pool->return_stack.mutex);
+    /* Move all the packets from the return stack to the local stack. We're
+     * the only one taking from it, so the head can't be reused under us. */
+    Packet *head;
+    do {
+        head = SC_ATOMIC_GET(pool->return_stack.head);
+        if (head == NULL)
+            break;
+    } while (SC_ATOMIC_CAS(&pool->return_stack.head, head, NULL) == 0);
+
+    pool->head = head;
+}
+
+/** \internal
+ *  \brief push a list of packets onto the return stack of 'pool'
+ *
+ *  A single CAS splices in the whole list. The owner of the pool is
+ *  only woken up if it's waiting for packets.
+ */
+static void PacketPoolReturnList(PktPool *pool, Packet *head, Packet *tail)
+{
+    Packet *old;
+    do {
+        old = SC_ATOMIC_GET(pool->return_stack.head);
+        tail->next = old;
+    } while (SC_ATOMIC_CAS(&pool->return_stack.head, old, head) == 0);
+
+    if (SC_ATOMIC_GET(pool->return_stack.sync_now)) {
+        SCMutexLock(&pool->return_stack.mutex);
+        SC_ATOMIC_RESET(pool->return_stack.sync_now);
+        SCCondSignal(&pool->return_stack.cond);
+        SCMutexUnlock(&pool->return_stack.mutex);
+    }
 }
 
 /** \brief Get a new packet from the packet pool
@@ -319,12 +352,8 @@ void PacketPoolReturnPacket(Packet *p)
             my_pool->pending_count++;
             if (SC_ATOMIC_GET(pool->return_stack.sync_now) || my_pool->pending_count > max_pending_return_packets) {
                 /* Return the entire list of pending packets. */
-                SCMutexLock(&pool->return_stack.mutex);
-                my_pool->pending_tail->next = pool->return_stack.head;
-                pool->return_stack.head = my_pool->pending_head;
-                SC_ATOMIC_RESET(pool->return_stack.sync_now);
-                SCMutexUnlock(&pool->return_stack.mutex);
-                SCCondSignal(&pool->return_stack.cond);
+                PacketPoolReturnList(pool, my_pool->pending_head,
+                        my_pool->pending_tail);
                 /* Clear the list of pending packets to return. */
                 my_pool->pending_pool = NULL;
                 my_pool->pending_head = NULL;
@@ -333,12 +362,7 @@ void PacketPoolReturnPacket(Packet *p)
             }
         } else {
             /* Push onto return stack for this pool */
-            SCMutexLock(&pool->return_stack.mutex);
-            p->next = pool->return_stack.head;
-            pool->return_stack.head = p;
-            SC_ATOMIC_RESET(pool->return_stack.sync_now);
-            SCMutexUnlock(&pool->return_stack.mutex);
-            SCCondSignal(&pool->return_stack.cond);
+            PacketPoolReturnList(pool, p, p);
         }
     }
 }
@@ -359,6 +383,7 @@ void PacketPoolInitEmpty(void)
 
     SCMutexInit(&my_pool->return_stack.mutex, NULL);
     SCCondInit(&my_pool->return_stack.cond, NULL);
+    SC_ATOMIC_INIT(my_pool->return_stack.head);
     SC_ATOMIC_INIT(my_pool->return_stack.sync_now);
 }
 
@@ -380,6 +405,7 @@ void PacketPoolInit(void)
 
     SCMutexInit(&my_pool->return_stack.mutex, NULL);
     SCCondInit(&my_pool->return_stack.cond, NULL);
+    SC_ATOMIC_INIT(my_pool->return_stack.head);
     SC_ATOMIC_INIT(my_pool->return_stack.sync_now);
 
     /* pre allocate packets */
@@ -428,6 +454,7 @@ void PacketPoolDestroy(void)
         PacketFree(p);
     }
 
+    SC_ATOMIC_DESTROY(my_pool->return_stack.head);
     SC_ATOMIC_DESTROY(my_pool->return_stack.sync_now);
 
 #ifdef DEBUG_VALIDATION
@@ -29,13 +29,16 @@
 #include "util-atomic.h"
 
     /* Return stack, onto which other threads free packets. */
-typedef struct PktPoolLockedStack_{
-    /* linked list of free packets. */
+typedef struct PktPoolReturnStack_{
+    /* linked list of free packets. Other threads push lists onto it
+     * with a CAS, the owner takes the whole list at once. */
+    SC_ATOMIC_DECLARE(Packet *, head);
+    /* set by the owner when it waits for packets. Only then do the
+     * other threads take the mutex and signal the cond. */
+    SC_ATOMIC_DECLARE(int, sync_now);
     SCMutex mutex;
     SCCondT cond;
-    SC_ATOMIC_DECLARE(int, sync_now);
-    Packet *head;
-} __attribute__((aligned(CLS))) PktPoolLockedStack;
+} __attribute__((aligned(CLS))) PktPoolReturnStack;
 
 typedef struct PktPool_ {
     /* link listed of free packets local to this thread.
@@ -64,7 +67,7 @@ typedef struct PktPool_ {
     /* Return stack, where other threads put packets that they free that belong
      * to this thread.
      */
-    PktPoolLockedStack return_stack;
+    PktPoolReturnStack return_stack;
 } PktPool;
 
 Packet *TmqhInputPacketpool(ThreadVars *);
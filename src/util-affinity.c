@@ -186,14 +186,21 @@ static void build_cpuset(char *name, ConfNode *node, cpu_set_t *cpu)
 
 /**
  * \brief Extract cpu affinity configuration from current config file
+ *
+ * Only done once: NumaSetup() may load it before the run mode does.
  */
 
 void AffinitySetupLoadFromConfig()
 {
 #if !defined __CYGWIN__ && !defined OS_WIN32 && !defined __OpenBSD__
+    static int loaded = 0;
     ConfNode *root = ConfGetNode("threading.cpu-affinity");
     ConfNode *affinity;
 
+    if (loaded)
+        return;
+    loaded = 1;
+
     if (thread_affinity_init_done == 0) {
         AffinitySetupInit();
         thread_affinity_init_done = 1;
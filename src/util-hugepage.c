@@ -0,0 +1,454 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Huge page backed memory for the hash tables and their objects.
+ *
+ * Random lookups in the large flow, host, ippair and defrag hashes cause
+ * a lot of TLB misses with 4k pages. If "hugepages.enabled" is set, the
+ * hash tables are mapped from reserved huge pages (MAP_HUGETLB), and the
+ * objects in their spare queues are carved from 2MB huge page chunks by
+ * a simple per NUMA node arena. If no huge pages are reserved, regular
+ * memory is mapped and transparent huge pages are requested for it. If
+ * the option is disabled, the regular allocators are used.
+ */
+
+#include "suricata-common.h"
+#include "conf.h"
+#include "threads.h"
+#include "util-debug.h"
+#include "util-hugepage.h"
+#include "util-misc.h"
+#include "util-numa.h"
+#include "util-unittest.h"
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#define HUGEPAGE_2MB    (2UL * 1024 * 1024)
+#define HUGEPAGE_1GB    (1024UL * 1024 * 1024)
+
+/** size of an arena chunk, chunks are aligned to their size */
+#define HUGEPAGE_ARENA_CHUNK    HUGEPAGE_2MB
+/** room for the chunk header at the start of each chunk */
+#define HUGEPAGE_ARENA_HDR      CLS
+
+static int hugepage_enabled = 0;
+static size_t hugepage_size = HUGEPAGE_2MB;
+
+/** mapped table memory, so HugepageFree knows the mapping length */
+typedef struct HugepageMapping_ {
+    void *ptr;
+    size_t len;
+    struct HugepageMapping_ *next;
+} HugepageMapping;
+
+static HugepageMapping *hugepage_mappings = NULL;
+static SCMutex hugepage_mappings_lock = SCMUTEX_INITIALIZER;
+
+typedef struct HugepageArenaChunk_ {
+    struct HugepageArenaChunk_ *next;
+    uint32_t node;
+} HugepageArenaChunk;
+
+typedef struct HugepageArenaNode_ {
+    SCSpinlock lock;
+    /** free objects, linked through their first word */
+    void *free;
+    /** unused part of the current chunk */
+    char *avail;
+    size_t avail_size;
+    HugepageArenaChunk *chunks;
+} __attribute__((aligned(CLS))) HugepageArenaNode;
+
+struct HugepageArena_ {
+    HugepageArenaNode nodes[NUMA_MAX_NODES];
+    const char *name;
+    size_t obj_size;
+};
+
+/**
+ *  \brief read the "hugepages" config
+ *
+ *  Needs to be called before the hash tables are set up.
+ */
+void HugepageSetup(void)
+{
+    hugepage_enabled = 0;
+    hugepage_size = HUGEPAGE_2MB;
+
+#if defined(HAVE_SYS_MMAN_H) && defined(MAP_ANONYMOUS)
+    int enabled = 0;
+    if (ConfGetBool("hugepages.enabled", &enabled) != 1 || !enabled)
+        return;
+
+    char *str = NULL;
+    if (ConfGet("hugepages.page-size", &str) == 1 && str != NULL) {
+        uint64_t size = 0;
+        if (ParseSizeStringU64(str, &size) < 0 ||
+                (size != HUGEPAGE_2MB && size != HUGEPAGE_1GB)) {
+            SCLogWarning(SC_ERR_INVALID_ARGUMENT, "hugepages.page-size of %s "
+                    "is invalid: valid values are 2mb and 1gb, using 2mb", str);
+        } else {
+            hugepage_size = (size_t)size;
+        }
+    }
+
+    hugepage_enabled = 1;
+    SCLogInfo("using huge pages for the hash tables, page size %"PRIuMAX"kb",
+            (uintmax_t)(hugepage_size / 1024));
+#else
+    SCLogDebug("huge pages not supported on this platform");
+#endif
+}
+
+int HugepageEnabled(void)
+{
+    return hugepage_enabled;
+}
+
+#if defined(HAVE_SYS_MMAN_H) && defined(MAP_ANONYMOUS)
+/**
+ *  \brief map 'len' bytes of reserved huge pages of size 'page'
+ *
+ *  \retval ptr mapping or NULL if no huge pages are available
+ */
+static void *HugepageMapHugetlb(size_t len, size_t page)
+{
+#ifdef MAP_HUGETLB
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB;
+#ifdef MAP_HUGE_SHIFT
+    flags |= (page == HUGEPAGE_1GB ? 30 : 21) << MAP_HUGE_SHIFT;
+#endif
+    void *ptr = mmap(NULL, len, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (ptr != MAP_FAILED)
+        return ptr;
+#endif
+    return NULL;
+}
+
+/**
+ *  \brief map 'len' bytes of regular memory aligned to 'align', and ask
+ *         for transparent huge pages
+ *
+ *  \retval ptr mapping of exactly len bytes or NULL
+ */
+static void *HugepageMapTransparent(size_t len, size_t align)
+{
+    char *ptr = mmap(NULL, len + align, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED)
+        return NULL;
+
+    /* trim the mapping to the aligned part */
+    char *aligned = (char *)(((uintptr_t)ptr + align - 1) & ~((uintptr_t)align - 1));
+    if (aligned != ptr)
+        munmap(ptr, aligned - ptr);
+    if (aligned + len != ptr + len + align)
+        munmap(aligned + len, (ptr + len + align) - (aligned + len));
+
+#ifdef MADV_HUGEPAGE
+    (void)madvise(aligned, len, MADV_HUGEPAGE);
+#endif
+    return aligned;
+}
+
+/** \brief map 'len' bytes, 'len' is a multiple of 'page' */
+static void *HugepageMap(size_t len, size_t page)
+{
+    void *ptr = HugepageMapHugetlb(len, page);
+    if (ptr == NULL)
+        ptr = HugepageMapTransparent(len, page);
+    return ptr;
+}
+#endif
+
+/**
+ *  \brief allocate memory for a hash table
+ *
+ *  Uses huge pages if enabled, regular aligned memory otherwise. The
+ *  memory has to be freed with HugepageFree.
+ *
+ *  \retval ptr memory or NULL
+ */
+void *HugepageAlloc(size_t size)
+{
+#if defined(HAVE_SYS_MMAN_H) && defined(MAP_ANONYMOUS)
+    if (hugepage_enabled && size > 0) {
+        /* 1gb pages only for tables that fill at least one */
+        size_t page = (hugepage_size == HUGEPAGE_1GB && size >= HUGEPAGE_1GB) ?
+            HUGEPAGE_1GB : HUGEPAGE_2MB;
+        size_t len = (size + page - 1) & ~(page - 1);
+
+        void *ptr = HugepageMap(len, page);
+        if (ptr == NULL && page == HUGEPAGE_1GB) {
+            page = HUGEPAGE_2MB;
+            len = (size + page - 1) & ~(page - 1);
+            ptr = HugepageMap(len, page);
+        }
+        if (ptr != NULL) {
+            HugepageMapping *m = SCMalloc(sizeof(*m));
+            if (unlikely(m == NULL)) {
+                munmap(ptr, len);
+                return NULL;
+            }
+            m->ptr = ptr;
+            m->len = len;
+
+            SCMutexLock(&hugepage_mappings_lock);
+            m->next = hugepage_mappings;
+            hugepage_mappings = m;
+            SCMutexUnlock(&hugepage_mappings_lock);
+
+            SCLogDebug("mapped %"PRIuMAX" bytes for a %"PRIuMAX" bytes table",
+                    (uintmax_t)len, (uintmax_t)size);
+            return ptr;
+        }
+        SCLogDebug("mapping %"PRIuMAX" bytes failed, falling back to malloc",
+                (uintmax_t)len);
+    }
+#endif
+    return SCMallocAligned(size, CLS);
+}
+
+/** \brief free memory from HugepageAlloc */
+void HugepageFree(void *ptr)
+{
+    if (ptr == NULL)
+        return;
+
+#if defined(HAVE_SYS_MMAN_H) && defined(MAP_ANONYMOUS)
+    SCMutexLock(&hugepage_mappings_lock);
+    HugepageMapping **pm = &hugepage_mappings;
+    while (*pm != NULL) {
+        HugepageMapping *m = *pm;
+        if (m->ptr == ptr) {
+            *pm = m->next;
+            SCMutexUnlock(&hugepage_mappings_lock);
+
+            munmap(m->ptr, m->len);
+            SCFree(m);
+            return;
+        }
+        pm = &m->next;
+    }
+    SCMutexUnlock(&hugepage_mappings_lock);
+#endif
+    SCFreeAligned(ptr);
+}
+
+/**
+ *  \brief create an arena for objects of 'obj_size' bytes
+ *
+ *  \retval arena the arena, or NULL if huge pages are disabled, in which
+ *                case the caller should use the regular allocator
+ */
+HugepageArena *HugepageArenaCreate(const char *name, size_t obj_size)
+{
+    if (!hugepage_enabled)
+        return NULL;
+
+    /* keep the objects 16 byte aligned */
+    obj_size = (obj_size + 15) & ~((size_t)15);
+    if (obj_size == 0 || obj_size > HUGEPAGE_ARENA_CHUNK - HUGEPAGE_ARENA_HDR)
+        return NULL;
+
+    HugepageArena *arena = SCMallocAligned(sizeof(*arena), CLS);
+    if (unlikely(arena == NULL))
+        return NULL;
+    memset(arena, 0, sizeof(*arena));
+
+    arena->name = name;
+    arena->obj_size = obj_size;
+
+    int n;
+    for (n = 0; n < NUMA_MAX_NODES; n++) {
+        SCSpinInit(&arena->nodes[n].lock, 0);
+    }
+
+    SCLogDebug("arena %s for objects of %"PRIuMAX" bytes", name,
+            (uintmax_t)obj_size);
+    return arena;
+}
+
+/**
+ *  \brief get an object from the arena of the calling thread's node
+ *
+ *  The object's memory is not cleared.
+ *
+ *  \retval ptr object or NULL if no memory could be mapped
+ */
+void *HugepageArenaAlloc(HugepageArena *arena)
+{
+    uint32_t node = NumaThreadNode();
+    if (node >= NUMA_MAX_NODES)
+        node = 0;
+    HugepageArenaNode *an = &arena->nodes[node];
+    void *ptr = NULL;
+
+    SCSpinLock(&an->lock);
+    if (an->free != NULL) {
+        ptr = an->free;
+        an->free = *(void **)ptr;
+    } else {
+#if defined(HAVE_SYS_MMAN_H) && defined(MAP_ANONYMOUS)
+        if (an->avail_size < arena->obj_size) {
+            /* the chunk is first touched here, so on a pinned thread it
+             * ends up in the memory of the thread's node */
+            HugepageArenaChunk *c = HugepageMap(HUGEPAGE_ARENA_CHUNK,
+                    HUGEPAGE_ARENA_CHUNK);
+            if (c == NULL) {
+                SCSpinUnlock(&an->lock);
+                return NULL;
+            }
+            c->node = node;
+            c->next = an->chunks;
+            an->chunks = c;
+            an->avail = (char *)c + HUGEPAGE_ARENA_HDR;
+            an->avail_size = HUGEPAGE_ARENA_CHUNK - HUGEPAGE_ARENA_HDR;
+        }
+        ptr = an->avail;
+        an->avail += arena->obj_size;
+        an->avail_size -= arena->obj_size;
+#endif
+    }
+    SCSpinUnlock(&an->lock);
+    return ptr;
+}
+
+/** \brief return an object to the arena of the node it came from */
+void HugepageArenaFree(HugepageArena *arena, void *ptr)
+{
+    if (ptr == NULL)
+        return;
+
+    HugepageArenaChunk *c = (HugepageArenaChunk *)
+        ((uintptr_t)ptr & ~((uintptr_t)HUGEPAGE_ARENA_CHUNK - 1));
+    BUG_ON(c->node >= NUMA_MAX_NODES);
+    HugepageArenaNode *an = &arena->nodes[c->node];
+
+    SCSpinLock(&an->lock);
+    *(void **)ptr = an->free;
+    an->free = ptr;
+    SCSpinUnlock(&an->lock);
+}
+
+/** \brief unmap all chunks of the arena, all objects need to be freed */
+void HugepageArenaDestroy(HugepageArena *arena)
+{
+    if (arena == NULL)
+        return;
+
+    int n;
+    for (n = 0; n < NUMA_MAX_NODES; n++) {
+        HugepageArenaChunk *c = arena->nodes[n].chunks;
+        while (c != NULL) {
+            HugepageArenaChunk *next = c->next;
+#if defined(HAVE_SYS_MMAN_H) && defined(MAP_ANONYMOUS)
+            munmap(c, HUGEPAGE_ARENA_CHUNK);
+#endif
+            c = next;
+        }
+        SCSpinDestroy(&arena->nodes[n].lock);
+    }
+    SCFreeAligned(arena);
+}
+
+#ifdef UNITTESTS
+static int HugepageTestArena01(void)
+{
+    int result = 0;
+    int saved = hugepage_enabled;
+    void **objs = NULL;
+    /* enough objects to need more than one chunk */
+    const int cnt = 3 * (HUGEPAGE_ARENA_CHUNK / 112);
+    int i;
+
+    hugepage_enabled = 1;
+    HugepageArena *arena = HugepageArenaCreate("test", 100);
+    if (arena == NULL)
+        goto end;
+    if (arena->obj_size != 112)
+        goto end;
+
+    objs = SCCalloc(cnt, sizeof(void *));
+    if (objs == NULL)
+        goto end;
+
+    for (i = 0; i < cnt; i++) {
+        objs[i] = HugepageArenaAlloc(arena);
+        if (objs[i] == NULL)
+            goto end;
+        memset(objs[i], 0xff, 100);
+    }
+    if (objs[1] != (char *)objs[0] + 112)
+        goto end;
+
+    /* freed objects are handed out again, last freed first */
+    HugepageArenaFree(arena, objs[10]);
+    HugepageArenaFree(arena, objs[cnt - 1]);
+    if (HugepageArenaAlloc(arena) != objs[cnt - 1])
+        goto end;
+    if (HugepageArenaAlloc(arena) != objs[10])
+        goto end;
+
+    result = 1;
+end:
+    SCFree(objs);
+    HugepageArenaDestroy(arena);
+    hugepage_enabled = saved;
+    return result;
+}
+
+static int HugepageTestAlloc01(void)
+{
+    int result = 0;
+    int saved = hugepage_enabled;
+
+    hugepage_enabled = 1;
+    uint8_t *ptr = HugepageAlloc(3 * 1024 * 1024);
+    if (ptr == NULL)
+        goto end;
+    if (((uintptr_t)ptr & (CLS - 1)) != 0)
+        goto end;
+    memset(ptr, 0xff, 3 * 1024 * 1024);
+    HugepageFree(ptr);
+
+    /* disabled: plain aligned malloc */
+    hugepage_enabled = 0;
+    ptr = HugepageAlloc(1024);
+    if (ptr == NULL)
+        goto end;
+    HugepageFree(ptr);
+
+    result = 1;
+end:
+    hugepage_enabled = saved;
+    return result;
+}
+#endif /* UNITTESTS */
+
+void HugepageRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("HugepageTestArena01", HugepageTestArena01);
+    UtRegisterTest("HugepageTestAlloc01", HugepageTestAlloc01);
+#endif
+}
@@ -0,0 +1,43 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Huge page backed memory for the hash tables and their objects.
+ */
+
+#ifndef __UTIL_HUGEPAGE_H__
+#define __UTIL_HUGEPAGE_H__
+
+/** arena of fixed size objects, carved from huge page chunks */
+typedef struct HugepageArena_ HugepageArena;
+
+void HugepageSetup(void);
+int HugepageEnabled(void);
+
+void *HugepageAlloc(size_t size);
+void HugepageFree(void *ptr);
+
+HugepageArena *HugepageArenaCreate(const char *name, size_t obj_size);
+void *HugepageArenaAlloc(HugepageArena *arena);
+void HugepageArenaFree(HugepageArena *arena, void *ptr);
+void HugepageArenaDestroy(HugepageArena *arena);
+
+void HugepageRegisterTests(void);
+
+#endif /* __UTIL_HUGEPAGE_H__ */
@@ -26,8 +26,17 @@
 #include "suricata-common.h"
 #include "suricata.h"
 
+#include "conf.h"
+#include "util-debug.h"
+#include "util-hash-lookup3.h"
+#include "util-unittest.h"
+#include "util-hyperscan.h"
+#include "util-misc.h"
+
 #ifdef BUILD_HYPERSCAN
 
+#include <dirent.h>
+
 /**
  * \internal
  * \brief Convert a pattern into a regex string accepted by the Hyperscan
@@ -56,4 +65,612 @@ char *HSRenderPattern(const uint8_t *pat, uint16_t pat_len)
     return str;
 }
 
+/*
+ * Database cache
+ *
+ * Compiled databases are serialised to files in the directory set by the
+ * "hyperscan-cache-dir" option, so that later starts and rule reloads can
+ * skip compiling pattern sets that did not change. The key of a database
+ * is a serialisation of all the compile inputs and the Hyperscan version.
+ * It is stored in full in the file and compared on load, so a hash
+ * collision of the file name can never return the wrong database.
+ *
+ * Loading a database refreshes its mtime. When a store takes the directory
+ * over "hyperscan-cache-max-size", the databases that were used least
+ * recently are removed.
+ */
+
+#define HS_CACHE_MAGIC      "SCHS"
+#define HS_CACHE_VERSION    1
+#define HS_CACHE_SUFFIX     ".hs"
+#define HS_CACHE_DEFAULT_MAX_SIZE   (256 * 1024 * 1024)
+
+typedef struct HSCacheHeader_ {
+    char magic[4];
+    uint32_t version;
+    uint64_t key_len;
+    uint64_t db_len;
+} HSCacheHeader;
+
+/* serialises writes to the cache directory */
+static SCMutex hs_cache_mutex = SCMUTEX_INITIALIZER;
+/* directory created by the last HSCacheDirCreate and its result, so the
+ * directory is only set up once. Protected by hs_cache_mutex. */
+static char hs_cache_dir_checked[PATH_MAX];
+static int hs_cache_dir_ok = 0;
+static uint64_t hs_cache_max_size = 0;
+
+static const char *HSCacheDir(void)
+{
+    char *dir = NULL;
+    if (ConfGet("hyperscan-cache-dir", &dir) != 1 || dir == NULL ||
+        strlen(dir) == 0)
+        return NULL;
+    return dir;
+}
+
+/* max size of the cache directory, looked up once. Called with
+ * hs_cache_mutex held. */
+static uint64_t HSCacheMaxSize(void)
+{
+    if (hs_cache_max_size != 0)
+        return hs_cache_max_size;
+
+    hs_cache_max_size = HS_CACHE_DEFAULT_MAX_SIZE;
+    char *str = NULL;
+    if (ConfGet("hyperscan-cache-max-size", &str) == 1 && str != NULL) {
+        uint64_t size = 0;
+        if (ParseSizeStringU64(str, &size) < 0 || size == 0) {
+            SCLogWarning(SC_ERR_INVALID_YAML_CONF_ENTRY, "invalid "
+                    "hyperscan-cache-max-size %s, using %"PRIu64, str,
+                    hs_cache_max_size);
+        } else {
+            hs_cache_max_size = size;
+        }
+    }
+    return hs_cache_max_size;
+}
+
+/**
+ * \brief Create the cache directory including its parents, like mkdir -p.
+ *        Called with hs_cache_mutex held; only the first call for a
+ *        directory does the work.
+ *
+ * \retval 0 directory exists
+ * \retval -1 directory can't be created, it was logged once
+ */
+static int HSCacheDirCreate(const char *dir)
+{
+    char path[PATH_MAX];
+    char *p;
+
+    if (strcmp(dir, hs_cache_dir_checked) == 0)
+        return hs_cache_dir_ok ? 0 : -1;
+    strlcpy(hs_cache_dir_checked, dir, sizeof(hs_cache_dir_checked));
+    hs_cache_dir_ok = 0;
+
+    if (strlcpy(path, dir, sizeof(path)) >= sizeof(path)) {
+        SCLogWarning(SC_ERR_FOPEN, "Hyperscan cache directory name too "
+                "long, caching disabled");
+        return -1;
+    }
+    for (p = path + 1; ; p++) {
+        if (*p != '/' && *p != '\0')
+            continue;
+        char c = *p;
+        *p = '\0';
+        if (mkdir(path, S_IRWXU|S_IRGRP|S_IXGRP) != 0 && errno != EEXIST) {
+            SCLogWarning(SC_ERR_FOPEN, "failed to create Hyperscan cache "
+                    "directory %s: %s, caching disabled", path, strerror(errno));
+            return -1;
+        }
+        *p = c;
+        if (c == '\0')
+            break;
+    }
+    hs_cache_dir_ok = 1;
+    return 0;
+}
+
+typedef struct HSCacheEntry_ {
+    char name[32];
+    time_t mtime;
+    off_t size;
+} HSCacheEntry;
+
+static int HSCacheEntryCompare(const void *a, const void *b)
+{
+    const HSCacheEntry *ea = a;
+    const HSCacheEntry *eb = b;
+    if (ea->mtime != eb->mtime)
+        return (ea->mtime < eb->mtime) ? -1 : 1;
+    return strcmp(ea->name, eb->name);
+}
+
+/**
+ * \brief Remove the least recently used databases until the cache
+ *        directory is within max_size. Called with hs_cache_mutex held.
+ *
+ * \param keep file name of a database that is never removed, NULL for none
+ *
+ * \retval cnt number of databases removed
+ */
+static uint32_t HSCachePrune(const char *dir, uint64_t max_size,
+        const char *keep)
+{
+    char path[PATH_MAX];
+    struct dirent *de;
+    struct stat st;
+    HSCacheEntry *entries = NULL;
+    uint32_t cnt = 0, size = 0, removed = 0, i;
+    uint64_t total = 0;
+
+    DIR *d = opendir(dir);
+    if (d == NULL)
+        return 0;
+    while ((de = readdir(d)) != NULL) {
+        size_t len = strlen(de->d_name);
+        if (len <= strlen(HS_CACHE_SUFFIX) || len >= sizeof(entries->name) ||
+            strcmp(de->d_name + len - strlen(HS_CACHE_SUFFIX),
+                   HS_CACHE_SUFFIX) != 0)
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+            continue;
+        total += st.st_size;
+        if (keep != NULL && strcmp(de->d_name, keep) == 0)
+            continue;
+
+        if (cnt == size) {
+            uint32_t new_size = (size == 0) ? 64 : size * 2;
+            HSCacheEntry *new_entries = SCRealloc(entries,
+                    new_size * sizeof(HSCacheEntry));
+            if (unlikely(new_entries == NULL))
+                break;
+            entries = new_entries;
+            size = new_size;
+        }
+        strlcpy(entries[cnt].name, de->d_name, sizeof(entries[cnt].name));
+        entries[cnt].mtime = st.st_mtime;
+        entries[cnt].size = st.st_size;
+        cnt++;
+    }
+    closedir(d);
+
+    if (total > max_size && cnt > 0) {
+        qsort(entries, cnt, sizeof(HSCacheEntry), HSCacheEntryCompare);
+        for (i = 0; i < cnt && total > max_size; i++) {
+            snprintf(path, sizeof(path), "%s/%s", dir, entries[i].name);
+            if (unlink(path) == 0) {
+                total -= entries[i].size;
+                removed++;
+            }
+        }
+        SCLogDebug("removed %u cached databases, cache now %"PRIu64" bytes",
+                removed, total);
+    }
+    SCFree(entries);
+    return removed;
+}
+
+static void HSCacheKeyAppend(uint8_t **ptr, const void *data, size_t len)
+{
+    memcpy(*ptr, data, len);
+    *ptr += len;
+}
+
+/**
+ * \brief Serialise the inputs of a Hyperscan compile into a cache key.
+ *
+ * Of the hs_expr_ext_t only the fields used by Suricata (flags, min and
+ * max offset) are part of the key.
+ *
+ * \param ids pattern ids, NULL for all 0
+ * \param ext extended parameters, NULL or NULL entries for none
+ * \param key_len set to the length of the key
+ *
+ * \retval key to be freed with SCFree, or NULL on error
+ */
+uint8_t *HSCacheKey(const char *const *expressions, const unsigned int *flags,
+        const unsigned int *ids, const hs_expr_ext_t *const *ext,
+        unsigned int cnt, unsigned int mode, size_t *key_len)
+{
+    const char *version = hs_version();
+    size_t len = strlen(version) + 1 + 2 * sizeof(uint32_t);
+    unsigned int i;
+
+    for (i = 0; i < cnt; i++) {
+        len += 3 * sizeof(uint32_t) + 3 * sizeof(uint64_t) +
+               strlen(expressions[i]);
+    }
+
+    uint8_t *key = SCMalloc(len);
+    if (unlikely(key == NULL))
+        return NULL;
+
+    uint8_t *ptr = key;
+    HSCacheKeyAppend(&ptr, version, strlen(version) + 1);
+    uint32_t u32 = mode;
+    HSCacheKeyAppend(&ptr, &u32, sizeof(u32));
+    u32 = cnt;
+    HSCacheKeyAppend(&ptr, &u32, sizeof(u32));
+
+    for (i = 0; i < cnt; i++) {
+        uint64_t e[3] = { 0, 0, 0 };
+        if (ext != NULL && ext[i] != NULL) {
+            e[0] = ext[i]->flags;
+            e[1] = ext[i]->min_offset;
+            e[2] = ext[i]->max_offset;
+        }
+        u32 = ids ? ids[i] : 0;
+        HSCacheKeyAppend(&ptr, &u32, sizeof(u32));
+        u32 = flags[i];
+        HSCacheKeyAppend(&ptr, &u32, sizeof(u32));
+        HSCacheKeyAppend(&ptr, e, sizeof(e));
+        u32 = strlen(expressions[i]);
+        HSCacheKeyAppend(&ptr, &u32, sizeof(u32));
+        HSCacheKeyAppend(&ptr, expressions[i], u32);
+    }
+    BUG_ON(ptr != key + len);
+
+    *key_len = len;
+    return key;
+}
+
+static void HSCachePath(const char *dir, const uint8_t *key, size_t key_len,
+        char *path, size_t path_size)
+{
+    uint32_t h1 = 0, h2 = 0;
+    hashlittle2(key, key_len, &h1, &h2);
+    snprintf(path, path_size, "%s/%08x%08x" HS_CACHE_SUFFIX, dir, h1, h2);
+}
+
+static int HSCacheLoadFrom(const char *dir, const uint8_t *key,
+        size_t key_len, hs_database_t **db)
+{
+    char path[PATH_MAX];
+    HSCacheHeader hdr;
+    uint8_t *file_key = NULL;
+    char *bytes = NULL;
+    int ret = -1;
+
+    HSCachePath(dir, key, key_len, path, sizeof(path));
+
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        SCLogDebug("no cached database %s", path);
+        return -1;
+    }
+
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+        memcmp(hdr.magic, HS_CACHE_MAGIC, sizeof(hdr.magic)) != 0 ||
+        hdr.version != HS_CACHE_VERSION || hdr.key_len != key_len ||
+        hdr.db_len == 0 || hdr.db_len > SIZE_MAX)
+        goto end;
+
+    file_key = SCMalloc(key_len);
+    if (unlikely(file_key == NULL))
+        goto end;
+    if (fread(file_key, key_len, 1, fp) != 1 ||
+        memcmp(file_key, key, key_len) != 0) {
+        SCLogDebug("cached database %s has a different key", path);
+        goto end;
+    }
+
+    bytes = SCMalloc(hdr.db_len);
+    if (unlikely(bytes == NULL))
+        goto end;
+    if (fread(bytes, hdr.db_len, 1, fp) != 1)
+        goto end;
+
+    hs_error_t err = hs_deserialize_database(bytes, hdr.db_len, db);
+    if (err != HS_SUCCESS) {
+        SCLogDebug("failed to deserialize %s, returned %d", path, err);
+        goto end;
+    }
+
+    SCLogDebug("loaded cached database %s", path);
+    /* mark it as recently used, see HSCachePrune */
+    (void)utimes(path, NULL);
+    ret = 0;
+end:
+    fclose(fp);
+    if (file_key != NULL)
+        SCFree(file_key);
+    if (bytes != NULL)
+        SCFree(bytes);
+    return ret;
+}
+
+static void HSCacheStoreTo(const char *dir, const uint8_t *key,
+        size_t key_len, const hs_database_t *db)
+{
+    char path[PATH_MAX];
+    char tmp_path[PATH_MAX];
+    char *bytes = NULL;
+    size_t db_len = 0;
+
+    hs_error_t err = hs_serialize_database(db, &bytes, &db_len);
+    if (err != HS_SUCCESS) {
+        SCLogDebug("failed to serialize database, returned %d", err);
+        return;
+    }
+
+    HSCachePath(dir, key, key_len, path, sizeof(path));
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, (int)getpid());
+
+    HSCacheHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, HS_CACHE_MAGIC, sizeof(hdr.magic));
+    hdr.version = HS_CACHE_VERSION;
+    hdr.key_len = key_len;
+    hdr.db_len = db_len;
+
+    SCMutexLock(&hs_cache_mutex);
+    if (HSCacheDirCreate(dir) < 0)
+        goto end;
+
+    FILE *fp = fopen(tmp_path, "wb");
+    if (fp == NULL) {
+        SCLogWarning(SC_ERR_FOPEN, "failed to open %s: %s", tmp_path,
+                strerror(errno));
+        goto end;
+    }
+    int ok = (fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+              fwrite(key, key_len, 1, fp) == 1 &&
+              fwrite(bytes, db_len, 1, fp) == 1);
+    if (fclose(fp) != 0)
+        ok = 0;
+
+    /* rename so that readers never see a partial file */
+    if (!ok || rename(tmp_path, path) != 0) {
+        SCLogWarning(SC_ERR_FWRITE, "failed to write cached Hyperscan "
+                "database %s", path);
+        unlink(tmp_path);
+        goto end;
+    }
+    SCLogDebug("stored database in %s", path);
+
+    const char *name = strrchr(path, '/');
+    (void)HSCachePrune(dir, HSCacheMaxSize(), name != NULL ? name + 1 : NULL);
+end:
+    SCMutexUnlock(&hs_cache_mutex);
+    SCFree(bytes);
+}
+
+/**
+ * \brief Load a compiled database from the cache.
+ *
+ * \param key key as built by HSCacheKey
+ * \param db set to the database on success
+ *
+ * \retval 0 database loaded
+ * \retval -1 cache disabled or no matching database
+ */
+int HSCacheLoad(const uint8_t *key, size_t key_len, hs_database_t **db)
+{
+    const char *dir = HSCacheDir();
+    if (dir == NULL)
+        return -1;
+    return HSCacheLoadFrom(dir, key, key_len, db);
+}
+
+/**
+ * \brief Store a compiled database in the cache, if it is enabled.
+ *        Errors are logged but otherwise ignored.
+ */
+void HSCacheStore(const uint8_t *key, size_t key_len, const hs_database_t *db)
+{
+    const char *dir = HSCacheDir();
+    if (dir == NULL)
+        return;
+    HSCacheStoreTo(dir, key, key_len, db);
+}
+
+#ifdef UNITTESTS
+
+static int HSCacheMatchEvent(unsigned int id, unsigned long long from,
+        unsigned long long to, unsigned int flags, void *ctx)
+{
+    (*(int *)ctx)++;
+    return 0;
+}
+
+/**
+ * \test Store a database and load it back, with the same and with a
+ *       different key.
+ */
+static int HSCacheTest01(void)
+{
+    char dir[] = "/tmp/suricata-hs-cache-XXXXXX";
+    const char *expr[2] = { "\\x61\\x62\\x63", "\\x78\\x79" };
+    unsigned int flags[2] = { HS_FLAG_SINGLEMATCH,
+                              HS_FLAG_SINGLEMATCH|HS_FLAG_CASELESS };
+    unsigned int ids[2] = { 0, 1 };
+    hs_database_t *db = NULL, *cached = NULL;
+    hs_scratch_t *scratch = NULL;
+    hs_compile_error_t *compile_err = NULL;
+    uint8_t *key = NULL, *key2 = NULL;
+    size_t key_len = 0, key2_len = 0;
+    int matches = 0;
+    int result = 0;
+
+    if (mkdtemp(dir) == NULL)
+        return 0;
+
+    if (hs_compile_multi(expr, flags, ids, 2, HS_MODE_BLOCK, NULL, &db,
+                &compile_err) != HS_SUCCESS) {
+        hs_free_compile_error(compile_err);
+        goto end;
+    }
+
+    key = HSCacheKey(expr, flags, ids, NULL, 2, HS_MODE_BLOCK, &key_len);
+    flags[1] &= ~HS_FLAG_CASELESS;
+    key2 = HSCacheKey(expr, flags, ids, NULL, 2, HS_MODE_BLOCK, &key2_len);
+    if (key == NULL || key2 == NULL)
+        goto end;
+
+    if (HSCacheLoadFrom(dir, key, key_len, &cached) != -1)
+        goto end;
+    HSCacheStoreTo(dir, key, key_len, db);
+    if (HSCacheLoadFrom(dir, key2, key2_len, &cached) != -1)
+        goto end;
+    if (HSCacheLoadFrom(dir, key, key_len, &cached) != 0)
+        goto end;
+
+    if (hs_alloc_scratch(cached, &scratch) != HS_SUCCESS)
+        goto end;
+    if (hs_scan(cached, "abcXY", 5, 0, scratch, HSCacheMatchEvent,
+                &matches) != HS_SUCCESS)
+        goto end;
+
+    result = (matches == 2);
+end:
+    if (key != NULL) {
+        char path[PATH_MAX];
+        HSCachePath(dir, key, key_len, path, sizeof(path));
+        unlink(path);
+        SCFree(key);
+    }
+    if (key2 != NULL)
+        SCFree(key2);
+    rmdir(dir);
+    hs_free_scratch(scratch);
+    hs_free_database(cached);
+    hs_free_database(db);
+    return result;
+}
+
+/**
+ * \test The cache directory is created including its parents.
+ */
+static int HSCacheTest02(void)
+{
+    char base[] = "/tmp/suricata-hs-cache-XXXXXX";
+    char dir[PATH_MAX], path[PATH_MAX];
+    const char *expr[1] = { "\\x61\\x62\\x63" };
+    unsigned int flags[1] = { 0 };
+    hs_database_t *db = NULL, *cached = NULL;
+    hs_compile_error_t *compile_err = NULL;
+    size_t key_len = 0;
+    uint8_t *key = NULL;
+    int result = 0;
+
+    if (mkdtemp(base) == NULL)
+        return 0;
+    snprintf(dir, sizeof(dir), "%s/cache/hs", base);
+
+    if (hs_compile_multi(expr, flags, NULL, 1, HS_MODE_BLOCK, NULL, &db,
+                &compile_err) != HS_SUCCESS) {
+        hs_free_compile_error(compile_err);
+        goto end;
+    }
+    key = HSCacheKey(expr, flags, NULL, NULL, 1, HS_MODE_BLOCK, &key_len);
+    if (key == NULL)
+        goto end;
+
+    HSCacheStoreTo(dir, key, key_len, db);
+    result = (HSCacheLoadFrom(dir, key, key_len, &cached) == 0);
+end:
+    if (key != NULL) {
+        HSCachePath(dir, key, key_len, path, sizeof(path));
+        unlink(path);
+        SCFree(key);
+    }
+    rmdir(dir);
+    snprintf(path, sizeof(path), "%s/cache", base);
+    rmdir(path);
+    rmdir(base);
+    hs_free_database(cached);
+    hs_free_database(db);
+    return result;
+}
+
+static int HSCacheTestFile(const char *dir, const char *name, size_t size,
+        time_t mtime)
+{
+    char path[PATH_MAX];
+    char buf[64];
+    struct timeval tv[2];
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL)
+        return -1;
+    memset(buf, 'x', sizeof(buf));
+    int ok = (fwrite(buf, size, 1, fp) == 1);
+    fclose(fp);
+
+    memset(tv, 0, sizeof(tv));
+    tv[0].tv_sec = tv[1].tv_sec = mtime;
+    return (ok && utimes(path, tv) == 0) ? 0 : -1;
+}
+
+/**
+ * \test Pruning removes the least recently used databases first, never
+ *       the one that is kept and only files of the cache.
+ */
+static int HSCacheTest03(void)
+{
+    char dir[] = "/tmp/suricata-hs-cache-XXXXXX";
+    char path[PATH_MAX];
+    const char *names[] = { "0000000000000001.hs", "0000000000000002.hs",
+                            "0000000000000003.hs", "0000000000000004.hs",
+                            "other.txt" };
+    unsigned int i;
+    int result = 0;
+
+    if (mkdtemp(dir) == NULL)
+        return 0;
+
+    /* 1 is the oldest, but is kept. 3 was used last. */
+    if (HSCacheTestFile(dir, names[0], 40, 1000) < 0 ||
+        HSCacheTestFile(dir, names[1], 40, 2000) < 0 ||
+        HSCacheTestFile(dir, names[2], 40, 4000) < 0 ||
+        HSCacheTestFile(dir, names[3], 40, 3000) < 0 ||
+        HSCacheTestFile(dir, names[4], 40, 0) < 0)
+        goto end;
+
+    if (HSCachePrune(dir, 200, names[0]) != 0)
+        goto end;
+    if (HSCachePrune(dir, 100, names[0]) != 2)
+        goto end;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, names[0]);
+    if (access(path, F_OK) != 0)
+        goto end;
+    snprintf(path, sizeof(path), "%s/%s", dir, names[1]);
+    if (access(path, F_OK) == 0)
+        goto end;
+    snprintf(path, sizeof(path), "%s/%s", dir, names[2]);
+    if (access(path, F_OK) != 0)
+        goto end;
+    snprintf(path, sizeof(path), "%s/%s", dir, names[3]);
+    if (access(path, F_OK) == 0)
+        goto end;
+    snprintf(path, sizeof(path), "%s/%s", dir, names[4]);
+    if (access(path, F_OK) != 0)
+        goto end;
+
+    result = 1;
+end:
+    for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+        unlink(path);
+    }
+    rmdir(dir);
+    return result;
+}
+
+#endif /* UNITTESTS */
+
+void HSCacheRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("HSCacheTest01", HSCacheTest01);
+    UtRegisterTest("HSCacheTest02", HSCacheTest02);
+    UtRegisterTest("HSCacheTest03", HSCacheTest03);
+#endif
+}
+
 #endif /* BUILD_HYPERSCAN */
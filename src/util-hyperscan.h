@@ -28,4 +28,18 @@
 
 char *HSRenderPattern(const uint8_t *pat, uint16_t pat_len);
 
+#ifdef BUILD_HYPERSCAN
+
+#include <hs.h>
+
+uint8_t *HSCacheKey(const char *const *expressions, const unsigned int *flags,
+        const unsigned int *ids, const hs_expr_ext_t *const *ext,
+        unsigned int cnt, unsigned int mode, size_t *key_len);
+int HSCacheLoad(const uint8_t *key, size_t key_len, hs_database_t **db);
+void HSCacheStore(const uint8_t *key, size_t key_len, const hs_database_t *db);
+
+void HSCacheRegisterTests(void);
+
+#endif /* BUILD_HYPERSCAN */
+
 #endif /* __UTIL_HYPERSCAN__H__ */
@@ -0,0 +1,483 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Streaming JSON writer: appends keys and values straight into a
+ * MemBuffer, without building an object tree.
+ *
+ * The output matches what jansson produces for the eve records
+ * (JSON_COMPACT|JSON_ENSURE_ASCII|JSON_ESCAPE_SLASH): non-ASCII UTF-8 is
+ * written as \\uXXXX escapes. Like json_string() failing on it, a string
+ * value that is not valid UTF-8 is left out of the record.
+ *
+ * If the buffer can't be expanded the writer stops writing and flags the
+ * error, so the caller can drop the incomplete record.
+ */
+
+#include "suricata-common.h"
+#include "util-debug.h"
+#include "util-buffer.h"
+#include "util-json-writer.h"
+#include "util-unittest.h"
+
+static const char hex[] = "0123456789ABCDEF";
+
+static void JsonWriterAppend(JsonWriter *jw, const char *data, uint32_t data_len)
+{
+    MemBuffer *buffer = *jw->buffer;
+
+    if (jw->error)
+        return;
+
+    /* MemBufferWriteRaw needs room for the terminating 0 */
+    if (data_len >= MEMBUFFER_SIZE(buffer) - MEMBUFFER_OFFSET(buffer)) {
+        uint32_t expand_by = MAX(jw->expand_by, data_len + 1);
+        if (MemBufferExpand(jw->buffer, expand_by) < 0) {
+            SCLogDebug("failed to expand the buffer by %u", expand_by);
+            jw->error = 1;
+            return;
+        }
+        buffer = *jw->buffer;
+    }
+    MemBufferWriteRaw(buffer, data, data_len);
+}
+
+static inline void JsonWriterAppendChar(JsonWriter *jw, char c)
+{
+    JsonWriterAppend(jw, &c, 1);
+}
+
+/** \brief decode one UTF-8 sequence
+ *  \retval len length of the sequence, 0 if it's not valid UTF-8
+ */
+static uint32_t JsonWriterDecodeUtf8(const uint8_t *s, uint32_t len, uint32_t *cp)
+{
+    uint32_t need, c, i;
+
+    if (s[0] >= 0xc2 && s[0] <= 0xdf) {
+        need = 2;
+        c = s[0] & 0x1f;
+    } else if (s[0] >= 0xe0 && s[0] <= 0xef) {
+        need = 3;
+        c = s[0] & 0x0f;
+    } else if (s[0] >= 0xf0 && s[0] <= 0xf4) {
+        need = 4;
+        c = s[0] & 0x07;
+    } else {
+        return 0;
+    }
+    if (need > len)
+        return 0;
+
+    for (i = 1; i < need; i++) {
+        if ((s[i] & 0xc0) != 0x80)
+            return 0;
+        c = (c << 6) | (s[i] & 0x3f);
+    }
+
+    /* overlong forms, surrogates and out of range */
+    if ((need == 3 && c < 0x800) || (need == 4 && c < 0x10000) ||
+            (c >= 0xd800 && c <= 0xdfff) || c > 0x10ffff)
+        return 0;
+
+    *cp = c;
+    return need;
+}
+
+/** \brief check that a string is valid UTF-8, as json_string() does */
+static int JsonWriterIsUtf8(const uint8_t *s, uint32_t len)
+{
+    uint32_t i = 0;
+
+    while (i < len) {
+        if (s[i] < 0x80) {
+            i++;
+            continue;
+        }
+        uint32_t cp;
+        uint32_t n = JsonWriterDecodeUtf8(s + i, len - i, &cp);
+        if (n == 0)
+            return 0;
+        i += n;
+    }
+    return 1;
+}
+
+static void JsonWriterAppendCodepoint(JsonWriter *jw, uint32_t cp)
+{
+    char esc[12];
+
+    if (cp > 0xffff) {
+        cp -= 0x10000;
+        uint32_t hi = 0xd800 | ((cp >> 10) & 0x3ff);
+        uint32_t lo = 0xdc00 | (cp & 0x3ff);
+        esc[0] = '\\'; esc[1] = 'u';
+        esc[2] = hex[(hi >> 12) & 0xf]; esc[3] = hex[(hi >> 8) & 0xf];
+        esc[4] = hex[(hi >> 4) & 0xf];  esc[5] = hex[hi & 0xf];
+        esc[6] = '\\'; esc[7] = 'u';
+        esc[8] = hex[(lo >> 12) & 0xf]; esc[9] = hex[(lo >> 8) & 0xf];
+        esc[10] = hex[(lo >> 4) & 0xf]; esc[11] = hex[lo & 0xf];
+        JsonWriterAppend(jw, esc, 12);
+    } else {
+        esc[0] = '\\'; esc[1] = 'u';
+        esc[2] = hex[(cp >> 12) & 0xf]; esc[3] = hex[(cp >> 8) & 0xf];
+        esc[4] = hex[(cp >> 4) & 0xf];  esc[5] = hex[cp & 0xf];
+        JsonWriterAppend(jw, esc, 6);
+    }
+}
+
+/** \brief append a quoted and escaped string, which needs to be valid
+ *         UTF-8 (see JsonWriterIsUtf8) */
+static void JsonWriterAppendString(JsonWriter *jw, const uint8_t *s, uint32_t len)
+{
+    uint32_t i = 0, start = 0;
+
+    JsonWriterAppendChar(jw, '"');
+    while (i < len) {
+        uint8_t c = s[i];
+
+        /* plain ASCII is copied in runs */
+        if (c >= 0x20 && c < 0x80 && c != '"' && c != '\\' && c != '/') {
+            i++;
+            continue;
+        }
+        if (i > start)
+            JsonWriterAppend(jw, (const char *)s + start, i - start);
+
+        switch (c) {
+            case '"':  JsonWriterAppend(jw, "\\\"", 2); i++; break;
+            case '\\': JsonWriterAppend(jw, "\\\\", 2); i++; break;
+            case '/':  JsonWriterAppend(jw, "\\/", 2); i++; break;
+            case '\b': JsonWriterAppend(jw, "\\b", 2); i++; break;
+            case '\f': JsonWriterAppend(jw, "\\f", 2); i++; break;
+            case '\n': JsonWriterAppend(jw, "\\n", 2); i++; break;
+            case '\r': JsonWriterAppend(jw, "\\r", 2); i++; break;
+            case '\t': JsonWriterAppend(jw, "\\t", 2); i++; break;
+            default:
+                if (c < 0x20) {
+                    JsonWriterAppendCodepoint(jw, c);
+                    i++;
+                } else {
+                    uint32_t cp = 0;
+                    uint32_t n = JsonWriterDecodeUtf8(s + i, len - i, &cp);
+                    BUG_ON(n == 0);
+                    JsonWriterAppendCodepoint(jw, cp);
+                    i += n;
+                }
+                break;
+        }
+        start = i;
+    }
+    if (i > start)
+        JsonWriterAppend(jw, (const char *)s + start, i - start);
+    JsonWriterAppendChar(jw, '"');
+}
+
+/** \brief write the separator and the key (if any) of the next value */
+static void JsonWriterKey(JsonWriter *jw, const char *key)
+{
+    uint32_t bit = 1U << jw->depth;
+
+    if (jw->sep & bit)
+        JsonWriterAppendChar(jw, ',');
+    jw->sep |= bit;
+
+    if (key != NULL) {
+        JsonWriterAppendString(jw, (const uint8_t *)key, strlen(key));
+        JsonWriterAppendChar(jw, ':');
+    }
+}
+
+/** \brief set up a writer that appends to the buffer
+ *
+ *  \param buffer buffer to append to, may be expanded (and moved)
+ *  \param expand_by min size to expand the buffer by
+ */
+void JsonWriterInit(JsonWriter *jw, MemBuffer **buffer, uint32_t expand_by)
+{
+    jw->buffer = buffer;
+    jw->expand_by = expand_by;
+    jw->depth = 0;
+    jw->sep = 0;
+    jw->error = 0;
+}
+
+/** \brief check if the record is incomplete because the buffer couldn't
+ *         be expanded */
+int JsonWriterHasError(const JsonWriter *jw)
+{
+    return jw->error;
+}
+
+/** \brief open an object
+ *  \param key key of the object, NULL at top level or in an array
+ */
+void JsonWriterOpenObject(JsonWriter *jw, const char *key)
+{
+    BUG_ON(jw->depth + 1 >= JSON_WRITER_MAX_DEPTH);
+
+    JsonWriterKey(jw, key);
+    JsonWriterAppendChar(jw, '{');
+    jw->depth++;
+    jw->sep &= ~(1U << jw->depth);
+}
+
+void JsonWriterCloseObject(JsonWriter *jw)
+{
+    BUG_ON(jw->depth == 0);
+
+    jw->depth--;
+    JsonWriterAppendChar(jw, '}');
+}
+
+/** \brief open an array
+ *  \param key key of the array, NULL at top level or in an array
+ */
+void JsonWriterOpenArray(JsonWriter *jw, const char *key)
+{
+    BUG_ON(jw->depth + 1 >= JSON_WRITER_MAX_DEPTH);
+
+    JsonWriterKey(jw, key);
+    JsonWriterAppendChar(jw, '[');
+    jw->depth++;
+    jw->sep &= ~(1U << jw->depth);
+}
+
+void JsonWriterCloseArray(JsonWriter *jw)
+{
+    BUG_ON(jw->depth == 0);
+
+    jw->depth--;
+    JsonWriterAppendChar(jw, ']');
+}
+
+/** \brief write a string value. Like json_string(), a NULL string or one
+ *         that is not valid UTF-8 is not written at all. */
+void JsonWriterString(JsonWriter *jw, const char *key, const char *str)
+{
+    if (str == NULL)
+        return;
+
+    uint32_t len = strlen(str);
+    if (!JsonWriterIsUtf8((const uint8_t *)str, len))
+        return;
+
+    JsonWriterKey(jw, key);
+    JsonWriterAppendString(jw, (const uint8_t *)str, len);
+}
+
+/** \brief write a string value from a buffer that is not 0 terminated.
+ *         Left out if it is not valid UTF-8. */
+void JsonWriterStringLen(JsonWriter *jw, const char *key,
+        const uint8_t *str, uint32_t str_len)
+{
+    if (str == NULL)
+        return;
+    if (!JsonWriterIsUtf8(str, str_len))
+        return;
+
+    JsonWriterKey(jw, key);
+    JsonWriterAppendString(jw, str, str_len);
+}
+
+void JsonWriterUint(JsonWriter *jw, const char *key, uint64_t val)
+{
+    char num[20];
+    uint32_t i = sizeof(num);
+
+    do {
+        num[--i] = '0' + (val % 10);
+        val /= 10;
+    } while (val != 0);
+
+    JsonWriterKey(jw, key);
+    JsonWriterAppend(jw, num + i, sizeof(num) - i);
+}
+
+void JsonWriterInt(JsonWriter *jw, const char *key, int64_t val)
+{
+    if (val >= 0) {
+        JsonWriterUint(jw, key, (uint64_t)val);
+        return;
+    }
+
+    char num[21];
+    uint64_t uval = (uint64_t)0 - (uint64_t)val;
+    uint32_t i = sizeof(num);
+
+    do {
+        num[--i] = '0' + (uval % 10);
+        uval /= 10;
+    } while (uval != 0);
+    num[--i] = '-';
+
+    JsonWriterKey(jw, key);
+    JsonWriterAppend(jw, num + i, sizeof(num) - i);
+}
+
+void JsonWriterBool(JsonWriter *jw, const char *key, int val)
+{
+    JsonWriterKey(jw, key);
+    if (val)
+        JsonWriterAppend(jw, "true", 4);
+    else
+        JsonWriterAppend(jw, "false", 5);
+}
+
+#ifdef HAVE_LIBJANSSON
+static int JsonWriterDumpCallback(const char *str, size_t size, void *data)
+{
+    JsonWriter *jw = (JsonWriter *)data;
+
+    JsonWriterAppend(jw, str, (uint32_t)size);
+    return jw->error ? -1 : 0;
+}
+
+/** \brief write a jansson object or array as value, for the parts of a
+ *         record that are still built as a tree */
+void JsonWriterJson(JsonWriter *jw, const char *key, json_t *js)
+{
+    if (js == NULL)
+        return;
+
+    JsonWriterKey(jw, key);
+    json_dump_callback(js, JsonWriterDumpCallback, jw,
+            JSON_PRESERVE_ORDER|JSON_COMPACT|JSON_ENSURE_ASCII|
+            JSON_ESCAPE_SLASH);
+}
+#endif
+
+#ifdef UNITTESTS
+static int JsonWriterTest01(void)
+{
+    MemBuffer *buffer = MemBufferCreateNew(8);
+    if (buffer == NULL)
+        return 0;
+
+    JsonWriter jw;
+    JsonWriterInit(&jw, &buffer, 8);
+    JsonWriterOpenObject(&jw, NULL);
+    JsonWriterString(&jw, "a", "b");
+    JsonWriterString(&jw, "null", NULL);
+    JsonWriterUint(&jw, "n", 1234567890123ULL);
+    JsonWriterInt(&jw, "neg", -42);
+    JsonWriterOpenObject(&jw, "o");
+    JsonWriterBool(&jw, "t", 1);
+    JsonWriterOpenArray(&jw, "arr");
+    JsonWriterUint(&jw, NULL, 0);
+    JsonWriterUint(&jw, NULL, 1);
+    JsonWriterCloseArray(&jw);
+    JsonWriterCloseObject(&jw);
+    JsonWriterCloseObject(&jw);
+
+    const char *expect = "{\"a\":\"b\",\"n\":1234567890123,\"neg\":-42,"
+        "\"o\":{\"t\":true,\"arr\":[0,1]}}";
+    int result = (MEMBUFFER_OFFSET(buffer) == strlen(expect) &&
+            memcmp(MEMBUFFER_BUFFER(buffer), expect, strlen(expect)) == 0);
+    if (!result)
+        printf("got \"%s\": ", MEMBUFFER_BUFFER(buffer));
+
+    MemBufferFree(buffer);
+    return result;
+}
+
+/** \test escaping follows jansson's ENSURE_ASCII|ESCAPE_SLASH */
+static int JsonWriterTest02(void)
+{
+    MemBuffer *buffer = MemBufferCreateNew(64);
+    if (buffer == NULL)
+        return 0;
+
+    /* quote, slash, control, 2 byte UTF-8, 4 byte UTF-8, NUL */
+    const uint8_t str[] = { 'a', '"', '/', '\n', 0x01, 0xc3, 0xa9,
+                            0xf0, 0x9f, 0x98, 0x80, 0x00 };
+    /* invalid byte, overlong form, truncated sequence */
+    const uint8_t bad1[] = { 'a', 0xff };
+    const uint8_t bad2[] = { 0xe0, 0x80, 0x80 };
+    const uint8_t bad3[] = { 'a', 0xc3 };
+
+    JsonWriter jw;
+    JsonWriterInit(&jw, &buffer, 64);
+    JsonWriterOpenArray(&jw, NULL);
+    JsonWriterStringLen(&jw, NULL, str, sizeof(str));
+    /* not UTF-8: left out, like json_string() failing on it */
+    JsonWriterStringLen(&jw, NULL, bad1, sizeof(bad1));
+    JsonWriterStringLen(&jw, NULL, bad2, sizeof(bad2));
+    JsonWriterStringLen(&jw, NULL, bad3, sizeof(bad3));
+    JsonWriterString(&jw, NULL, "\xff");
+    JsonWriterCloseArray(&jw);
+
+    const char *expect = "[\"a\\\"\\/\\n\\u0001\\u00E9\\uD83D\\uDE00"
+        "\\u0000\"]";
+    int result = (MEMBUFFER_OFFSET(buffer) == strlen(expect) &&
+            memcmp(MEMBUFFER_BUFFER(buffer), expect, strlen(expect)) == 0);
+    if (!result)
+        printf("got \"%s\": ", MEMBUFFER_BUFFER(buffer));
+
+    MemBufferFree(buffer);
+    return result;
+}
+
+/** \test a failed expand flags the writer and stops all writes */
+static int JsonWriterTest03(void)
+{
+    MemBuffer *buffer = MemBufferCreateNew(16);
+    if (buffer == NULL)
+        return 0;
+
+    /* expanding by more than the MemBuffer limit fails */
+    JsonWriter jw;
+    JsonWriterInit(&jw, &buffer, 16 * 1024 * 1024);
+    JsonWriterOpenObject(&jw, NULL);
+    JsonWriterUint(&jw, "a", 1);
+    if (JsonWriterHasError(&jw))
+        goto error;
+
+    JsonWriterString(&jw, "b", "does not fit in the buffer");
+    if (!JsonWriterHasError(&jw))
+        goto error;
+    /* nothing is written after the failure */
+    uint32_t offset = MEMBUFFER_OFFSET(buffer);
+    JsonWriterCloseObject(&jw);
+    if (MEMBUFFER_OFFSET(buffer) != offset ||
+            memcmp(MEMBUFFER_BUFFER(buffer), "{\"a\":1,\"b\":\"", 11) != 0)
+        goto error;
+
+    /* a new record starts out fine */
+    MemBufferReset(buffer);
+    JsonWriterInit(&jw, &buffer, 16);
+    if (JsonWriterHasError(&jw))
+        goto error;
+
+    MemBufferFree(buffer);
+    return 1;
+error:
+    MemBufferFree(buffer);
+    return 0;
+}
+#endif
+
+void JsonWriterRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("JsonWriterTest01", JsonWriterTest01);
+    UtRegisterTest("JsonWriterTest02", JsonWriterTest02);
+    UtRegisterTest("JsonWriterTest03", JsonWriterTest03);
+#endif
+}
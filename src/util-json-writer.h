@@ -0,0 +1,66 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Streaming JSON writer: appends keys and values straight into a
+ * MemBuffer, without building an object tree.
+ */
+
+#ifndef __UTIL_JSON_WRITER_H__
+#define __UTIL_JSON_WRITER_H__
+
+#include "util-buffer.h"
+
+/** max nesting of objects and arrays */
+#define JSON_WRITER_MAX_DEPTH   32
+
+typedef struct JsonWriter_ {
+    MemBuffer **buffer;     /**< buffer to use & expand as needed */
+    uint32_t expand_by;     /**< expand by at least this size */
+    uint32_t depth;
+    /** bit per depth: a value was already written at that level, so the
+     *  next one needs a separator */
+    uint32_t sep;
+    /** the buffer couldn't be expanded: the record is incomplete and
+     *  must not be written */
+    int error;
+} JsonWriter;
+
+void JsonWriterInit(JsonWriter *jw, MemBuffer **buffer, uint32_t expand_by);
+int JsonWriterHasError(const JsonWriter *jw);
+
+void JsonWriterOpenObject(JsonWriter *jw, const char *key);
+void JsonWriterCloseObject(JsonWriter *jw);
+void JsonWriterOpenArray(JsonWriter *jw, const char *key);
+void JsonWriterCloseArray(JsonWriter *jw);
+
+void JsonWriterString(JsonWriter *jw, const char *key, const char *str);
+void JsonWriterStringLen(JsonWriter *jw, const char *key,
+        const uint8_t *str, uint32_t str_len);
+void JsonWriterUint(JsonWriter *jw, const char *key, uint64_t val);
+void JsonWriterInt(JsonWriter *jw, const char *key, int64_t val);
+void JsonWriterBool(JsonWriter *jw, const char *key, int val);
+
+#ifdef HAVE_LIBJANSSON
+void JsonWriterJson(JsonWriter *jw, const char *key, json_t *js);
+#endif
+
+void JsonWriterRegisterTests(void);
+
+#endif /* __UTIL_JSON_WRITER_H__ */
@@ -26,6 +26,8 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
 
 #include "suricata-common.h" /* errno.h, string.h, etc. */
 #include "tm-modules.h"      /* LogFileCtx */
@@ -33,6 +35,14 @@
 #include "output.h"          /* DEFAULT_LOG_* */
 #include "util-logopenfile.h"
 #include "util-logopenfile-tile.h"
+#include "util-atomic.h"
+#include "util-misc.h"          /* ParseSizeStringU32 */
+#include "util-optimize.h"      /* hw_barrier */
+#include "util-signal.h"
+#include "tm-threads.h"
+#include "runmodes.h"           /* thread_name_logfile_writer */
+#include "counters.h"
+#include "util-unittest.h"
 
 const char * redis_push_cmd = "LPUSH";
 const char * redis_publish_cmd = "PUBLISH";
@@ -155,6 +165,516 @@ static int SCLogFileWrite(const char *buffer, int buffer_len, LogFileCtx *log_ct
     return ret;
 }
 
+/* async writer defaults */
+#define LOGFILE_ASYNC_DEFAULT_BUFFER_SIZE       65536
+#define LOGFILE_ASYNC_DEFAULT_FLUSH_INTERVAL    100     /* msec */
+#define LOGFILE_ASYNC_MAX_FLUSH_INTERVAL        60000   /* msec */
+/* a thread's ring holds this many times buffer-size, records that don't
+ * fit are dropped */
+#define LOGFILE_ASYNC_RING_FACTOR               4
+/* number of iovecs handed to a single writev call, a ring adds up to 2 */
+#define LOGFILE_ASYNC_IOV_MAX                   64
+
+#ifdef TLS
+/** per thread index into the per thread log state, shared by all log files */
+static __thread int logfile_thread_id = -1;
+static int logfile_thread_cnt = 0;
+#endif
+
+/** log files that are written out by the log file writer thread */
+static TAILQ_HEAD(, LogFileCtx_) logfile_writer_list =
+    TAILQ_HEAD_INITIALIZER(logfile_writer_list);
+/** protects the list, held by the writer thread during a round */
+static SCMutex logfile_writer_list_m = SCMUTEX_INITIALIZER;
+/** msec between rounds: the smallest interval of the listed files */
+static uint32_t logfile_writer_interval = LOGFILE_ASYNC_MAX_FLUSH_INTERVAL;
+
+static SCCtrlMutex logfile_writer_ctrl_mutex;
+static SCCtrlCondT logfile_writer_ctrl_cond;
+
+/** set while the writer thread runs. If it's not running records are
+ *  written synchronously. */
+SC_ATOMIC_DECLARE(int, logfile_writer_running);
+
+typedef struct LogFileWriterThreadData_ {
+    uint16_t counter_async_dropped;
+} LogFileWriterThreadData;
+
+/** \brief get the calling thread's index into the per thread log state
+ *  \retval id the index, -1 if the thread has to use the shared state
+ */
+static int LogFileThreadId(void)
+{
+#ifdef TLS
+    if (unlikely(logfile_thread_id == -1)) {
+        logfile_thread_id = SCAtomicFetchAndAdd(&logfile_thread_cnt, 1);
+    }
+    if (unlikely(logfile_thread_id >= LOGFILE_MAX_THREADS))
+        return -1;
+    return logfile_thread_id;
+#else
+    return -1;
+#endif
+}
+
+/** \brief have the writer thread write out a log file
+ *  \param interval max time in msec records of the file are held back
+ */
+static void LogFileWriterRegister(LogFileCtx *log_ctx, uint32_t interval)
+{
+    SCMutexLock(&logfile_writer_list_m);
+    if (!log_ctx->writer_registered) {
+        TAILQ_INSERT_TAIL(&logfile_writer_list, log_ctx, writer_next);
+        log_ctx->writer_registered = 1;
+    }
+    if (interval < logfile_writer_interval)
+        logfile_writer_interval = interval;
+    SCMutexUnlock(&logfile_writer_list_m);
+}
+
+/** \brief remove a log file from the writer thread. On return the writer
+ *         doesn't touch the file anymore. */
+static void LogFileWriterDeregister(LogFileCtx *log_ctx)
+{
+    SCMutexLock(&logfile_writer_list_m);
+    if (log_ctx->writer_registered) {
+        TAILQ_REMOVE(&logfile_writer_list, log_ctx, writer_next);
+        log_ctx->writer_registered = 0;
+    }
+    SCMutexUnlock(&logfile_writer_list_m);
+}
+
+/** \brief wake up the writer thread. If it isn't waiting the signal is
+ *         lost, its interval then bounds the delay. */
+static void LogFileWriterWakeup(void)
+{
+    if (SC_ATOMIC_GET(logfile_writer_running))
+        SCCtrlCondSignal(&logfile_writer_ctrl_cond);
+}
+
+/** \brief get (or set up) the record ring of the calling thread
+ *  \retval slot the thread's ring, NULL if the thread has to write
+ *          synchronously
+ */
+static LogFileAsyncSlot *LogFileAsyncGetSlot(LogFileAsync *async)
+{
+    int id = LogFileThreadId();
+    if (unlikely(id < 0))
+        return NULL;
+
+    LogFileAsyncSlot *slot = async->slots[id];
+    if (likely(slot != NULL))
+        return slot;
+
+    slot = SCCalloc(1, sizeof(LogFileAsyncSlot));
+    if (unlikely(slot == NULL))
+        return NULL;
+    slot->buf = SCMalloc(async->ring_size);
+    if (unlikely(slot->buf == NULL)) {
+        SCFree(slot);
+        return NULL;
+    }
+    SC_ATOMIC_INIT(slot->head);
+    SC_ATOMIC_INIT(slot->tail);
+
+    /* only this thread sets its slot, the CAS publishes it to the writer */
+    (void)SCAtomicCompareAndSwap(&async->slots[id], NULL, slot);
+    return slot;
+}
+
+/** \brief append a record to the calling thread's ring
+ *
+ *  Only the owning thread moves head and only the writer moves tail, so
+ *  neither side takes a lock. A record that doesn't fit in the free part
+ *  of the ring is dropped and counted.
+ *
+ *  \retval 0 record buffered or dropped
+ *  \retval -1 record not buffered, caller has to write it
+ */
+static int LogFileAsyncWrite(LogFileAsync *async, const uint8_t *data,
+        size_t data_len)
+{
+    /* never fits, write it synchronously */
+    if (unlikely(data_len > async->ring_size))
+        return -1;
+
+    LogFileAsyncSlot *slot = LogFileAsyncGetSlot(async);
+    if (slot == NULL)
+        return -1;
+
+    uint64_t head = SC_ATOMIC_GET(slot->head);
+    uint64_t tail = SC_ATOMIC_GET(slot->tail);
+    /* don't overwrite data the writer may still be reading */
+    hw_barrier();
+
+    uint32_t used = (uint32_t)(head - tail);
+    if (data_len > async->ring_size - used) {
+        (void)SC_ATOMIC_ADD(async->dropped, 1);
+        return 0;
+    }
+
+    uint32_t off = (uint32_t)(head % async->ring_size);
+    uint32_t first = MIN((uint32_t)data_len, async->ring_size - off);
+    memcpy(slot->buf + off, data, first);
+    if (first < data_len)
+        memcpy(slot->buf, data + first, data_len - first);
+
+    /* publishes the data written above */
+    SC_ATOMIC_SET(slot->head, head + data_len);
+
+    /* size based flush */
+    if (used < async->buffer_size && used + data_len >= async->buffer_size)
+        LogFileWriterWakeup();
+    return 0;
+}
+
+/** \brief write the iovecs to the log file, handling partial writes */
+static void LogFileAsyncWritev(LogFileCtx *log_ctx, struct iovec *iov, int iovcnt)
+{
+    int retried = 0;
+
+    SCMutexLock(&log_ctx->fp_mutex);
+    if (log_ctx->rotation_flag) {
+        log_ctx->rotation_flag = 0;
+        SCConfLogReopen(log_ctx);
+    }
+    if (log_ctx->fp == NULL && log_ctx->is_sock)
+        SCLogUnixSocketReconnect(log_ctx);
+
+    while (log_ctx->fp != NULL && iovcnt > 0) {
+        ssize_t r = writev(fileno(log_ctx->fp), iov, iovcnt);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            /* error on Unix socket, maybe needs reconnect */
+            if (log_ctx->is_sock && !retried && SCLogUnixSocketReconnect(log_ctx)) {
+                retried = 1;
+                continue;
+            }
+            break;
+        }
+
+        /* skip what was written, a partial write resumes mid iovec */
+        while (iovcnt > 0 && (size_t)r >= iov->iov_len) {
+            r -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (uint8_t *)iov->iov_base + r;
+            iov->iov_len -= r;
+        }
+    }
+    SCMutexUnlock(&log_ctx->fp_mutex);
+}
+
+/** \brief write out the records of all threads
+ *
+ *  Must only be called by one thread at a time: the writer thread, or
+ *  the owner of the file once it's no longer registered with the writer.
+ */
+static void LogFileAsyncFlush(LogFileCtx *log_ctx)
+{
+    LogFileAsync *async = log_ctx->async;
+    struct iovec iov[LOGFILE_ASYNC_IOV_MAX];
+    LogFileAsyncSlot *flushed[LOGFILE_ASYNC_IOV_MAX];
+    uint64_t heads[LOGFILE_ASYNC_IOV_MAX];
+    int iovcnt = 0, cnt = 0;
+    int i, j;
+
+    for (i = 0; i < LOGFILE_MAX_THREADS; i++) {
+        LogFileAsyncSlot *slot = async->slots[i];
+        if (slot == NULL)
+            continue;
+
+        uint64_t head = SC_ATOMIC_GET(slot->head);
+        uint64_t tail = SC_ATOMIC_GET(slot->tail);
+        if (head == tail)
+            continue;
+        /* don't read data ahead of the head that published it */
+        hw_barrier();
+
+        uint32_t len = (uint32_t)(head - tail);
+        uint32_t off = (uint32_t)(tail % async->ring_size);
+        uint32_t first = MIN(len, async->ring_size - off);
+        iov[iovcnt].iov_base = slot->buf + off;
+        iov[iovcnt].iov_len = first;
+        iovcnt++;
+        if (first < len) {
+            iov[iovcnt].iov_base = slot->buf;
+            iov[iovcnt].iov_len = len - first;
+            iovcnt++;
+        }
+        flushed[cnt] = slot;
+        heads[cnt] = head;
+        cnt++;
+
+        if (iovcnt > LOGFILE_ASYNC_IOV_MAX - 2) {
+            LogFileAsyncWritev(log_ctx, iov, iovcnt);
+            /* hand the written space back to the threads */
+            for (j = 0; j < cnt; j++)
+                SC_ATOMIC_SET(flushed[j]->tail, heads[j]);
+            iovcnt = cnt = 0;
+        }
+    }
+    if (cnt > 0) {
+        LogFileAsyncWritev(log_ctx, iov, iovcnt);
+        for (j = 0; j < cnt; j++)
+            SC_ATOMIC_SET(flushed[j]->tail, heads[j]);
+    }
+}
+
+static uint32_t LogFileMergeRound(LogFileCtx *log_ctx, int final);
+
+/** \brief one round of the writer thread over all registered files
+ *  \retval dropped records dropped since the last round
+ */
+static uint64_t LogFileWriterRound(void)
+{
+    LogFileCtx *log_ctx;
+    uint64_t dropped = 0;
+
+    SCMutexLock(&logfile_writer_list_m);
+    TAILQ_FOREACH(log_ctx, &logfile_writer_list, writer_next) {
+        LogFileAsync *async = log_ctx->async;
+        if (async != NULL) {
+            LogFileAsyncFlush(log_ctx);
+
+            uint64_t total = SC_ATOMIC_GET(async->dropped);
+            dropped += total - async->dropped_reported;
+            async->dropped_reported = total;
+        }
+        if (log_ctx->threads != NULL)
+            (void)LogFileMergeRound(log_ctx, 0);
+    }
+    SCMutexUnlock(&logfile_writer_list_m);
+    return dropped;
+}
+
+static TmEcode LogFileWriterThreadInit(ThreadVars *t, void *initdata, void **data)
+{
+    LogFileWriterThreadData *td = SCCalloc(1, sizeof(*td));
+    if (td == NULL)
+        return TM_ECODE_FAILED;
+
+    td->counter_async_dropped = StatsRegisterCounter("logfile.async_dropped", t);
+
+    *data = td;
+    return TM_ECODE_OK;
+}
+
+static TmEcode LogFileWriterThreadDeinit(ThreadVars *t, void *data)
+{
+    SCFree(data);
+    return TM_ECODE_OK;
+}
+
+/** \brief called by TmThreadKillThread until the writer is closed */
+static void LogFileWriterShutdownHandler(ThreadVars *tv)
+{
+    SCCtrlCondSignal(&logfile_writer_ctrl_cond);
+}
+
+/** \brief Thread that writes out the async and merged log files
+ *
+ *  \param th_v ThreadVars of the writer
+ *  \param thread_data LogFileWriterThreadData
+ */
+static TmEcode LogFileWriter(ThreadVars *th_v, void *thread_data)
+{
+    LogFileWriterThreadData *td = (LogFileWriterThreadData *)thread_data;
+    struct timeval tv;
+    struct timespec cond_time;
+    uint64_t dropped;
+
+    /* block usr2. usr2 to be handled by the main thread only */
+    UtilSignalBlock(SIGUSR2);
+
+    SC_ATOMIC_SET(logfile_writer_running, 1);
+
+    while (1)
+    {
+        if (TmThreadsCheckFlag(th_v, THV_PAUSE)) {
+            TmThreadsSetFlag(th_v, THV_PAUSED);
+            TmThreadTestThreadUnPaused(th_v);
+            TmThreadsUnsetFlag(th_v, THV_PAUSED);
+        }
+
+        dropped = LogFileWriterRound();
+        if (dropped > 0)
+            StatsAddUI64(th_v, td->counter_async_dropped, dropped);
+
+        if (TmThreadsCheckFlag(th_v, THV_KILL)) {
+            /* from here on records are written synchronously, write out
+             * what was buffered till now */
+            SC_ATOMIC_SET(logfile_writer_running, 0);
+            dropped = LogFileWriterRound();
+            if (dropped > 0)
+                StatsAddUI64(th_v, td->counter_async_dropped, dropped);
+            StatsSyncCounters(th_v);
+            break;
+        }
+
+        gettimeofday(&tv, NULL);
+        uint64_t usec = (uint64_t)tv.tv_usec + (uint64_t)logfile_writer_interval * 1000;
+        cond_time.tv_sec = tv.tv_sec + (usec / 1000000);
+        cond_time.tv_nsec = (usec % 1000000) * 1000;
+        SCCtrlMutexLock(&logfile_writer_ctrl_mutex);
+        SCCtrlCondTimedwait(&logfile_writer_ctrl_cond,
+                &logfile_writer_ctrl_mutex, &cond_time);
+        SCCtrlMutexUnlock(&logfile_writer_ctrl_mutex);
+
+        StatsSyncCountersIfSignalled(th_v);
+    }
+
+    return TM_ECODE_OK;
+}
+
+/** \brief spawn the log file writer thread, if a log file needs it */
+void LogFileWriterThreadSpawn(void)
+{
+#ifdef AFLFUZZ_DISABLE_MGTTHREADS
+    return;
+#endif
+    SCMutexLock(&logfile_writer_list_m);
+    int empty = TAILQ_EMPTY(&logfile_writer_list);
+    SCMutexUnlock(&logfile_writer_list_m);
+    if (empty)
+        return;
+
+    ThreadVars *tv_writer = TmThreadCreateMgmtThreadByName(
+            thread_name_logfile_writer, "LogFileWriter", 0);
+    if (tv_writer == NULL) {
+        SCLogError(SC_ERR_THREAD_CREATE, "failed to create the log file "
+                "writer thread");
+        exit(EXIT_FAILURE);
+    }
+    tv_writer->InShutdownHandler = LogFileWriterShutdownHandler;
+
+    if (TmThreadSpawn(tv_writer) != TM_ECODE_OK) {
+        SCLogError(SC_ERR_THREAD_SPAWN, "failed to spawn the log file "
+                "writer thread");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void TmModuleLogFileWriterRegister (void)
+{
+    tmm_modules[TMM_LOGFILEWRITER].name = "LogFileWriter";
+    tmm_modules[TMM_LOGFILEWRITER].ThreadInit = LogFileWriterThreadInit;
+    tmm_modules[TMM_LOGFILEWRITER].ThreadDeinit = LogFileWriterThreadDeinit;
+    tmm_modules[TMM_LOGFILEWRITER].Management = LogFileWriter;
+    tmm_modules[TMM_LOGFILEWRITER].cap_flags = 0;
+    tmm_modules[TMM_LOGFILEWRITER].flags = TM_FLAG_MANAGEMENT_TM;
+    SCLogDebug("%s registered", tmm_modules[TMM_LOGFILEWRITER].name);
+
+    SC_ATOMIC_INIT(logfile_writer_running);
+    SCCtrlMutexInit(&logfile_writer_ctrl_mutex, NULL);
+    SCCtrlCondInit(&logfile_writer_ctrl_cond, NULL);
+}
+
+/** \brief set up async writing if enabled in the output's config
+ *  \retval 0 on success, also if async is not enabled
+ *  \retval -1 on error
+ */
+static int LogFileAsyncSetup(ConfNode *conf, LogFileCtx *log_ctx)
+{
+    ConfNode *async_node = ConfNodeLookupChild(conf, "async");
+    if (async_node == NULL)
+        return 0;
+
+    int enabled = 0;
+    if (!ConfGetChildValueBool(async_node, "enabled", &enabled) || !enabled)
+        return 0;
+
+#ifndef TLS
+    SCLogWarning(SC_ERR_INVALID_YAML_CONF_ENTRY, "%s.async needs thread "
+            "local storage support, writing synchronously", conf->name);
+    return 0;
+#endif
+    if (log_ctx->flags & LOGFILE_WRITES_FP) {
+        SCLogWarning(SC_ERR_INVALID_YAML_CONF_ENTRY, "%s.async is not "
+                "supported by this output, writing synchronously", conf->name);
+        return 0;
+    }
+    if (!(log_ctx->is_regular ||
+          (log_ctx->is_sock && log_ctx->sock_type == SOCK_STREAM))) {
+        SCLogWarning(SC_ERR_INVALID_YAML_CONF_ENTRY, "%s.async is only "
+                "supported for regular files and unix_stream sockets, "
+                "writing synchronously", conf->name);
+        return 0;
+    }
+
+    uint32_t buffer_size = LOGFILE_ASYNC_DEFAULT_BUFFER_SIZE;
+    const char *str = ConfNodeLookupChildValue(async_node, "buffer-size");
+    if (str != NULL) {
+        if (ParseSizeStringU32(str, &buffer_size) < 0 || buffer_size == 0 ||
+                buffer_size > UINT32_MAX / LOGFILE_ASYNC_RING_FACTOR) {
+            SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "Invalid value for "
+                    "%s.async.buffer-size: %s", conf->name, str);
+            return -1;
+        }
+    }
+
+    intmax_t flush_interval = LOGFILE_ASYNC_DEFAULT_FLUSH_INTERVAL;
+    if (ConfGetChildValueInt(async_node, "flush-interval", &flush_interval)) {
+        if (flush_interval <= 0 ||
+                flush_interval > LOGFILE_ASYNC_MAX_FLUSH_INTERVAL) {
+            SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "Invalid value for "
+                    "%s.async.flush-interval: %"PRIdMAX" (1-%d msec)",
+                    conf->name, flush_interval,
+                    LOGFILE_ASYNC_MAX_FLUSH_INTERVAL);
+            return -1;
+        }
+    }
+
+    LogFileAsync *async = SCCalloc(1, sizeof(LogFileAsync));
+    if (unlikely(async == NULL))
+        return -1;
+    async->buffer_size = buffer_size;
+    async->ring_size = buffer_size * LOGFILE_ASYNC_RING_FACTOR;
+    async->flush_interval = (uint32_t)flush_interval;
+    SC_ATOMIC_INIT(async->dropped);
+
+    log_ctx->async = async;
+    LogFileWriterRegister(log_ctx, async->flush_interval);
+
+    SCLogInfo("%s: async writing enabled, buffer-size %"PRIu32", "
+            "flush-interval %"PRIu32"ms", conf->name, async->buffer_size,
+            async->flush_interval);
+    return 0;
+}
+
+/** \brief take the file from the writer thread and write out what is left */
+static void LogFileAsyncFree(LogFileCtx *log_ctx)
+{
+    LogFileAsync *async = log_ctx->async;
+    int i;
+
+    LogFileWriterDeregister(log_ctx);
+    LogFileAsyncFlush(log_ctx);
+
+    uint64_t dropped = SC_ATOMIC_GET(async->dropped);
+    if (dropped > 0) {
+        SCLogInfo("%s: %"PRIu64" records dropped as the async buffers were "
+                "full", log_ctx->filename, dropped);
+    }
+
+    for (i = 0; i < LOGFILE_MAX_THREADS; i++) {
+        LogFileAsyncSlot *slot = async->slots[i];
+        if (slot == NULL)
+            continue;
+        SC_ATOMIC_DESTROY(slot->head);
+        SC_ATOMIC_DESTROY(slot->tail);
+        SCFree(slot->buf);
+        SCFree(slot);
+    }
+    SC_ATOMIC_DESTROY(async->dropped);
+    SCFree(async);
+    log_ctx->async = NULL;
+}
+
+
 static void SCLogFileClose(LogFileCtx *log_ctx)
 {
     if (log_ctx->fp)
@@ -202,6 +722,437 @@ static PcieFile *SCLogOpenPcieFp(LogFileCtx *log_ctx, const char *path,
 #endif
 }
 
+/* per thread files merger defaults */
+#define LOGFILE_MERGE_DEFAULT_INTERVAL  1000    /* msec */
+#define LOGFILE_MERGE_MAX_INTERVAL      60000   /* msec */
+/* max records taken from a single file per merge round */
+#define LOGFILE_MERGE_MAX_RECORDS       16384
+/* merged size after which a per thread file is replaced by a new one */
+#define LOGFILE_MERGE_SPOOL_SIZE        (1024 * 1024)
+/* suffix of a merged per thread file while its rest is merged */
+#define LOGFILE_MERGE_SPOOL_SUFFIX      ".merging"
+
+/** read side of a per thread file, owned by the merger */
+typedef struct LogFileMergeShard_ {
+    FILE *fp;
+    ino_t ino;
+    off_t start;        /**< file size when the thread opened it */
+    int spool;          /**< fp is the renamed file, unlink it once drained */
+} LogFileMergeShard;
+
+typedef struct LogFileMergeRecord_ {
+    char *line;
+    size_t len;
+    const char *ts;     /**< timestamp value in the line, NULL if none */
+    uint32_t idx;       /**< keeps the read order for equal timestamps */
+} LogFileMergeRecord;
+
+/** Per thread files of a "threaded" output: each thread writes its own
+ *  file, so threads never share a LogFileCtx. Optionally the log file
+ *  writer thread interleaves the files by timestamp into the output's own
+ *  file. */
+typedef struct LogFileThreads_ {
+    const char *append;
+    LogFileCtx *ctx[LOGFILE_MAX_THREADS];
+
+    /** set on rotation, turned into a generation bump so that each
+     *  thread reopens its own file */
+    int rotation_flag;
+    uint32_t rotation_gen;
+    uint32_t thread_gen[LOGFILE_MAX_THREADS];
+
+    int merge;
+    uint32_t merge_interval;    /**< msec between merge rounds */
+    off_t spool_size;           /**< see LOGFILE_MERGE_SPOOL_SIZE */
+    /** the merger renamed the thread's file and asks it to open a new
+     *  one (req), the thread confirms once it did (ack) */
+    uint32_t spool_req[LOGFILE_MAX_THREADS];
+    uint32_t spool_ack[LOGFILE_MAX_THREADS];
+    LogFileMergeShard shards[LOGFILE_MAX_THREADS];
+} LogFileThreads;
+
+/** \brief build the name of a per thread file: eve.json -> eve.<id>.json */
+static int LogFileThreadPath(const char *path, int id, char *out, size_t out_size)
+{
+    const char *base = strrchr(path, '/');
+    base = (base != NULL) ? base + 1 : path;
+    const char *ext = strrchr(base, '.');
+    int r;
+
+    if (ext == NULL || ext == base) {
+        r = snprintf(out, out_size, "%s.%d", path, id);
+    } else {
+        r = snprintf(out, out_size, "%.*s.%d%s", (int)(ext - path), path,
+                id, ext);
+    }
+    return (r < 0 || (size_t)r >= out_size) ? -1 : 0;
+}
+
+/** \brief get (or open) the calling thread's own log file
+ *  \retval log_ctx the thread's file, or the shared one if the thread
+ *          can't have its own
+ */
+static LogFileCtx *LogFileGetThreadCtx(LogFileCtx *parent)
+{
+    LogFileThreads *threads = parent->threads;
+    int id = LogFileThreadId();
+    if (unlikely(id < 0))
+        return parent;
+
+    if (unlikely(threads->rotation_flag)) {
+        if (SCAtomicCompareAndSwap(&threads->rotation_flag, 1, 0))
+            (void)SCAtomicAddAndFetch(&threads->rotation_gen, 1);
+    }
+
+    LogFileCtx *log_ctx = threads->ctx[id];
+    if (likely(log_ctx != NULL)) {
+        if (unlikely(threads->thread_gen[id] != threads->rotation_gen)) {
+            threads->thread_gen[id] = threads->rotation_gen;
+            if (log_ctx != parent)
+                log_ctx->rotation_flag = 1;
+        }
+        /* our file was renamed by the merger: the next write opens a new
+         * one, so nothing is added to the renamed file after the ack */
+        if (unlikely(threads->spool_ack[id] != threads->spool_req[id])) {
+            if (log_ctx != parent)
+                log_ctx->rotation_flag = 1;
+            hw_barrier();
+            threads->spool_ack[id] = threads->spool_req[id];
+        }
+        return log_ctx;
+    }
+
+    /* a failed open stores the shared ctx, so we don't retry per record */
+    char path[PATH_MAX];
+    log_ctx = LogFileNewCtx();
+    if (unlikely(log_ctx == NULL) ||
+            LogFileThreadPath(parent->filename, id, path, sizeof(path)) < 0 ||
+            (log_ctx->fp = SCLogOpenFileFp(path, threads->append)) == NULL ||
+            (log_ctx->filename = SCStrdup(path)) == NULL)
+    {
+        if (log_ctx != NULL)
+            LogFileFreeCtx(log_ctx);
+        log_ctx = parent;
+    } else {
+        log_ctx->type = parent->type;
+        log_ctx->is_regular = 1;
+        fseeko(log_ctx->fp, 0, SEEK_END);
+        threads->shards[id].start = ftello(log_ctx->fp);
+        SCLogInfo("%s: thread %d logs to %s", parent->filename, id, path);
+    }
+    threads->thread_gen[id] = threads->rotation_gen;
+
+    /* only this thread sets its ctx, the CAS publishes it to the merger */
+    (void)SCAtomicCompareAndSwap(&threads->ctx[id], NULL, log_ctx);
+    return log_ctx;
+}
+
+/** \brief (re)open the read side of a per thread file
+ *  \retval 0 file is ready for reading
+ *  \retval -1 file not available (yet)
+ */
+static int LogFileMergeShardOpen(LogFileMergeShard *shard, const char *path)
+{
+    struct stat st;
+
+    if (shard->fp != NULL)
+        return 0;
+
+    shard->fp = fopen(path, "r");
+    if (shard->fp == NULL)
+        return -1;
+    if (fstat(fileno(shard->fp), &st) == 0)
+        shard->ino = st.st_ino;
+    if (shard->start > 0) {
+        fseeko(shard->fp, shard->start, SEEK_SET);
+        shard->start = 0;
+    }
+    return 0;
+}
+
+/** \brief done with a per thread file: close it, and remove it if it
+ *         was renamed by the merger */
+static void LogFileMergeShardClose(LogFileMergeShard *shard, const char *path)
+{
+    char spool_path[PATH_MAX];
+
+    fclose(shard->fp);
+    shard->fp = NULL;
+    if (shard->spool) {
+        snprintf(spool_path, sizeof(spool_path), "%s%s", path,
+                LOGFILE_MERGE_SPOOL_SUFFIX);
+        if (unlink(spool_path) != 0) {
+            SCLogWarning(SC_ERR_FOPEN, "failed to remove %s: %s",
+                    spool_path, strerror(errno));
+        }
+        shard->spool = 0;
+    }
+}
+
+/** \brief have the thread write a new file once its file is merged up to
+ *         the spool size, so the merged part can be removed */
+static void LogFileMergeShardSpool(LogFileThreads *threads, int id,
+        const char *path)
+{
+    LogFileMergeShard *shard = &threads->shards[id];
+    char spool_path[PATH_MAX];
+
+    if (shard->spool || ftello(shard->fp) < threads->spool_size)
+        return;
+
+    snprintf(spool_path, sizeof(spool_path), "%s%s", path,
+            LOGFILE_MERGE_SPOOL_SUFFIX);
+    if (rename(path, spool_path) != 0) {
+        SCLogWarning(SC_ERR_FOPEN, "failed to rename %s: %s", path,
+                strerror(errno));
+        return;
+    }
+    shard->spool = 1;
+    hw_barrier();
+    threads->spool_req[id]++;
+}
+
+/** \brief read the complete records that were added to a per thread file
+ *  \param final the threads are gone, nothing is written anymore
+ *  \retval cnt updated number of records in recs
+ */
+static uint32_t LogFileMergeShardRead(LogFileThreads *threads, int id,
+        const char *path, int final, LogFileMergeRecord **recs, uint32_t cnt,
+        uint32_t *size)
+{
+    LogFileMergeShard *shard = &threads->shards[id];
+    struct stat st;
+    uint32_t read = 0;
+
+    /* once the thread acked, it no longer writes to the renamed file, so
+     * its end is final. Check before reading so the end we read up to
+     * is the final one. */
+    int drained = final || (shard->spool &&
+            threads->spool_ack[id] == threads->spool_req[id]);
+    hw_barrier();
+
+    /* after a rotation we read the old file till its end, and switch to
+     * the new file in the next round */
+    int rotated = (!shard->spool && stat(path, &st) == 0 &&
+            st.st_ino != shard->ino);
+
+    while (read < LOGFILE_MERGE_MAX_RECORDS) {
+        char *line = NULL;
+        size_t n = 0;
+        ssize_t len = getline(&line, &n, shard->fp);
+        if (len <= 0) {
+            SCFree(line);
+            clearerr(shard->fp);
+            if (drained && shard->spool) {
+                LogFileMergeShardClose(shard, path);
+            } else if (rotated) {
+                LogFileMergeShardClose(shard, path);
+            } else if (!final) {
+                LogFileMergeShardSpool(threads, id, path);
+            }
+            break;
+        }
+        /* partial record, the thread is still writing it */
+        if (line[len - 1] != '\n') {
+            SCFree(line);
+            fseeko(shard->fp, -(off_t)len, SEEK_CUR);
+            clearerr(shard->fp);
+            break;
+        }
+
+        if (cnt == *size) {
+            uint32_t new_size = (*size == 0) ? 1024 : *size * 2;
+            LogFileMergeRecord *new_recs = SCRealloc(*recs,
+                    new_size * sizeof(LogFileMergeRecord));
+            if (unlikely(new_recs == NULL)) {
+                SCFree(line);
+                fseeko(shard->fp, -(off_t)len, SEEK_CUR);
+                break;
+            }
+            *recs = new_recs;
+            *size = new_size;
+        }
+
+        LogFileMergeRecord *rec = &(*recs)[cnt];
+        rec->line = line;
+        rec->len = (size_t)len;
+        rec->ts = strstr(line, "\"timestamp\":\"");
+        if (rec->ts != NULL)
+            rec->ts += strlen("\"timestamp\":\"");
+        rec->idx = cnt;
+        cnt++;
+        read++;
+    }
+    return cnt;
+}
+
+static int LogFileMergeRecordCompare(const void *a, const void *b)
+{
+    const LogFileMergeRecord *ra = a;
+    const LogFileMergeRecord *rb = b;
+
+    /* records without timestamp sort first */
+    if (ra->ts != NULL && rb->ts != NULL) {
+        const char *ea = strchr(ra->ts, '"');
+        const char *eb = strchr(rb->ts, '"');
+        size_t la = ea ? (size_t)(ea - ra->ts) : strlen(ra->ts);
+        size_t lb = eb ? (size_t)(eb - rb->ts) : strlen(rb->ts);
+        int r = memcmp(ra->ts, rb->ts, MIN(la, lb));
+        if (r != 0)
+            return r;
+        if (la != lb)
+            return (la < lb) ? -1 : 1;
+    } else if (ra->ts != NULL) {
+        return 1;
+    } else if (rb->ts != NULL) {
+        return -1;
+    }
+    return (ra->idx < rb->idx) ? -1 : (ra->idx > rb->idx);
+}
+
+/** \brief merge the records added to the per thread files since the last
+ *         round into the output's file, ordered by timestamp
+ *  \param final the threads are gone, nothing is written anymore
+ *  \retval cnt number of records merged
+ */
+static uint32_t LogFileMergeRound(LogFileCtx *log_ctx, int final)
+{
+    LogFileThreads *threads = log_ctx->threads;
+    LogFileMergeRecord *recs = NULL;
+    uint32_t cnt = 0, size = 0, i;
+
+    for (i = 0; i < LOGFILE_MAX_THREADS; i++) {
+        LogFileCtx *thread_ctx = threads->ctx[i];
+        if (thread_ctx == NULL || thread_ctx == log_ctx)
+            continue;
+
+        LogFileMergeShard *shard = &threads->shards[i];
+        if (LogFileMergeShardOpen(shard, thread_ctx->filename) < 0)
+            continue;
+        cnt = LogFileMergeShardRead(threads, i, thread_ctx->filename, final,
+                &recs, cnt, &size);
+        /* done with the old file, go on with the thread's current one */
+        if (shard->fp == NULL &&
+                LogFileMergeShardOpen(shard, thread_ctx->filename) == 0) {
+            cnt = LogFileMergeShardRead(threads, i, thread_ctx->filename,
+                    final, &recs, cnt, &size);
+        }
+    }
+    if (cnt == 0) {
+        SCFree(recs);
+        return 0;
+    }
+
+    qsort(recs, cnt, sizeof(LogFileMergeRecord), LogFileMergeRecordCompare);
+
+    SCMutexLock(&log_ctx->fp_mutex);
+    if (log_ctx->rotation_flag) {
+        log_ctx->rotation_flag = 0;
+        SCConfLogReopen(log_ctx);
+    }
+    for (i = 0; i < cnt; i++) {
+        if (log_ctx->fp != NULL)
+            fwrite(recs[i].line, recs[i].len, 1, log_ctx->fp);
+        SCFree(recs[i].line);
+    }
+    if (log_ctx->fp != NULL)
+        fflush(log_ctx->fp);
+    SCMutexUnlock(&log_ctx->fp_mutex);
+
+    SCFree(recs);
+    return cnt;
+}
+
+/** \brief set up per thread files if the output is "threaded"
+ *  \retval 0 on success, also if the output is not threaded
+ *  \retval -1 on error
+ */
+static int LogFileThreadsSetup(ConfNode *conf, LogFileCtx *log_ctx,
+        const char *append)
+{
+    int threaded = 0;
+    if (!ConfGetChildValueBool(conf, "threaded", &threaded) || !threaded)
+        return 0;
+
+#ifndef TLS
+    SCLogWarning(SC_ERR_INVALID_YAML_CONF_ENTRY, "%s.threaded needs thread "
+            "local storage support, using a single file", conf->name);
+    return 0;
+#endif
+    if (log_ctx->flags & LOGFILE_WRITES_FP) {
+        SCLogWarning(SC_ERR_INVALID_YAML_CONF_ENTRY, "%s.threaded is not "
+                "supported by this output, using a single file", conf->name);
+        return 0;
+    }
+    if (!log_ctx->is_regular) {
+        SCLogWarning(SC_ERR_INVALID_YAML_CONF_ENTRY, "%s.threaded is only "
+                "supported for regular files, using a single file", conf->name);
+        return 0;
+    }
+
+    int merge = 0;
+    (void)ConfGetChildValueBool(conf, "merge", &merge);
+    intmax_t merge_interval = LOGFILE_MERGE_DEFAULT_INTERVAL;
+    if (ConfGetChildValueInt(conf, "merge-interval", &merge_interval)) {
+        if (merge_interval <= 0 || merge_interval > LOGFILE_MERGE_MAX_INTERVAL) {
+            SCLogError(SC_ERR_INVALID_YAML_CONF_ENTRY, "Invalid value for "
+                    "%s.merge-interval: %"PRIdMAX" (1-%d msec)",
+                    conf->name, merge_interval, LOGFILE_MERGE_MAX_INTERVAL);
+            return -1;
+        }
+    }
+
+    LogFileThreads *threads = SCCalloc(1, sizeof(LogFileThreads));
+    if (unlikely(threads == NULL))
+        return -1;
+    threads->append = ConfValIsTrue(append) ? "yes" : "no";
+    threads->merge = merge;
+    threads->merge_interval = (uint32_t)merge_interval;
+    threads->spool_size = LOGFILE_MERGE_SPOOL_SIZE;
+    OutputRegisterFileRotationFlag(&threads->rotation_flag);
+    log_ctx->threads = threads;
+
+    if (merge) {
+        LogFileWriterRegister(log_ctx, threads->merge_interval);
+        SCLogInfo("%s: per thread files, merged into %s every %"PRIu32"ms",
+                conf->name, log_ctx->filename, threads->merge_interval);
+    } else {
+        SCLogInfo("%s: per thread files", conf->name);
+    }
+    return 0;
+}
+
+/** \brief merge what is left and close the per thread files. Merged per
+ *         thread files are removed. */
+static void LogFileThreadsFree(LogFileCtx *log_ctx)
+{
+    LogFileThreads *threads = log_ctx->threads;
+    int i;
+
+    if (threads->merge) {
+        LogFileWriterDeregister(log_ctx);
+        while (LogFileMergeRound(log_ctx, 1) > 0)
+            ;
+    }
+
+    for (i = 0; i < LOGFILE_MAX_THREADS; i++) {
+        LogFileCtx *thread_ctx = threads->ctx[i];
+        if (threads->shards[i].fp != NULL)
+            LogFileMergeShardClose(&threads->shards[i], thread_ctx->filename);
+        if (thread_ctx == NULL || thread_ctx == log_ctx)
+            continue;
+        if (threads->merge && unlink(thread_ctx->filename) != 0 &&
+                errno != ENOENT) {
+            SCLogWarning(SC_ERR_FOPEN, "failed to remove %s: %s",
+                    thread_ctx->filename, strerror(errno));
+        }
+        LogFileFreeCtx(thread_ctx);
+    }
+    OutputUnregisterFileRotationFlag(&threads->rotation_flag);
+    SCFree(threads);
+    log_ctx->threads = NULL;
+}
+
 /** \brief open a generic output "log file", which may be a regular file or a socket
  *  \param conf ConfNode structure for the output section in question
  *  \param log_ctx Log file context allocated by caller
@@ -294,6 +1245,12 @@ SCConfLogOpenGeneric(ConfNode *conf,
         return -1;
     }
 
+    if (LogFileThreadsSetup(conf, log_ctx, append) < 0)
+        return -1;
+    /* per thread files don't share a lock, no need for async writing */
+    if (log_ctx->threads == NULL && LogFileAsyncSetup(conf, log_ctx) < 0)
+        return -1;
+
     SCLogInfo("%s output device (%s) initialized: %s", conf->name, filetype,
               filename);
 
@@ -500,6 +1457,11 @@ int LogFileFreeCtx(LogFileCtx *lf_ctx)
         SCReturnInt(0);
     }
 
+    if (lf_ctx->async != NULL)
+        LogFileAsyncFree(lf_ctx);
+    if (lf_ctx->threads != NULL)
+        LogFileThreadsFree(lf_ctx);
+
     if (lf_ctx->fp != NULL) {
         SCMutexLock(&lf_ctx->fp_mutex);
         lf_ctx->Close(lf_ctx);
@@ -537,6 +1499,30 @@ int LogFileFreeCtx(LogFileCtx *lf_ctx)
     SCReturnInt(1);
 }
 
+/** \brief write a complete record, including its newline, to a file
+ *         type log
+ *
+ *  Outputs that format their own records use this rather than calling
+ *  file_ctx->Write, so that async writing applies to them as well.
+ *
+ *  \retval 0 always, write errors are handled by the file's Write
+ */
+int LogFileWriteRecord(LogFileCtx *file_ctx, const char *data, size_t data_len)
+{
+    if (file_ctx->threads != NULL)
+        file_ctx = LogFileGetThreadCtx(file_ctx);
+
+    if (file_ctx->async != NULL && SC_ATOMIC_GET(logfile_writer_running) &&
+            LogFileAsyncWrite(file_ctx->async, (const uint8_t *)data, data_len) == 0) {
+        return 0;
+    }
+
+    SCMutexLock(&file_ctx->fp_mutex);
+    file_ctx->Write(data, (int)data_len, file_ctx);
+    SCMutexUnlock(&file_ctx->fp_mutex);
+    return 0;
+}
+
 #ifdef HAVE_LIBHIREDIS
 static int  LogFileWriteRedis(LogFileCtx *file_ctx, const char *string, size_t string_len)
 {
@@ -628,10 +1614,8 @@ int LogFileWrite(LogFileCtx *file_ctx, MemBuffer *buffer)
     {
         /* append \n for files only */
         MemBufferWriteString(buffer, "\n");
-        SCMutexLock(&file_ctx->fp_mutex);
-        file_ctx->Write((const char *)MEMBUFFER_BUFFER(buffer),
-                        MEMBUFFER_OFFSET(buffer), file_ctx);
-        SCMutexUnlock(&file_ctx->fp_mutex);
+        LogFileWriteRecord(file_ctx, (const char *)MEMBUFFER_BUFFER(buffer),
+                MEMBUFFER_OFFSET(buffer));
     }
 #ifdef HAVE_LIBHIREDIS
     else if (file_ctx->type == LOGFILE_TYPE_REDIS) {
@@ -644,3 +1628,320 @@ int LogFileWrite(LogFileCtx *file_ctx, MemBuffer *buffer)
 
     return 0;
 }
+
+#ifdef UNITTESTS
+#ifdef TLS
+/** \brief set up a LogFileCtx writing to a temp file, with a small ring */
+static LogFileCtx *LogFileAsyncTestCtx(uint32_t buffer_size)
+{
+    LogFileCtx *lf = LogFileNewCtx();
+    if (lf == NULL)
+        return NULL;
+    lf->fp = tmpfile();
+    lf->is_regular = 1;
+    lf->async = SCCalloc(1, sizeof(LogFileAsync));
+    if (lf->fp == NULL || lf->async == NULL) {
+        LogFileFreeCtx(lf);
+        return NULL;
+    }
+    lf->async->buffer_size = buffer_size;
+    lf->async->ring_size = buffer_size * LOGFILE_ASYNC_RING_FACTOR;
+    lf->async->flush_interval = LOGFILE_ASYNC_DEFAULT_FLUSH_INTERVAL;
+    SC_ATOMIC_INIT(lf->async->dropped);
+    return lf;
+}
+
+/** \brief read back what was written to the temp file */
+static size_t LogFileTestRead(LogFileCtx *lf, char *buf, size_t size)
+{
+    fflush(lf->fp);
+    rewind(lf->fp);
+    size_t len = fread(buf, 1, size - 1, lf->fp);
+    buf[len] = '\0';
+    return len;
+}
+
+/** \test records are buffered per thread and written out in order by a
+ *        flush, also when they wrap around the end of the ring */
+static int LogFileAsyncTest01(void)
+{
+    char buf[256];
+    LogFileCtx *lf = LogFileAsyncTestCtx(8);
+    FAIL_IF_NULL(lf);
+
+    FAIL_IF_NOT(LogFileAsyncWrite(lf->async, (const uint8_t *)"one\n", 4) == 0);
+    FAIL_IF_NOT(LogFileAsyncWrite(lf->async, (const uint8_t *)"two\n", 4) == 0);
+    /* buffered, nothing written yet */
+    FAIL_IF_NOT(LogFileTestRead(lf, buf, sizeof(buf)) == 0);
+
+    LogFileAsyncFlush(lf);
+    LogFileTestRead(lf, buf, sizeof(buf));
+    FAIL_IF_NOT(strcmp(buf, "one\ntwo\n") == 0);
+
+    /* ring is 32 bytes, head is at 8: these wrap */
+    FAIL_IF_NOT(LogFileAsyncWrite(lf->async, (const uint8_t *)"three-three\n", 12) == 0);
+    FAIL_IF_NOT(LogFileAsyncWrite(lf->async, (const uint8_t *)"four-four\n", 10) == 0);
+    FAIL_IF_NOT(LogFileAsyncWrite(lf->async, (const uint8_t *)"five\n", 5) == 0);
+    LogFileAsyncFlush(lf);
+    LogFileAsyncWrite(lf->async, (const uint8_t *)"six\n", 4);
+    LogFileAsyncFlush(lf);
+
+    LogFileTestRead(lf, buf, sizeof(buf));
+    FAIL_IF_NOT(strcmp(buf, "one\ntwo\nthree-three\nfour-four\nfive\nsix\n") == 0);
+    FAIL_IF_NOT(SC_ATOMIC_GET(lf->async->dropped) == 0);
+
+    LogFileFreeCtx(lf);
+    PASS;
+}
+
+/** \test a full ring drops and counts records instead of growing, a
+ *        record larger than the ring is left to the caller */
+static int LogFileAsyncTest02(void)
+{
+    char buf[256];
+    LogFileCtx *lf = LogFileAsyncTestCtx(8);
+    FAIL_IF_NULL(lf);
+
+    int i;
+    for (i = 0; i < 4; i++) {
+        FAIL_IF_NOT(LogFileAsyncWrite(lf->async, (const uint8_t *)"1234567\n", 8) == 0);
+    }
+    FAIL_IF_NOT(SC_ATOMIC_GET(lf->async->dropped) == 0);
+
+    /* ring of 32 bytes is full */
+    FAIL_IF_NOT(LogFileAsyncWrite(lf->async, (const uint8_t *)"x\n", 2) == 0);
+    FAIL_IF_NOT(SC_ATOMIC_GET(lf->async->dropped) == 1);
+
+    /* never fits */
+    char big[40];
+    memset(big, 'b', sizeof(big));
+    FAIL_IF_NOT(LogFileAsyncWrite(lf->async, (const uint8_t *)big, sizeof(big)) == -1);
+    FAIL_IF_NOT(SC_ATOMIC_GET(lf->async->dropped) == 1);
+
+    /* the writer made room again */
+    LogFileAsyncFlush(lf);
+    FAIL_IF_NOT(LogFileAsyncWrite(lf->async, (const uint8_t *)"y\n", 2) == 0);
+    LogFileAsyncFlush(lf);
+
+    size_t len = LogFileTestRead(lf, buf, sizeof(buf));
+    FAIL_IF_NOT(len == 34);
+    FAIL_IF_NOT(strcmp(buf + 32, "y\n") == 0);
+
+    LogFileFreeCtx(lf);
+    PASS;
+}
+
+/** \test without a running writer thread records are written
+ *        synchronously, and freeing the ctx writes out what was buffered */
+static int LogFileAsyncTest03(void)
+{
+    char buf[256];
+    LogFileCtx *lf = LogFileAsyncTestCtx(8);
+    FAIL_IF_NULL(lf);
+    FAIL_IF(SC_ATOMIC_GET(logfile_writer_running));
+
+    LogFileWriteRecord(lf, "sync\n", 5);
+    LogFileTestRead(lf, buf, sizeof(buf));
+    FAIL_IF_NOT(strcmp(buf, "sync\n") == 0);
+
+    /* buffered while the writer was running */
+    FAIL_IF_NOT(LogFileAsyncWrite(lf->async, (const uint8_t *)"left\n", 5) == 0);
+    FILE *fp = lf->fp;
+    int fd = dup(fileno(fp));
+    FAIL_IF(fd < 0);
+    LogFileFreeCtx(lf);
+
+    FILE *rfp = fdopen(fd, "r");
+    FAIL_IF_NULL(rfp);
+    rewind(rfp);
+    size_t len = fread(buf, 1, sizeof(buf) - 1, rfp);
+    buf[len] = '\0';
+    fclose(rfp);
+    FAIL_IF_NOT(strcmp(buf, "sync\nleft\n") == 0);
+    PASS;
+}
+/** \test per thread file names */
+static int LogFileThreadsTest01(void)
+{
+    char path[PATH_MAX];
+
+    FAIL_IF_NOT(LogFileThreadPath("/var/log/suricata/eve.json", 3, path,
+                sizeof(path)) == 0);
+    FAIL_IF_NOT(strcmp(path, "/var/log/suricata/eve.3.json") == 0);
+    FAIL_IF_NOT(LogFileThreadPath("/var/log.d/eve", 12, path, sizeof(path)) == 0);
+    FAIL_IF_NOT(strcmp(path, "/var/log.d/eve.12") == 0);
+    FAIL_IF_NOT(LogFileThreadPath("/var/log/.eve", 1, path, sizeof(path)) == 0);
+    FAIL_IF_NOT(strcmp(path, "/var/log/.eve.1") == 0);
+    FAIL_IF_NOT(LogFileThreadPath("eve.json", 1, path, 8) == -1);
+    PASS;
+}
+
+/** \brief set up a merged "threaded" LogFileCtx in a new temp dir */
+static LogFileCtx *LogFileThreadsTestCtx(char *dir, size_t dir_size)
+{
+    char path[PATH_MAX];
+
+    strlcpy(dir, "/tmp/suricata-logfile-XXXXXX", dir_size);
+    if (mkdtemp(dir) == NULL)
+        return NULL;
+    snprintf(path, sizeof(path), "%s/eve.json", dir);
+
+    LogFileCtx *lf = LogFileNewCtx();
+    if (lf == NULL)
+        return NULL;
+    lf->type = LOGFILE_TYPE_FILE;
+    lf->is_regular = 1;
+    lf->fp = SCLogOpenFileFp(path, "no");
+    lf->filename = SCStrdup(path);
+    lf->threads = SCCalloc(1, sizeof(LogFileThreads));
+    if (lf->fp == NULL || lf->filename == NULL || lf->threads == NULL) {
+        LogFileFreeCtx(lf);
+        return NULL;
+    }
+    lf->threads->append = "no";
+    lf->threads->merge = 1;
+    lf->threads->merge_interval = LOGFILE_MERGE_DEFAULT_INTERVAL;
+    lf->threads->spool_size = LOGFILE_MERGE_SPOOL_SIZE;
+    return lf;
+}
+
+/** \brief read a file into buf */
+static size_t LogFileTestReadPath(const char *path, char *buf, size_t size)
+{
+    size_t len = 0;
+    FILE *fp = fopen(path, "r");
+    if (fp != NULL) {
+        len = fread(buf, 1, size - 1, fp);
+        fclose(fp);
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+typedef struct LogFileThreadsTestRecord_ {
+    LogFileCtx *lf;
+    const char *rec;
+} LogFileThreadsTestRecord;
+
+static void *LogFileThreadsTestThread(void *arg)
+{
+    LogFileThreadsTestRecord *r = (LogFileThreadsTestRecord *)arg;
+    LogFileWriteRecord(r->lf, r->rec, strlen(r->rec));
+    return NULL;
+}
+
+#define LOGFILE_TEST_REC1 "{\"timestamp\":\"2016-05-01T10:00:01.000000\"}\n"
+#define LOGFILE_TEST_REC2 "{\"timestamp\":\"2016-05-01T10:00:02.000000\"}\n"
+
+/** \test records of two threads go to their own files, are merged in
+ *        timestamp order and the per thread files are removed at the end */
+static int LogFileThreadsTest02(void)
+{
+    char dir[PATH_MAX], buf[512], own_path[PATH_MAX], other_path[PATH_MAX];
+    LogFileCtx *lf = LogFileThreadsTestCtx(dir, sizeof(dir));
+    FAIL_IF_NULL(lf);
+    LogFileThreads *threads = lf->threads;
+
+    LogFileWriteRecord(lf, LOGFILE_TEST_REC2, strlen(LOGFILE_TEST_REC2));
+    LogFileCtx *own = threads->ctx[LogFileThreadId()];
+    FAIL_IF(own == NULL || own == lf);
+    strlcpy(own_path, own->filename, sizeof(own_path));
+    LogFileTestReadPath(own_path, buf, sizeof(buf));
+    FAIL_IF_NOT(strcmp(buf, LOGFILE_TEST_REC2) == 0);
+
+    /* an older record from another thread */
+    pthread_t t;
+    LogFileThreadsTestRecord r = { lf, LOGFILE_TEST_REC1 };
+    FAIL_IF(pthread_create(&t, NULL, LogFileThreadsTestThread, &r) != 0);
+    pthread_join(t, NULL);
+
+    int i, files = 0;
+    for (i = 0; i < LOGFILE_MAX_THREADS; i++) {
+        if (threads->ctx[i] != NULL && threads->ctx[i] != own) {
+            strlcpy(other_path, threads->ctx[i]->filename, sizeof(other_path));
+            files++;
+        }
+    }
+    FAIL_IF_NOT(files == 1);
+    FAIL_IF(strcmp(own_path, other_path) == 0);
+
+    FAIL_IF_NOT(LogFileMergeRound(lf, 0) == 2);
+    FAIL_IF_NOT(LogFileMergeRound(lf, 0) == 0);
+    LogFileTestReadPath(lf->filename, buf, sizeof(buf));
+    FAIL_IF_NOT(strcmp(buf, LOGFILE_TEST_REC1 LOGFILE_TEST_REC2) == 0);
+
+    char path[PATH_MAX];
+    strlcpy(path, lf->filename, sizeof(path));
+    LogFileFreeCtx(lf);
+
+    FAIL_IF(access(own_path, F_OK) == 0);
+    FAIL_IF(access(other_path, F_OK) == 0);
+    LogFileTestReadPath(path, buf, sizeof(buf));
+    FAIL_IF_NOT(strcmp(buf, LOGFILE_TEST_REC1 LOGFILE_TEST_REC2) == 0);
+
+    /* nothing else was left behind */
+    FAIL_IF(unlink(path) != 0);
+    FAIL_IF(rmdir(dir) != 0);
+    PASS;
+}
+
+/** \test a merged per thread file is renamed, the thread moves on to a new
+ *        file and the renamed one is removed once it's merged */
+static int LogFileThreadsTest03(void)
+{
+    char dir[PATH_MAX], buf[512], own_path[PATH_MAX], spool_path[PATH_MAX];
+    LogFileCtx *lf = LogFileThreadsTestCtx(dir, sizeof(dir));
+    FAIL_IF_NULL(lf);
+    LogFileThreads *threads = lf->threads;
+    int id = LogFileThreadId();
+    threads->spool_size = 1;
+
+    LogFileWriteRecord(lf, LOGFILE_TEST_REC1, strlen(LOGFILE_TEST_REC1));
+    FAIL_IF_NULL(threads->ctx[id]);
+    strlcpy(own_path, threads->ctx[id]->filename, sizeof(own_path));
+    snprintf(spool_path, sizeof(spool_path), "%s%s", own_path,
+            LOGFILE_MERGE_SPOOL_SUFFIX);
+
+    /* merged past the spool size: renamed, thread asked for a new file */
+    FAIL_IF_NOT(LogFileMergeRound(lf, 0) == 1);
+    FAIL_IF_NOT(access(spool_path, F_OK) == 0);
+    FAIL_IF(access(own_path, F_OK) == 0);
+    FAIL_IF(threads->spool_req[id] == threads->spool_ack[id]);
+
+    /* the next record goes to a new file */
+    LogFileWriteRecord(lf, LOGFILE_TEST_REC2, strlen(LOGFILE_TEST_REC2));
+    FAIL_IF_NOT(threads->spool_req[id] == threads->spool_ack[id]);
+    LogFileTestReadPath(own_path, buf, sizeof(buf));
+    FAIL_IF_NOT(strcmp(buf, LOGFILE_TEST_REC2) == 0);
+
+    /* the renamed file is drained and removed, the new file is merged */
+    FAIL_IF_NOT(LogFileMergeRound(lf, 0) == 1);
+    LogFileTestReadPath(lf->filename, buf, sizeof(buf));
+    FAIL_IF_NOT(strcmp(buf, LOGFILE_TEST_REC1 LOGFILE_TEST_REC2) == 0);
+
+    char path[PATH_MAX];
+    strlcpy(path, lf->filename, sizeof(path));
+    LogFileFreeCtx(lf);
+
+    FAIL_IF(access(own_path, F_OK) == 0);
+    FAIL_IF(access(spool_path, F_OK) == 0);
+    FAIL_IF(unlink(path) != 0);
+    FAIL_IF(rmdir(dir) != 0);
+    PASS;
+}
+#endif /* TLS */
+#endif /* UNITTESTS */
+
+void LogFileRegisterTests(void)
+{
+#ifdef UNITTESTS
+#ifdef TLS
+    UtRegisterTest("LogFileAsyncTest01", LogFileAsyncTest01);
+    UtRegisterTest("LogFileAsyncTest02", LogFileAsyncTest02);
+    UtRegisterTest("LogFileAsyncTest03", LogFileAsyncTest03);
+    UtRegisterTest("LogFileThreadsTest01", LogFileThreadsTest01);
+    UtRegisterTest("LogFileThreadsTest02", LogFileThreadsTest02);
+    UtRegisterTest("LogFileThreadsTest03", LogFileThreadsTest03);
+#endif
+#endif
+}
@@ -61,6 +61,33 @@ typedef struct RedisSetup_ {
 } RedisSetup;
 #endif
 
+/** Max number of threads that get their own async record buffer or
+ *  per thread file. Other threads use the shared file synchronously. */
+#define LOGFILE_MAX_THREADS         256
+
+/** Per thread record ring of an async log file. The owning thread
+ *  appends at head, the writer thread consumes from tail. */
+typedef struct LogFileAsyncSlot_ {
+    uint8_t *buf;
+    SC_ATOMIC_DECLARE(uint64_t, head);  /**< bytes appended by the thread */
+    SC_ATOMIC_DECLARE(uint64_t, tail);  /**< bytes written out */
+} LogFileAsyncSlot;
+
+/** Async writing: threads append their records to per thread rings,
+ *  the log file writer thread drains them with writev */
+typedef struct LogFileAsync_ {
+    uint32_t buffer_size;       /**< per thread fill that triggers a flush */
+    uint32_t ring_size;         /**< per thread capacity, beyond it records
+                                 *   are dropped */
+    uint32_t flush_interval;    /**< max time in msec records are held back */
+
+    SC_ATOMIC_DECLARE(uint64_t, dropped);
+    uint64_t dropped_reported;  /**< part of dropped already counted by the
+                                 *   writer thread */
+
+    LogFileAsyncSlot *slots[LOGFILE_MAX_THREADS];
+} LogFileAsync;
+
 /** Global structure for Output Context */
 typedef struct LogFileCtx_ {
     union {
@@ -85,6 +112,16 @@ typedef struct LogFileCtx_ {
      * record cannot be written to the file in one call */
     SCMutex fp_mutex;
 
+    /** async writer, NULL if records are written synchronously */
+    LogFileAsync *async;
+
+    /** per thread files, NULL unless the output is "threaded" */
+    struct LogFileThreads_ *threads;
+
+    /** entry in the log file writer thread's list */
+    TAILQ_ENTRY(LogFileCtx_) writer_next;
+    int writer_registered;
+
     /** the type of file */
     enum LogFileType type;
 
@@ -128,10 +165,19 @@ typedef struct LogFileCtx_ {
 /* flags for LogFileCtx */
 #define LOGFILE_HEADER_WRITTEN 0x01
 #define LOGFILE_ALERTS_PRINTED 0x02
+/** output writes to fp itself, so records can't be buffered or split
+ *  over per thread files */
+#define LOGFILE_WRITES_FP      0x04
 
 LogFileCtx *LogFileNewCtx(void);
 int LogFileFreeCtx(LogFileCtx *);
 int LogFileWrite(LogFileCtx *file_ctx, MemBuffer *buffer);
+int LogFileWriteRecord(LogFileCtx *file_ctx, const char *data, size_t data_len);
+
+void TmModuleLogFileWriterRegister(void);
+void LogFileWriterThreadSpawn(void);
+
+void LogFileRegisterTests(void);
 
 int SCConfLogOpenGeneric(ConfNode *conf, LogFileCtx *, const char *, int);
 int SCConfLogOpenRedis(ConfNode *conf, LogFileCtx *log_ctx);
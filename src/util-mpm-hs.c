@@ -609,8 +609,9 @@ int SCHSPreparePatterns(MpmCtx *mpm_ctx)
     SCFree(ctx->init_hash);
     ctx->init_hash = NULL;
 
-    /* Serialise whole database compilation as a relatively easy way to ensure
-     * dedupe is safe. */
+    /* The lookup and insertion in the global table are serialised, the
+     * compilation itself is not, so that contexts can be prepared in
+     * parallel. */
     SCMutexLock(&g_db_table_mutex);
 
     /* Init global pattern database hash if necessary. */
@@ -640,6 +641,7 @@ int SCHSPreparePatterns(MpmCtx *mpm_ctx)
         SCHSFreeCompileData(cd);
         return 0;
     }
+    SCMutexUnlock(&g_db_table_mutex);
 
     BUG_ON(ctx->pattern_db != NULL); /* already built? */
 
@@ -674,21 +676,37 @@ int SCHSPreparePatterns(MpmCtx *mpm_ctx)
 
     BUG_ON(mpm_ctx->pattern_cnt == 0);
 
-    err = hs_compile_ext_multi((const char *const *)cd->expressions, cd->flags,
-                               cd->ids, (const hs_expr_ext_t *const *)cd->ext,
-                               cd->pattern_cnt, HS_MODE_BLOCK, NULL, &pd->hs_db,
-                               &compile_err);
+    /* Try the on-disk cache before compiling. */
+    size_t key_len = 0;
+    uint8_t *key = HSCacheKey((const char *const *)cd->expressions, cd->flags,
+                              cd->ids, (const hs_expr_ext_t *const *)cd->ext,
+                              cd->pattern_cnt, HS_MODE_BLOCK, &key_len);
+    if (key != NULL && HSCacheLoad(key, key_len, &pd->hs_db) == 0) {
+        SCLogDebug("Loaded cached database for %" PRIu32 " patterns",
+                   pd->pattern_cnt);
+    } else {
+        err = hs_compile_ext_multi((const char *const *)cd->expressions,
+                                   cd->flags, cd->ids,
+                                   (const hs_expr_ext_t *const *)cd->ext,
+                                   cd->pattern_cnt, HS_MODE_BLOCK, NULL,
+                                   &pd->hs_db, &compile_err);
+
+        if (err != HS_SUCCESS) {
+            SCLogError(SC_ERR_FATAL, "failed to compile hyperscan database");
+            if (compile_err) {
+                SCLogError(SC_ERR_FATAL, "compile error: %s",
+                           compile_err->message);
+            }
+            hs_free_compile_error(compile_err);
+            SCFree(key);
+            goto error;
+        }
 
-    if (err != HS_SUCCESS) {
-        SCLogError(SC_ERR_FATAL, "failed to compile hyperscan database");
-        if (compile_err) {
-            SCLogError(SC_ERR_FATAL, "compile error: %s", compile_err->message);
+        if (key != NULL) {
+            HSCacheStore(key, key_len, pd->hs_db);
         }
-        hs_free_compile_error(compile_err);
-        goto error;
     }
-
-    ctx->pattern_db = pd;
+    SCFree(key);
 
     SCMutexLock(&g_scratch_proto_mutex);
     err = hs_alloc_scratch(pd->hs_db, &g_scratch_proto);
@@ -698,28 +716,44 @@ int SCHSPreparePatterns(MpmCtx *mpm_ctx)
         goto error;
     }
 
-    err = hs_database_size(pd->hs_db, &ctx->hs_db_size);
+    size_t hs_db_size = 0;
+    err = hs_database_size(pd->hs_db, &hs_db_size);
     if (err != HS_SUCCESS) {
         SCLogError(SC_ERR_FATAL, "failed to query database size");
         goto error;
     }
 
-    mpm_ctx->memory_cnt++;
-    mpm_ctx->memory_size += ctx->hs_db_size;
+    SCMutexLock(&g_db_table_mutex);
 
-    SCLogDebug("Built %" PRIu32 " patterns into a database of size %" PRIuMAX
-               " bytes", mpm_ctx->pattern_cnt, (uintmax_t)ctx->hs_db_size);
+    /* Another context may have built the same database while we were
+     * compiling, in which case we use that one. */
+    pd_cached = HashTableLookup(g_db_table, pd, 1);
+    if (pd_cached != NULL) {
+        pd_cached->ref_cnt++;
+        ctx->pattern_db = pd_cached;
+        SCMutexUnlock(&g_db_table_mutex);
+        PatternDatabaseFree(pd);
+        SCHSFreeCompileData(cd);
+        return 0;
+    }
 
     /* Cache this database globally for later. */
     pd->ref_cnt = 1;
     HashTableAdd(g_db_table, pd, 1);
     SCMutexUnlock(&g_db_table_mutex);
 
+    ctx->pattern_db = pd;
+    ctx->hs_db_size = hs_db_size;
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += ctx->hs_db_size;
+
+    SCLogDebug("Built %" PRIu32 " patterns into a database of size %" PRIuMAX
+               " bytes", mpm_ctx->pattern_cnt, (uintmax_t)ctx->hs_db_size);
+
     SCHSFreeCompileData(cd);
     return 0;
 
 error:
-    SCMutexUnlock(&g_db_table_mutex);
     if (pd) {
         PatternDatabaseFree(pd);
     }
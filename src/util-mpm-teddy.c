@@ -0,0 +1,819 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * SIMD multi literal matcher for small pattern sets, after the "Teddy"
+ * algorithm from the Hyperscan project.
+ *
+ * The patterns are spread over 8 buckets. For each of the first 1-3 bytes
+ * of the patterns two 16 byte tables are built, mapping the low and the
+ * high nibble of the byte to the buckets that have a pattern with that
+ * nibble at that position. The search then takes 16 (SSSE3) or 32 (AVX2)
+ * input bytes at a time, looks up both nibbles of each byte with a
+ * shuffle and ANDs the results. What's left is a bucket mask per input
+ * position, and only the patterns of those buckets are compared.
+ *
+ * Nocase patterns set the bits for both cases of their letters.
+ *
+ * Sets of more than TEDDY_MAX_PATTERNS patterns would fill all buckets
+ * at most positions, so these are handed to the aho-corasick mpm. The
+ * same is done if Suricata isn't built for a CPU with SSSE3.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+
+#include "detect.h"
+#include "detect-parse.h"
+#include "detect-engine.h"
+
+#include "util-debug.h"
+#include "util-unittest.h"
+#include "util-unittest-helper.h"
+#include "util-memcmp.h"
+#include "util-memcpy.h"
+#include "util-mpm-teddy.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define TEDDY_SIMD
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#define TEDDY_SIMD
+#endif
+
+void SCTeddyInitCtx(MpmCtx *);
+void SCTeddyInitThreadCtx(MpmCtx *, MpmThreadCtx *);
+void SCTeddyDestroyCtx(MpmCtx *);
+void SCTeddyDestroyThreadCtx(MpmCtx *, MpmThreadCtx *);
+int SCTeddyAddPatternCI(MpmCtx *, uint8_t *, uint16_t, uint16_t, uint16_t,
+                        uint32_t, SigIntId, uint8_t);
+int SCTeddyAddPatternCS(MpmCtx *, uint8_t *, uint16_t, uint16_t, uint16_t,
+                        uint32_t, SigIntId, uint8_t);
+int SCTeddyPreparePatterns(MpmCtx *mpm_ctx);
+uint32_t SCTeddySearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                       PatternMatcherQueue *pmq, const uint8_t *buf, uint16_t buflen);
+void SCTeddyPrintInfo(MpmCtx *mpm_ctx);
+void SCTeddyPrintSearchStats(MpmThreadCtx *mpm_thread_ctx);
+void SCTeddyRegisterTests(void);
+
+/**
+ * \brief Hand the patterns of the init hash to an ac ctx.
+ */
+static int SCTeddyPrepareFallback(MpmCtx *mpm_ctx, SCTeddyCtx *ctx)
+{
+    ctx->ac_ctx = SCMalloc(sizeof(MpmCtx));
+    if (ctx->ac_ctx == NULL)
+        return -1;
+    memset(ctx->ac_ctx, 0, sizeof(MpmCtx));
+
+    MpmInitCtx(ctx->ac_ctx, MPM_AC);
+
+    /* give ac our hash, so the patterns don't have to be added again */
+    SCFree(ctx->ac_ctx->init_hash);
+    ctx->ac_ctx->init_hash = mpm_ctx->init_hash;
+    mpm_ctx->init_hash = NULL;
+
+    ctx->ac_ctx->pattern_cnt = mpm_ctx->pattern_cnt;
+    ctx->ac_ctx->minlen = mpm_ctx->minlen;
+    ctx->ac_ctx->maxlen = mpm_ctx->maxlen;
+    ctx->ac_ctx->max_pat_id = mpm_ctx->max_pat_id;
+
+    if (mpm_table[MPM_AC].Prepare(ctx->ac_ctx) < 0)
+        return -1;
+
+    mpm_ctx->memory_cnt += ctx->ac_ctx->memory_cnt;
+    mpm_ctx->memory_size += ctx->ac_ctx->memory_size;
+    return 0;
+}
+
+/** \brief sort patterns on their first bytes, so that patterns sharing
+ *         bytes end up in the same bucket */
+static int SCTeddyPatternCompare(const void *a, const void *b)
+{
+    const MpmPattern *p1 = *(const MpmPattern **)a;
+    const MpmPattern *p2 = *(const MpmPattern **)b;
+
+    uint16_t len = MIN(p1->len, p2->len);
+    int r = memcmp(p1->ci, p2->ci, MIN(len, TEDDY_MAX_MASKS));
+    if (r != 0)
+        return r;
+    return (int)p1->id - (int)p2->id;
+}
+
+static void SCTeddySetNibbles(SCTeddyCtx *ctx, uint32_t mask, uint8_t c, uint8_t bucket_bit)
+{
+    ctx->nibble_mask[mask][0][c & 0x0f] |= bucket_bit;
+    ctx->nibble_mask[mask][1][c >> 4] |= bucket_bit;
+}
+
+/**
+ * \brief Process the patterns added to the mpm, and create the nibble
+ *        masks, or the ac state table if there are too many patterns.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ */
+int SCTeddyPreparePatterns(MpmCtx *mpm_ctx)
+{
+    SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+    MpmPattern **parray = NULL;
+    uint32_t i, p = 0;
+
+    if (mpm_ctx->pattern_cnt == 0 || mpm_ctx->init_hash == NULL) {
+        SCLogDebug("no patterns supplied to this mpm_ctx");
+        return 0;
+    }
+
+#ifdef TEDDY_SIMD
+    if (mpm_ctx->pattern_cnt > TEDDY_MAX_PATTERNS)
+#endif
+    {
+        SCLogDebug("%u patterns, using ac", mpm_ctx->pattern_cnt);
+        return SCTeddyPrepareFallback(mpm_ctx, ctx);
+    }
+
+    parray = SCMalloc(mpm_ctx->pattern_cnt * sizeof(MpmPattern *));
+    if (parray == NULL)
+        goto error;
+
+    for (i = 0; i < MPM_INIT_HASH_SIZE; i++) {
+        MpmPattern *node = mpm_ctx->init_hash[i], *nnode = NULL;
+        while (node != NULL) {
+            nnode = node->next;
+            node->next = NULL;
+            parray[p++] = node;
+            node = nnode;
+        }
+    }
+    BUG_ON(p != mpm_ctx->pattern_cnt);
+
+    /* we no longer need the hash, so free it's memory */
+    SCFree(mpm_ctx->init_hash);
+    mpm_ctx->init_hash = NULL;
+
+    qsort(parray, mpm_ctx->pattern_cnt, sizeof(MpmPattern *), SCTeddyPatternCompare);
+
+    ctx->patterns = SCMalloc(mpm_ctx->pattern_cnt * sizeof(SCTeddyPattern));
+    if (ctx->patterns == NULL)
+        goto error;
+    memset(ctx->patterns, 0, mpm_ctx->pattern_cnt * sizeof(SCTeddyPattern));
+    ctx->pattern_cnt = mpm_ctx->pattern_cnt;
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += mpm_ctx->pattern_cnt * sizeof(SCTeddyPattern);
+
+    ctx->masks = MIN(TEDDY_MAX_MASKS, mpm_ctx->minlen);
+
+    /* spread the sorted patterns evenly over the buckets */
+    uint32_t b;
+    for (b = 0; b <= TEDDY_BUCKETS; b++) {
+        ctx->bucket_start[b] = (ctx->pattern_cnt * b) / TEDDY_BUCKETS;
+    }
+
+    b = 0;
+    for (i = 0; i < ctx->pattern_cnt; i++) {
+        MpmPattern *mp = parray[i];
+        SCTeddyPattern *tp = &ctx->patterns[i];
+
+        while (i >= ctx->bucket_start[b + 1])
+            b++;
+
+        tp->len = mp->len;
+        tp->id = mp->id;
+        tp->nocase = (mp->flags & MPM_PATTERN_FLAG_NOCASE) ? 1 : 0;
+        tp->pat = SCMalloc(mp->len);
+        if (tp->pat == NULL)
+            goto error;
+        memcpy(tp->pat, tp->nocase ? mp->ci : mp->original_pat, mp->len);
+        mpm_ctx->memory_cnt++;
+        mpm_ctx->memory_size += mp->len;
+
+        /* the teddy pattern now owns the sids */
+        tp->sids_size = mp->sids_size;
+        tp->sids = mp->sids;
+        mp->sids_size = 0;
+        mp->sids = NULL;
+
+        uint32_t m;
+        for (m = 0; m < ctx->masks; m++) {
+            uint8_t c = tp->pat[m];
+            SCTeddySetNibbles(ctx, m, c, 1 << b);
+            if (tp->nocase && c >= 'a' && c <= 'z')
+                SCTeddySetNibbles(ctx, m, c - 'a' + 'A', 1 << b);
+        }
+    }
+
+    for (i = 0; i < mpm_ctx->pattern_cnt; i++) {
+        MpmFreePattern(mpm_ctx, parray[i]);
+    }
+    SCFree(parray);
+
+    ctx->pattern_id_bitarray_size = (mpm_ctx->max_pat_id / 8) + 1;
+    return 0;
+
+error:
+    if (parray != NULL) {
+        for (i = 0; i < p; i++) {
+            MpmFreePattern(mpm_ctx, parray[i]);
+        }
+        SCFree(parray);
+    }
+    return -1;
+}
+
+/**
+ * \brief Init the mpm thread context. There is no per thread state.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ */
+void SCTeddyInitThreadCtx(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx)
+{
+    memset(mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+}
+
+/**
+ * \brief Initialize the teddy context.
+ *
+ * \param mpm_ctx       Mpm context.
+ */
+void SCTeddyInitCtx(MpmCtx *mpm_ctx)
+{
+    if (mpm_ctx->ctx != NULL)
+        return;
+
+    mpm_ctx->ctx = SCMallocAligned(sizeof(SCTeddyCtx), 16);
+    if (mpm_ctx->ctx == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    memset(mpm_ctx->ctx, 0, sizeof(SCTeddyCtx));
+
+    mpm_ctx->memory_cnt++;
+    mpm_ctx->memory_size += sizeof(SCTeddyCtx);
+
+    /* initialize the hash we use to speed up pattern insertions */
+    mpm_ctx->init_hash = SCMalloc(sizeof(MpmPattern *) * MPM_INIT_HASH_SIZE);
+    if (mpm_ctx->init_hash == NULL) {
+        exit(EXIT_FAILURE);
+    }
+    memset(mpm_ctx->init_hash, 0, sizeof(MpmPattern *) * MPM_INIT_HASH_SIZE);
+}
+
+void SCTeddyDestroyThreadCtx(MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx)
+{
+}
+
+/**
+ * \brief Destroy the mpm context.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ */
+void SCTeddyDestroyCtx(MpmCtx *mpm_ctx)
+{
+    SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+    if (ctx == NULL)
+        return;
+
+    if (mpm_ctx->init_hash != NULL) {
+        uint32_t i;
+        for (i = 0; i < MPM_INIT_HASH_SIZE; i++) {
+            MpmPattern *node = mpm_ctx->init_hash[i], *nnode = NULL;
+            while (node != NULL) {
+                nnode = node->next;
+                MpmFreePattern(mpm_ctx, node);
+                node = nnode;
+            }
+        }
+        SCFree(mpm_ctx->init_hash);
+        mpm_ctx->init_hash = NULL;
+    }
+
+    if (ctx->patterns != NULL) {
+        uint32_t i;
+        for (i = 0; i < ctx->pattern_cnt; i++) {
+            if (ctx->patterns[i].pat != NULL)
+                SCFree(ctx->patterns[i].pat);
+            if (ctx->patterns[i].sids != NULL)
+                SCFree(ctx->patterns[i].sids);
+        }
+        SCFree(ctx->patterns);
+    }
+
+    if (ctx->ac_ctx != NULL) {
+        mpm_table[MPM_AC].DestroyCtx(ctx->ac_ctx);
+        SCFree(ctx->ac_ctx);
+    }
+
+    SCFreeAligned(mpm_ctx->ctx);
+    mpm_ctx->ctx = NULL;
+    mpm_ctx->memory_cnt--;
+    mpm_ctx->memory_size -= sizeof(SCTeddyCtx);
+}
+
+/**
+ * \brief Compare the patterns of the buckets in 'buckets' to the buffer
+ *        at 'offset'.
+ *
+ * \retval matches number of patterns that matched
+ */
+static inline uint32_t SCTeddyVerify(const SCTeddyCtx *ctx, uint32_t buckets,
+        PatternMatcherQueue *pmq, const uint8_t *buf, uint16_t buflen,
+        uint32_t offset, uint8_t *bitarray)
+{
+    uint32_t matches = 0;
+
+    while (buckets != 0) {
+        uint32_t b = __builtin_ctz(buckets);
+        buckets &= buckets - 1;
+
+        uint32_t i;
+        for (i = ctx->bucket_start[b]; i < ctx->bucket_start[b + 1]; i++) {
+            const SCTeddyPattern *tp = &ctx->patterns[i];
+            if (tp->len > buflen - offset)
+                continue;
+
+            if (tp->nocase) {
+                if (SCMemcmpLowercase(tp->pat, buf + offset, tp->len) != 0)
+                    continue;
+            } else {
+                if (SCMemcmp(tp->pat, buf + offset, tp->len) != 0)
+                    continue;
+            }
+
+            if (!(bitarray[tp->id / 8] & (1 << (tp->id % 8)))) {
+                bitarray[tp->id / 8] |= (1 << (tp->id % 8));
+                MpmAddSids(pmq, tp->sids, tp->sids_size);
+            }
+            matches++;
+        }
+    }
+
+    return matches;
+}
+
+/** \brief non-SIMD lookup of the buckets for a single position */
+static inline uint32_t SCTeddyBuckets(const SCTeddyCtx *ctx, const uint8_t *buf)
+{
+    uint32_t buckets = 0xff;
+    uint32_t m;
+
+    for (m = 0; m < ctx->masks; m++) {
+        buckets &= ctx->nibble_mask[m][0][buf[m] & 0x0f] &
+                   ctx->nibble_mask[m][1][buf[m] >> 4];
+    }
+    return buckets;
+}
+
+#if defined(__AVX2__)
+#define TEDDY_BLOCK 32
+
+/** \brief bucket masks for TEDDY_BLOCK positions starting at buf
+ *  \retval 1 if any position has a candidate bucket */
+static inline int SCTeddyBlock(const SCTeddyCtx *ctx, const uint8_t *buf,
+        uint8_t *out)
+{
+    const __m256i low4 = _mm256_set1_epi8(0x0f);
+    __m256i res = _mm256_set1_epi8((char)0xff);
+    uint32_t m;
+
+    for (m = 0; m < ctx->masks; m++) {
+        const __m256i lo_tbl = _mm256_broadcastsi128_si256(
+                _mm_load_si128((const __m128i *)ctx->nibble_mask[m][0]));
+        const __m256i hi_tbl = _mm256_broadcastsi128_si256(
+                _mm_load_si128((const __m128i *)ctx->nibble_mask[m][1]));
+        __m256i v = _mm256_loadu_si256((const __m256i *)(buf + m));
+        __m256i lo = _mm256_and_si256(v, low4);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low4);
+        res = _mm256_and_si256(res, _mm256_and_si256(
+                    _mm256_shuffle_epi8(lo_tbl, lo),
+                    _mm256_shuffle_epi8(hi_tbl, hi)));
+    }
+
+    if (_mm256_testz_si256(res, res))
+        return 0;
+    _mm256_storeu_si256((__m256i *)out, res);
+    return 1;
+}
+#elif defined(__SSSE3__)
+#define TEDDY_BLOCK 16
+
+static inline int SCTeddyBlock(const SCTeddyCtx *ctx, const uint8_t *buf,
+        uint8_t *out)
+{
+    const __m128i low4 = _mm_set1_epi8(0x0f);
+    __m128i res = _mm_set1_epi8((char)0xff);
+    uint32_t m;
+
+    for (m = 0; m < ctx->masks; m++) {
+        const __m128i lo_tbl = _mm_load_si128((const __m128i *)ctx->nibble_mask[m][0]);
+        const __m128i hi_tbl = _mm_load_si128((const __m128i *)ctx->nibble_mask[m][1]);
+        __m128i v = _mm_loadu_si128((const __m128i *)(buf + m));
+        __m128i lo = _mm_and_si128(v, low4);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), low4);
+        res = _mm_and_si128(res, _mm_and_si128(
+                    _mm_shuffle_epi8(lo_tbl, lo),
+                    _mm_shuffle_epi8(hi_tbl, hi)));
+    }
+
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(res, _mm_setzero_si128())) == 0xffff)
+        return 0;
+    _mm_storeu_si128((__m128i *)out, res);
+    return 1;
+}
+#endif
+
+/**
+ * \brief The teddy search function.
+ *
+ * \param mpm_ctx        Pointer to the mpm context.
+ * \param mpm_thread_ctx Pointer to the mpm thread context.
+ * \param pmq            Pointer to the Pattern Matcher Queue to hold
+ *                       search matches.
+ * \param buf            Buffer to be searched.
+ * \param buflen         Buffer length.
+ *
+ * \retval matches Match count.
+ */
+uint32_t SCTeddySearch(const MpmCtx *mpm_ctx, MpmThreadCtx *mpm_thread_ctx,
+                       PatternMatcherQueue *pmq, const uint8_t *buf, uint16_t buflen)
+{
+    const SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+    uint32_t matches = 0;
+    uint32_t i = 0;
+
+    if (ctx->ac_ctx != NULL)
+        return mpm_table[MPM_AC].Search(ctx->ac_ctx, mpm_thread_ctx, pmq,
+                                        buf, buflen);
+
+    if (ctx->pattern_cnt == 0 || buflen < ctx->masks)
+        return 0;
+
+    uint8_t bitarray[ctx->pattern_id_bitarray_size];
+    memset(bitarray, 0, ctx->pattern_id_bitarray_size);
+
+#ifdef TEDDY_SIMD
+    /* full blocks, the loads for the last mask byte must stay in buf */
+    uint8_t res[TEDDY_BLOCK];
+    for ( ; i + TEDDY_BLOCK + ctx->masks - 1 <= buflen; i += TEDDY_BLOCK) {
+        if (SCTeddyBlock(ctx, buf + i, res) == 0)
+            continue;
+
+        uint32_t j;
+        for (j = 0; j < TEDDY_BLOCK; j++) {
+            if (res[j] != 0) {
+                matches += SCTeddyVerify(ctx, res[j], pmq, buf, buflen,
+                                         i + j, bitarray);
+            }
+        }
+    }
+#endif
+
+    /* the tail */
+    for ( ; i + ctx->masks <= buflen; i++) {
+        uint32_t buckets = SCTeddyBuckets(ctx, buf + i);
+        if (buckets != 0) {
+            matches += SCTeddyVerify(ctx, buckets, pmq, buf, buflen,
+                                     i, bitarray);
+        }
+    }
+
+    return matches;
+}
+
+/**
+ * \brief Add a case insensitive pattern.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ * \param pat     The pattern to add.
+ * \param patnen  The pattern length.
+ * \param offset  Ignored.
+ * \param depth   Ignored.
+ * \param pid     The pattern id.
+ * \param sid     Ignored.
+ * \param flags   Flags associated with this pattern.
+ *
+ * \retval  0 On success.
+ * \retval -1 On failure.
+ */
+int SCTeddyAddPatternCI(MpmCtx *mpm_ctx, uint8_t *pat, uint16_t patlen,
+                        uint16_t offset, uint16_t depth, uint32_t pid,
+                        SigIntId sid, uint8_t flags)
+{
+    flags |= MPM_PATTERN_FLAG_NOCASE;
+    return MpmAddPattern(mpm_ctx, pat, patlen, offset, depth, pid, sid, flags);
+}
+
+/**
+ * \brief Add a case sensitive pattern.
+ *
+ * \param mpm_ctx Pointer to the mpm context.
+ * \param pat     The pattern to add.
+ * \param patnen  The pattern length.
+ * \param offset  Ignored.
+ * \param depth   Ignored.
+ * \param pid     The pattern id.
+ * \param sid     Ignored.
+ * \param flags   Flags associated with this pattern.
+ *
+ * \retval  0 On success.
+ * \retval -1 On failure.
+ */
+int SCTeddyAddPatternCS(MpmCtx *mpm_ctx, uint8_t *pat, uint16_t patlen,
+                        uint16_t offset, uint16_t depth, uint32_t pid,
+                        SigIntId sid, uint8_t flags)
+{
+    return MpmAddPattern(mpm_ctx, pat, patlen, offset, depth, pid, sid, flags);
+}
+
+void SCTeddyPrintSearchStats(MpmThreadCtx *mpm_thread_ctx)
+{
+}
+
+void SCTeddyPrintInfo(MpmCtx *mpm_ctx)
+{
+    SCTeddyCtx *ctx = (SCTeddyCtx *)mpm_ctx->ctx;
+
+    printf("MPM Teddy Information:\n");
+    printf("Memory allocs:   %" PRIu32 "\n", mpm_ctx->memory_cnt);
+    printf("Memory alloced:  %" PRIu32 "\n", mpm_ctx->memory_size);
+    printf(" Sizeof:\n");
+    printf("  MpmCtx         %" PRIuMAX "\n", (uintmax_t)sizeof(MpmCtx));
+    printf("  SCTeddyCtx:    %" PRIuMAX "\n", (uintmax_t)sizeof(SCTeddyCtx));
+    printf("Unique Patterns: %" PRIu32 "\n", mpm_ctx->pattern_cnt);
+    printf("Smallest:        %" PRIu32 "\n", mpm_ctx->minlen);
+    printf("Largest:         %" PRIu32 "\n", mpm_ctx->maxlen);
+    if (ctx->ac_ctx != NULL) {
+        printf("Using ac for this pattern set\n");
+    } else {
+        printf("Mask bytes:      %" PRIu32 "\n", ctx->masks);
+    }
+    printf("\n");
+}
+
+/************************** Mpm Registration ***************************/
+
+/**
+ * \brief Register the teddy mpm.
+ */
+void MpmTeddyRegister(void)
+{
+    mpm_table[MPM_TEDDY].name = "teddy";
+    mpm_table[MPM_TEDDY].InitCtx = SCTeddyInitCtx;
+    mpm_table[MPM_TEDDY].InitThreadCtx = SCTeddyInitThreadCtx;
+    mpm_table[MPM_TEDDY].DestroyCtx = SCTeddyDestroyCtx;
+    mpm_table[MPM_TEDDY].DestroyThreadCtx = SCTeddyDestroyThreadCtx;
+    mpm_table[MPM_TEDDY].AddPattern = SCTeddyAddPatternCS;
+    mpm_table[MPM_TEDDY].AddPatternNocase = SCTeddyAddPatternCI;
+    mpm_table[MPM_TEDDY].Prepare = SCTeddyPreparePatterns;
+    mpm_table[MPM_TEDDY].Search = SCTeddySearch;
+    mpm_table[MPM_TEDDY].Cleanup = NULL;
+    mpm_table[MPM_TEDDY].PrintCtx = SCTeddyPrintInfo;
+    mpm_table[MPM_TEDDY].PrintThreadCtx = SCTeddyPrintSearchStats;
+    mpm_table[MPM_TEDDY].RegisterUnittests = SCTeddyRegisterTests;
+}
+
+/*************************************Unittests********************************/
+
+#ifdef UNITTESTS
+
+/** \internal search buf with both teddy and ac and compare the results */
+static int SCTeddyCompareWithAC(const char **patterns, int pattern_cnt,
+        int nocase, const uint8_t *buf, uint16_t buflen, uint32_t *matches)
+{
+    MpmCtx teddy_ctx, ac_ctx;
+    MpmThreadCtx teddy_thread_ctx, ac_thread_ctx;
+    PatternMatcherQueue teddy_pmq, ac_pmq;
+    int result = 0;
+    int i;
+
+    memset(&teddy_ctx, 0, sizeof(MpmCtx));
+    memset(&ac_ctx, 0, sizeof(MpmCtx));
+    MpmInitCtx(&teddy_ctx, MPM_TEDDY);
+    MpmInitCtx(&ac_ctx, MPM_AC);
+    mpm_table[MPM_TEDDY].InitThreadCtx(&teddy_ctx, &teddy_thread_ctx);
+    mpm_table[MPM_AC].InitThreadCtx(&ac_ctx, &ac_thread_ctx);
+    PmqSetup(&teddy_pmq);
+    PmqSetup(&ac_pmq);
+
+    for (i = 0; i < pattern_cnt; i++) {
+        uint16_t len = strlen(patterns[i]);
+        if (nocase) {
+            MpmAddPatternCI(&teddy_ctx, (uint8_t *)patterns[i], len, 0, 0, i, i, 0);
+            MpmAddPatternCI(&ac_ctx, (uint8_t *)patterns[i], len, 0, 0, i, i, 0);
+        } else {
+            MpmAddPatternCS(&teddy_ctx, (uint8_t *)patterns[i], len, 0, 0, i, i, 0);
+            MpmAddPatternCS(&ac_ctx, (uint8_t *)patterns[i], len, 0, 0, i, i, 0);
+        }
+    }
+    SCTeddyPreparePatterns(&teddy_ctx);
+    mpm_table[MPM_AC].Prepare(&ac_ctx);
+
+    uint32_t teddy_cnt = SCTeddySearch(&teddy_ctx, &teddy_thread_ctx,
+                                       &teddy_pmq, buf, buflen);
+    uint32_t ac_cnt = mpm_table[MPM_AC].Search(&ac_ctx, &ac_thread_ctx,
+                                               &ac_pmq, buf, buflen);
+
+    if (teddy_cnt != ac_cnt) {
+        printf("teddy %u != ac %u: ", teddy_cnt, ac_cnt);
+        goto end;
+    }
+    if (teddy_pmq.rule_id_array_cnt != ac_pmq.rule_id_array_cnt) {
+        printf("teddy sids %u != ac sids %u: ", teddy_pmq.rule_id_array_cnt,
+                ac_pmq.rule_id_array_cnt);
+        goto end;
+    }
+    /* the order of the sids differs, compare them as a set */
+    uint32_t teddy_sids = 0, ac_sids = 0;
+    uint32_t u;
+    for (u = 0; u < teddy_pmq.rule_id_array_cnt; u++) {
+        teddy_sids |= 1 << (teddy_pmq.rule_id_array[u] % 32);
+        ac_sids |= 1 << (ac_pmq.rule_id_array[u] % 32);
+    }
+    if (teddy_sids != ac_sids) {
+        printf("teddy sids %08x != ac sids %08x: ", teddy_sids, ac_sids);
+        goto end;
+    }
+
+    *matches = teddy_cnt;
+    result = 1;
+end:
+    SCTeddyDestroyCtx(&teddy_ctx);
+    mpm_table[MPM_AC].DestroyCtx(&ac_ctx);
+    SCTeddyDestroyThreadCtx(&teddy_ctx, &teddy_thread_ctx);
+    mpm_table[MPM_AC].DestroyThreadCtx(&ac_ctx, &ac_thread_ctx);
+    PmqFree(&teddy_pmq);
+    PmqFree(&ac_pmq);
+    return result;
+}
+
+static int SCTeddyTest01(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    memset(&mpm_thread_ctx, 0, sizeof(MpmThreadCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY);
+    SCTeddyInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+
+    /* 1 match */
+    MpmAddPatternCS(&mpm_ctx, (uint8_t *)"abcd", 4, 0, 0, 0, 0, 0);
+    PmqSetup(&pmq);
+
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    char *buf = "abcdefghjiklmnopqrstuvwxyz";
+
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                                 (uint8_t *)buf, strlen(buf));
+
+    if (cnt == 1)
+        result = 1;
+    else
+        printf("1 != %" PRIu32 " ",cnt);
+
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+/** \test matches in and past the SIMD blocks, and at the very end */
+static int SCTeddyTest02(void)
+{
+    const char *patterns[] = { "abcd", "bcde", "fghj", "xyz", "z" };
+    const char *buf = "abcdefghjiklmnopqrstuvwxyzabcdefghjiklmnopqrstuvwxyz"
+        "abcdefghjiklmnopqrstuvwxyz";
+    uint32_t matches = 0;
+
+    if (SCTeddyCompareWithAC(patterns, 5, 0, (const uint8_t *)buf,
+                strlen(buf), &matches) == 0)
+        return 0;
+    if (matches != 15) {
+        printf("15 != %u: ", matches);
+        return 0;
+    }
+    return 1;
+}
+
+/** \test case sensitive patterns don't match the wrong case */
+static int SCTeddyTest03(void)
+{
+    const char *patterns[] = { "ABCD", "Bcde", "fGHJ" };
+    const char *buf = "abcdefghjiklmnopqrstuvwxyzABCDEFGHJIKLMNOPQRSTUVWXYZ";
+    uint32_t matches = 0;
+
+    if (SCTeddyCompareWithAC(patterns, 3, 0, (const uint8_t *)buf,
+                strlen(buf), &matches) == 0)
+        return 0;
+    if (matches != 1) {
+        printf("1 != %u: ", matches);
+        return 0;
+    }
+    return 1;
+}
+
+/** \test nocase patterns */
+static int SCTeddyTest04(void)
+{
+    const char *patterns[] = { "ABCD", "Bcde", "fGHJ", "wxyz" };
+    const char *buf = "abcdefghjiklmnopqrstuvwxyzABCDEFGHJIKLMNOPQRSTUVWXYZ";
+    uint32_t matches = 0;
+
+    if (SCTeddyCompareWithAC(patterns, 4, 1, (const uint8_t *)buf,
+                strlen(buf), &matches) == 0)
+        return 0;
+    if (matches != 8) {
+        printf("8 != %u: ", matches);
+        return 0;
+    }
+    return 1;
+}
+
+/** \test more patterns than teddy handles, so ac is used */
+static int SCTeddyTest05(void)
+{
+    int result = 0;
+    MpmCtx mpm_ctx;
+    MpmThreadCtx mpm_thread_ctx;
+    PatternMatcherQueue pmq;
+    char pat[8];
+    uint32_t i;
+
+    memset(&mpm_ctx, 0, sizeof(MpmCtx));
+    MpmInitCtx(&mpm_ctx, MPM_TEDDY);
+    SCTeddyInitThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqSetup(&pmq);
+
+    for (i = 0; i < TEDDY_MAX_PATTERNS + 1; i++) {
+        snprintf(pat, sizeof(pat), "p%04u", i);
+        MpmAddPatternCS(&mpm_ctx, (uint8_t *)pat, strlen(pat), 0, 0, i, i, 0);
+    }
+    SCTeddyPreparePatterns(&mpm_ctx);
+
+    if (((SCTeddyCtx *)mpm_ctx.ctx)->ac_ctx == NULL) {
+        printf("not using ac: ");
+        goto end;
+    }
+
+    char *buf = "xxp0001xxp0064xxp0065";
+    uint32_t cnt = SCTeddySearch(&mpm_ctx, &mpm_thread_ctx, &pmq,
+                                 (uint8_t *)buf, strlen(buf));
+    if (cnt != 2) {
+        printf("2 != %u: ", cnt);
+        goto end;
+    }
+
+    result = 1;
+end:
+    SCTeddyDestroyCtx(&mpm_ctx);
+    SCTeddyDestroyThreadCtx(&mpm_ctx, &mpm_thread_ctx);
+    PmqFree(&pmq);
+    return result;
+}
+
+/** \test binary patterns and a buffer shorter than a SIMD block */
+static int SCTeddyTest06(void)
+{
+    const char *patterns[] = { "\x01\xff", "\xff\x80\x7f", "\x7f" };
+    const uint8_t buf[] = { 0x01, 0xff, 0x80, 0x7f, 0x01, 0xff };
+    uint32_t matches = 0;
+
+    if (SCTeddyCompareWithAC(patterns, 3, 0, buf, sizeof(buf), &matches) == 0)
+        return 0;
+    if (matches != 4) {
+        printf("4 != %u: ", matches);
+        return 0;
+    }
+    return 1;
+}
+#endif /* UNITTESTS */
+
+void SCTeddyRegisterTests(void)
+{
+#ifdef UNITTESTS
+    UtRegisterTest("SCTeddyTest01", SCTeddyTest01);
+    UtRegisterTest("SCTeddyTest02", SCTeddyTest02);
+    UtRegisterTest("SCTeddyTest03", SCTeddyTest03);
+    UtRegisterTest("SCTeddyTest04", SCTeddyTest04);
+    UtRegisterTest("SCTeddyTest05", SCTeddyTest05);
+    UtRegisterTest("SCTeddyTest06", SCTeddyTest06);
+#endif /* UNITTESTS */
+}
@@ -0,0 +1,68 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * SIMD multi literal matcher for small pattern sets, after the "Teddy"
+ * algorithm. Larger sets are handed to the aho-corasick mpm.
+ */
+
+#ifndef __UTIL_MPM_TEDDY__H__
+#define __UTIL_MPM_TEDDY__H__
+
+/** number of buckets, one bit per bucket in the nibble masks */
+#define TEDDY_BUCKETS       8
+/** number of leading pattern bytes checked by the SIMD filter */
+#define TEDDY_MAX_MASKS     3
+/** pattern sets larger than this are handled by ac */
+#define TEDDY_MAX_PATTERNS  64
+
+typedef struct SCTeddyPattern_ {
+    /* pattern, lowercase if nocase */
+    uint8_t *pat;
+    uint16_t len;
+    uint8_t nocase;
+    /* pattern id */
+    uint32_t id;
+
+    /* sid(s) for this pattern */
+    uint32_t sids_size;
+    SigIntId *sids;
+} SCTeddyPattern;
+
+typedef struct SCTeddyCtx_ {
+    /* per mask byte, the buckets for each low (0) and high (1) nibble */
+    uint8_t nibble_mask[TEDDY_MAX_MASKS][2][16] __attribute__((aligned(16)));
+    /* number of masks in use, min(TEDDY_MAX_MASKS, minlen) */
+    uint32_t masks;
+
+    /* patterns, sorted by bucket */
+    SCTeddyPattern *patterns;
+    uint32_t pattern_cnt;
+    /* bucket b holds patterns[bucket_start[b]] up to patterns[bucket_start[b+1]] */
+    uint32_t bucket_start[TEDDY_BUCKETS + 1];
+
+    uint32_t pattern_id_bitarray_size;
+
+    /* ac ctx when the pattern set is too large for teddy */
+    MpmCtx *ac_ctx;
+} SCTeddyCtx;
+
+void MpmTeddyRegister(void);
+
+#endif /* __UTIL_MPM_TEDDY__H__ */
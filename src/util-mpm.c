@@ -32,6 +32,7 @@
 #include "util-mpm-ac-bs.h"
 #include "util-mpm-ac-tile.h"
 #include "util-mpm-hs.h"
+#include "util-mpm-teddy.h"
 #include "util-hashlist.h"
 
 #include "detect-engine.h"
@@ -515,6 +516,7 @@ void MpmTableSetup(void)
     MpmACRegister();
     MpmACBSRegister();
     MpmACTileRegister();
+    MpmTeddyRegister();
 #ifdef BUILD_HYPERSCAN
     MpmHSRegister();
 #endif /* BUILD_HYPERSCAN */
@@ -39,6 +39,7 @@ enum {
     MPM_AC_BS,
     MPM_AC_TILE,
     MPM_HS,
+    MPM_TEDDY,
     /* table size */
     MPM_TABLE_SIZE,
 };
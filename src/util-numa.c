@@ -0,0 +1,474 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * NUMA node awareness for memory pools.
+ *
+ * The node topology is read from sysfs. A thread that is pinned to the
+ * cpus of a single node is considered local to that node. Memory is
+ * placed by the kernel's first touch policy: pools that are filled from
+ * the main thread are filled per node with the main thread temporarily
+ * bound to the cpus of that node (NumaRunOnNode).
+ *
+ * Pools are only split over the nodes the packet threads are pinned to by
+ * the cpu affinity settings, weighted by the number of cpus they use on
+ * each node. Without pinning, or with all packet threads on one node, a
+ * single set of pools is used. The node numbers used by the pools are
+ * indexes in that list of nodes, not the system's node ids.
+ */
+
+#include "suricata-common.h"
+#include "conf.h"
+#include "counters.h"
+#include "util-atomic.h"
+#include "util-debug.h"
+#include "util-affinity.h"
+#include "util-numa.h"
+#include "util-unittest.h"
+
+typedef struct NumaNode_ {
+#ifdef __linux__
+    cpu_set_t cpus;
+#endif
+    /** system node id */
+    uint32_t id;
+    /** cpus the packet threads use on the node, for its share of the pools */
+    uint32_t weight;
+    SC_ATOMIC_DECLARE(uint64_t, memuse);
+} NumaNode;
+
+/** the nodes with packet threads pinned to them */
+static NumaNode numa_nodes[NUMA_MAX_NODES];
+/** number of nodes we keep separate pools for, 1 if not numa aware */
+static uint32_t numa_node_cnt = 1;
+static uint32_t numa_weight_total = 0;
+
+#if defined(__linux__) && defined(TLS)
+/** node of the calling thread, -1 if the thread isn't bound to one node */
+static __thread int numa_thread_node = -1;
+#endif
+
+#ifdef __linux__
+/**
+ *  \brief parse a sysfs cpulist like "0-7,16-23"
+ *
+ *  \retval cnt number of cpus in the list, -1 on a parse error
+ */
+static int NumaParseCpuList(const char *str, cpu_set_t *set)
+{
+    int cnt = 0;
+
+    CPU_ZERO(set);
+
+    while (*str != '\0' && *str != '\n') {
+        char *end = NULL;
+        long a = strtol(str, &end, 10);
+        if (end == str || a < 0 || a >= CPU_SETSIZE)
+            return -1;
+        long b = a;
+        str = end;
+        if (*str == '-') {
+            str++;
+            b = strtol(str, &end, 10);
+            if (end == str || b < a || b >= CPU_SETSIZE)
+                return -1;
+            str = end;
+        }
+        for ( ; a <= b; a++) {
+            CPU_SET(a, set);
+            cnt++;
+        }
+        if (*str == ',')
+            str++;
+        else if (*str != '\0' && *str != '\n')
+            return -1;
+    }
+    return cnt;
+}
+#endif /* __linux__ */
+
+#if defined(__linux__) && defined(TLS)
+/** thread types that handle packets and so use the flow and segment pools */
+static const int numa_packet_cpu_sets[] = {
+    RECEIVE_CPU_SET,
+    DECODE_CPU_SET,
+    STREAM_CPU_SET,
+    DETECT_CPU_SET,
+    VERDICT_CPU_SET,
+};
+
+/**
+ *  \brief number of cpus the packet threads will be pinned to on a node
+ *
+ *  Exclusive mode pins each thread to one cpu of the set. Balanced mode
+ *  pins the threads to the whole set, so they are only local to the node
+ *  if the set is.
+ */
+static uint32_t NumaNodePinnedCpus(const cpu_set_t *node_cpus)
+{
+    uint32_t weight = 0;
+    uint32_t i;
+
+    for (i = 0; i < sizeof(numa_packet_cpu_sets) / sizeof(numa_packet_cpu_sets[0]); i++) {
+        const ThreadsAffinityType *taf = &thread_affinity[numa_packet_cpu_sets[i]];
+        cpu_set_t and;
+
+        CPU_AND(&and, &taf->cpu_set, node_cpus);
+        int cnt = CPU_COUNT(&and);
+        if (cnt == 0)
+            continue;
+
+        if (taf->mode_flag == EXCLUSIVE_AFFINITY ||
+            cnt == CPU_COUNT(&taf->cpu_set))
+        {
+            weight += (uint32_t)cnt;
+        }
+    }
+    return weight;
+}
+#endif
+
+/**
+ *  \brief read the node topology and the "threading.numa-aware" setting
+ *
+ *  Needs to be called before the memory pools are set up. Loads the cpu
+ *  affinity settings to find the nodes the packet threads will run on.
+ */
+void NumaSetup(void)
+{
+    uint32_t n;
+
+    for (n = 0; n < NUMA_MAX_NODES; n++) {
+        SC_ATOMIC_INIT(numa_nodes[n].memuse);
+        numa_nodes[n].id = n;
+        numa_nodes[n].weight = 0;
+    }
+    numa_node_cnt = 1;
+    numa_weight_total = 0;
+
+    int enabled = 1;
+    (void)ConfGetBool("threading.numa-aware", &enabled);
+    if (!enabled) {
+        SCLogDebug("numa awareness disabled");
+        return;
+    }
+
+#if defined(__linux__) && defined(TLS)
+    int set_affinity = 0;
+    (void)ConfGetBool("threading.set-cpu-affinity", &set_affinity);
+    if (set_affinity)
+        AffinitySetupLoadFromConfig();
+
+    uint32_t nodes = 0;
+    uint32_t cnt = 0;
+    for (n = 0; n < NUMA_MAX_NODES; n++) {
+        char path[64];
+        char buf[1024];
+        cpu_set_t cpus;
+
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", n);
+        FILE *fp = fopen(path, "r");
+        if (fp == NULL)
+            break;
+        char *r = fgets(buf, sizeof(buf), fp);
+        fclose(fp);
+        if (r == NULL)
+            break;
+
+        if (NumaParseCpuList(buf, &cpus) <= 0)
+            break;
+        nodes++;
+        SCLogDebug("node %u: cpus %s", n, buf);
+
+        if (!set_affinity)
+            continue;
+
+        uint32_t weight = NumaNodePinnedCpus(&cpus);
+        if (weight == 0) {
+            SCLogDebug("node %u: no packet threads pinned to it", n);
+            continue;
+        }
+        numa_nodes[cnt].cpus = cpus;
+        numa_nodes[cnt].id = n;
+        numa_nodes[cnt].weight = weight;
+        numa_weight_total += weight;
+        cnt++;
+    }
+
+    if (nodes <= 1)
+        return;
+
+    if (cnt > 1) {
+        numa_node_cnt = cnt;
+        SCLogInfo("using node local memory pools for %u of %u NUMA nodes",
+                cnt, nodes);
+    } else {
+        SCLogInfo("%u NUMA nodes, but the packet threads are not pinned to "
+                "more than one: using a single set of memory pools. See "
+                "threading.set-cpu-affinity.", nodes);
+    }
+#endif
+}
+
+uint32_t NumaNodeCount(void)
+{
+    return numa_node_cnt;
+}
+
+/**
+ *  \brief part of a pool size for a node, by the share of the packet
+ *         threads' cpus on it. Node 0 also gets the remainder.
+ */
+uint32_t NumaNodeShare(uint32_t node, uint32_t total)
+{
+    uint32_t n;
+
+    if (numa_node_cnt <= 1 || numa_weight_total == 0)
+        return (node == 0) ? total : 0;
+    if (node >= numa_node_cnt)
+        return 0;
+    if (node > 0)
+        return (uint32_t)((uint64_t)total * numa_nodes[node].weight / numa_weight_total);
+
+    uint32_t share = total;
+    for (n = 1; n < numa_node_cnt; n++) {
+        share -= NumaNodeShare(n, total);
+    }
+    return share;
+}
+
+/** \brief node of the calling thread, 0 if it isn't bound to a single node */
+uint32_t NumaThreadNode(void)
+{
+#if defined(__linux__) && defined(TLS)
+    if (numa_thread_node >= 0)
+        return (uint32_t)numa_thread_node;
+#endif
+    return 0;
+}
+
+/**
+ *  \brief determine the node of the calling thread from its cpu affinity
+ *
+ *  To be called by a thread after its cpu affinity has been set up.
+ */
+void NumaThreadSetup(void)
+{
+#if defined(__linux__) && defined(TLS)
+    numa_thread_node = -1;
+
+    if (numa_node_cnt <= 1)
+        return;
+
+    cpu_set_t cs;
+    if (sched_getaffinity(0, sizeof(cs), &cs) != 0)
+        return;
+
+    uint32_t n;
+    for (n = 0; n < numa_node_cnt; n++) {
+        cpu_set_t and;
+        CPU_AND(&and, &cs, &numa_nodes[n].cpus);
+        if (CPU_EQUAL(&and, &cs)) {
+            numa_thread_node = (int)n;
+            SCLogDebug("thread is local to numa node %u", n);
+            return;
+        }
+    }
+#endif
+}
+
+/**
+ *  \brief run Func with the calling thread bound to the cpus of a node
+ *
+ *  Memory that Func touches first is placed on that node. The thread's
+ *  affinity is restored afterwards. Without numa awareness Func is just
+ *  called.
+ *
+ *  The thread counts as local to the node while Func runs even if it
+ *  can't be bound to its cpus, so that what Func sets up is tied to the
+ *  node's pools. Only the memory placement is lost then.
+ */
+void NumaRunOnNode(uint32_t node, void (*Func)(void *), void *data)
+{
+#if defined(__linux__) && defined(TLS)
+    if (numa_node_cnt > 1 && node < numa_node_cnt) {
+        cpu_set_t saved;
+        int bound = 0;
+
+        if (sched_getaffinity(0, sizeof(saved), &saved) == 0) {
+            if (sched_setaffinity(0, sizeof(cpu_set_t), &numa_nodes[node].cpus) == 0)
+                bound = 1;
+        }
+        if (!bound) {
+            SCLogDebug("failed to bind to the cpus of numa node %u: %s",
+                    numa_nodes[node].id, strerror(errno));
+        }
+
+        int saved_node = numa_thread_node;
+        numa_thread_node = (int)node;
+
+        Func(data);
+
+        numa_thread_node = saved_node;
+        if (bound && sched_setaffinity(0, sizeof(saved), &saved) != 0) {
+            SCLogWarning(SC_ERR_THREAD_INIT, "failed to restore the cpu "
+                    "affinity: %s", strerror(errno));
+        }
+        return;
+    }
+#endif
+    Func(data);
+}
+
+void NumaMemuseAdd(uint32_t node, uint64_t size)
+{
+    if (numa_node_cnt > 1 && node < NUMA_MAX_NODES)
+        (void)SC_ATOMIC_ADD(numa_nodes[node].memuse, size);
+}
+
+void NumaMemuseSub(uint32_t node, uint64_t size)
+{
+    if (numa_node_cnt > 1 && node < NUMA_MAX_NODES)
+        (void)SC_ATOMIC_SUB(numa_nodes[node].memuse, size);
+}
+
+#define NUMA_MEMUSE_COUNTER(n)                          \
+static uint64_t NumaMemuseNode##n(void)                 \
+{                                                       \
+    return SC_ATOMIC_GET(numa_nodes[(n)].memuse);       \
+}
+
+NUMA_MEMUSE_COUNTER(0)
+NUMA_MEMUSE_COUNTER(1)
+NUMA_MEMUSE_COUNTER(2)
+NUMA_MEMUSE_COUNTER(3)
+NUMA_MEMUSE_COUNTER(4)
+NUMA_MEMUSE_COUNTER(5)
+NUMA_MEMUSE_COUNTER(6)
+NUMA_MEMUSE_COUNTER(7)
+
+/** \brief register the per node memuse of the flow and segment pools */
+void NumaRegisterCounters(void)
+{
+    /* named by system node id */
+    static char *names[NUMA_MAX_NODES] = {
+        "numa.node0.memuse", "numa.node1.memuse",
+        "numa.node2.memuse", "numa.node3.memuse",
+        "numa.node4.memuse", "numa.node5.memuse",
+        "numa.node6.memuse", "numa.node7.memuse",
+    };
+    /* by pool node index */
+    static uint64_t (*funcs[NUMA_MAX_NODES])(void) = {
+        NumaMemuseNode0, NumaMemuseNode1, NumaMemuseNode2, NumaMemuseNode3,
+        NumaMemuseNode4, NumaMemuseNode5, NumaMemuseNode6, NumaMemuseNode7,
+    };
+
+    if (numa_node_cnt <= 1)
+        return;
+
+    uint32_t n;
+    for (n = 0; n < numa_node_cnt; n++) {
+        StatsRegisterGlobalCounter(names[numa_nodes[n].id], funcs[n]);
+    }
+}
+
+#ifdef UNITTESTS
+#ifdef __linux__
+static int NumaTestParseCpuList01(void)
+{
+    cpu_set_t set;
+
+    if (NumaParseCpuList("0\n", &set) != 1 || !CPU_ISSET(0, &set))
+        return 0;
+    if (NumaParseCpuList("0-3,8-11\n", &set) != 8)
+        return 0;
+    if (!CPU_ISSET(3, &set) || CPU_ISSET(4, &set) || !CPU_ISSET(11, &set))
+        return 0;
+    if (NumaParseCpuList("2,5", &set) != 2 || !CPU_ISSET(5, &set))
+        return 0;
+    if (NumaParseCpuList("\n", &set) != 0)
+        return 0;
+    if (NumaParseCpuList("3-1", &set) != -1)
+        return 0;
+    if (NumaParseCpuList("0-x", &set) != -1)
+        return 0;
+    return 1;
+}
+
+#ifdef TLS
+static void NumaTestRecordNode(void *data)
+{
+    *(uint32_t *)data = NumaThreadNode();
+}
+
+/** \test pools are split by weight, and a thread that can't be bound to
+ *        the cpus of a node still counts as local to it */
+static int NumaTestNodes01(void)
+{
+    uint32_t saved_cnt = numa_node_cnt;
+    uint32_t saved_total = numa_weight_total;
+    uint32_t node = 0;
+    int result = 0;
+
+    numa_node_cnt = 2;
+    numa_nodes[0].weight = 3;
+    numa_nodes[1].weight = 1;
+    numa_weight_total = 4;
+
+    if (NumaNodeShare(0, 1001) != 751 || NumaNodeShare(1, 1001) != 250)
+        goto end;
+    if (NumaNodeShare(2, 1001) != 0)
+        goto end;
+
+    /* no cpus: binding fails */
+    CPU_ZERO(&numa_nodes[1].cpus);
+    NumaRunOnNode(1, NumaTestRecordNode, &node);
+    if (node != 1)
+        goto end;
+    if (NumaThreadNode() != 0)
+        goto end;
+
+    numa_node_cnt = 1;
+    numa_weight_total = 0;
+    if (NumaNodeShare(0, 1001) != 1001 || NumaNodeShare(1, 1001) != 0)
+        goto end;
+
+    result = 1;
+end:
+    numa_node_cnt = saved_cnt;
+    numa_weight_total = saved_total;
+    numa_nodes[0].weight = 0;
+    numa_nodes[1].weight = 0;
+    return result;
+}
+#endif /* TLS */
+#endif /* __linux__ */
+#endif /* UNITTESTS */
+
+void NumaRegisterTests(void)
+{
+#ifdef UNITTESTS
+#ifdef __linux__
+    UtRegisterTest("NumaTestParseCpuList01", NumaTestParseCpuList01);
+#ifdef TLS
+    UtRegisterTest("NumaTestNodes01", NumaTestNodes01);
+#endif
+#endif
+#endif
+}
@@ -0,0 +1,45 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * NUMA node awareness for memory pools.
+ */
+
+#ifndef __UTIL_NUMA_H__
+#define __UTIL_NUMA_H__
+
+/** max NUMA nodes we keep separate pools for */
+#define NUMA_MAX_NODES  8
+
+void NumaSetup(void);
+void NumaRegisterCounters(void);
+
+uint32_t NumaNodeCount(void);
+uint32_t NumaNodeShare(uint32_t node, uint32_t total);
+uint32_t NumaThreadNode(void);
+void NumaThreadSetup(void);
+
+void NumaRunOnNode(uint32_t node, void (*Func)(void *), void *data);
+
+void NumaMemuseAdd(uint32_t node, uint64_t size);
+void NumaMemuseSub(uint32_t node, uint64_t size);
+
+void NumaRegisterTests(void);
+
+#endif /* __UTIL_NUMA_H__ */
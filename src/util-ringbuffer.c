@@ -232,6 +232,50 @@ int RingBufferSrSw8Put(RingBuffer8 *rb, void *ptr)
     return 0;
 }
 
+/** \brief put a ptr in the ringbuffer without waiting if it's full
+ *
+ *  \retval 0 ok
+ *  \retval -1 buffer full
+ */
+int RingBufferSrSw8PutNoWait(RingBuffer8 *rb, void *ptr)
+{
+    if ((unsigned char)(SC_ATOMIC_GET(rb->write) + 1) == SC_ATOMIC_GET(rb->read))
+        return -1;
+
+    rb->array[SC_ATOMIC_GET(rb->write)] = ptr;
+    (void) SC_ATOMIC_ADD(rb->write, 1);
+    return 0;
+}
+
+/** \brief get up to max ptrs from the ringbuffer without waiting. The
+ *         read idx is updated once for the whole batch.
+ *
+ *  \param ptrs array to store the ptrs in
+ *  \param max size of the ptrs array
+ *
+ *  \retval cnt number of ptrs retrieved, 0 if the buffer is empty
+ */
+uint16_t RingBufferSrSw8GetBatch(RingBuffer8 *rb, void **ptrs, uint16_t max)
+{
+    unsigned char read = SC_ATOMIC_GET(rb->read);
+    const unsigned char write = SC_ATOMIC_GET(rb->write);
+    uint16_t cnt = 0;
+
+    while (read != write && cnt < max) {
+        ptrs[cnt++] = rb->array[read++];
+    }
+
+    if (cnt > 0)
+        (void) SC_ATOMIC_ADD(rb->read, (unsigned char)cnt);
+    return cnt;
+}
+
+/** \brief number of ptrs in the ringbuffer */
+uint16_t RingBuffer8Size(RingBuffer8 *rb)
+{
+    return (unsigned char)(SC_ATOMIC_GET(rb->write) - SC_ATOMIC_GET(rb->read));
+}
+
 /* Single Reader, Multi Writer, 8 bites */
 
 void *RingBufferSrMw8Get(RingBuffer8 *rb)
@@ -1073,6 +1117,68 @@ end:
     return result;
 }
 
+/**
+ *  \test non waiting put and batched get, wrapping around the end
+ */
+static int RingBuffer8SrSwBatch01 (void)
+{
+    int result = 0;
+    int array[300];
+    void *batch[32];
+    int cnt, n = 0, got = 0;
+    RingBuffer8 *rb = RingBuffer8Init();
+    if (rb == NULL)
+        return 0;
+
+    for (cnt = 0; cnt < 255; cnt++) {
+        if (RingBufferSrSw8PutNoWait(rb, &array[n++]) != 0)
+            goto end;
+    }
+    if (RingBufferSrSw8PutNoWait(rb, &array[n]) != -1) {
+        printf("put in full buffer should fail: ");
+        goto end;
+    }
+    if (RingBuffer8Size(rb) != 255)
+        goto end;
+
+    while (got < 200) {
+        uint16_t c = RingBufferSrSw8GetBatch(rb, batch, 32);
+        if (c == 0)
+            goto end;
+        for (cnt = 0; cnt < c; cnt++) {
+            if (batch[cnt] != &array[got]) {
+                printf("ptr %d out of order: ", got);
+                goto end;
+            }
+            got++;
+        }
+    }
+
+    /* refill past the wrap around point */
+    while (n < 300) {
+        if (RingBufferSrSw8PutNoWait(rb, &array[n++]) != 0)
+            goto end;
+    }
+    if (RingBuffer8Size(rb) != (uint16_t)(n - got))
+        goto end;
+
+    uint16_t c;
+    while ((c = RingBufferSrSw8GetBatch(rb, batch, 32)) > 0) {
+        for (cnt = 0; cnt < c; cnt++) {
+            if (batch[cnt] != &array[got])
+                goto end;
+            got++;
+        }
+    }
+    if (got != 300 || !(RingBuffer8IsEmpty(rb)))
+        goto end;
+
+    result = 1;
+end:
+    RingBuffer8Destroy(rb);
+    return result;
+}
+
 #endif /* UNITTESTS */
 
 void DetectRingBufferRegisterTests(void)
@@ -1083,6 +1189,7 @@ void DetectRingBufferRegisterTests(void)
     UtRegisterTest("RingBuffer8SrSwPut02", RingBuffer8SrSwPut02);
     UtRegisterTest("RingBuffer8SrSwGet01", RingBuffer8SrSwGet01);
     UtRegisterTest("RingBuffer8SrSwGet02", RingBuffer8SrSwGet02);
+    UtRegisterTest("RingBuffer8SrSwBatch01", RingBuffer8SrSwBatch01);
 #endif /* UNITTESTS */
 }
 
@@ -24,6 +24,7 @@
  */
 
 #ifndef __UTIL_RINGBUFFER_H__
+#define __UTIL_RINGBUFFER_H__
 
 #include "util-atomic.h"
 #include "threads.h"
@@ -95,6 +96,9 @@ void RingBufferWait(RingBuffer16 *rb);
  *  wrap around */
 void *RingBufferSrSw8Get(RingBuffer8 *);
 int RingBufferSrSw8Put(RingBuffer8 *, void *);
+int RingBufferSrSw8PutNoWait(RingBuffer8 *, void *);
+uint16_t RingBufferSrSw8GetBatch(RingBuffer8 *, void **, uint16_t);
+uint16_t RingBuffer8Size(RingBuffer8 *);
 
 /** Multiple Reader, Single Writer ring buffer, fixed at
  *  256 items so we can use unsigned char's that just
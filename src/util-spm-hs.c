@@ -76,6 +76,8 @@ static int HSBuildDatabase(const uint8_t *needle, uint16_t needle_len,
 
     unsigned flags = nocase ? HS_FLAG_CASELESS : 0;
 
+    /* Not cached on disk: a single literal compiles quickly, and caching
+     * would leave a file per content keyword in the cache directory. */
     hs_database_t *db = NULL;
     hs_compile_error_t *compile_err = NULL;
     hs_error_t err = hs_compile(expr, flags, HS_MODE_BLOCK, NULL, &db,
@@ -0,0 +1,263 @@
+/* Copyright (C) 2016 Open Information Security Foundation
+ *
+ * You can copy, redistribute or modify this Program under the terms of
+ * the GNU General Public License version 2 as published by the Free
+ * Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * version 2 along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * \file
+ *
+ * Single pattern matcher filtering on the first and last byte of the
+ * needle.
+ *
+ * For a block of 16 (SSE2) or 32 (AVX2) start offsets the haystack is
+ * loaded twice: at the offsets and at the offsets plus the needle length
+ * minus one. Both loads are compared against the first and last byte of
+ * the needle. Only offsets where both bytes match are checked further.
+ * There is no per pattern preprocessing beyond that, which makes it a
+ * good fit for the short contents most rules use.
+ *
+ * For nocase the needle is stored in lowercase. An alphabetic first or
+ * last byte is compared after setting the 0x20 bit of the haystack bytes,
+ * which maps the uppercase letters (and only those) onto the lowercase
+ * ones. Without SSE2 the same filter runs one byte at a time.
+ */
+
+#include "suricata-common.h"
+#include "suricata.h"
+
+#include "util-spm.h"
+#include "util-spm-simd.h"
+#include "util-debug.h"
+#include "util-memcmp.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SPM_SIMD_BLOCK 32
+typedef __m256i SpmVector;
+#define SPM_VEC_SET1(b)     _mm256_set1_epi8((char)(b))
+#define SPM_VEC_LOADU(p)    _mm256_loadu_si256((const __m256i *)(p))
+#define SPM_VEC_OR(a, b)    _mm256_or_si256((a), (b))
+#define SPM_VEC_AND(a, b)   _mm256_and_si256((a), (b))
+#define SPM_VEC_CMPEQ(a, b) _mm256_cmpeq_epi8((a), (b))
+#define SPM_VEC_MASK(v)     (uint32_t)_mm256_movemask_epi8((v))
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define SPM_SIMD_BLOCK 16
+typedef __m128i SpmVector;
+#define SPM_VEC_SET1(b)     _mm_set1_epi8((char)(b))
+#define SPM_VEC_LOADU(p)    _mm_loadu_si128((const __m128i *)(p))
+#define SPM_VEC_OR(a, b)    _mm_or_si128((a), (b))
+#define SPM_VEC_AND(a, b)   _mm_and_si128((a), (b))
+#define SPM_VEC_CMPEQ(a, b) _mm_cmpeq_epi8((a), (b))
+#define SPM_VEC_MASK(v)     (uint32_t)_mm_movemask_epi8((v))
+#endif
+
+typedef struct SpmSimdCtx_ {
+    uint8_t *needle;        /**< lowercase for nocase */
+    uint16_t needle_len;
+    int nocase;
+    uint8_t first;
+    uint8_t last;
+    /** 0x20 if the first/last byte is a letter in a nocase needle, so
+     *  that (byte | first_case) == first matches both cases */
+    uint8_t first_case;
+    uint8_t last_case;
+} SpmSimdCtx;
+
+static inline uint8_t SIMDCaseBit(uint8_t c, int nocase)
+{
+    return (nocase && c >= 'a' && c <= 'z') ? 0x20 : 0x00;
+}
+
+static SpmCtx *SIMDInitCtx(const uint8_t *needle, uint16_t needle_len,
+                           int nocase, SpmGlobalThreadCtx *global_thread_ctx)
+{
+    if (needle_len == 0) {
+        SCLogDebug("Empty needle.");
+        return NULL;
+    }
+
+    SpmCtx *ctx = SCMalloc(sizeof(SpmCtx));
+    if (ctx == NULL) {
+        SCLogDebug("Unable to alloc SpmCtx.");
+        return NULL;
+    }
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->matcher = SPM_SIMD;
+
+    SpmSimdCtx *sctx = SCMalloc(sizeof(SpmSimdCtx));
+    if (sctx == NULL) {
+        SCLogDebug("Unable to alloc SpmSimdCtx.");
+        SCFree(ctx);
+        return NULL;
+    }
+    memset(sctx, 0, sizeof(*sctx));
+
+    sctx->needle = SCMalloc(needle_len);
+    if (sctx->needle == NULL) {
+        SCLogDebug("Unable to alloc string.");
+        SCFree(sctx);
+        SCFree(ctx);
+        return NULL;
+    }
+    memcpy(sctx->needle, needle, needle_len);
+    sctx->needle_len = needle_len;
+
+    if (nocase) {
+        uint16_t i;
+        for (i = 0; i < needle_len; i++) {
+            sctx->needle[i] = u8_tolower(sctx->needle[i]);
+        }
+        sctx->nocase = 1;
+    }
+
+    sctx->first = sctx->needle[0];
+    sctx->last = sctx->needle[needle_len - 1];
+    sctx->first_case = SIMDCaseBit(sctx->first, sctx->nocase);
+    sctx->last_case = SIMDCaseBit(sctx->last, sctx->nocase);
+
+    ctx->ctx = sctx;
+    return ctx;
+}
+
+static void SIMDDestroyCtx(SpmCtx *ctx)
+{
+    if (ctx == NULL) {
+        return;
+    }
+
+    SpmSimdCtx *sctx = ctx->ctx;
+    if (sctx != NULL) {
+        if (sctx->needle != NULL) {
+            SCFree(sctx->needle);
+        }
+        SCFree(sctx);
+    }
+
+    SCFree(ctx);
+}
+
+/** \brief check the bytes between the first and the last one
+ *  \retval 1 match */
+static inline int SIMDVerify(const SpmSimdCtx *sctx, const uint8_t *buf)
+{
+    if (sctx->needle_len <= 2)
+        return 1;
+
+    if (sctx->nocase) {
+        return SCMemcmpLowercase(sctx->needle + 1, buf + 1,
+                                 sctx->needle_len - 2) == 0;
+    }
+    return SCMemcmp(sctx->needle + 1, buf + 1, sctx->needle_len - 2) == 0;
+}
+
+static uint8_t *SIMDScan(const SpmCtx *ctx, SpmThreadCtx *thread_ctx,
+                         const uint8_t *haystack, uint16_t haystack_len)
+{
+    const SpmSimdCtx *sctx = ctx->ctx;
+    const uint32_t len = sctx->needle_len;
+    uint32_t i = 0;
+
+    if (haystack_len < len)
+        return NULL;
+
+#ifdef SPM_SIMD_BLOCK
+    const SpmVector first = SPM_VEC_SET1(sctx->first);
+    const SpmVector last = SPM_VEC_SET1(sctx->last);
+    const SpmVector first_case = SPM_VEC_SET1(sctx->first_case);
+    const SpmVector last_case = SPM_VEC_SET1(sctx->last_case);
+
+    /* full blocks, the loads for the last byte must stay in the haystack */
+    for ( ; i + len - 1 + SPM_SIMD_BLOCK <= haystack_len; i += SPM_SIMD_BLOCK) {
+        SpmVector f = SPM_VEC_LOADU(haystack + i);
+        SpmVector l = SPM_VEC_LOADU(haystack + i + len - 1);
+
+        f = SPM_VEC_CMPEQ(SPM_VEC_OR(f, first_case), first);
+        l = SPM_VEC_CMPEQ(SPM_VEC_OR(l, last_case), last);
+
+        uint32_t bits = SPM_VEC_MASK(SPM_VEC_AND(f, l));
+        while (bits != 0) {
+            uint32_t pos = i + (uint32_t)__builtin_ctz(bits);
+            if (SIMDVerify(sctx, haystack + pos))
+                return (uint8_t *)haystack + pos;
+            bits &= bits - 1;
+        }
+    }
+#endif
+
+    /* remaining offsets, or all of them without SIMD support */
+    for ( ; i + len <= haystack_len; i++) {
+        if ((haystack[i] | sctx->first_case) == sctx->first &&
+            (haystack[i + len - 1] | sctx->last_case) == sctx->last &&
+            SIMDVerify(sctx, haystack + i))
+        {
+            return (uint8_t *)haystack + i;
+        }
+    }
+
+    return NULL;
+}
+
+static SpmGlobalThreadCtx *SIMDInitGlobalThreadCtx(void)
+{
+    SpmGlobalThreadCtx *global_thread_ctx = SCMalloc(sizeof(SpmGlobalThreadCtx));
+    if (global_thread_ctx == NULL) {
+        SCLogDebug("Unable to alloc SpmThreadCtx.");
+        return NULL;
+    }
+    memset(global_thread_ctx, 0, sizeof(*global_thread_ctx));
+    global_thread_ctx->matcher = SPM_SIMD;
+    return global_thread_ctx;
+}
+
+static void SIMDDestroyGlobalThreadCtx(SpmGlobalThreadCtx *global_thread_ctx)
+{
+    if (global_thread_ctx == NULL) {
+        return;
+    }
+    SCFree(global_thread_ctx);
+}
+
+static void SIMDDestroyThreadCtx(SpmThreadCtx *thread_ctx)
+{
+    if (thread_ctx == NULL) {
+        return;
+    }
+    SCFree(thread_ctx);
+}
+
+static SpmThreadCtx *SIMDMakeThreadCtx(const SpmGlobalThreadCtx *global_thread_ctx)
+{
+    SpmThreadCtx *thread_ctx = SCMalloc(sizeof(SpmThreadCtx));
+    if (thread_ctx == NULL) {
+        SCLogDebug("Unable to alloc SpmThreadCtx.");
+        return NULL;
+    }
+    memset(thread_ctx, 0, sizeof(*thread_ctx));
+    thread_ctx->matcher = SPM_SIMD;
+    return thread_ctx;
+}
+
+void SpmSIMDRegister(void)
+{
+    spm_table[SPM_SIMD].name = "simd";
+    spm_table[SPM_SIMD].InitGlobalThreadCtx = SIMDInitGlobalThreadCtx;
+    spm_table[SPM_SIMD].DestroyGlobalThreadCtx = SIMDDestroyGlobalThreadCtx;
+    spm_table[SPM_SIMD].MakeThreadCtx = SIMDMakeThreadCtx;
+    spm_table[SPM_SIMD].DestroyThreadCtx = SIMDDestroyThreadCtx;
+    spm_table[SPM_SIMD].InitCtx = SIMDInitCtx;
+    spm_table[SPM_SIMD].DestroyCtx = SIMDDestroyCtx;
+    spm_table[SPM_SIMD].Scan = SIMDScan;
+}
@@ -54,6 +54,7 @@
 #include "util-spm-bs2bm.h"
 #include "util-spm-bm.h"
 #include "util-spm-hs.h"
+#include "util-spm-simd.h"
 #include "util-clock.h"
 
 /**
@@ -101,6 +102,7 @@ void SpmTableSetup(void)
     memset(spm_table, 0, sizeof(spm_table));
 
     SpmBMRegister();
+    SpmSIMDRegister();
 #ifdef BUILD_HYPERSCAN
     SpmHSRegister();
 #endif
@@ -2637,6 +2639,79 @@ int SpmSearchTest02() {
     return ret;
 }
 
+int SpmSearchTest03() {
+    SpmTableSetup();
+    printf("\n");
+
+    /* Test longer haystacks, filled with near misses that share the first
+     * and last byte with the needle, so that matches span the block
+     * boundaries of vectorized matchers. */
+
+    static const char* needles[] = {
+        "ab", "abc", "abXc", "suricata", "Suricata", "a\xffz",
+    };
+
+    int ret = 1;
+
+    uint16_t matcher;
+    for (matcher = 0; matcher < SPM_TABLE_SIZE; matcher++) {
+        const SpmTableElmt *m = &spm_table[matcher];
+        if (m->name == NULL) {
+            continue;
+        }
+        printf("matcher: %s\n", m->name);
+
+        SpmTestData d;
+        char haystack[256];
+
+        uint32_t i;
+        for (i = 0; i < sizeof(needles) / sizeof(needles[0]); i++) {
+            const char *needle = needles[i];
+            uint16_t needle_len = strlen(needle);
+            uint16_t offset;
+            for (offset = 0; offset + needle_len <= sizeof(haystack); offset += 7) {
+                /* decoys: the first and last byte of the needle around
+                 * bytes that don't occur in the needles. A two byte
+                 * needle only gets its first byte. */
+                uint16_t j;
+                memset(haystack, '_', sizeof(haystack));
+                for (j = 0; j + needle_len <= offset; j += needle_len) {
+                    haystack[j] = needle[0];
+                    if (needle_len > 2)
+                        haystack[j + needle_len - 1] = needle[needle_len - 1];
+                }
+                memcpy(haystack + offset, needle, needle_len);
+
+                d.needle = needle;
+                d.needle_len = needle_len;
+                d.haystack = haystack;
+                d.haystack_len = sizeof(haystack);
+                d.nocase = 0;
+                d.match_offset = offset;
+
+                if (SpmTestSearch(&d, matcher) == 0) {
+                    printf("  test %" PRIu32 " offset %" PRIu16 ": fail "
+                           "(case-sensitive)\n", i, offset);
+                    ret = 0;
+                }
+
+                d.nocase = 1;
+                for (j = 0; j < sizeof(haystack); j++) {
+                    haystack[j] = toupper((unsigned char)haystack[j]);
+                }
+                if (SpmTestSearch(&d, matcher) == 0) {
+                    printf("  test %" PRIu32 " offset %" PRIu16 ": fail "
+                           "(case-insensitive)\n", i, offset);
+                    ret = 0;
+                }
+            }
+        }
+        printf("  %" PRIu32 " tests passed\n", i);
+    }
+
+    return ret;
+}
+
 #endif
 
 /* Register unittests */
@@ -2680,6 +2755,7 @@ void UtilSpmSearchRegistertests(void)
     /* new SPM API */
     UtRegisterTest("SpmSearchTest01", SpmSearchTest01);
     UtRegisterTest("SpmSearchTest02", SpmSearchTest02);
+    UtRegisterTest("SpmSearchTest03", SpmSearchTest03);
 
 #ifdef ENABLE_SEARCH_STATS
     /* Give some stats searching given a prepared context (look at the wrappers) */